@@ -5,6 +5,7 @@
 #include "phill_svg_loader.h"
 #include "phill_svg_update.h"
 #include "../kernel/security/signature.h"
+#include "../drivers/pci_snapshot.h"
 
 static UINTN parse_ai_pages(const char *cmd)
 {
@@ -283,6 +284,51 @@ static void load_offline_cfg(EFI_HANDLE image, boot_info_t *info)
     }
 }
 
+/* The kernel binds its boot disk from this file, so it cannot read the
+ * file itself until that is done; hand it over the way UEFI sees it. */
+static void load_pci_snapshot(EFI_HANDLE image, boot_info_t *info)
+{
+    EFI_STATUS status;
+    EFI_LOADED_IMAGE *li;
+    EFI_GUID li_guid = EFI_LOADED_IMAGE_PROTOCOL_GUID;
+    status = uefi_call_wrapper(BS->HandleProtocol, 3, image, &li_guid, (void**)&li);
+    if (EFI_ERROR(status))
+        return;
+
+    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *fs;
+    EFI_GUID fs_guid = EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_GUID;
+    status = uefi_call_wrapper(BS->HandleProtocol, 3, li->DeviceHandle, &fs_guid, (void**)&fs);
+    if (EFI_ERROR(status))
+        return;
+
+    EFI_FILE_PROTOCOL *root;
+    status = uefi_call_wrapper(fs->OpenVolume, 2, fs, &root);
+    if (EFI_ERROR(status))
+        return;
+
+    EFI_FILE_PROTOCOL *file;
+    status = uefi_call_wrapper(root->Open, 5, root,
+                               L"\\EFI\\PHILLOS\\pcisnap.bin", EFI_FILE_MODE_READ, 0);
+    if (EFI_ERROR(status))
+        return;
+
+    VOID *buf;
+    UINTN size = PCI_SNAPSHOT_FILE_SIZE;
+    status = uefi_call_wrapper(BS->AllocatePool, 3, EfiLoaderData, size, &buf);
+    if (EFI_ERROR(status)) {
+        file->Close(file);
+        return;
+    }
+    status = uefi_call_wrapper(file->Read, 3, file, &size, buf);
+    file->Close(file);
+    if (EFI_ERROR(status)) {
+        BS->FreePool(buf);
+        return;
+    }
+    info->pcisnap_base = (uint64_t)buf;
+    info->pcisnap_size = size;
+}
+
 static void load_gpu_cfg(EFI_HANDLE image, boot_info_t *info)
 {
     EFI_STATUS status;
@@ -456,6 +502,20 @@ static EFI_STATUS prepare_boot_info(EFI_HANDLE image, boot_info_t **out_info)
         }
     }
 
+    /* The kernel finds the PCIe ECAM window through the ACPI tables;
+     * prefer the ACPI 2.0 RSDP since only it points at the XSDT */
+    EFI_GUID acpi20_guid = ACPI_20_TABLE_GUID;
+    EFI_GUID acpi_guid = ACPI_TABLE_GUID;
+    for (UINTN i = 0; i < ST->NumberOfTableEntries; i++) {
+        EFI_CONFIGURATION_TABLE *t = &ST->ConfigurationTable[i];
+        if (CompareGuid(&t->VendorGuid, &acpi20_guid) == 0) {
+            info->acpi_rsdp = (uint64_t)t->VendorTable;
+            break;
+        }
+        if (CompareGuid(&t->VendorGuid, &acpi_guid) == 0)
+            info->acpi_rsdp = (uint64_t)t->VendorTable;
+    }
+
     EFI_GUID gop_guid = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
     EFI_GRAPHICS_OUTPUT_PROTOCOL *gop;
     status = uefi_call_wrapper(BS->LocateProtocol, 3, &gop_guid, NULL, (void**)&gop);
@@ -471,6 +531,7 @@ static EFI_STATUS prepare_boot_info(EFI_HANDLE image, boot_info_t **out_info)
     load_offline_cfg(image, info);
     load_gpu_cfg(image, info);
     load_display_cfg(image, info);
+    load_pci_snapshot(image, info);
 
     VOID *svg_data = NULL;
     UINTN svg_size = 0;
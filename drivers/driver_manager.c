@@ -1,44 +1,224 @@
 #include "driver_manager.h"
+#include "pci_snapshot.h"
 #include "../kernel/debug.h"
 #include "../kernel/modules/modules.h"
+#include "../kernel/security/verify_cache.h"
+#include "../kernel/tsc.h"
+#include "../kernel/workqueue.h"
+#include <string.h>
+
+/* Devices come and go through three paths. PCIe downstream ports with a
+ * hot-plug capable slot report presence and link changes in their Slot
+ * Status register; those ports are remembered when the scan first meets
+ * them, and an event on one rescans only the buses below it. Checking
+ * them costs one config read per port, so driver_manager_poll() can do it
+ * every tick. Anything else (conventional PCI, firmware-managed slots) is
+ * caught by a full rescan at most once per rescan interval.
+ *
+ * The scan itself only records devices and picks drivers. Each driver's
+ * init() (or the module load for a device nobody claims) is an init job
+ * on the workqueue, so a slow probe no longer stalls the walk, and a job
+ * waits while a facility it requires is still being brought up by
+ * another job or is held by the kernel: storage before module loads,
+ * the boot framebuffer before a GPU sets a mode. Jobs with nothing
+ * between them run back to back in discovery order; the kernel has one
+ * CPU and no preemption, so that is as concurrent as they get.
+ *
+ * Boot starts from the snapshot of the previous enumeration when there
+ * is one: each remembered function costs a single ID read, and if all of
+ * them still answer with the same IDs they are bound straight away, to
+ * the driver they had last time where it is still registered. The full
+ * walk then runs from the first poll after boot and catches whatever the
+ * snapshot did not know about. One stale ID means the tree changed under
+ * us and boot falls back to the full walk. The snapshot is read from the
+ * loader's copy, since the boot disk is among what it binds, and written
+ * back by a job that waits for storage. */
 
 static driver_t *driver_list = NULL;
 static IHotSwapListener *listener_list = NULL;
+static IHotSwapBatchListener *batch_listener_list = NULL;
 
 typedef struct {
     uint8_t bus, slot, func;
     uint16_t vendor, device;
     uint8_t class_code, subclass;
+    uint8_t header;
     int present;
+    uint8_t hash_next;   /* next record in the BDF bucket, index + 1 */
+    uint8_t job;         /* pending init job, index + 1 */
+    uint8_t deferred;    /* needs an init job, none was free */
+    int announced;       /* listeners have been told it was added */
     driver_t *driver;
     module_t *module;
+    uint64_t found_at;   /* TSC at discovery */
+    uint64_t wait_ticks;
+    uint64_t init_ticks;
 } device_record_t;
 
 #define MAX_DEVICES 64
 static device_record_t devices[MAX_DEVICES];
 static unsigned device_count = 0;
 
-#define MAX_EVENTS 16
-static hot_swap_event_t event_q[MAX_EVENTS];
-static unsigned event_head = 0, event_tail = 0;
+/* A record has at most one live init job, and init() never runs outside
+ * one, so the table holds a job per device plus the boot tasks (manifest
+ * and snapshot). Cancelled jobs keep their slot until the workqueue gets
+ * to them; a record that finds none free meanwhile is deferred and gets
+ * its job from the next jobs_dispatch() that has one. */
+#define INIT_TASK_JOBS 2
+#if MAX_INIT_JOBS < MAX_DEVICES + INIT_TASK_JOBS
+#error "MAX_INIT_JOBS must cover a job per device plus the boot tasks"
+#endif
+
+/* Records are found by bus/slot/func through chained buckets of indices
+ * into devices[] (index + 1, 0 ends a chain). */
+#define BDF_BUCKETS 64
+static uint8_t bdf_head[BDF_BUCKETS];
+
+/* Buses already walked by the current scan; guards against bridges whose
+ * secondary bus numbers loop back. */
+static uint8_t bus_seen[256 / 8];
+
+typedef struct {
+    uint8_t bus, slot, func;
+    uint8_t cap;         /* PCI Express capability offset */
+    uint16_t pending;    /* slot events acked by the interrupt entry */
+} hotplug_port_t;
+
+static hotplug_port_t hp_ports[MAX_HOTPLUG_PORTS];
+static unsigned hp_count = 0;
+
+static uint64_t rescan_interval;
+static int rescan_default = 1;     /* derive it from DRIVER_RESCAN_MS */
+static uint64_t last_full_scan = 0;
+
+enum { JOB_FREE, JOB_WAITING, JOB_QUEUED, JOB_CANCELLED };
+
+typedef struct {
+    work_t work;
+    uint8_t state;
+    uint8_t bus, slot, func;
+    driver_t *drv;       /* NULL: load a module for the device instead */
+    void (*task)(void);  /* kernel work with no device behind it */
+    uint8_t requires;
+    uint8_t provides;
+} init_job_t;
+
+static init_job_t init_jobs[MAX_INIT_JOBS];
+/* per DRIVER_DEP_* bit: jobs providing it that have not finished */
+static uint16_t dep_pending[DRIVER_DEP_COUNT];
+static uint8_t dep_held = 0;
+static unsigned jobs_deferred = 0;
+
+/* Event ring. Events are pushed only by notify(), which runs from scans
+ * and the workqueue, never from the hot-plug interrupt (that one just
+ * latches slot events for the poll), so there is a single producer and
+ * event_head needs no atomics on its side. Any number of readers (the
+ * query ioctl among them) claim events by advancing event_tail with a
+ * compare-and-swap. Each slot carries a sequence word: pos + 1 once event
+ * `pos` is in it, pos + size once its reader is done, which is exactly
+ * the position the producer may fill next. A reader owns the events it
+ * claimed until it hands the slots back, so copies are never torn. When
+ * the ring is full the producer claims the oldest event itself and
+ * overwrites it; if a reader is still copying that one the new event is
+ * dropped instead, so the producer never waits on a reader. */
+#define EVENT_MASK (DRIVER_EVENT_RING_SIZE - 1)
+
+typedef struct {
+    uint64_t seq;
+    hot_swap_event_t ev;
+} event_slot_t;
+
+static event_slot_t event_ring[DRIVER_EVENT_RING_SIZE];
+static int event_ring_ready = 0;
+static uint64_t event_head = 0;      /* producer only */
+static uint64_t event_tail = 0;      /* shared by readers */
+static uint64_t events_popped = 0;
+static uint64_t events_overwritten = 0;
+static uint64_t events_dropped = 0;
 
 static void push_event(int added, const IDevice *dev)
 {
-    event_q[event_head].added = added;
-    event_q[event_head].dev = *dev;
-    event_head = (event_head + 1) % MAX_EVENTS;
-    if (event_head == event_tail)
-        event_tail = (event_tail + 1) % MAX_EVENTS;
+    if (!event_ring_ready) {
+        for (uint64_t i = 0; i < DRIVER_EVENT_RING_SIZE; i++)
+            __atomic_store_n(&event_ring[i].seq, i, __ATOMIC_RELAXED);
+        event_ring_ready = 1;
+    }
+
+    uint64_t pos = event_head;
+    event_slot_t *slot = &event_ring[pos & EVENT_MASK];
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos) {
+        uint64_t oldest = pos - DRIVER_EVENT_RING_SIZE;
+        if (__atomic_compare_exchange_n(&event_tail, &oldest, oldest + 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(&events_overwritten, events_overwritten + 1,
+                             __ATOMIC_RELAXED);
+        } else if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos) {
+            __atomic_store_n(&events_dropped, events_dropped + 1,
+                             __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    slot->ev.added = added;
+    slot->ev.dev = *dev;
+    slot->ev.seq = pos;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&event_head, pos + 1, __ATOMIC_RELEASE);
+}
+
+int driver_manager_pop_events(hot_swap_event_t *out, int max)
+{
+    if (!out || max <= 0)
+        return 0;
+    if (max > (int)DRIVER_EVENT_RING_SIZE)
+        max = DRIVER_EVENT_RING_SIZE;
+
+    uint64_t tail = __atomic_load_n(&event_tail, __ATOMIC_ACQUIRE);
+    for (;;) {
+        int n = 0;
+        while (n < max &&
+               __atomic_load_n(&event_ring[(tail + n) & EVENT_MASK].seq,
+                               __ATOMIC_ACQUIRE) == tail + n + 1)
+            n++;
+        if (!n) {
+            uint64_t now = __atomic_load_n(&event_tail, __ATOMIC_ACQUIRE);
+            if (now == tail)
+                return 0;
+            tail = now;
+            continue;
+        }
+        /* on failure `tail` is reloaded and the scan starts over */
+        if (__atomic_compare_exchange_n(&event_tail, &tail, tail + n, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            for (int i = 0; i < n; i++) {
+                event_slot_t *slot = &event_ring[(tail + i) & EVENT_MASK];
+                out[i] = slot->ev;
+                __atomic_store_n(&slot->seq, tail + i + DRIVER_EVENT_RING_SIZE,
+                                 __ATOMIC_RELEASE);
+            }
+            __atomic_fetch_add(&events_popped, n, __ATOMIC_RELAXED);
+            return n;
+        }
+    }
 }
 
 int driver_manager_pop_event(hot_swap_event_t *ev)
 {
-    if (event_head == event_tail)
-        return -1;
-    if (ev)
-        *ev = event_q[event_tail];
-    event_tail = (event_tail + 1) % MAX_EVENTS;
-    return 0;
+    hot_swap_event_t tmp;
+    return driver_manager_pop_events(ev ? ev : &tmp, 1) == 1 ? 0 : -1;
+}
+
+void driver_manager_get_event_stats(hot_swap_event_stats_t *out)
+{
+    if (!out)
+        return;
+    uint64_t head = __atomic_load_n(&event_head, __ATOMIC_ACQUIRE);
+    uint64_t tail = __atomic_load_n(&event_tail, __ATOMIC_ACQUIRE);
+    out->dropped = __atomic_load_n(&events_dropped, __ATOMIC_RELAXED);
+    out->pushed = head + out->dropped;
+    out->popped = __atomic_load_n(&events_popped, __ATOMIC_RELAXED);
+    out->overwritten = __atomic_load_n(&events_overwritten, __ATOMIC_RELAXED);
+    out->pending = tail < head ? (uint32_t)(head - tail) : 0;
 }
 
 void driver_manager_add_listener(IHotSwapListener *listener)
@@ -62,10 +242,185 @@ void driver_manager_remove_listener(IHotSwapListener *listener)
     }
 }
 
+void driver_manager_add_batch_listener(IHotSwapBatchListener *listener)
+{
+    if (!listener)
+        return;
+    listener->next = batch_listener_list;
+    batch_listener_list = listener;
+}
+
+void driver_manager_remove_batch_listener(IHotSwapBatchListener *listener)
+{
+    IHotSwapBatchListener **p = &batch_listener_list;
+    while (*p) {
+        if (*p == listener) {
+            *p = listener->next;
+            listener->next = NULL;
+            break;
+        }
+        p = &(*p)->next;
+    }
+}
+
+/* Match index. Every table line becomes an entry filed under a key built
+ * from the fields its flags name, so a device needs one probe per flag
+ * combination in use (at most 15) rather than a call into every driver. */
+typedef struct match_entry {
+    uint64_t key;
+    driver_t *drv;
+    uint32_t seq;              /* registration order, for ties */
+    struct match_entry *next;
+} match_entry_t;
+
+static match_entry_t match_pool[MATCH_INDEX_ENTRIES];
+static match_entry_t *match_free = NULL;
+static int match_pool_ready = 0;
+static match_entry_t *match_index[MATCH_INDEX_BUCKETS];
+static uint16_t flags_refs[PCI_MATCH_ALL + 1];
+static uint32_t register_seq = 0;
+
+static uint64_t match_key(uint8_t flags, uint16_t vendor, uint16_t device,
+                          uint8_t class_code, uint8_t subclass)
+{
+    uint64_t key = flags & PCI_MATCH_ALL;
+    if (flags & PCI_MATCH_VENDOR)
+        key |= (uint64_t)vendor << 8;
+    if (flags & PCI_MATCH_DEVICE)
+        key |= (uint64_t)device << 24;
+    if (flags & PCI_MATCH_CLASS)
+        key |= (uint64_t)class_code << 40;
+    if (flags & PCI_MATCH_SUBCLASS)
+        key |= (uint64_t)subclass << 48;
+    return key;
+}
+
+static uint64_t device_key(uint8_t flags, const pci_device_t *dev)
+{
+    return match_key(flags, dev->vendor_id, dev->device_id, dev->class_code,
+                     dev->subclass);
+}
+
+static uint64_t id_key(const pci_match_t *id)
+{
+    return match_key(id->flags, id->vendor_id, id->device_id, id->class_code,
+                     id->subclass);
+}
+
+static unsigned match_bucket(uint64_t key)
+{
+    return (key * 0x9E3779B97F4A7C15ULL) >> 32 & (MATCH_INDEX_BUCKETS - 1);
+}
+
+static void index_driver(driver_t *drv)
+{
+    if (!match_pool_ready) {
+        for (unsigned i = 0; i < MATCH_INDEX_ENTRIES; i++) {
+            match_pool[i].next = match_free;
+            match_free = &match_pool[i];
+        }
+        match_pool_ready = 1;
+    }
+    for (const pci_match_t *id = drv->ids; id->flags & PCI_MATCH_ALL; id++) {
+        match_entry_t *e = match_free;
+        if (!e) {
+            debug_puts("driver_manager: match index full, ");
+            debug_puts(drv->name);
+            debug_puts(" partly unindexed\n");
+            return;
+        }
+        match_free = e->next;
+        e->key = id_key(id);
+        e->drv = drv;
+        e->seq = register_seq;
+        unsigned b = match_bucket(e->key);
+        e->next = match_index[b];
+        match_index[b] = e;
+        flags_refs[id->flags & PCI_MATCH_ALL]++;
+    }
+}
+
+static void unindex_driver(driver_t *drv)
+{
+    for (unsigned b = 0; b < MATCH_INDEX_BUCKETS; b++) {
+        match_entry_t **p = &match_index[b];
+        while (*p) {
+            match_entry_t *e = *p;
+            if (e->drv != drv) {
+                p = &e->next;
+                continue;
+            }
+            *p = e->next;
+            flags_refs[e->key & PCI_MATCH_ALL]--;
+            e->next = match_free;
+            match_free = e;
+        }
+    }
+}
+
+static int field_count(unsigned flags)
+{
+    return (flags & 1) + (flags >> 1 & 1) + (flags >> 2 & 1) + (flags >> 3 & 1);
+}
+
+/* Driver whose table claims the device, or NULL. */
+static driver_t *match_lookup(const pci_device_t *dev)
+{
+    const match_entry_t *best = NULL;
+    int best_fields = 0;
+    for (unsigned flags = PCI_MATCH_ALL; flags; flags--) {
+        if (!flags_refs[flags])
+            continue;
+        uint64_t key = device_key(flags, dev);
+        for (const match_entry_t *e = match_index[match_bucket(key)]; e;
+             e = e->next) {
+            if (e->key != key)
+                continue;
+            int fields = field_count(flags);
+            if (best && (fields < best_fields ||
+                         (fields == best_fields && e->seq < best->seq)))
+                continue;
+            if (e->drv->match && !e->drv->match(dev))
+                continue;
+            best = e;
+            best_fields = fields;
+        }
+    }
+    return best ? best->drv : NULL;
+}
+
+/* Drivers without a table, most recently registered first. */
+static driver_t *match_fallback(const pci_device_t *dev)
+{
+    for (driver_t *d = driver_list; d; d = d->next) {
+        if (!d->ids && (!d->match || d->match(dev)))
+            return d;
+    }
+    return NULL;
+}
+
+/* Whether one particular driver would take the device. */
+static int driver_matches(const driver_t *drv, const pci_device_t *dev)
+{
+    if (drv->ids) {
+        const pci_match_t *id = drv->ids;
+        for (; id->flags & PCI_MATCH_ALL; id++) {
+            if (id_key(id) == device_key(id->flags, dev))
+                break;
+        }
+        if (!(id->flags & PCI_MATCH_ALL))
+            return 0;
+    }
+    return !drv->match || drv->match(dev);
+}
+
 void driver_manager_register(driver_t *drv)
 {
     drv->next = driver_list;
     driver_list = drv;
+    register_seq++;
+    if (drv->ids)
+        index_driver(drv);
 }
 
 void driver_manager_unregister(driver_t *drv)
@@ -75,41 +430,130 @@ void driver_manager_unregister(driver_t *drv)
         if (*indirect == drv) {
             *indirect = drv->next;
             drv->next = NULL;
+            if (drv->ids)
+                unindex_driver(drv);
             return;
         }
         indirect = &(*indirect)->next;
     }
 }
 
-uint32_t pci_config_read32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset)
+static unsigned bdf_bucket(uint8_t bus, uint8_t slot, uint8_t func)
+{
+    unsigned bdf = (unsigned)bus << 8 | (unsigned)slot << 3 | func;
+    return (bdf ^ bdf >> 6 ^ bdf >> 12) % BDF_BUCKETS;
+}
+
+static void bdf_link(unsigned idx)
+{
+    device_record_t *rec = &devices[idx];
+    unsigned b = bdf_bucket(rec->bus, rec->slot, rec->func);
+    rec->hash_next = bdf_head[b];
+    bdf_head[b] = idx + 1;
+}
+
+static void bdf_unlink(unsigned idx)
 {
-    uint32_t addr = (uint32_t)(1 << 31) |
-                    ((uint32_t)bus << 16) |
-                    ((uint32_t)slot << 11) |
-                    ((uint32_t)func << 8) |
-                    (offset & 0xfc);
-    __asm__ volatile("outl %0, %1" :: "a"(addr), "d"((uint16_t)0xcf8));
-    uint32_t data;
-    __asm__ volatile("inl %1, %0" : "=a"(data) : "d"((uint16_t)0xcfc));
-    return data;
+    device_record_t *rec = &devices[idx];
+    uint8_t *p = &bdf_head[bdf_bucket(rec->bus, rec->slot, rec->func)];
+    while (*p && *p != idx + 1)
+        p = &devices[*p - 1].hash_next;
+    if (*p)
+        *p = rec->hash_next;
 }
 
 static device_record_t *find_record(uint8_t bus, uint8_t slot, uint8_t func)
 {
-    for (unsigned i = 0; i < device_count; i++) {
-        if (devices[i].bus == bus && devices[i].slot == slot && devices[i].func == func)
-            return &devices[i];
+    for (uint8_t i = bdf_head[bdf_bucket(bus, slot, func)]; i;
+         i = devices[i - 1].hash_next) {
+        device_record_t *rec = &devices[i - 1];
+        if (rec->bus == bus && rec->slot == slot && rec->func == func)
+            return rec;
     }
     return NULL;
 }
 
-static void remove_record(device_record_t *rec)
+/* Listener notifications wait here until notify_work runs, so a slow
+ * listener never holds up a scan. A removal takes back an addition still
+ * waiting here, which leaves at most one removal per record that existed
+ * at the last flush and one addition per live record. */
+#if MAX_PENDING_NOTIFY < 2 * MAX_DEVICES
+#error MAX_PENDING_NOTIFY must hold two notifications per device record
+#endif
+static uint8_t notify_added[MAX_PENDING_NOTIFY];
+static IDevice notify_devs[MAX_PENDING_NOTIFY];
+static unsigned notify_count = 0;
+static work_t notify_work;
+static int notify_work_ready = 0;
+
+static void deliver(int added, const IDevice *devs, unsigned count)
 {
-    if (rec->module)
-        module_unload(rec->module);
-    else if (rec->driver)
-        driver_manager_unregister(rec->driver);
+    for (IHotSwapListener *l = listener_list; l; l = l->next) {
+        for (unsigned i = 0; i < count; i++) {
+            if (added && l->device_added)
+                l->device_added(&devs[i]);
+            else if (!added && l->device_removed)
+                l->device_removed(&devs[i]);
+        }
+    }
+    for (IHotSwapBatchListener *l = batch_listener_list; l; l = l->next) {
+        if (added && l->devices_added)
+            l->devices_added(devs, count);
+        else if (!added && l->devices_removed)
+            l->devices_removed(devs, count);
+    }
+}
+
+/* Hand everything pending to the listeners, each run of additions or
+ * removals as one batch. Listeners may cause new notifications; those
+ * go out in a later round. */
+static void notify_flush(void)
+{
+    while (notify_count) {
+        uint8_t added[MAX_PENDING_NOTIFY];
+        IDevice devs[MAX_PENDING_NOTIFY];
+        unsigned n = notify_count;
+        memcpy(added, notify_added, n);
+        memcpy(devs, notify_devs, n * sizeof(devs[0]));
+        notify_count = 0;
+        for (unsigned i = 0; i < n; ) {
+            unsigned run = 1;
+            while (i + run < n && added[i + run] == added[i])
+                run++;
+            deliver(added[i], &devs[i], run);
+            i += run;
+        }
+    }
+}
+
+static void notify_run(work_t *work)
+{
+    (void)work;
+    notify_flush();
+}
+
+/* Drop the pending addition of the function at `dev`, if the last thing
+ * queued for it is one. */
+static int notify_take_back(const IDevice *dev)
+{
+    for (unsigned i = notify_count; i-- > 0; ) {
+        const IDevice *q = &notify_devs[i];
+        if (q->bus != dev->bus || q->slot != dev->slot || q->func != dev->func)
+            continue;
+        if (!notify_added[i])
+            return 0;
+        memmove(&notify_added[i], &notify_added[i + 1], notify_count - i - 1);
+        memmove(&notify_devs[i], &notify_devs[i + 1],
+                (notify_count - i - 1) * sizeof(notify_devs[0]));
+        notify_count--;
+        return 1;
+    }
+    return 0;
+}
 
+static void notify(device_record_t *rec, int added)
+{
+    rec->announced = added;
     IDevice idev = {
         .bus = rec->bus,
         .slot = rec->slot,
@@ -119,22 +563,350 @@ static void remove_record(device_record_t *rec)
         .class_code = rec->class_code,
         .subclass = rec->subclass,
     };
-    for (IHotSwapListener *l = listener_list; l; l = l->next) {
-        if (l->device_removed)
-            l->device_removed(&idev);
+    push_event(added, &idev);
+
+    /* listeners never hear of a device that came and went in between */
+    if (!added && notify_take_back(&idev))
+        return;
+    notify_added[notify_count] = (uint8_t)added;
+    notify_devs[notify_count] = idev;
+    notify_count++;
+    if (!notify_work_ready) {
+        work_init(&notify_work, notify_run);
+        notify_work_ready = 1;
+    }
+    workqueue_queue(&notify_work);
+}
+
+static void hotplug_add(uint8_t bus, uint8_t slot, uint8_t func)
+{
+    for (unsigned i = 0; i < hp_count; i++) {
+        if (hp_ports[i].bus == bus && hp_ports[i].slot == slot &&
+            hp_ports[i].func == func)
+            return;
+    }
+    uint8_t cap = pci_find_capability(bus, slot, func, PCI_CAP_ID_PCIE);
+    if (!cap || hp_count >= MAX_HOTPLUG_PORTS)
+        return;
+    if (!(pci_config_read16(bus, slot, func, cap + PCI_EXP_FLAGS) &
+          PCI_EXP_FLAGS_SLOT))
+        return;
+    uint32_t sltcap = pci_config_read32(bus, slot, func, cap + PCI_EXP_SLTCAP);
+    if (!(sltcap & PCI_EXP_SLTCAP_HPC))
+        return;
+
+    hotplug_port_t *p = &hp_ports[hp_count++];
+    p->bus = bus;
+    p->slot = slot;
+    p->func = func;
+    p->cap = cap;
+    p->pending = 0;
+
+    /* Slot Control and Slot Status share a dword; writing back the old
+     * status bits would clear them, so only control is carried over.
+     * Events are latched in Slot Status for the poll to find; the slot
+     * interrupt stays off, since no vector is routed to it. */
+    uint32_t ctl = pci_config_read32(bus, slot, func, cap + PCI_EXP_SLTCTL);
+    ctl = (ctl & 0xFFFF & ~PCI_EXP_SLTCTL_HPIE) | PCI_EXP_SLTCTL_ABPE |
+          PCI_EXP_SLTCTL_PDCE | PCI_EXP_SLTCTL_DLLSCE;
+    pci_config_write32(bus, slot, func, cap + PCI_EXP_SLTCTL, ctl);
+    debug_puts("PCIe hot-plug slot behind bus 0x");
+    debug_puthex(bus);
+    debug_puts(" slot 0x");
+    debug_puthex(slot);
+    debug_putc('\n');
+}
+
+static void hotplug_remove(uint8_t bus, uint8_t slot, uint8_t func)
+{
+    for (unsigned i = 0; i < hp_count; i++) {
+        if (hp_ports[i].bus == bus && hp_ports[i].slot == slot &&
+            hp_ports[i].func == func) {
+            hp_ports[i] = hp_ports[--hp_count];
+            return;
+        }
     }
-    push_event(0, &idev);
+}
+
+static void job_release(init_job_t *job);
+static void jobs_dispatch(void);
+static void deps_add(uint8_t provides, int delta);
+
+static void remove_record(device_record_t *rec)
+{
+    hotplug_remove(rec->bus, rec->slot, rec->func);
+
+    if (rec->deferred) {
+        deps_add(rec->driver ? rec->driver->provides : 0, -1);
+        rec->deferred = 0;
+        jobs_deferred--;
+    }
+
+    if (rec->job) {
+        /* a queued job cannot be pulled off the workqueue; it finds
+         * itself cancelled when it runs */
+        init_job_t *job = &init_jobs[rec->job - 1];
+        uint8_t state = job->state;
+        job_release(job);
+        if (state == JOB_QUEUED)
+            job->state = JOB_CANCELLED;
+        rec->job = 0;
+        jobs_dispatch();
+    }
+
+    if (rec->module)
+        module_unload(rec->module);
+    else if (rec->driver)
+        driver_manager_unregister(rec->driver);
+
+    if (rec->announced)
+        notify(rec, 0);
 
     unsigned idx = rec - devices;
-    if (idx < device_count - 1)
-        devices[idx] = devices[device_count - 1];
+    unsigned last = device_count - 1;
+    bdf_unlink(idx);
+    if (idx < last) {
+        bdf_unlink(last);
+        devices[idx] = devices[last];
+        bdf_link(idx);
+    }
     device_count--;
 }
 
-static void handle_new_device(const pci_device_t *dev)
+static uint8_t deps_busy(void)
 {
-    if (device_count >= MAX_DEVICES)
+    uint8_t busy = dep_held;
+    for (unsigned i = 0; i < DRIVER_DEP_COUNT; i++) {
+        if (dep_pending[i])
+            busy |= 1u << i;
+    }
+    return busy;
+}
+
+static void deps_add(uint8_t provides, int delta)
+{
+    for (unsigned i = 0; i < DRIVER_DEP_COUNT; i++) {
+        if (provides & (1u << i))
+            dep_pending[i] += delta;
+    }
+}
+
+/* Drop a job's claim on what it provides and free its slot. */
+static void job_release(init_job_t *job)
+{
+    deps_add(job->provides, -1);
+    job->state = JOB_FREE;
+}
+
+static void job_submit(device_record_t *rec, driver_t *drv);
+
+/* Queue every waiting job whose requirements are met, after handing free
+ * slots to deferred records. A job queued here keeps what it provides
+ * busy until it has run, so its dependants wait for the next pass. */
+static void jobs_dispatch(void)
+{
+    for (unsigned i = 0; jobs_deferred && i < device_count; i++) {
+        device_record_t *rec = &devices[i];
+        if (rec->deferred)
+            job_submit(rec, rec->driver);
+    }
+    uint8_t busy = deps_busy();
+    for (unsigned i = 0; i < MAX_INIT_JOBS; i++) {
+        init_job_t *job = &init_jobs[i];
+        if (job->state != JOB_WAITING || (job->requires & busy))
+            continue;
+        job->state = JOB_QUEUED;
+        workqueue_queue(&job->work);
+    }
+}
+
+static void module_ready(module_t *mod, void *ctx);
+static void module_path(const pci_device_t *dev, char *path);
+
+static void record_device(const device_record_t *rec, pci_device_t *dev)
+{
+    dev->bus = rec->bus;
+    dev->slot = rec->slot;
+    dev->func = rec->func;
+    dev->vendor_id = rec->vendor;
+    dev->device_id = rec->device;
+    dev->class_code = rec->class_code;
+    dev->subclass = rec->subclass;
+}
+
+static void run_init(device_record_t *rec, driver_t *drv)
+{
+    pci_device_t dev;
+    record_device(rec, &dev);
+    uint64_t start = tsc_read();
+    rec->wait_ticks = start - rec->found_at;
+    if (drv->init)
+        drv->init(&dev);
+    rec->init_ticks = tsc_read() - start;
+    debug_puts("PnP init: ");
+    debug_puts(drv->name);
+    debug_puts(" took 0x");
+    debug_puthex64(rec->init_ticks);
+    debug_puts(" ticks\n");
+}
+
+static void load_module(const device_record_t *rec)
+{
+    char path[32];
+    pci_device_t dev;
+    record_device(rec, &dev);
+    debug_puts("Loading module for vendor 0x");
+    debug_puthex(dev.vendor_id);
+    debug_puts(" device 0x");
+    debug_puthex(dev.device_id);
+    debug_putc('\n');
+    module_path(&dev, path);
+    uintptr_t bdf = ((uintptr_t)dev.bus << 16) | ((uintptr_t)dev.slot << 8) |
+                    dev.func;
+    module_load_async(path, module_ready, (void *)bdf);
+}
+
+static void init_job_run(work_t *work)
+{
+    init_job_t *job = (init_job_t *)((char *)work - offsetof(init_job_t, work));
+    if (job->state == JOB_CANCELLED) {
+        job->state = JOB_FREE;
+        if (jobs_deferred)
+            jobs_dispatch();
+        return;
+    }
+    device_record_t *rec = NULL;
+    if (job->task)
+        job->task();
+    else
+        rec = find_record(job->bus, job->slot, job->func);
+    if (rec) {
+        rec->job = 0;
+        if (job->drv) {
+            run_init(rec, job->drv);
+            notify(rec, 1);
+        } else {
+            load_module(rec);
+        }
+    }
+    /* the record may have moved or gone inside init() */
+    job_release(job);
+    jobs_dispatch();
+}
+
+static init_job_t *job_alloc(void)
+{
+    for (unsigned i = 0; i < MAX_INIT_JOBS; i++) {
+        init_job_t *job = &init_jobs[i];
+        if (job->state != JOB_FREE)
+            continue;
+        memset(job, 0, sizeof(*job));
+        work_init(&job->work, init_job_run);
+        job->state = JOB_WAITING;
+        return job;
+    }
+    return NULL;
+}
+
+/* Run `task` as a job once nothing in `requires` is busy. Free slots are
+ * taken lowest first and dispatched in slot order, so a task submitted
+ * before a scan runs ahead of the jobs that scan creates. */
+static int task_submit(void (*task)(void), uint8_t requires)
+{
+    init_job_t *job = job_alloc();
+    if (!job)
+        return -1;
+    job->task = task;
+    job->requires = requires;
+    return 0;
+}
+
+/* Give the record an init job for `drv`, or a module load when NULL. It
+ * waits until the next jobs_dispatch(); scans dispatch once they are done,
+ * so providers found later in the walk still go first. Without a free
+ * slot the record is deferred, still counting as a pending provider so
+ * its dependants keep waiting for it. */
+static void job_submit(device_record_t *rec, driver_t *drv)
+{
+    uint8_t provides = drv ? drv->provides : 0;
+    init_job_t *job = job_alloc();
+    if (!job) {
+        if (!rec->deferred) {
+            debug_puts("driver_manager: init jobs exhausted, deferring\n");
+            rec->deferred = 1;
+            jobs_deferred++;
+            deps_add(provides, 1);
+        }
+        return;
+    }
+    if (rec->deferred) {
+        rec->deferred = 0;
+        jobs_deferred--;
+    } else {
+        deps_add(provides, 1);
+    }
+    job->bus = rec->bus;
+    job->slot = rec->slot;
+    job->func = rec->func;
+    job->drv = drv;
+    job->provides = provides;
+    /* modules come off storage; nobody waits on what it provides itself */
+    job->requires = (drv ? drv->requires : DRIVER_DEP_STORAGE) & ~provides;
+    rec->job = job - init_jobs + 1;
+}
+
+/* "/modules/VVVV_DDDD.ko" */
+static void module_path(const pci_device_t *dev, char *path)
+{
+    const char hex[] = "0123456789abcdef";
+    int idx = 0;
+    const char *pre = "/modules/";
+    while (pre[idx]) { path[idx] = pre[idx]; idx++; }
+    path[idx++] = hex[(dev->vendor_id >> 12) & 0xF];
+    path[idx++] = hex[(dev->vendor_id >> 8) & 0xF];
+    path[idx++] = hex[(dev->vendor_id >> 4) & 0xF];
+    path[idx++] = hex[dev->vendor_id & 0xF];
+    path[idx++] = '_';
+    path[idx++] = hex[(dev->device_id >> 12) & 0xF];
+    path[idx++] = hex[(dev->device_id >> 8) & 0xF];
+    path[idx++] = hex[(dev->device_id >> 4) & 0xF];
+    path[idx++] = hex[dev->device_id & 0xF];
+    path[idx++] = '.'; path[idx++] = 'k'; path[idx++] = 'o';
+    path[idx] = '\0';
+}
+
+/* Completion of a background module load for the device at `ctx`. */
+static void module_ready(module_t *mod, void *ctx)
+{
+    uintptr_t bdf = (uintptr_t)ctx;
+    device_record_t *rec = find_record((uint8_t)(bdf >> 16), (uint8_t)(bdf >> 8),
+                                       (uint8_t)bdf);
+    if (!mod)
+        return;
+    if (!rec || rec->driver) {
+        /* the device went away while the module was loading */
+        module_unload(mod);
         return;
+    }
+    pci_device_t dev;
+    record_device(rec, &dev);
+    driver_t *drv = mod->driver;
+    if (!driver_matches(drv, &dev)) {
+        module_unload(mod);
+        return;
+    }
+    rec->driver = drv;
+    rec->module = mod;
+    job_submit(rec, drv);
+    jobs_dispatch();
+}
+
+/* `hint` is the driver the snapshot remembers, tried before the index. */
+static device_record_t *handle_new_device(const pci_device_t *dev,
+                                          uint8_t header, driver_t *hint)
+{
+    if (device_count >= MAX_DEVICES)
+        return NULL;
 
     device_record_t *rec = &devices[device_count++];
     memset(rec, 0, sizeof(*rec));
@@ -145,125 +917,310 @@ static void handle_new_device(const pci_device_t *dev)
     rec->device = dev->device_id;
     rec->class_code = dev->class_code;
     rec->subclass = dev->subclass;
+    rec->header = header;
     rec->present = 1;
+    rec->found_at = tsc_read();
+    bdf_link(rec - devices);
 
-    for (driver_t *d = driver_list; d; d = d->next) {
-        if (!d->match || d->match(dev)) {
-            debug_puts("PnP init: ");
-            debug_puts(d->name);
-            debug_putc('\n');
-            if (d->init)
-                d->init(dev);
-            rec->driver = d;
-            break;
-        }
+    driver_t *d = hint && driver_matches(hint, dev) ? hint : NULL;
+    if (!d)
+        d = match_lookup(dev);
+    if (!d)
+        d = match_fallback(dev);
+    if (d) {
+        rec->driver = d;
+        /* a driver that came from a module keeps it loaded for as long
+         * as this device is present */
+        rec->module = module_find_by_driver(d);
+        module_hold(rec->module);
     }
+    /* no driver: the job fetches a module, and the scan carries on */
+    job_submit(rec, d);
+    return rec;
+}
 
-    if (!rec->driver) {
-        char path[32];
-        debug_puts("Loading module for vendor 0x");
-        debug_puthex(dev->vendor_id);
-        debug_puts(" device 0x");
-        debug_puthex(dev->device_id);
-        debug_putc('\n');
-        const char hex[] = "0123456789abcdef";
-        int idx = 0;
-        const char *pre = "/modules/";
-        while (pre[idx]) { path[idx] = pre[idx]; idx++; }
-        path[idx++] = hex[(dev->vendor_id >> 12) & 0xF];
-        path[idx++] = hex[(dev->vendor_id >> 8) & 0xF];
-        path[idx++] = hex[(dev->vendor_id >> 4) & 0xF];
-        path[idx++] = hex[dev->vendor_id & 0xF];
-        path[idx++] = '_';
-        path[idx++] = hex[(dev->device_id >> 12) & 0xF];
-        path[idx++] = hex[(dev->device_id >> 8) & 0xF];
-        path[idx++] = hex[(dev->device_id >> 4) & 0xF];
-        path[idx++] = hex[dev->device_id & 0xF];
-        path[idx++] = '.'; path[idx++] = 'k'; path[idx++] = 'o';
-        path[idx] = '\0';
-        module_t *mod = module_load(path);
-        if (mod && mod->driver) {
-            driver_t *drv = mod->driver;
-            if (!drv->match || drv->match(dev)) {
-                if (drv->init)
-                    drv->init(dev);
-                rec->driver = drv;
-                rec->module = mod;
-            } else {
-                module_unload(mod);
-            }
-        }
+static void scan_bus(uint8_t bus);
+
+static void scan_function(uint8_t bus, uint8_t slot, uint8_t func,
+                          uint32_t venddev, uint8_t header)
+{
+    uint32_t classcode = pci_config_read32(bus, slot, func, PCI_CLASS_REVISION);
+    pci_device_t dev = {
+        .bus = bus,
+        .slot = slot,
+        .func = func,
+        .vendor_id = venddev & 0xFFFF,
+        .device_id = venddev >> 16,
+        .class_code = (classcode >> 24) & 0xFF,
+        .subclass = (classcode >> 16) & 0xFF,
+    };
+
+    device_record_t *rec = find_record(bus, slot, func);
+    if (rec)
+        rec->present = 1;
+    else
+        handle_new_device(&dev, header, NULL);
+
+    uint8_t type = header & PCI_HEADER_TYPE_MASK;
+    if (type == PCI_HEADER_TYPE_BRIDGE && !rec)
+        hotplug_add(bus, slot, func);
+    if (type == PCI_HEADER_TYPE_BRIDGE || type == PCI_HEADER_TYPE_CARDBUS) {
+        uint8_t secondary = pci_config_read8(bus, slot, func, PCI_SECONDARY_BUS);
+        /* 0 means firmware left the bridge unconfigured */
+        if (secondary)
+            scan_bus(secondary);
+    } else if (bus == 0 && slot == 0 && func &&
+               dev.class_code == 0x06 && dev.subclass == 0x00) {
+        /* extra functions of a multifunction host bridge at 00:00 are
+         * host controllers of their own, function N owning bus N */
+        scan_bus(func);
     }
+}
 
-    if (rec->driver) {
-        IDevice idev = {
-            .bus = rec->bus,
-            .slot = rec->slot,
-            .func = rec->func,
-            .vendor_id = rec->vendor,
-            .device_id = rec->device,
-            .class_code = rec->class_code,
-            .subclass = rec->subclass,
-        };
-        for (IHotSwapListener *l = listener_list; l; l = l->next) {
-            if (l->device_added)
-                l->device_added(&idev);
+static void scan_bus(uint8_t bus)
+{
+    if (bus_seen[bus >> 3] & (1u << (bus & 7)))
+        return;
+    bus_seen[bus >> 3] |= 1u << (bus & 7);
+
+    for (uint8_t slot = 0; slot < 32; slot++) {
+        uint32_t venddev = pci_config_read32(bus, slot, 0, 0);
+        if ((venddev & 0xFFFF) == 0xFFFF)
+            continue;
+        uint8_t header = pci_config_read8(bus, slot, 0, PCI_HEADER_TYPE);
+        scan_function(bus, slot, 0, venddev, header);
+        if (!(header & PCI_HEADER_MULTIFUNCTION))
+            continue;
+        for (uint8_t func = 1; func < 8; func++) {
+            venddev = pci_config_read32(bus, slot, func, 0);
+            if ((venddev & 0xFFFF) == 0xFFFF)
+                continue;
+            scan_function(bus, slot, func, venddev,
+                          pci_config_read8(bus, slot, func, PCI_HEADER_TYPE));
         }
-        push_event(1, &idev);
     }
 }
 
-static void pci_scan_changes(void)
+static void mark_range(uint8_t first, uint8_t last)
 {
-    for (unsigned i = 0; i < device_count; i++)
-        devices[i].present = 0;
-
-    for (uint8_t bus = 0; bus < 256; bus++) {
-        for (uint8_t slot = 0; slot < 32; slot++) {
-            for (uint8_t func = 0; func < 8; func++) {
-                uint32_t venddev = pci_config_read32(bus, slot, func, 0);
-                uint16_t vendor = venddev & 0xFFFF;
-                if (vendor == 0xFFFF)
-                    continue;
-                uint16_t device = venddev >> 16;
-                uint32_t classcode = pci_config_read32(bus, slot, func, 8);
-                pci_device_t dev = {
-                    .bus = bus,
-                    .slot = slot,
-                    .func = func,
-                    .vendor_id = vendor,
-                    .device_id = device,
-                    .class_code = (classcode >> 24) & 0xFF,
-                    .subclass = (classcode >> 16) & 0xFF,
-                };
-
-                device_record_t *rec = find_record(bus, slot, func);
-                if (rec) {
-                    rec->present = 1;
-                } else {
-                    handle_new_device(&dev);
-                }
-            }
-        }
+    for (unsigned i = 0; i < device_count; i++) {
+        if (devices[i].bus >= first && devices[i].bus <= last)
+            devices[i].present = 0;
     }
+    memset(bus_seen, 0, sizeof(bus_seen));
+}
 
+/* Drop records in the range that the walk did not find again. */
+static void sweep_range(uint8_t first, uint8_t last)
+{
     for (unsigned i = 0; i < device_count; ) {
-        if (!devices[i].present)
+        if (!devices[i].present &&
+            devices[i].bus >= first && devices[i].bus <= last)
             remove_record(&devices[i]);
         else
             i++;
     }
 }
 
+/* Walk the bus tree from the host bridges: bus 0, the first bus of every
+ * ECAM window, and whatever bridges lead to from there. Only functions
+ * that exist are probed past function 0, so a rescan costs 32 reads per
+ * populated bus plus a few per device instead of 65,536. */
+static void pci_scan_changes(void)
+{
+    mark_range(0, 255);
+    scan_bus(0);
+    for (int i = 0; i < pci_ecam_count(); i++)
+        scan_bus(pci_ecam_region(i)->bus_start);
+    sweep_range(0, 255);
+    jobs_dispatch();
+    last_full_scan = tsc_read();
+}
+
+/* Rescan the buses a bridge forwards to. */
+static void scan_below(uint8_t bus, uint8_t slot, uint8_t func)
+{
+    uint32_t numbers = pci_config_read32(bus, slot, func, PCI_PRIMARY_BUS);
+    uint8_t secondary = (numbers >> 8) & 0xFF;
+    uint8_t subordinate = (numbers >> 16) & 0xFF;
+    if (!secondary || subordinate < secondary)
+        return;
+    mark_range(secondary, subordinate);
+    scan_bus(secondary);
+    sweep_range(secondary, subordinate);
+    jobs_dispatch();
+}
+
+/* Read and ack a port's slot events. Status bits are write-1-to-clear;
+ * acking before the rescan means an event that lands during the scan is
+ * seen next time. */
+static uint16_t hotplug_ack(const hotplug_port_t *p)
+{
+    uint32_t reg = pci_config_read32(p->bus, p->slot, p->func,
+                                     p->cap + PCI_EXP_SLTCTL);
+    uint16_t events = (reg >> 16) & (PCI_EXP_SLTSTA_ABP | PCI_EXP_SLTSTA_PDC |
+                                     PCI_EXP_SLTSTA_DLLSC);
+    if (reg == 0xFFFFFFFF || !events)
+        return 0;
+    pci_config_write32(p->bus, p->slot, p->func, p->cap + PCI_EXP_SLTCTL,
+                       (reg & 0xFFFF) | (uint32_t)events << 16);
+    return events;
+}
+
+/* Ports are walked last to first: a rescan can drop ports, and removal
+ * moves the last port into the freed slot, which has then already been
+ * seen. Ports a rescan adds are checked from the next call. */
+static void hotplug_service(void)
+{
+    for (unsigned i = hp_count; i-- > 0; ) {
+        if (i >= hp_count)
+            continue;
+        hotplug_port_t *p = &hp_ports[i];
+        uint16_t events = hotplug_ack(p) |
+                          __atomic_exchange_n(&p->pending, 0, __ATOMIC_ACQ_REL);
+        if (events)
+            scan_below(p->bus, p->slot, p->func);
+    }
+}
+
+/* --- enumeration snapshot --- */
+
+static pci_snapshot_entry_t snapshot[PCI_SNAPSHOT_MAX];
+static int snapshot_count = -1;    /* what the file holds, -1 unknown */
+
+static driver_t *driver_by_hash(uint32_t hash)
+{
+    for (driver_t *d = driver_list; d; d = d->next) {
+        if (pci_snapshot_hash(d->name) == hash)
+            return d;
+    }
+    return NULL;
+}
+
+/* Bind every device the snapshot lists, provided each one still reads
+ * back the same IDs. Returns -1, having created nothing, otherwise. */
+static int snapshot_boot(void)
+{
+    snapshot_count = pci_snapshot_load(snapshot, PCI_SNAPSHOT_MAX);
+    if (snapshot_count <= 0)
+        return -1;
+    for (int i = 0; i < snapshot_count; i++) {
+        const pci_snapshot_entry_t *e = &snapshot[i];
+        uint32_t venddev = pci_config_read32(e->bus, e->slot, e->func, 0);
+        if (venddev != ((uint32_t)e->device_id << 16 | e->vendor_id)) {
+            debug_puts("PCI snapshot: stale, full scan\n");
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < snapshot_count; i++) {
+        const pci_snapshot_entry_t *e = &snapshot[i];
+        pci_device_t dev = {
+            .bus = e->bus,
+            .slot = e->slot,
+            .func = e->func,
+            .vendor_id = e->vendor_id,
+            .device_id = e->device_id,
+            .class_code = e->class_code,
+            .subclass = e->subclass,
+        };
+        driver_t *hint = e->flags & PCI_SNAPSHOT_DRIVER ?
+                         driver_by_hash(e->driver) : NULL;
+        if (find_record(e->bus, e->slot, e->func) ||
+            !handle_new_device(&dev, e->header, hint))
+            continue;
+        if ((e->header & PCI_HEADER_TYPE_MASK) == PCI_HEADER_TYPE_BRIDGE)
+            hotplug_add(e->bus, e->slot, e->func);
+    }
+    jobs_dispatch();
+    /* snapshot_validate() stands in for the first periodic scan */
+    last_full_scan = tsc_read();
+    debug_puts("PCI snapshot: bound 0x");
+    debug_puthex(device_count);
+    debug_puts(" functions\n");
+    return 0;
+}
+
+/* Write the current enumeration out if it differs from the file. */
+static void snapshot_sync(void)
+{
+    pci_snapshot_entry_t now[PCI_SNAPSHOT_MAX];
+    int count = 0;
+    for (unsigned i = 0; i < device_count && count < PCI_SNAPSHOT_MAX; i++) {
+        const device_record_t *rec = &devices[i];
+        pci_snapshot_entry_t *e = &now[count++];
+        memset(e, 0, sizeof(*e));
+        e->bus = rec->bus;
+        e->slot = rec->slot;
+        e->func = rec->func;
+        e->header = rec->header;
+        e->vendor_id = rec->vendor;
+        e->device_id = rec->device;
+        e->class_code = rec->class_code;
+        e->subclass = rec->subclass;
+        if (rec->driver) {
+            e->flags = PCI_SNAPSHOT_DRIVER |
+                       (rec->module ? PCI_SNAPSHOT_MODULE : 0);
+            e->driver = pci_snapshot_hash(rec->driver->name);
+        }
+    }
+    if (count == snapshot_count &&
+        !memcmp(now, snapshot, count * sizeof(now[0])))
+        return;
+    if (pci_snapshot_save(now, count) == 0) {
+        memcpy(snapshot, now, count * sizeof(now[0]));
+        snapshot_count = count;
+    }
+}
+
+/* Background half of a snapshot boot: the full walk it skipped. */
+static void snapshot_validate(void)
+{
+    pci_scan_changes();
+    snapshot_sync();
+}
+
+/* Optional: lets boot-time module loads skip their own RSA checks. It
+ * is read off the boot disk, so it waits for storage like they do. */
+static void manifest_load(void)
+{
+    module_load_manifest(MODULE_MANIFEST_PATH);
+}
+
 void driver_manager_init(void)
 {
     device_count = 0;
-    pci_scan_changes();
+    hp_count = 0;
+    memset(bdf_head, 0, sizeof(bdf_head));
+    if (rescan_default)
+        rescan_interval = tsc_ms(DRIVER_RESCAN_MS);
+    if (task_submit(manifest_load, DRIVER_DEP_STORAGE))
+        manifest_load();
+    int from_snapshot = snapshot_boot() == 0;
+    if (!from_snapshot)
+        pci_scan_changes();
+    /* every init job and missing module is in flight now; boot waits for
+     * the slowest, but not for jobs stuck behind a held facility */
+    while (module_loads_pending() || workqueue_pending())
+        module_poll();
+    /* the file is rewritten through the boot disk, which may still be
+     * waiting on a held facility; without a free slot it is simply not
+     * rewritten this boot */
+    if (task_submit(from_snapshot ? snapshot_validate : snapshot_sync,
+                    DRIVER_DEP_STORAGE))
+        return;
+    jobs_dispatch();
+    /* a snapshot boot leaves the walk to the first poll */
+    if (!from_snapshot)
+        workqueue_run();
 }
 
+/* Unlike the periodic scans, an explicit rescan returns with the new
+ * devices' drivers initialised, unless they wait on a held facility. */
 void driver_manager_rescan(void)
 {
     pci_scan_changes();
+    workqueue_run();
 }
 
 void driver_manager_unload(uint8_t bus, uint8_t slot, uint8_t func)
@@ -275,7 +1232,57 @@ void driver_manager_unload(uint8_t bus, uint8_t slot, uint8_t func)
 
 void driver_manager_poll(void)
 {
-    pci_scan_changes();
+    hotplug_service();
+    if (tsc_read() - last_full_scan >= rescan_interval)
+        pci_scan_changes();
+    /* runs the init jobs of whatever turned up above */
+    module_poll();
+}
+
+void driver_manager_hotplug_irq(void)
+{
+    /* nothing here is safe to do from an interrupt beyond the ack; the
+     * next poll rescans behind the ports that saw an event */
+    for (unsigned i = 0; i < hp_count; i++) {
+        uint16_t events = hotplug_ack(&hp_ports[i]);
+        if (events)
+            __atomic_fetch_or(&hp_ports[i].pending, events, __ATOMIC_RELEASE);
+    }
+}
+
+void driver_manager_set_rescan_interval(uint64_t ticks)
+{
+    rescan_interval = ticks;
+    rescan_default = 0;
+}
+
+void driver_manager_hold(uint8_t deps)
+{
+    dep_held |= deps;
+}
+
+void driver_manager_release(uint8_t deps)
+{
+    dep_held &= ~deps;
+    jobs_dispatch();
+}
+
+int driver_manager_init_stats(driver_init_stat_t *out, int max)
+{
+    int n = 0;
+    for (unsigned i = 0; i < device_count && n < max; i++) {
+        const device_record_t *rec = &devices[i];
+        if (!rec->driver || rec->job || rec->deferred)
+            continue;
+        out[n].driver = rec->driver->name;
+        out[n].bus = rec->bus;
+        out[n].slot = rec->slot;
+        out[n].func = rec->func;
+        out[n].wait_ticks = rec->wait_ticks;
+        out[n].init_ticks = rec->init_ticks;
+        n++;
+    }
+    return n;
 }
 
 const IDriverManager driver_manager = {
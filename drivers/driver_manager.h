@@ -1,9 +1,11 @@
 #ifndef PHILLOS_DRIVER_MANAGER_H
 #define PHILLOS_DRIVER_MANAGER_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <phillos/driver/IDriverManager.h>
 #include <phillos/driver/IHotSwapListener.h>
+#include "pci.h"
 
 typedef struct pci_device {
     uint8_t bus;
@@ -15,31 +17,130 @@ typedef struct pci_device {
     uint8_t subclass;
 } pci_device_t;
 
+/* default full rescan interval */
+#define DRIVER_RESCAN_MS    2000
+#define MAX_HOTPLUG_PORTS   16
+
+/* pci_match_t.flags: which fields of an entry a device must equal */
+#define PCI_MATCH_VENDOR    0x1
+#define PCI_MATCH_DEVICE    0x2
+#define PCI_MATCH_CLASS     0x4
+#define PCI_MATCH_SUBCLASS  0x8
+#define PCI_MATCH_ALL       0xF
+
+/* One line of a driver's match table; the table ends with flags == 0. */
+typedef struct pci_match {
+    uint8_t flags;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t class_code;
+    uint8_t subclass;
+} pci_match_t;
+
+/* Facilities a driver's init() can provide or need (driver_t.provides and
+ * .requires). The kernel may hold one while it sets it up itself. */
+#define DRIVER_DEP_STORAGE      0x01   /* block devices the module loader reads */
+#define DRIVER_DEP_FRAMEBUFFER  0x02   /* boot framebuffer initialised */
+#define DRIVER_DEP_DISPLAY      0x04   /* a GPU owns the display */
+#define DRIVER_DEP_NETWORK      0x08
+#define DRIVER_DEP_COUNT        8
+
+/* A driver binds through its match table when it has one: the tables of
+ * all registered drivers are kept in a hash index, the entry naming the
+ * most fields wins and a tie goes to the driver registered last. match(),
+ * if also set, can still turn down a device the table picked. Drivers
+ * without a table are tried through match() in registration order, most
+ * recent first, and only when no table claims the device; one with
+ * neither takes any device.
+ *
+ * init() does not run during the scan: it becomes a job on the kernel
+ * workqueue that starts once nothing providing a facility in `requires`
+ * is still initialising or held. Listeners hear about the device after
+ * its init() has returned, from the workqueue and batched with whatever
+ * else changed meanwhile. */
 typedef struct driver {
     const char *name;
     int (*match)(const pci_device_t *dev);
     void (*init)(const pci_device_t *dev);
     struct driver *next;
+    const pci_match_t *ids;
+    uint8_t provides;         /* DRIVER_DEP_* */
+    uint8_t requires;
 } driver_t;
 
+/* Fields after `next` were added later (ids, then provides and
+ * requires). The loader registers a zeroed copy of a module's
+ * driver_entry holding only the bytes the module defines, so one built
+ * against an older driver_t reads the missing fields as 0: no match
+ * table and no dependencies. Anything smaller than the original four
+ * fields is refused. */
+#define DRIVER_MIN_SIZE offsetof(driver_t, ids)
+
+#define MATCH_INDEX_BUCKETS 128
+#define MATCH_INDEX_ENTRIES 256
+#define MAX_INIT_JOBS       128
+#define MAX_PENDING_NOTIFY  128  /* undelivered listener notifications */
+
+typedef struct {
+    const char *driver;
+    uint8_t bus, slot, func;
+    uint64_t wait_ticks;      /* TSC ticks from discovery to init() */
+    uint64_t init_ticks;      /* TSC ticks spent in init() */
+} driver_init_stat_t;
+
 void driver_manager_register(driver_t *drv);
 void driver_manager_unregister(driver_t *drv);
 void driver_manager_init(void);
 void driver_manager_rescan(void);
 void driver_manager_unload(uint8_t bus, uint8_t slot, uint8_t func);
+/* Cheap periodic work: module loads, hot-plug slot events, and a full
+ * rescan once the fallback interval has passed. */
 void driver_manager_poll(void);
-uint32_t pci_config_read32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset);
+/* Interrupt entry for PCIe hot-plug: acks the slot events of every port
+ * and leaves them for the next driver_manager_poll() to rescan. */
+void driver_manager_hotplug_irq(void);
+/* TSC ticks between full rescans from driver_manager_poll(); until this
+ * is called it is DRIVER_RESCAN_MS at the calibrated TSC rate. */
+void driver_manager_set_rescan_interval(uint64_t ticks);
+/* Keep init jobs that require any of `deps` waiting until released. */
+void driver_manager_hold(uint8_t deps);
+void driver_manager_release(uint8_t deps);
+/* Init timings of the bound devices; returns how many were written. */
+int driver_manager_init_stats(driver_init_stat_t *out, int max);
 
 void driver_manager_add_listener(IHotSwapListener *listener);
 void driver_manager_remove_listener(IHotSwapListener *listener);
+void driver_manager_add_batch_listener(IHotSwapBatchListener *listener);
+void driver_manager_remove_batch_listener(IHotSwapBatchListener *listener);
 
 extern const IDriverManager driver_manager;
 
+/* Hot-swap events wait in a ring of 2^DRIVER_EVENT_RING_ORDER entries. */
+#ifndef DRIVER_EVENT_RING_ORDER
+#define DRIVER_EVENT_RING_ORDER 8
+#endif
+#define DRIVER_EVENT_RING_SIZE (1u << DRIVER_EVENT_RING_ORDER)
+
 typedef struct hot_swap_event {
     int added; /* 1 = added, 0 = removed */
     IDevice dev;
+    uint64_t seq; /* 0, 1, 2... in order of occurrence; a gap means loss */
 } hot_swap_event_t;
 
+typedef struct {
+    uint64_t pushed;
+    uint64_t popped;
+    uint64_t overwritten;  /* oldest events given up to make room */
+    uint64_t dropped;      /* new events lost while a reader held the oldest */
+    uint32_t pending;
+} hot_swap_event_stats_t;
+
+/* Readers may run concurrently with each other and with the driver
+ * manager; each event is returned to exactly one of them. Returns 0 and
+ * the oldest event, or -1 when there is none. */
 int driver_manager_pop_event(hot_swap_event_t *ev);
+/* Take up to `max` events, oldest first; returns how many. */
+int driver_manager_pop_events(hot_swap_event_t *out, int max);
+void driver_manager_get_event_stats(hot_swap_event_stats_t *out);
 
 #endif // PHILLOS_DRIVER_MANAGER_H
@@ -7,13 +7,16 @@
 #include "../../kernel/init.h"
 #include "../driver_manager.h"
 
-static int amd_match(const pci_device_t *dev)
-{
-    return dev->vendor_id == 0x1002 && dev->class_code == 0x03;
-}
+static const pci_match_t amd_ids[] = {
+    { .flags = PCI_MATCH_VENDOR | PCI_MATCH_CLASS,
+      .vendor_id = 0x1002, .class_code = 0x03 },
+    { 0 }
+};
 
 static const pci_device_t *amd_dev = NULL;
 static uintptr_t amd_mmio_base = 0;
+static uint32_t amd_surface = 0;       /* last written */
+static uint32_t amd_surface_live = 0;  /* ... and before that */
 
 #define AMD_D1CRTC_H_TOTAL            0x6020
 #define AMD_D1CRTC_V_TOTAL            0x6024
@@ -24,7 +27,26 @@ static uintptr_t amd_mmio_base = 0;
 #define AMD_D1GRPH_PRIMARY_SURFACE_ADDRESS 0x6110
 #define AMD_D1GRPH_PITCH              0x6120
 #define AMD_D1GRPH_ENABLE             0x6104
+#define AMD_D1GRPH_UPDATE             0x6144
+#define AMD_D1GRPH_SURFACE_UPDATE_PENDING 0x00000004
+
+#define AMD_APERTURE_BAR              0   /* VRAM window */
+
+#ifdef GPU_EMULATED_MMIO
+/* Host test builds provide a software model of the display registers. */
+uint32_t gpu_emu_readl(uint32_t reg);
+void gpu_emu_writel(uint32_t reg, uint32_t val);
+
+static inline void amd_writel(uint32_t reg, uint32_t val)
+{
+    gpu_emu_writel(reg, val);
+}
 
+static inline uint32_t amd_readl(uint32_t reg)
+{
+    return gpu_emu_readl(reg);
+}
+#else
 static inline void amd_writel(uint32_t reg, uint32_t val)
 {
     volatile uint32_t *addr = (volatile uint32_t *)(amd_mmio_base + reg);
@@ -36,18 +58,47 @@ static inline uint32_t amd_readl(uint32_t reg)
     volatile uint32_t *addr = (volatile uint32_t *)(amd_mmio_base + reg);
     return *addr;
 }
+#endif
 
 static void amd_program_regs(void)
 {
     debug_puts("AMD: programming registers\n");
     extern boot_info_t *boot_info_get(void);
     framebuffer_info_t *fb = &boot_info_get()->fb;
-    amd_writel(AMD_D1GRPH_PRIMARY_SURFACE_ADDRESS,
-               (uint32_t)(fb->base & 0xFFFFFFFF));
+    amd_surface = amd_surface_live = (uint32_t)(fb->base & 0xFFFFFFFF);
+    amd_writel(AMD_D1GRPH_PRIMARY_SURFACE_ADDRESS, amd_surface);
     amd_writel(AMD_D1GRPH_PITCH, fb->pitch);
     amd_writel(AMD_D1GRPH_ENABLE, 1);
 }
 
+/* The surface address is latched at vblank; UPDATE reports a write that
+ * has not been taken up yet. Until then the display still reads from the
+ * address latched before, and a second write replaces the first. */
+static void amd_flip(uint64_t phys)
+{
+    if (!(amd_readl(AMD_D1GRPH_UPDATE) & AMD_D1GRPH_SURFACE_UPDATE_PENDING))
+        amd_surface_live = amd_surface;
+    amd_surface = (uint32_t)(phys & 0xFFFFFFFF);
+    amd_writel(AMD_D1GRPH_PRIMARY_SURFACE_ADDRESS, amd_surface);
+}
+
+static int amd_flip_done(void)
+{
+    return !(amd_readl(AMD_D1GRPH_UPDATE) &
+             AMD_D1GRPH_SURFACE_UPDATE_PENDING);
+}
+
+static uint32_t amd_scanout(void)
+{
+    return amd_flip_done() ? amd_surface : amd_surface_live;
+}
+
+static const fb_flip_ops_t amd_flip_ops = {
+    .flip = amd_flip,
+    .flip_done = amd_flip_done,
+    .scanout = amd_scanout,
+};
+
 static int amd_set_mode(uint32_t w, uint32_t h)
 {
     debug_puts("AMD: set display mode ");
@@ -101,6 +152,11 @@ static void amd_hw_init(const pci_device_t *dev)
     init_framebuffer(&boot_info_get()->fb);
     gpu_set_active_gfx_device(framebuffer_get_gfx_device());
     amd_program_regs();
+
+    uint64_t aperture, aperture_size;
+    if (pci_bar_range(dev->bus, dev->slot, dev->func, AMD_APERTURE_BAR,
+                      &aperture, &aperture_size) == 0)
+        fb_enable_flip(&amd_flip_ops, aperture, aperture_size);
     gpu_set_active_driver(&amd_driver);
 }
 
@@ -127,6 +183,8 @@ gpu_driver_t amd_driver = {
 
 driver_t amd_pnp_driver = {
     .name = "AMD GPU",
-    .match = amd_match,
+    .ids = amd_ids,
     .init = amd_pnp_init,
+    .provides = DRIVER_DEP_DISPLAY,
+    .requires = DRIVER_DEP_FRAMEBUFFER,
 };
@@ -5,6 +5,7 @@
 #include "../../kernel/memory/paging.h"
 #include "../../kernel/memory/heap.h"
 #include "../../kernel/debug.h"
+#include "../../kernel/tsc.h"
 #include "font8x8_basic.h"
 #include <string.h>
 
@@ -15,6 +16,26 @@ static uint32_t fb_width = 0;
 static uint32_t fb_height = 0;
 static uint32_t fb_pitch = 0;
 static gfx_device_t fb_gfx_device;
+static gfx_present_stats_t present_stats;
+
+/* Buffer 0 is the GOP framebuffer; flipping adds up to two more right
+ * after it in the aperture. stale[] holds, per buffer, what it lacks of
+ * the last presented frame, so a back buffer several frames old is
+ * brought up to date by copying only those rectangles. The fb_draw_*
+ * helpers first bring every buffer level with the one on screen and then
+ * write into all of them, so what they draw stays on screen across flips
+ * until a present covers it, as it does when copying. */
+#define FB_FLIP_TIMEOUT_MS 100      /* several frames even at 24 Hz */
+
+static const fb_flip_ops_t *flip_ops = NULL;
+static uint8_t *fb_buf[GFX_MAX_BUFFERS];
+static gfx_damage_t fb_stale[GFX_MAX_BUFFERS];
+static uint32_t fb_nbuf = 1;        /* allocated */
+static uint32_t fb_buffers = 1;     /* in use */
+static int fb_scanout = 0;
+static int fb_queued = -1;          /* flipped to, not yet latched */
+
+static void overlay_sync(void);
 
 void init_framebuffer(framebuffer_info_t *info)
 {
@@ -34,6 +55,14 @@ void init_framebuffer(framebuffer_info_t *info)
         debug_puts("paging not initialized, framebuffer not mapped\n");
         fb_ptr = NULL;
     }
+    flip_ops = NULL;
+    fb_buf[0] = fb_ptr;
+    fb_stale[0].count = 0;
+    fb_nbuf = fb_buffers = 1;
+    fb_scanout = 0;
+    fb_queued = -1;
+    memset(&present_stats, 0, sizeof(present_stats));
+    present_stats.buffers = 1;
 
     debug_puts("GOP framebuffer base=");
     debug_puthex64(fb_base);
@@ -55,18 +84,24 @@ void fb_draw_pixel(uint32_t x, uint32_t y, uint32_t color)
     if (x >= fb_width || y >= fb_height)
         return;
 
-    uint32_t *pixel = (uint32_t*)(fb_ptr + (y * fb_pitch + x) * 4);
-    *pixel = color;
+    overlay_sync();
+    for (uint32_t b = 0; b < fb_nbuf; b++) {
+        uint32_t *pixel = (uint32_t*)(fb_buf[b] + (y * fb_pitch + x) * 4);
+        *pixel = color;
+    }
 }
 
 void fb_clear(uint32_t color)
 {
     if (!fb_ptr)
         return;
-    for (uint32_t y = 0; y < fb_height; y++) {
-        uint32_t *row = (uint32_t*)(fb_ptr + y * fb_pitch * 4);
-        for (uint32_t x = 0; x < fb_width; x++)
-            row[x] = color;
+    overlay_sync();
+    for (uint32_t b = 0; b < fb_nbuf; b++) {
+        for (uint32_t y = 0; y < fb_height; y++) {
+            uint32_t *row = (uint32_t*)(fb_buf[b] + y * fb_pitch * 4);
+            for (uint32_t x = 0; x < fb_width; x++)
+                row[x] = color;
+        }
     }
 }
 
@@ -109,12 +144,16 @@ void fb_fill_rect(uint32_t x, uint32_t y, uint32_t w, uint32_t h,
     if (!fb_ptr)
         return;
 
-    for (uint32_t j = 0; j < h; j++) {
-        if (y + j >= fb_height)
-            break;
-        uint32_t *row = (uint32_t*)(fb_ptr + ((y + j) * fb_pitch + x) * 4);
-        for (uint32_t i = 0; i < w && x + i < fb_width; i++)
-            row[i] = color;
+    overlay_sync();
+    for (uint32_t b = 0; b < fb_nbuf; b++) {
+        for (uint32_t j = 0; j < h; j++) {
+            if (y + j >= fb_height)
+                break;
+            uint32_t *row =
+                (uint32_t*)(fb_buf[b] + ((y + j) * fb_pitch + x) * 4);
+            for (uint32_t i = 0; i < w && x + i < fb_width; i++)
+                row[i] = color;
+        }
     }
 }
 
@@ -184,21 +223,100 @@ void fb_update_pointer_sprite(uint32_t x, uint32_t y,
 {
     if (!fb_ptr || !sprite)
         return;
-    for (uint32_t j = 0; j < h; j++) {
-        if (y + j >= fb_height)
-            break;
-        uint32_t *dst = (uint32_t *)(fb_ptr + ((y + j) * fb_pitch + x) * 4);
-        const uint32_t *src = sprite + j * w;
-        for (uint32_t i = 0; i < w && x + i < fb_width; i++) {
-            uint32_t pix = src[i];
-            if ((pix >> 24) != 0)
-                dst[i] = pix;
+    overlay_sync();
+    for (uint32_t b = 0; b < fb_nbuf; b++) {
+        for (uint32_t j = 0; j < h; j++) {
+            if (y + j >= fb_height)
+                break;
+            uint32_t *dst =
+                (uint32_t *)(fb_buf[b] + ((y + j) * fb_pitch + x) * 4);
+            const uint32_t *src = sprite + j * w;
+            for (uint32_t i = 0; i < w && x + i < fb_width; i++) {
+                uint32_t pix = src[i];
+                if ((pix >> 24) != 0)
+                    dst[i] = pix;
+            }
         }
     }
 }
 
 /* --- gfx_device_t fallback implementation --- */
 
+static uint64_t rect_area(const gfx_rect_t *r)
+{
+    return (uint64_t)r->w * r->h;
+}
+
+static gfx_rect_t rect_union(const gfx_rect_t *a, const gfx_rect_t *b)
+{
+    uint32_t x0 = a->x < b->x ? a->x : b->x;
+    uint32_t y0 = a->y < b->y ? a->y : b->y;
+    uint32_t x1 = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+    uint32_t y1 = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
+    gfx_rect_t u = { x0, y0, x1 - x0, y1 - y0 };
+    return u;
+}
+
+/* Overlapping or sharing an edge. */
+static int rect_touches(const gfx_rect_t *a, const gfx_rect_t *b)
+{
+    return a->x <= b->x + b->w && b->x <= a->x + a->w &&
+           a->y <= b->y + b->h && b->y <= a->y + a->h;
+}
+
+static void damage_remove(gfx_damage_t *d, uint32_t i)
+{
+    d->rects[i] = d->rects[--d->count];
+}
+
+/* Merge `r` into the set, absorbing every rectangle it touches; each
+ * absorption can make the union touch others, hence the rescan. */
+static void damage_insert(gfx_damage_t *d, gfx_rect_t r)
+{
+    for (uint32_t i = 0; i < d->count; ) {
+        if (rect_touches(&r, &d->rects[i])) {
+            r = rect_union(&r, &d->rects[i]);
+            damage_remove(d, i);
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+    if (d->count < GFX_DAMAGE_RECTS) {
+        d->rects[d->count++] = r;
+        return;
+    }
+    /* full: fold in the rectangle that costs the fewest extra pixels
+     * (the set is disjoint, so a union never covers less than both) */
+    uint32_t best = 0;
+    uint64_t best_waste = ~0ULL;
+    for (uint32_t i = 0; i < d->count; i++) {
+        gfx_rect_t u = rect_union(&r, &d->rects[i]);
+        uint64_t waste = rect_area(&u) - rect_area(&r) - rect_area(&d->rects[i]);
+        if (waste < best_waste) {
+            best_waste = waste;
+            best = i;
+        }
+    }
+    gfx_rect_t u = rect_union(&r, &d->rects[best]);
+    damage_remove(d, best);
+    damage_insert(d, u);
+}
+
+static void fb_surface_damage(gfx_surface_t *surf,
+                              uint32_t x, uint32_t y,
+                              uint32_t w, uint32_t h)
+{
+    if (!surf || x >= surf->width || y >= surf->height || !w || !h)
+        return;
+    if (w > surf->width - x)
+        w = surf->width - x;
+    if (h > surf->height - y)
+        h = surf->height - y;
+    gfx_rect_t r = { x, y, w, h };
+    damage_insert(&surf->damage, r);
+}
+
 static gfx_surface_t *fb_create_surface(uint32_t w, uint32_t h)
 {
     gfx_surface_t *surf = kmalloc(sizeof(gfx_surface_t));
@@ -213,6 +331,9 @@ static gfx_surface_t *fb_create_surface(uint32_t w, uint32_t h)
         return NULL;
     }
     memset(surf->pixels, 0, (size_t)w * h * 4);
+    /* the screen holds something else until the first present */
+    surf->damage.count = 0;
+    fb_surface_damage(surf, 0, 0, w, h);
     return surf;
 }
 
@@ -228,25 +349,229 @@ static void fb_surface_draw_rect(gfx_surface_t *surf,
         for (uint32_t i = 0; i < w && x + i < surf->width; i++)
             row[i] = color;
     }
+    fb_surface_damage(surf, x, y, w, h);
 }
 
-static void fb_present_frame(gfx_surface_t *surf)
+/* Copy the rectangles of `d` from the surface into a screen buffer. */
+static uint64_t copy_damage(uint8_t *dst, const gfx_surface_t *surf,
+                            const gfx_damage_t *d)
 {
-    if (!surf || !surf->pixels || !fb_ptr)
-        return;
     uint32_t copy_w = surf->width < fb_width ? surf->width : fb_width;
     uint32_t copy_h = surf->height < fb_height ? surf->height : fb_height;
-    for (uint32_t j = 0; j < copy_h; j++) {
-        memcpy(fb_ptr + j * fb_pitch * 4,
-               surf->pixels + j * surf->pitch,
-               copy_w * 4);
+    uint64_t bytes = 0;
+    for (uint32_t k = 0; k < d->count; k++) {
+        const gfx_rect_t *r = &d->rects[k];
+        if (r->x >= copy_w || r->y >= copy_h)
+            continue;
+        uint32_t w = r->w < copy_w - r->x ? r->w : copy_w - r->x;
+        uint32_t h = r->h < copy_h - r->y ? r->h : copy_h - r->y;
+        for (uint32_t j = r->y; j < r->y + h; j++) {
+            memcpy(dst + ((size_t)j * fb_pitch + r->x) * 4,
+                   surf->pixels + (size_t)j * surf->pitch + r->x,
+                   (size_t)w * 4);
+        }
+        bytes += (uint64_t)w * h * 4;
     }
+    return bytes;
+}
+
+static void flip_latched(void)
+{
+    fb_scanout = fb_queued;
+    fb_queued = -1;
+    fb_ptr = fb_buf[fb_scanout];
+}
+
+/* Stop flipping and copy into whatever buffer the display shows. Without
+ * a readback that is the one before the flip that never landed; pointing
+ * the display at it again keeps a late latch from moving it. */
+static void flip_abandon(void)
+{
+    int shown = fb_scanout;
+    if (flip_ops->scanout) {
+        uint32_t live = flip_ops->scanout();
+        for (uint32_t b = 0; b < fb_nbuf; b++) {
+            if ((uint32_t)(uintptr_t)fb_buf[b] == live)
+                shown = b;
+        }
+    }
+    flip_ops->flip((uint64_t)(uintptr_t)fb_buf[shown]);
+    fb_queued = shown;
+    flip_latched();
+    fb_buffers = present_stats.buffers = 1;
+}
+
+/* Wait for the queued flip to reach the screen. A flip that never lands
+ * means the display engine is not doing what we think. */
+static void flip_wait(void)
+{
+    if (fb_queued < 0)
+        return;
+    if (flip_ops->flip_done()) {
+        flip_latched();
+        return;
+    }
+    present_stats.flip_waits++;
+    uint64_t start = tsc_read();
+    uint64_t limit = tsc_ms(FB_FLIP_TIMEOUT_MS);
+    while (tsc_read() - start < limit) {
+        if (flip_ops->flip_done()) {
+            flip_latched();
+            return;
+        }
+    }
+    debug_puts("framebuffer: flip timed out, copying instead\n");
+    flip_abandon();
+}
+
+/* Before the fb_draw_* helpers write into every buffer: let a queued flip
+ * land, then copy into each other buffer what it lacks of the one on
+ * screen. They are left lacking only what that one does, which is
+ * nothing unless a flip was abandoned. */
+static void overlay_sync(void)
+{
+    flip_wait();
+    const uint8_t *src = fb_buf[fb_scanout];
+    for (uint32_t b = 0; b < fb_nbuf; b++) {
+        gfx_damage_t *d = &fb_stale[b];
+        if ((int)b == fb_scanout || !d->count)
+            continue;
+        for (uint32_t k = 0; k < d->count; k++) {
+            const gfx_rect_t *r = &d->rects[k];
+            if (r->x >= fb_width || r->y >= fb_height)
+                continue;
+            uint32_t w = r->w < fb_width - r->x ? r->w : fb_width - r->x;
+            uint32_t h = r->h < fb_height - r->y ? r->h : fb_height - r->y;
+            for (uint32_t j = r->y; j < r->y + h; j++) {
+                size_t off = ((size_t)j * fb_pitch + r->x) * 4;
+                memcpy(fb_buf[b] + off, src + off, (size_t)w * 4);
+            }
+        }
+        *d = fb_stale[fb_scanout];
+    }
+}
+
+/* The buffer after the visible one, skipping one still waiting to land;
+ * with buffers used round-robin that is the oldest. */
+static int pick_back_buffer(void)
+{
+    for (uint32_t i = 1; i < fb_nbuf; i++) {
+        int b = (fb_scanout + i) % fb_nbuf;
+        if ((uint32_t)b < fb_buffers && b != fb_queued)
+            return b;
+    }
+    return -1;
+}
+
+/* Bring a back buffer up to date and queue a flip to it. Only one flip
+ * is in flight at a time since the scanout register holds one address;
+ * with three buffers the copy overlaps the wait for the previous one. */
+static uint64_t present_flip(const gfx_surface_t *surf)
+{
+    if (fb_queued >= 0 && flip_ops->flip_done())
+        flip_latched();
+    int back = pick_back_buffer();
+    if (back < 0) {
+        flip_wait();
+        if (fb_buffers == 1)
+            return 0;
+        back = pick_back_buffer();
+    }
+    uint64_t bytes = copy_damage(fb_buf[back], surf, &fb_stale[back]);
+    fb_stale[back].count = 0;
+    flip_wait();
+    if (fb_buffers == 1)
+        return bytes;
+    flip_ops->flip((uint64_t)(uintptr_t)fb_buf[back]);
+    fb_queued = back;
+    present_stats.flips++;
+    return bytes;
+}
+
+static void fb_present_frame(gfx_surface_t *surf)
+{
+    if (!fb_ptr || !surf)
+        return;
+    uint32_t rects = surf->damage.count;
+    for (uint32_t b = 0; b < fb_nbuf; b++)
+        for (uint32_t k = 0; k < rects; k++)
+            damage_insert(&fb_stale[b], surf->damage.rects[k]);
+    surf->damage.count = 0;
+
+    uint64_t bytes = 0;
+    if (fb_buffers > 1 && rects)
+        bytes = present_flip(surf);
+    if (fb_buffers == 1) {
+        bytes += copy_damage(fb_buf[fb_scanout], surf, &fb_stale[fb_scanout]);
+        fb_stale[fb_scanout].count = 0;
+    }
+    present_stats.frames++;
+    present_stats.bytes += bytes;
+    present_stats.last_bytes = bytes;
+    present_stats.last_rects = rects;
+}
+
+/* Buffers dropped from use keep collecting damage, so taking them back
+ * later needs no special care. */
+static uint32_t fb_set_buffering(uint32_t buffers)
+{
+    if (buffers < 1)
+        buffers = 1;
+    if (buffers > fb_nbuf)
+        buffers = fb_nbuf;
+    flip_wait();
+    fb_buffers = present_stats.buffers = buffers;
+    return fb_buffers;
+}
+
+int fb_enable_flip(const fb_flip_ops_t *ops, uint64_t aperture,
+                   uint64_t size)
+{
+    if (!fb_ptr || !ops || !ops->flip || !ops->flip_done)
+        return -1;
+    uint64_t frame = (uint64_t)fb_pitch * fb_height * 4;
+    if (fb_size > frame)
+        frame = fb_size;
+    uint64_t stride = (frame + 0xFFF) & ~0xFFFULL;
+    if (fb_base < aperture || fb_base >= aperture + size)
+        return -1;
+    uint64_t room = (aperture + size - fb_base) / stride;
+    if (room < 2)
+        return -1;
+    uint32_t n = room < GFX_MAX_BUFFERS ? (uint32_t)room : GFX_MAX_BUFFERS;
+
+    for (uint32_t b = 1; b < n; b++) {
+        uint64_t phys = fb_base + b * stride;
+        map_identity_range(phys, stride);
+        fb_buf[b] = (uint8_t *)(uintptr_t)phys;
+        /* whatever the buffer holds, it is not the frame on screen */
+        fb_stale[b].count = 0;
+        gfx_rect_t all = { 0, 0, fb_width, fb_height };
+        damage_insert(&fb_stale[b], all);
+    }
+    flip_ops = ops;
+    fb_nbuf = fb_buffers = present_stats.buffers = n;
+    fb_scanout = 0;
+    fb_queued = -1;
+    debug_puts("framebuffer: flipping between ");
+    debug_puthex(n);
+    debug_puts(" buffers\n");
+    return (int)n;
+}
+
+static void fb_get_present_stats(gfx_present_stats_t *out)
+{
+    if (out)
+        *out = present_stats;
 }
 
 static gfx_device_t fb_gfx_device = {
     .present_frame = fb_present_frame,
     .create_surface = fb_create_surface,
     .draw_rect = fb_surface_draw_rect,
+    .damage = fb_surface_damage,
+    .get_present_stats = fb_get_present_stats,
+    .set_buffering = fb_set_buffering,
 };
 
 gfx_device_t *framebuffer_get_gfx_device(void)
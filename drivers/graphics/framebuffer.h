@@ -32,4 +32,23 @@ uint32_t fb_get_pitch(void);
 
 gfx_device_t *framebuffer_get_gfx_device(void);
 
+/* Scanout flipping supplied by a GPU driver. flip() points the display
+ * at another buffer, latched by the hardware at the next vblank;
+ * flip_done() reports whether the last flip has been latched; scanout()
+ * reads back the low 32 bits of the address the display reads from now,
+ * which is optional. */
+typedef struct fb_flip_ops {
+    void (*flip)(uint64_t phys);
+    int (*flip_done)(void);
+    uint32_t (*scanout)(void);
+} fb_flip_ops_t;
+
+/* Place extra buffers after the GOP framebuffer inside the aperture
+ * [aperture, aperture + size) and present by flipping between them.
+ * Returns the number of buffers (2 or 3), or -1 if not even a second one
+ * fits, in which case presents keep copying into the visible buffer.
+ * init_framebuffer() turns flipping off again. */
+int fb_enable_flip(const fb_flip_ops_t *ops, uint64_t aperture,
+                   uint64_t size);
+
 #endif // PHILLOS_FRAMEBUFFER_H
@@ -3,13 +3,50 @@
 
 #include <stdint.h>
 
+#define GFX_DAMAGE_RECTS 8
+
+typedef struct gfx_rect {
+    uint32_t x, y, w, h;
+} gfx_rect_t;
+
+/* What changed on a surface since it was last presented, as disjoint
+ * rectangles. Rectangles that overlap or touch are merged as they come
+ * in; when every slot is taken, the pair whose union adds the fewest
+ * pixels is merged to make room. */
+typedef struct gfx_damage {
+    uint32_t count;
+    gfx_rect_t rects[GFX_DAMAGE_RECTS];
+} gfx_damage_t;
+
 typedef struct gfx_surface {
     uint32_t width;
     uint32_t height;
     uint32_t pitch;
     uint32_t *pixels;
+    gfx_damage_t damage;
 } gfx_surface_t;
 
+#define GFX_MAX_BUFFERS 3
+
+typedef struct gfx_present_stats {
+    uint64_t frames;
+    uint64_t bytes;          /* copied to the screen, all frames */
+    uint64_t last_bytes;     /* copied by the latest present */
+    uint32_t last_rects;
+    uint32_t buffers;        /* 1: copy into the visible buffer */
+    uint64_t flips;
+    uint64_t flip_waits;     /* presents that waited for a vblank */
+} gfx_present_stats_t;
+
+/* present_frame copies only the damaged parts of the surface and then
+ * clears the damage. draw_rect records its own damage; code that writes
+ * pixels directly reports them through damage().
+ *
+ * When the display hardware can flip, the copy goes into a back buffer
+ * that is not being scanned out and the flip takes effect at the next
+ * vblank, so a frame is never shown half drawn. set_buffering picks
+ * copy-only (1), double (2) or triple (3) buffering and returns the count
+ * actually in use, which may be lower. */
 typedef struct gfx_device {
     void (*present_frame)(gfx_surface_t *surf);
     gfx_surface_t *(*create_surface)(uint32_t width, uint32_t height);
@@ -17,6 +54,11 @@ typedef struct gfx_device {
                       uint32_t x, uint32_t y,
                       uint32_t w, uint32_t h,
                       uint32_t color);
+    void (*damage)(gfx_surface_t *surf,
+                   uint32_t x, uint32_t y,
+                   uint32_t w, uint32_t h);
+    void (*get_present_stats)(gfx_present_stats_t *out);
+    uint32_t (*set_buffering)(uint32_t buffers);
 } gfx_device_t;
 
 #endif // PHILLOS_GFX_H
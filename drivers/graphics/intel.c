@@ -7,13 +7,15 @@
 #include "../../kernel/init.h"
 #include "../driver_manager.h"
 
-static int intel_match(const pci_device_t *dev)
-{
-    return dev->vendor_id == 0x8086 && dev->class_code == 0x03;
-}
+static const pci_match_t intel_ids[] = {
+    { .flags = PCI_MATCH_VENDOR | PCI_MATCH_CLASS,
+      .vendor_id = 0x8086, .class_code = 0x03 },
+    { 0 }
+};
 
 static const pci_device_t *intel_dev = NULL;
 static uintptr_t intel_mmio_base = 0;
+static uint32_t intel_flip_addr = 0;
 
 #define INTEL_PIPEA_CONF        0x70008
 #define INTEL_PIPECONF_ENABLE   0x80000000
@@ -25,7 +27,25 @@ static uintptr_t intel_mmio_base = 0;
 #define INTEL_DSPSURF_A         0x70184
 #define INTEL_DSPSTRIDE_A       0x70188
 #define INTEL_DSPSIZE_A         0x70190
+#define INTEL_DSPSURFLIVE_A     0x701ac
+
+#define INTEL_APERTURE_BAR      2   /* GMADR */
+
+#ifdef GPU_EMULATED_MMIO
+/* Host test builds provide a software model of the display registers. */
+uint32_t gpu_emu_readl(uint32_t reg);
+void gpu_emu_writel(uint32_t reg, uint32_t val);
+
+static inline void intel_writel(uint32_t reg, uint32_t val)
+{
+    gpu_emu_writel(reg, val);
+}
 
+static inline uint32_t intel_readl(uint32_t reg)
+{
+    return gpu_emu_readl(reg);
+}
+#else
 static inline void intel_writel(uint32_t reg, uint32_t val)
 {
     volatile uint32_t *addr = (volatile uint32_t *)(intel_mmio_base + reg);
@@ -37,6 +57,7 @@ static inline uint32_t intel_readl(uint32_t reg)
     volatile uint32_t *addr = (volatile uint32_t *)(intel_mmio_base + reg);
     return *addr;
 }
+#endif
 
 static void intel_program_regs(void)
 {
@@ -48,6 +69,30 @@ static void intel_program_regs(void)
     intel_writel(INTEL_DSPSTRIDE_A, fb->pitch * 4);
 }
 
+/* DSPSURF is double buffered: a write is latched at the next vblank,
+ * after which DSPSURFLIVE reads back the new address. */
+static void intel_flip(uint64_t phys)
+{
+    intel_flip_addr = (uint32_t)(phys & 0xFFFFFFFF);
+    intel_writel(INTEL_DSPSURF_A, intel_flip_addr);
+}
+
+static int intel_flip_done(void)
+{
+    return intel_readl(INTEL_DSPSURFLIVE_A) == intel_flip_addr;
+}
+
+static uint32_t intel_scanout(void)
+{
+    return intel_readl(INTEL_DSPSURFLIVE_A);
+}
+
+static const fb_flip_ops_t intel_flip_ops = {
+    .flip = intel_flip,
+    .flip_done = intel_flip_done,
+    .scanout = intel_scanout,
+};
+
 static int intel_set_mode(uint32_t w, uint32_t h)
 {
     debug_puts("Intel: set display mode ");
@@ -98,6 +143,11 @@ static void intel_hw_init(const pci_device_t *dev)
     init_framebuffer(&boot_info_get()->fb);
     gpu_set_active_gfx_device(framebuffer_get_gfx_device());
     intel_program_regs();
+
+    uint64_t aperture, aperture_size;
+    if (pci_bar_range(dev->bus, dev->slot, dev->func, INTEL_APERTURE_BAR,
+                      &aperture, &aperture_size) == 0)
+        fb_enable_flip(&intel_flip_ops, aperture, aperture_size);
     gpu_set_active_driver(&intel_driver);
 }
 
@@ -124,6 +174,8 @@ gpu_driver_t intel_driver = {
 
 driver_t intel_pnp_driver = {
     .name = "Intel GPU",
-    .match = intel_match,
+    .ids = intel_ids,
     .init = intel_pnp_init,
+    .provides = DRIVER_DEP_DISPLAY,
+    .requires = DRIVER_DEP_FRAMEBUFFER,
 };
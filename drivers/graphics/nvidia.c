@@ -7,13 +7,16 @@
 #include "../../kernel/init.h"
 #include "../driver_manager.h"
 
-static int nvidia_match(const pci_device_t *dev)
-{
-    return dev->vendor_id == 0x10DE && dev->class_code == 0x03;
-}
+static const pci_match_t nvidia_ids[] = {
+    { .flags = PCI_MATCH_VENDOR | PCI_MATCH_CLASS,
+      .vendor_id = 0x10DE, .class_code = 0x03 },
+    { 0 }
+};
 
 static const pci_device_t *nvidia_dev = NULL;
 static uintptr_t nvidia_mmio_base = 0;
+static uint32_t nvidia_fb_addr = 0;       /* last written */
+static uint32_t nvidia_fb_addr_live = 0;  /* ... and before that */
 
 #define NV50_PDISPLAY_CRTC_DISPLAY_TOTAL     0x00610af8
 #define NV50_PDISPLAY_CRTC_SYNC_DURATION     0x00610b00
@@ -25,6 +28,21 @@ static uintptr_t nvidia_mmio_base = 0;
 #define NV50_PDISPLAY_UNK30_CTRL_UPDATE_VCLK0 0x00000200
 #define NV50_PDISPLAY_UNK30_CTRL_PENDING     0x80000000
 
+#ifdef GPU_EMULATED_MMIO
+/* Host test builds provide a software model of the display registers. */
+uint32_t gpu_emu_readl(uint32_t reg);
+void gpu_emu_writel(uint32_t reg, uint32_t val);
+
+static inline void nv_writel(uint32_t reg, uint32_t val)
+{
+    gpu_emu_writel(reg, val);
+}
+
+static inline uint32_t nv_readl(uint32_t reg)
+{
+    return gpu_emu_readl(reg);
+}
+#else
 static inline void nv_writel(uint32_t reg, uint32_t val)
 {
     volatile uint32_t *addr = (volatile uint32_t *)(nvidia_mmio_base + reg);
@@ -36,23 +54,57 @@ static inline uint32_t nv_readl(uint32_t reg)
     volatile uint32_t *addr = (volatile uint32_t *)(nvidia_mmio_base + reg);
     return *addr;
 }
+#endif
 
 #define NV50_PDISPLAY_CRTC_CONTROL          0x00610080
 #define NV50_PDISPLAY_CRTC_CONTROL_ENABLE   0x00000001
 #define NV50_PDISPLAY_CRTC_FB_ADDR          0x00610b10
 
+#define NV_APERTURE_BAR                     1   /* VRAM window */
+
 static void nvidia_program_regs(void)
 {
     debug_puts("Nvidia: programming registers\n");
     extern boot_info_t *boot_info_get(void);
     framebuffer_info_t *fb = &boot_info_get()->fb;
 
-    nv_writel(NV50_PDISPLAY_CRTC_FB_ADDR,
-              (uint32_t)(fb->base & 0xFFFFFFFF));
+    nvidia_fb_addr = nvidia_fb_addr_live = (uint32_t)(fb->base & 0xFFFFFFFF);
+    nv_writel(NV50_PDISPLAY_CRTC_FB_ADDR, nvidia_fb_addr);
     nv_writel(NV50_PDISPLAY_CRTC_CONTROL,
               NV50_PDISPLAY_CRTC_CONTROL_ENABLE);
 }
 
+/* A new FB_ADDR goes through the same update request as a mode set; the
+ * display engine carries it out at vblank and then drops PENDING. Until
+ * then it reads from the address it had before. */
+static void nvidia_flip(uint64_t phys)
+{
+    if (!(nv_readl(NV50_PDISPLAY_UNK30_CTRL) &
+          NV50_PDISPLAY_UNK30_CTRL_PENDING))
+        nvidia_fb_addr_live = nvidia_fb_addr;
+    nvidia_fb_addr = (uint32_t)(phys & 0xFFFFFFFF);
+    nv_writel(NV50_PDISPLAY_CRTC_FB_ADDR, nvidia_fb_addr);
+    nv_writel(NV50_PDISPLAY_UNK30_CTRL,
+              NV50_PDISPLAY_UNK30_CTRL_UPDATE_VCLK0);
+}
+
+static int nvidia_flip_done(void)
+{
+    return !(nv_readl(NV50_PDISPLAY_UNK30_CTRL) &
+             NV50_PDISPLAY_UNK30_CTRL_PENDING);
+}
+
+static uint32_t nvidia_scanout(void)
+{
+    return nvidia_flip_done() ? nvidia_fb_addr : nvidia_fb_addr_live;
+}
+
+static const fb_flip_ops_t nvidia_flip_ops = {
+    .flip = nvidia_flip,
+    .flip_done = nvidia_flip_done,
+    .scanout = nvidia_scanout,
+};
+
 static int nvidia_set_mode(uint32_t w, uint32_t h)
 {
     debug_puts("Nvidia: set display mode ");
@@ -108,6 +160,11 @@ static void nvidia_hw_init(const pci_device_t *dev)
     init_framebuffer(&boot_info_get()->fb);
     gpu_set_active_gfx_device(framebuffer_get_gfx_device());
     nvidia_program_regs();
+
+    uint64_t aperture, aperture_size;
+    if (pci_bar_range(dev->bus, dev->slot, dev->func, NV_APERTURE_BAR,
+                      &aperture, &aperture_size) == 0)
+        fb_enable_flip(&nvidia_flip_ops, aperture, aperture_size);
     gpu_set_active_driver(&nvidia_driver);
 }
 
@@ -134,6 +191,8 @@ gpu_driver_t nvidia_driver = {
 
 driver_t nvidia_pnp_driver = {
     .name = "Nvidia GPU",
-    .match = nvidia_match,
+    .ids = nvidia_ids,
     .init = nvidia_pnp_init,
+    .provides = DRIVER_DEP_DISPLAY,
+    .requires = DRIVER_DEP_FRAMEBUFFER,
 };
@@ -18,7 +18,7 @@ static int load_vkd3d_library(void)
         return 0;
 
     uint32_t sz = 0;
-    void *file = fat32_load_file(VKD3D_LIB_PATH, &sz);
+    void *file = fat32_mmap(VKD3D_LIB_PATH, &sz);
     if (!file) {
         debug_puts("Failed to load library\n");
         return -1;
@@ -26,11 +26,12 @@ static int load_vkd3d_library(void)
 
     if (elf_load_image(file, sz, &vkd3d_mod)) {
         debug_puts("Invalid ELF image\n");
-        kfree(file);
+        fat32_munmap(file);
         return -1;
     }
 
-    kfree(file);
+    /* read-only segments keep their page cache pages */
+    fat32_munmap(file);
 
     debug_puts("vkd3d loaded at 0x");
     debug_puthex64((uint64_t)(uintptr_t)vkd3d_mod.base);
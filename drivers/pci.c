@@ -0,0 +1,337 @@
+#include "pci.h"
+#include "../kernel/memory/paging.h"
+#include "../kernel/debug.h"
+#include <string.h>
+
+/* ECAM gives every function its own 4 KiB page at base + (bus << 20 |
+ * slot << 15 | func << 12), so a config access is a single uncached load or
+ * store instead of an address write and a data read on two serialising I/O
+ * ports. The window of a bus is mapped the first time that bus is touched;
+ * a machine rarely populates more than a handful of the 256 buses, so
+ * mapping the whole window up front would mostly build page tables for
+ * nothing. Only segment group 0 is kept: bus/slot/func cannot address any
+ * other. */
+
+typedef struct __attribute__((packed)) {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt;
+    uint32_t length;
+    uint64_t xsdt;
+    uint8_t ext_checksum;
+    uint8_t reserved[3];
+} acpi_rsdp_t;
+
+#define ACPI_RSDP_V1_LEN 20
+
+typedef struct __attribute__((packed)) {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} acpi_sdt_t;
+
+/* MCFG: an acpi_sdt_t, 8 reserved bytes, then one entry per allocation */
+typedef struct __attribute__((packed)) {
+    uint64_t base;
+    uint16_t segment;
+    uint8_t bus_start;
+    uint8_t bus_end;
+    uint32_t reserved;
+} mcfg_entry_t;
+
+#define MCFG_ENTRIES_OFFSET (sizeof(acpi_sdt_t) + 8)
+
+static pci_ecam_region_t ecam[PCI_MAX_ECAM];
+static uint8_t ecam_mapped[PCI_MAX_ECAM][256 / 8];
+static int ecam_count = 0;
+
+#ifdef PCI_EMULATED_PIO
+/* Host test builds provide a software model of the config ports. */
+uint32_t pci_emu_inl(uint16_t port);
+void pci_emu_outl(uint16_t port, uint32_t val);
+
+static inline uint32_t port_inl(uint16_t port)
+{
+    return pci_emu_inl(port);
+}
+
+static inline void port_outl(uint16_t port, uint32_t val)
+{
+    pci_emu_outl(port, val);
+}
+#else
+static inline uint32_t port_inl(uint16_t port)
+{
+    uint32_t data;
+    __asm__ volatile("inl %1, %0" : "=a"(data) : "d"(port));
+    return data;
+}
+
+static inline void port_outl(uint16_t port, uint32_t val)
+{
+    __asm__ volatile("outl %0, %1" :: "a"(val), "d"(port));
+}
+#endif
+
+static int checksum_ok(const void *p, uint32_t len)
+{
+    const uint8_t *b = p;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < len; i++)
+        sum += b[i];
+    return sum == 0;
+}
+
+static const acpi_sdt_t *map_table(uint64_t phys)
+{
+    if (!phys)
+        return NULL;
+    map_identity_range(phys, sizeof(acpi_sdt_t));
+    const acpi_sdt_t *t = (const acpi_sdt_t *)(uintptr_t)phys;
+    if (t->length < sizeof(*t))
+        return NULL;
+    map_identity_range(phys, t->length);
+    return checksum_ok(t, t->length) ? t : NULL;
+}
+
+/* Walk the XSDT (or the RSDT on ACPI 1.0 firmware) for a table. */
+static const acpi_sdt_t *acpi_find_table(uint64_t rsdp_phys, const char *sig)
+{
+    map_identity_range(rsdp_phys, sizeof(acpi_rsdp_t));
+    const acpi_rsdp_t *rsdp = (const acpi_rsdp_t *)(uintptr_t)rsdp_phys;
+    if (memcmp(rsdp->signature, "RSD PTR ", 8) != 0 ||
+        !checksum_ok(rsdp, ACPI_RSDP_V1_LEN))
+        return NULL;
+
+    int wide = rsdp->revision >= 2 && rsdp->xsdt &&
+               checksum_ok(rsdp, sizeof(*rsdp));
+    const acpi_sdt_t *root = map_table(wide ? rsdp->xsdt : rsdp->rsdt);
+    if (!root || memcmp(root->signature, wide ? "XSDT" : "RSDT", 4) != 0)
+        return NULL;
+
+    uint32_t stride = wide ? 8 : 4;
+    uint32_t count = (root->length - sizeof(*root)) / stride;
+    const uint8_t *entries = (const uint8_t *)(root + 1);
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t phys = 0;
+        memcpy(&phys, entries + i * stride, stride);
+        if (!phys)
+            continue;
+        map_identity_range(phys, sizeof(acpi_sdt_t));
+        const acpi_sdt_t *t = (const acpi_sdt_t *)(uintptr_t)phys;
+        if (memcmp(t->signature, sig, 4) == 0)
+            return map_table(phys);
+    }
+    return NULL;
+}
+
+int pci_init(uint64_t rsdp)
+{
+    ecam_count = 0;
+    memset(ecam_mapped, 0, sizeof(ecam_mapped));
+
+    const acpi_sdt_t *mcfg = rsdp ? acpi_find_table(rsdp, "MCFG") : NULL;
+    if (!mcfg || mcfg->length < MCFG_ENTRIES_OFFSET) {
+        debug_puts("PCI: no MCFG, using port I/O\n");
+        return 0;
+    }
+
+    uint32_t count = (mcfg->length - MCFG_ENTRIES_OFFSET) / sizeof(mcfg_entry_t);
+    const mcfg_entry_t *e =
+        (const mcfg_entry_t *)((const uint8_t *)mcfg + MCFG_ENTRIES_OFFSET);
+    for (uint32_t i = 0; i < count && ecam_count < PCI_MAX_ECAM; i++) {
+        if (e[i].segment != 0 || !e[i].base || e[i].bus_end < e[i].bus_start)
+            continue;
+        pci_ecam_region_t *r = &ecam[ecam_count++];
+        r->base = e[i].base;
+        r->segment = e[i].segment;
+        r->bus_start = e[i].bus_start;
+        r->bus_end = e[i].bus_end;
+        debug_puts("PCI: ECAM at 0x");
+        debug_puthex64(r->base);
+        debug_puts(" buses 0x");
+        debug_puthex(r->bus_start);
+        debug_puts("-0x");
+        debug_puthex(r->bus_end);
+        debug_putc('\n');
+    }
+    return ecam_count;
+}
+
+int pci_ecam_count(void)
+{
+    return ecam_count;
+}
+
+const pci_ecam_region_t *pci_ecam_region(int index)
+{
+    if (index < 0 || index >= ecam_count)
+        return NULL;
+    return &ecam[index];
+}
+
+/* Config page of a function inside an ECAM window, or NULL. */
+static volatile uint8_t *ecam_page(uint8_t bus, uint8_t slot, uint8_t func)
+{
+    for (int i = 0; i < ecam_count; i++) {
+        const pci_ecam_region_t *r = &ecam[i];
+        if (bus < r->bus_start || bus > r->bus_end)
+            continue;
+        uint64_t bus_base = r->base + ((uint64_t)bus << 20);
+        if (!(ecam_mapped[i][bus >> 3] & (1u << (bus & 7)))) {
+            map_identity_range(bus_base, 1ULL << 20);
+            ecam_mapped[i][bus >> 3] |= 1u << (bus & 7);
+        }
+        return (volatile uint8_t *)(uintptr_t)(bus_base |
+                                               (uint64_t)(slot & 31) << 15 |
+                                               (uint64_t)(func & 7) << 12);
+    }
+    return NULL;
+}
+
+static uint32_t port_address(uint8_t bus, uint8_t slot, uint8_t func,
+                             uint16_t offset)
+{
+    return (uint32_t)(1u << 31) |
+           ((uint32_t)bus << 16) |
+           ((uint32_t)(slot & 31) << 11) |
+           ((uint32_t)(func & 7) << 8) |
+           (offset & 0xfc);
+}
+
+uint32_t pci_config_read32(uint8_t bus, uint8_t slot, uint8_t func,
+                           uint16_t offset)
+{
+    if (offset >= PCIE_CFG_SIZE)
+        return 0xFFFFFFFF;
+    volatile uint8_t *page = ecam_page(bus, slot, func);
+    if (page)
+        return *(volatile uint32_t *)(page + (offset & 0xffc));
+    if (offset >= PCI_CFG_SIZE)
+        return 0xFFFFFFFF;
+    port_outl(0xcf8, port_address(bus, slot, func, offset));
+    return port_inl(0xcfc);
+}
+
+void pci_config_write32(uint8_t bus, uint8_t slot, uint8_t func,
+                        uint16_t offset, uint32_t value)
+{
+    if (offset >= PCIE_CFG_SIZE)
+        return;
+    volatile uint8_t *page = ecam_page(bus, slot, func);
+    if (page) {
+        *(volatile uint32_t *)(page + (offset & 0xffc)) = value;
+        return;
+    }
+    if (offset >= PCI_CFG_SIZE)
+        return;
+    port_outl(0xcf8, port_address(bus, slot, func, offset));
+    port_outl(0xcfc, value);
+}
+
+uint16_t pci_config_read16(uint8_t bus, uint8_t slot, uint8_t func,
+                           uint16_t offset)
+{
+    return pci_config_read32(bus, slot, func, offset) >> ((offset & 2) * 8);
+}
+
+uint8_t pci_config_read8(uint8_t bus, uint8_t slot, uint8_t func,
+                         uint16_t offset)
+{
+    return pci_config_read32(bus, slot, func, offset) >> ((offset & 3) * 8);
+}
+
+uint16_t pci_config_size(uint8_t bus, uint8_t slot, uint8_t func)
+{
+    /* conventional PCI functions behind a PCIe bridge have no extended
+     * space even when ECAM reaches them */
+    if (!ecam_page(bus, slot, func) ||
+        !pci_find_capability(bus, slot, func, PCI_CAP_ID_PCIE))
+        return PCI_CFG_SIZE;
+    return PCIE_CFG_SIZE;
+}
+
+uint8_t pci_find_capability(uint8_t bus, uint8_t slot, uint8_t func,
+                            uint8_t id)
+{
+    uint16_t status = pci_config_read16(bus, slot, func, PCI_STATUS);
+    if (status == 0xFFFF || !(status & PCI_STATUS_CAP_LIST))
+        return 0;
+
+    uint8_t ptr = pci_config_read8(bus, slot, func, PCI_CAP_PTR) & 0xfc;
+    /* a broken list may loop; 48 entries is every slot from 0x40 on */
+    for (int n = 0; n < 48 && ptr >= 0x40; n++) {
+        uint32_t hdr = pci_config_read32(bus, slot, func, ptr);
+        if ((hdr & 0xFF) == id)
+            return ptr;
+        ptr = (hdr >> 8) & 0xfc;
+    }
+    return 0;
+}
+
+uint16_t pci_find_ext_capability(uint8_t bus, uint8_t slot, uint8_t func,
+                                 uint16_t id)
+{
+    if (pci_config_size(bus, slot, func) < PCIE_CFG_SIZE)
+        return 0;
+
+    uint16_t off = PCI_EXT_CAP_START;
+    for (int n = 0; n < (PCIE_CFG_SIZE - PCI_CFG_SIZE) / 8; n++) {
+        uint32_t hdr = pci_config_read32(bus, slot, func, off);
+        if (hdr == 0 || hdr == 0xFFFFFFFF)
+            return 0;
+        if ((hdr & 0xFFFF) == id)
+            return off;
+        off = (hdr >> 20) & 0xffc;
+        if (off < PCI_EXT_CAP_START)
+            return 0;
+    }
+    return 0;
+}
+
+int pci_bar_range(uint8_t bus, uint8_t slot, uint8_t func, int bar,
+                  uint64_t *base, uint64_t *size)
+{
+    if (bar < 0 || bar > 5)
+        return -1;
+    uint16_t off = PCI_BAR0 + bar * 4;
+    uint32_t lo = pci_config_read32(bus, slot, func, off);
+    if (lo == 0xFFFFFFFF || (lo & PCI_BAR_IO))
+        return -1;
+    int wide = (lo & PCI_BAR_TYPE_MASK) == PCI_BAR_TYPE_64;
+    if (wide && bar == 5)
+        return -1;
+    uint32_t hi = wide ? pci_config_read32(bus, slot, func, off + 4) : 0;
+
+    /* the upper half is status; writing zeroes there clears nothing */
+    uint32_t cmd = pci_config_read32(bus, slot, func, PCI_COMMAND) & 0xFFFF;
+    pci_config_write32(bus, slot, func, PCI_COMMAND,
+                       cmd & ~PCI_COMMAND_MEMORY);
+    pci_config_write32(bus, slot, func, off, 0xFFFFFFFF);
+    uint32_t mask_lo = pci_config_read32(bus, slot, func, off);
+    pci_config_write32(bus, slot, func, off, lo);
+    uint32_t mask_hi = 0xFFFFFFFF;
+    if (wide) {
+        pci_config_write32(bus, slot, func, off + 4, 0xFFFFFFFF);
+        mask_hi = pci_config_read32(bus, slot, func, off + 4);
+        pci_config_write32(bus, slot, func, off + 4, hi);
+    }
+    pci_config_write32(bus, slot, func, PCI_COMMAND, cmd);
+
+    uint64_t mask = ((uint64_t)mask_hi << 32) | (mask_lo & ~0xFu);
+    if (!(mask_lo & ~0xFu) && (!wide || !mask_hi))
+        return -1;
+    if (base)
+        *base = (((uint64_t)hi << 32) | lo) & ~0xFULL;
+    if (size)
+        *size = ~mask + 1;
+    return 0;
+}
@@ -0,0 +1,101 @@
+#ifndef PHILLOS_PCI_H
+#define PHILLOS_PCI_H
+
+#include <stdint.h>
+
+/* PCI configuration space access. When the firmware publishes an ACPI MCFG
+ * table, config reads and writes are plain loads and stores into the ECAM
+ * window and the full 4 KiB PCIe config space is reachable. Buses outside
+ * every ECAM region, and machines without MCFG, fall back to the legacy
+ * 0xCF8/0xCFC ports, which only reach the first 256 bytes. */
+
+#define PCI_CFG_SIZE        256
+#define PCIE_CFG_SIZE       4096
+#define PCI_MAX_ECAM        8      /* MCFG allocations kept */
+
+#define PCI_COMMAND         0x04
+#define PCI_STATUS          0x06
+#define PCI_CLASS_REVISION  0x08
+#define PCI_HEADER_TYPE     0x0E
+#define PCI_PRIMARY_BUS     0x18
+#define PCI_SECONDARY_BUS   0x19
+#define PCI_SUBORDINATE_BUS 0x1A
+#define PCI_BAR0            0x10
+#define PCI_CAP_PTR         0x34
+
+#define PCI_COMMAND_MEMORY  0x0002
+
+#define PCI_BAR_IO          0x1
+#define PCI_BAR_TYPE_MASK   0x6
+#define PCI_BAR_TYPE_64     0x4
+
+#define PCI_STATUS_CAP_LIST      0x10
+#define PCI_HEADER_MULTIFUNCTION 0x80
+#define PCI_HEADER_TYPE_MASK     0x7F
+#define PCI_HEADER_TYPE_BRIDGE   0x01
+#define PCI_HEADER_TYPE_CARDBUS  0x02
+
+#define PCI_CAP_ID_PM       0x01
+#define PCI_CAP_ID_MSI      0x05
+#define PCI_CAP_ID_PCIE     0x10
+#define PCI_CAP_ID_MSIX     0x11
+
+/* PCI Express capability registers, relative to the capability */
+#define PCI_EXP_FLAGS           0x02
+#define PCI_EXP_FLAGS_SLOT      0x0100   /* slot implemented */
+#define PCI_EXP_SLTCAP          0x14
+#define PCI_EXP_SLTCAP_HPC      0x0040   /* hot-plug capable */
+#define PCI_EXP_SLTCTL          0x18
+#define PCI_EXP_SLTCTL_ABPE     0x0001
+#define PCI_EXP_SLTCTL_PDCE     0x0008
+#define PCI_EXP_SLTCTL_HPIE     0x0020
+#define PCI_EXP_SLTCTL_DLLSCE   0x1000
+#define PCI_EXP_SLTSTA          0x1A
+#define PCI_EXP_SLTSTA_ABP      0x0001   /* attention button pressed */
+#define PCI_EXP_SLTSTA_PDC      0x0008   /* presence detect changed */
+#define PCI_EXP_SLTSTA_DLLSC    0x0100   /* data link layer state changed */
+
+#define PCI_EXT_CAP_START   0x100
+#define PCI_EXT_CAP_ID_AER  0x0001
+#define PCI_EXT_CAP_ID_DSN  0x0003
+
+typedef struct {
+    uint64_t base;       /* physical address of bus 0 in this window */
+    uint16_t segment;
+    uint8_t bus_start;
+    uint8_t bus_end;
+} pci_ecam_region_t;
+
+/* Locate ECAM through the ACPI tables below `rsdp` (physical address, 0 if
+ * the firmware gave none). Returns the number of ECAM regions in use; 0
+ * means every access goes through the I/O ports. Call after paging is up. */
+int pci_init(uint64_t rsdp);
+int pci_ecam_count(void);
+const pci_ecam_region_t *pci_ecam_region(int index);
+
+/* Offsets are rounded down to the access size. Reads outside the reachable
+ * config space return all ones and such writes are dropped. */
+uint32_t pci_config_read32(uint8_t bus, uint8_t slot, uint8_t func,
+                           uint16_t offset);
+void pci_config_write32(uint8_t bus, uint8_t slot, uint8_t func,
+                        uint16_t offset, uint32_t value);
+uint16_t pci_config_read16(uint8_t bus, uint8_t slot, uint8_t func,
+                           uint16_t offset);
+uint8_t pci_config_read8(uint8_t bus, uint8_t slot, uint8_t func,
+                         uint16_t offset);
+/* Bytes of config space reachable for this function: 256 or 4096. */
+uint16_t pci_config_size(uint8_t bus, uint8_t slot, uint8_t func);
+
+/* Offset of the first capability with this ID, or 0 if there is none. */
+uint8_t pci_find_capability(uint8_t bus, uint8_t slot, uint8_t func,
+                            uint8_t id);
+uint16_t pci_find_ext_capability(uint8_t bus, uint8_t slot, uint8_t func,
+                                 uint16_t id);
+
+/* Address and size of memory BAR `bar` (0-5), sized with the usual
+ * all-ones probe while memory decoding is off. A 64-bit BAR also uses the
+ * next index. Returns -1 for I/O and unimplemented BARs. */
+int pci_bar_range(uint8_t bus, uint8_t slot, uint8_t func, int bar,
+                  uint64_t *base, uint64_t *size);
+
+#endif // PHILLOS_PCI_H
@@ -0,0 +1,70 @@
+#include "pci_snapshot.h"
+#include "../kernel/fs/fat32.h"
+#include "../kernel/debug.h"
+#include <string.h>
+
+static const uint8_t *boot_copy;
+static uint64_t boot_copy_size;
+
+static uint32_t fnv1a(uint32_t hash, const void *data, uint32_t len)
+{
+    const uint8_t *p = data;
+    for (uint32_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+uint32_t pci_snapshot_hash(const char *name)
+{
+    return name ? fnv1a(0x811C9DC5, name, strlen(name)) : 0;
+}
+
+void pci_snapshot_set_boot_copy(const void *data, uint64_t size)
+{
+    boot_copy = data;
+    boot_copy_size = data ? size : 0;
+}
+
+int pci_snapshot_load(pci_snapshot_entry_t *out, int max)
+{
+    pci_snapshot_header_t hdr;
+    if (boot_copy_size < sizeof(hdr))
+        return -1;
+    memcpy(&hdr, boot_copy, sizeof(hdr));
+    if (hdr.magic != PCI_SNAPSHOT_MAGIC ||
+        hdr.version != PCI_SNAPSHOT_VERSION ||
+        hdr.count > PCI_SNAPSHOT_MAX || (int)hdr.count > max)
+        return -1;
+    uint32_t len = hdr.count * sizeof(pci_snapshot_entry_t);
+    if (boot_copy_size < sizeof(hdr) + len ||
+        fnv1a(0x811C9DC5, boot_copy + sizeof(hdr), len) != hdr.checksum) {
+        debug_puts("PCI snapshot: corrupt, ignored\n");
+        return -1;
+    }
+    memcpy(out, boot_copy + sizeof(hdr), len);
+    return hdr.count;
+}
+
+int pci_snapshot_save(const pci_snapshot_entry_t *entries, int count)
+{
+    fat32_file_t file;
+    if (count < 0 || count > PCI_SNAPSHOT_MAX)
+        return -1;
+    if (fat32_open(PCI_SNAPSHOT_PATH, &file) ||
+        file.size < PCI_SNAPSHOT_FILE_SIZE)
+        return -1;
+
+    uint8_t buf[PCI_SNAPSHOT_FILE_SIZE];
+    pci_snapshot_header_t *hdr = (pci_snapshot_header_t *)buf;
+    uint32_t len = count * sizeof(pci_snapshot_entry_t);
+    memset(buf, 0, sizeof(buf));
+    hdr->magic = PCI_SNAPSHOT_MAGIC;
+    hdr->version = PCI_SNAPSHOT_VERSION;
+    hdr->count = count;
+    hdr->checksum = fnv1a(0x811C9DC5, entries, len);
+    memcpy(buf + sizeof(*hdr), entries, len);
+    /* only the part in use; stale entries past `count` are never read */
+    return fat32_write_at(&file, 0, buf, sizeof(*hdr) + len);
+}
@@ -0,0 +1,57 @@
+#ifndef PHILLOS_PCI_SNAPSHOT_H
+#define PHILLOS_PCI_SNAPSHOT_H
+
+#include <stdint.h>
+
+/* What the last boot found on PCI, kept on the boot partition so the next
+ * boot can bind the same devices without walking every bus first. The
+ * file is overwritten in place and must already exist with room for
+ * PCI_SNAPSHOT_MAX entries; a file of zeros reads as no snapshot.
+ *
+ * The boot disk is one of the devices the snapshot binds, so the kernel
+ * cannot read the file before it is done with it: the loader reads it
+ * through UEFI and passes the copy in boot_info. Only saving goes through
+ * fat32, and the driver manager does that once storage is up. */
+
+#define PCI_SNAPSHOT_PATH     "/EFI/PHILLOS/pcisnap.bin"
+#define PCI_SNAPSHOT_MAGIC    0x50534E50   /* "PNSP" */
+#define PCI_SNAPSHOT_VERSION  1
+#define PCI_SNAPSHOT_MAX      64
+
+/* pci_snapshot_entry_t.flags */
+#define PCI_SNAPSHOT_DRIVER   0x01   /* a driver was bound */
+#define PCI_SNAPSHOT_MODULE   0x02   /* ... and it came from a module */
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t checksum;       /* FNV-1a over the entries */
+    uint32_t reserved;
+} pci_snapshot_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t bus, slot, func;
+    uint8_t header;          /* header type byte, multifunction bit included */
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t flags;
+    uint8_t reserved;
+    uint32_t driver;         /* pci_snapshot_hash() of the driver's name */
+} pci_snapshot_entry_t;
+
+#define PCI_SNAPSHOT_FILE_SIZE \
+    (sizeof(pci_snapshot_header_t) + \
+     PCI_SNAPSHOT_MAX * sizeof(pci_snapshot_entry_t))
+
+uint32_t pci_snapshot_hash(const char *name);
+/* The loader's copy of the file; NULL when it found none. */
+void pci_snapshot_set_boot_copy(const void *data, uint64_t size);
+/* Returns the number of entries in the boot copy, or -1 when there is no
+ * valid snapshot. */
+int pci_snapshot_load(pci_snapshot_entry_t *out, int max);
+int pci_snapshot_save(const pci_snapshot_entry_t *entries, int count);
+
+#endif // PHILLOS_PCI_SNAPSHOT_H
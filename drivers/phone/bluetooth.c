@@ -12,10 +12,11 @@
 
 static int bt_up = 0;
 
-static int bluetooth_match(const pci_device_t *dev)
-{
-    return dev->class_code == 0x0D && dev->subclass == 0x10; // Wireless Bluetooth
-}
+static const pci_match_t bluetooth_ids[] = {
+    { .flags = PCI_MATCH_CLASS | PCI_MATCH_SUBCLASS,
+      .class_code = 0x0D, .subclass = 0x10 }, // Wireless Bluetooth
+    { 0 }
+};
 
 static void bluetooth_pnp_init(const pci_device_t *dev)
 {
@@ -73,6 +74,6 @@ int bluetooth_start_pairing(const char *name)
 
 driver_t bluetooth_pnp_driver = {
     .name = "Bluetooth",
-    .match = bluetooth_match,
+    .ids = bluetooth_ids,
     .init = bluetooth_pnp_init,
 };
@@ -18,10 +18,11 @@ static const char *modem_paths[] = {
 static int modem_present = 0;
 static char iccid_cache[32] = "";
 
-static int sim_match(const pci_device_t *dev)
-{
-    return dev->class_code == 0x07 && dev->subclass == 0x03; // Communications Modem
-}
+static const pci_match_t sim_ids[] = {
+    { .flags = PCI_MATCH_CLASS | PCI_MATCH_SUBCLASS,
+      .class_code = 0x07, .subclass = 0x03 }, // Communications Modem
+    { 0 }
+};
 
 static void sim_pnp_init(const pci_device_t *dev)
 {
@@ -149,6 +150,6 @@ int sim_send_sms(const char *to, const char *msg)
 
 driver_t sim_pnp_driver = {
     .name = "SIM/Modem",
-    .match = sim_match,
+    .ids = sim_ids,
     .init = sim_pnp_init,
 };
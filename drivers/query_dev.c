@@ -11,6 +11,7 @@ typedef struct {
     kernel_query_request_t req;
     kernel_query_response_t res;
     kernel_device_event_t event;
+    kernel_io_stats_t io;
 } query_ioc_t;
 
 #ifndef QUERY_IOCTL
@@ -25,11 +26,15 @@ static long query_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
     query_ioc_t ioc;
     if (copy_from_user(&ioc, (void __user *)arg, sizeof(ioc)))
         return -EFAULT;
+    if (kernel_query_verify(&ioc.req) != 0)
+        return -EINVAL;
     if (ioc.req.query == KERNEL_QUERY_NEXT_DEVICE_EVENT) {
         if (kernel_pop_device_event(&ioc.event) == 0)
             ioc.res.result = 1;
         else
             ioc.res.result = 0;
+    } else if (ioc.req.query == KERNEL_QUERY_IO_STATS) {
+        ioc.res.result = kernel_get_io_stats(ioc.io.index, &ioc.io) == 0;
     } else if (kernel_query(&ioc.req, &ioc.res) != 0) {
         return -EINVAL;
     }
@@ -0,0 +1,601 @@
+#include "ahci.h"
+#include "iosched.h"
+#include "../../kernel/memory/alloc.h"
+#include "../../kernel/memory/paging.h"
+#include "../../kernel/debug.h"
+#include <string.h>
+
+/* AHCI port driver. Every port keeps up to 32 commands in flight, using
+ * Native Command Queuing when both HBA and disk support it. Requests map
+ * their scatter-gather list straight onto the PRD table of a command slot
+ * and are completed from batched polling. Requests that arrive while all
+ * slots are busy wait on a per-port backlog. HBA interrupts stay masked
+ * until something routes the controller's vector to ahci_irq(). */
+
+/* Generic host control */
+#define AHCI_CAP        0x00
+#define AHCI_GHC        0x04
+#define AHCI_IS         0x08
+#define AHCI_PI         0x0C
+
+#define AHCI_CAP_NCS(c) ((((c) >> 8) & 0x1F) + 1)
+#define AHCI_CAP_SNCQ   (1u << 30)
+#define AHCI_GHC_IE     (1u << 1)
+#define AHCI_GHC_AE     (1u << 31)
+
+/* Port registers */
+#define AHCI_PORT(n)    (0x100 + (uint32_t)(n) * 0x80)
+#define PXCLB           0x00
+#define PXCLBU          0x04
+#define PXFB            0x08
+#define PXFBU           0x0C
+#define PXIS            0x10
+#define PXIE            0x14
+#define PXCMD           0x18
+#define PXTFD           0x20
+#define PXSIG           0x24
+#define PXSSTS          0x28
+#define PXSERR          0x30
+#define PXSACT          0x34
+#define PXCI            0x38
+
+#define PXCMD_ST        (1u << 0)
+#define PXCMD_FRE       (1u << 4)
+#define PXCMD_FR        (1u << 14)
+#define PXCMD_CR        (1u << 15)
+
+#define PXIS_DHRS       (1u << 0)
+#define PXIS_SDBS       (1u << 3)
+#define PXIS_IFS        (1u << 27)
+#define PXIS_HBDS       (1u << 28)
+#define PXIS_HBFS       (1u << 29)
+#define PXIS_TFES       (1u << 30)
+#define PXIS_ERRORS     (PXIS_IFS | PXIS_HBDS | PXIS_HBFS | PXIS_TFES)
+
+#define SATA_SIG_ATA    0x00000101
+#define SSTS_DET_PRESENT 3
+#define SSTS_IPM_ACTIVE  1
+
+/* ATA commands */
+#define ATA_CMD_READ_DMA_EXT     0x25
+#define ATA_CMD_WRITE_DMA_EXT    0x35
+#define ATA_CMD_READ_FPDMA       0x60
+#define ATA_CMD_WRITE_FPDMA      0x61
+#define ATA_CMD_IDENTIFY         0xEC
+
+#define FIS_TYPE_REG_H2D 0x27
+
+#define AHCI_SECTOR      512
+#define AHCI_MAX_PRDT    BLKDEV_MAX_SG
+#define AHCI_PRD_MAX     (4u << 20)     /* DBC is a 22-bit field */
+#define AHCI_SPIN_LIMIT  1000000
+
+typedef struct __attribute__((packed)) {
+    uint16_t flags;     /* CFL in bits 0-4, W bit 6 */
+    uint16_t prdtl;
+    uint32_t prdbc;
+    uint32_t ctba;
+    uint32_t ctbau;
+    uint32_t rsv[4];
+} ahci_cmd_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t dba;
+    uint32_t dbau;
+    uint32_t rsv;
+    uint32_t dbc;       /* byte count - 1, bit 31 = interrupt on completion */
+} ahci_prd_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t cfis[64];
+    uint8_t acmd[16];
+    uint8_t rsv[48];
+    ahci_prd_t prdt[AHCI_MAX_PRDT];
+} ahci_cmd_table_t;
+
+#define AHCI_TABLES_PER_PAGE (4096 / sizeof(ahci_cmd_table_t))
+
+typedef struct {
+    int present;
+    uint32_t base;                     /* register offset of the port */
+    ahci_cmd_header_t *cmd_list;       /* 32 headers, 1 KiB aligned */
+    uint8_t *rx_fis;                   /* 256 byte aligned */
+    ahci_cmd_table_t *tables[AHCI_MAX_SLOTS];
+    blk_request_t *slot_req[AHCI_MAX_SLOTS];
+    uint32_t busy;                     /* slots owned by the device */
+    uint32_t slot_mask;
+    int ncq;
+    blk_request_t *backlog;
+    blk_request_t *backlog_tail;
+    blkdev_t dev;
+    char name[8];
+    ahci_stats_t stats;
+} ahci_port_t;
+
+static uintptr_t ahci_mmio_base = 0;
+static ahci_port_t ports[AHCI_MAX_PORTS];
+static uint32_t hba_slots = 1;
+static int hba_ncq = 0;
+
+#ifdef AHCI_EMULATED_MMIO
+/* Host test builds provide a software model of the HBA registers. */
+uint32_t ahci_emu_readl(uint32_t reg);
+void ahci_emu_writel(uint32_t reg, uint32_t val);
+
+static inline uint32_t ahci_readl(uint32_t reg)
+{
+    return ahci_emu_readl(reg);
+}
+
+static inline void ahci_writel(uint32_t reg, uint32_t val)
+{
+    ahci_emu_writel(reg, val);
+}
+#else
+static inline uint32_t ahci_readl(uint32_t reg)
+{
+    volatile uint32_t *addr = (volatile uint32_t *)(ahci_mmio_base + reg);
+    return *addr;
+}
+
+static inline void ahci_writel(uint32_t reg, uint32_t val)
+{
+    volatile uint32_t *addr = (volatile uint32_t *)(ahci_mmio_base + reg);
+    *addr = val;
+}
+#endif
+
+static inline uint32_t port_readl(ahci_port_t *p, uint32_t reg)
+{
+    return ahci_readl(p->base + reg);
+}
+
+static inline void port_writel(ahci_port_t *p, uint32_t reg, uint32_t val)
+{
+    ahci_writel(p->base + reg, val);
+}
+
+static int wait_clear(ahci_port_t *p, uint32_t reg, uint32_t mask)
+{
+    for (int i = 0; i < AHCI_SPIN_LIMIT; i++) {
+        if (!(port_readl(p, reg) & mask))
+            return 0;
+    }
+    return -1;
+}
+
+static void port_stop(ahci_port_t *p)
+{
+    uint32_t cmd = port_readl(p, PXCMD);
+    port_writel(p, PXCMD, cmd & ~PXCMD_ST);
+    wait_clear(p, PXCMD, PXCMD_CR);
+    cmd = port_readl(p, PXCMD);
+    port_writel(p, PXCMD, cmd & ~PXCMD_FRE);
+    wait_clear(p, PXCMD, PXCMD_FR);
+}
+
+static void port_start(ahci_port_t *p)
+{
+    wait_clear(p, PXCMD, PXCMD_CR);
+    uint32_t cmd = port_readl(p, PXCMD);
+    port_writel(p, PXCMD, cmd | PXCMD_FRE);
+    port_writel(p, PXCMD, cmd | PXCMD_FRE | PXCMD_ST);
+}
+
+static int port_alloc(ahci_port_t *p)
+{
+    uint8_t *page = alloc_page();
+    if (!page)
+        return -1;
+    memset(page, 0, 4096);
+    p->cmd_list = (ahci_cmd_header_t *)page;
+    p->rx_fis = page + 1024;
+
+    uint8_t *tpage = NULL;
+    for (uint32_t s = 0; s < hba_slots; s++) {
+        if (s % AHCI_TABLES_PER_PAGE == 0) {
+            tpage = alloc_page();
+            if (!tpage)
+                return -1;
+            memset(tpage, 0, 4096);
+        }
+        ahci_cmd_table_t *t = (ahci_cmd_table_t *)
+            (tpage + (s % AHCI_TABLES_PER_PAGE) * sizeof(ahci_cmd_table_t));
+        uint64_t phys = (uint64_t)(uintptr_t)t;
+        p->tables[s] = t;
+        p->cmd_list[s].ctba = (uint32_t)phys;
+        p->cmd_list[s].ctbau = (uint32_t)(phys >> 32);
+    }
+    return 0;
+}
+
+static void build_fis(uint8_t *fis, uint8_t command, uint64_t lba,
+                      uint32_t count, int ncq, uint32_t tag)
+{
+    memset(fis, 0, 20);
+    fis[0] = FIS_TYPE_REG_H2D;
+    fis[1] = 0x80;                      /* command, not control */
+    fis[2] = command;
+    fis[4] = (uint8_t)lba;
+    fis[5] = (uint8_t)(lba >> 8);
+    fis[6] = (uint8_t)(lba >> 16);
+    fis[7] = 0x40;                      /* LBA mode */
+    fis[8] = (uint8_t)(lba >> 24);
+    fis[9] = (uint8_t)(lba >> 32);
+    fis[10] = (uint8_t)(lba >> 40);
+    if (ncq) {
+        /* FPDMA: sector count in the feature field, tag in count[7:3] */
+        fis[3] = (uint8_t)count;
+        fis[11] = (uint8_t)(count >> 8);
+        fis[12] = (uint8_t)(tag << 3);
+    } else {
+        fis[12] = (uint8_t)count;
+        fis[13] = (uint8_t)(count >> 8);
+    }
+}
+
+static void issue(ahci_port_t *p, uint32_t slot, uint8_t command,
+                  uint64_t lba, uint32_t count, const blk_sg_t *sg,
+                  uint32_t sg_count, int write, int ncq)
+{
+    ahci_cmd_header_t *hdr = &p->cmd_list[slot];
+    ahci_cmd_table_t *tbl = p->tables[slot];
+
+    build_fis(tbl->cfis, command, lba, count, ncq, slot);
+    /* segments longer than one PRD can describe are split */
+    uint32_t nprd = 0;
+    for (uint32_t i = 0; i < sg_count; i++) {
+        uint64_t phys = (uint64_t)(uintptr_t)sg[i].buf;
+        for (uint32_t off = 0; off < sg[i].len; off += AHCI_PRD_MAX) {
+            uint32_t len = sg[i].len - off;
+            if (len > AHCI_PRD_MAX)
+                len = AHCI_PRD_MAX;
+            ahci_prd_t *prd = &tbl->prdt[nprd++];
+            prd->dba = (uint32_t)(phys + off);
+            prd->dbau = (uint32_t)((phys + off) >> 32);
+            prd->rsv = 0;
+            prd->dbc = len - 1;
+        }
+    }
+    tbl->prdt[nprd - 1].dbc |= 0x80000000u;
+    hdr->flags = (uint16_t)(5 | (write ? (1u << 6) : 0)); /* 5 dword FIS */
+    hdr->prdtl = (uint16_t)nprd;
+    hdr->prdbc = 0;
+
+    p->busy |= 1u << slot;
+    p->stats.commands++;
+    p->stats.inflight++;
+    if (p->stats.inflight > p->stats.max_inflight)
+        p->stats.max_inflight = p->stats.inflight;
+    if (ncq)
+        port_writel(p, PXSACT, 1u << slot);
+    port_writel(p, PXCI, 1u << slot);
+}
+
+static int free_slot(ahci_port_t *p)
+{
+    uint32_t avail = ~p->busy & p->slot_mask;
+    if (!avail)
+        return -1;
+    return __builtin_ctz(avail);
+}
+
+static void issue_request(ahci_port_t *p, uint32_t slot, blk_request_t *req)
+{
+    int write = req->op == BLK_OP_WRITE;
+    uint8_t cmd;
+    if (p->ncq)
+        cmd = write ? ATA_CMD_WRITE_FPDMA : ATA_CMD_READ_FPDMA;
+    else
+        cmd = write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+    p->slot_req[slot] = req;
+    issue(p, slot, cmd, req->lba, req->count, req->sg, req->sg_count,
+          write, p->ncq);
+}
+
+static void complete(ahci_port_t *p, uint32_t slot, int status)
+{
+    blk_request_t *req = p->slot_req[slot];
+    p->slot_req[slot] = NULL;
+    p->busy &= ~(1u << slot);
+    p->stats.inflight--;
+    if (status)
+        p->stats.errors++;
+    else
+        p->stats.completions++;
+    if (!req)
+        return;
+    if (req->done)
+        req->done(req, status);
+    else
+        req->status = status;
+}
+
+static void drain_backlog(ahci_port_t *p)
+{
+    while (p->backlog) {
+        int slot = free_slot(p);
+        if (slot < 0)
+            return;
+        blk_request_t *req = p->backlog;
+        p->backlog = req->next;
+        if (!p->backlog)
+            p->backlog_tail = NULL;
+        req->next = NULL;
+        issue_request(p, (uint32_t)slot, req);
+    }
+}
+
+static void port_service(ahci_port_t *p)
+{
+    uint32_t is = port_readl(p, PXIS);
+    if (is)
+        port_writel(p, PXIS, is);
+
+    if (is & PXIS_ERRORS) {
+        /* The device aborted the queue; fail everything outstanding and
+         * restart the port so the backlog can proceed. */
+        debug_puts("AHCI: port error, TFD=0x");
+        debug_puthex(port_readl(p, PXTFD));
+        debug_putc('\n');
+        port_stop(p);
+        for (uint32_t s = 0; s < AHCI_MAX_SLOTS; s++) {
+            if (p->busy & (1u << s))
+                complete(p, s, -1);
+        }
+        port_writel(p, PXSERR, 0xFFFFFFFF);
+        port_writel(p, PXIS, 0xFFFFFFFF);
+        port_start(p);
+    } else if (p->busy) {
+        uint32_t pending = port_readl(p, PXCI);
+        if (p->ncq)
+            pending |= port_readl(p, PXSACT);
+        uint32_t done = p->busy & ~pending;
+        while (done) {
+            uint32_t s = (uint32_t)__builtin_ctz(done);
+            done &= done - 1;
+            complete(p, s, 0);
+        }
+    }
+    drain_backlog(p);
+    /* completions may have come from ahci_irq(); refill freed slots */
+    if (p->dev.sched)
+        iosched_dispatch(p->dev.sched);
+}
+
+/* PRD entries a scatter-gather list needs, or 0 if it cannot be issued. */
+static uint32_t prd_count(const blk_request_t *req)
+{
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < req->sg_count; i++) {
+        if (!req->sg[i].len)
+            return 0;
+        n += (req->sg[i].len + AHCI_PRD_MAX - 1) / AHCI_PRD_MAX;
+    }
+    return n <= AHCI_MAX_PRDT ? n : 0;
+}
+
+static int ahci_submit(blkdev_t *dev, blk_request_t *req)
+{
+    ahci_port_t *p = dev->priv;
+    if (req->sg_count == 0 || req->sg_count > AHCI_MAX_PRDT ||
+        req->count == 0 || req->count > 0xFFFF || !prd_count(req))
+        return -1;
+    req->next = NULL;
+    int slot = p->backlog ? -1 : free_slot(p);
+    if (slot >= 0) {
+        issue_request(p, (uint32_t)slot, req);
+        return 0;
+    }
+    if (p->backlog_tail)
+        p->backlog_tail->next = req;
+    else
+        p->backlog = req;
+    p->backlog_tail = req;
+    return 0;
+}
+
+static void ahci_blk_poll(blkdev_t *dev)
+{
+    port_service(dev->priv);
+}
+
+static const blkdev_ops_t ahci_blk_ops = {
+    .submit = ahci_submit,
+    .poll = ahci_blk_poll,
+};
+
+static int port_identify(ahci_port_t *p, uint64_t *sectors, int *ncq_ok)
+{
+    uint16_t *id = alloc_page();
+    if (!id)
+        return -1;
+    memset(id, 0, 512);
+    blk_sg_t sg = { .buf = id, .len = 512 };
+    issue(p, 0, ATA_CMD_IDENTIFY, 0, 0, &sg, 1, 0, 0);
+    p->slot_req[0] = NULL;
+
+    int rc = -1;
+    for (int i = 0; i < AHCI_SPIN_LIMIT; i++) {
+        uint32_t is = port_readl(p, PXIS);
+        if (is & PXIS_ERRORS)
+            break;
+        if (!(port_readl(p, PXCI) & 1u)) {
+            rc = 0;
+            break;
+        }
+    }
+    port_writel(p, PXIS, port_readl(p, PXIS));
+    if (rc == 0) {
+        complete(p, 0, 0);
+        *sectors = (uint64_t)id[100] | ((uint64_t)id[101] << 16) |
+                   ((uint64_t)id[102] << 32) | ((uint64_t)id[103] << 48);
+        if (!*sectors)
+            *sectors = (uint64_t)id[60] | ((uint64_t)id[61] << 16);
+        *ncq_ok = (id[76] & (1u << 8)) != 0;
+    } else {
+        complete(p, 0, -1);
+    }
+    free_page(id);
+    return rc;
+}
+
+static int port_init(int n)
+{
+    ahci_port_t *p = &ports[n];
+    memset(p, 0, sizeof(*p));
+    p->base = AHCI_PORT(n);
+
+    uint32_t ssts = port_readl(p, PXSSTS);
+    if ((ssts & 0xF) != SSTS_DET_PRESENT ||
+        ((ssts >> 8) & 0xF) != SSTS_IPM_ACTIVE)
+        return -1;
+    if (port_readl(p, PXSIG) != SATA_SIG_ATA)
+        return -1;
+
+    port_stop(p);
+    if (port_alloc(p))
+        return -1;
+    uint64_t clb = (uint64_t)(uintptr_t)p->cmd_list;
+    uint64_t fb = (uint64_t)(uintptr_t)p->rx_fis;
+    port_writel(p, PXCLB, (uint32_t)clb);
+    port_writel(p, PXCLBU, (uint32_t)(clb >> 32));
+    port_writel(p, PXFB, (uint32_t)fb);
+    port_writel(p, PXFBU, (uint32_t)(fb >> 32));
+    port_writel(p, PXSERR, 0xFFFFFFFF);
+    port_writel(p, PXIS, 0xFFFFFFFF);
+    port_writel(p, PXIE, 0);    /* completions are polled */
+    port_start(p);
+
+    uint64_t sectors = 0;
+    int ncq_ok = 0;
+    if (port_identify(p, &sectors, &ncq_ok) || !sectors)
+        return -1;
+
+    p->ncq = hba_ncq && ncq_ok;
+    p->slot_mask = hba_slots >= 32 ? 0xFFFFFFFFu : ((1u << hba_slots) - 1);
+    p->stats.ncq = (uint32_t)p->ncq;
+    p->stats.slots = hba_slots;
+    p->name[0] = 'a'; p->name[1] = 'h'; p->name[2] = 'c'; p->name[3] = 'i';
+    p->name[4] = n >= 10 ? (char)('0' + n / 10) : (char)('0' + n);
+    p->name[5] = n >= 10 ? (char)('0' + n % 10) : '\0';
+    p->name[6] = '\0';
+    p->dev.name = p->name;
+    p->dev.block_size = AHCI_SECTOR;
+    p->dev.block_count = sectors;
+    p->dev.ops = &ahci_blk_ops;
+    p->dev.priv = p;
+    p->present = 1;
+    blkdev_register(&p->dev);
+    iosched_attach(&p->dev);
+
+    debug_puts("AHCI: port ");
+    debug_puthex((uint32_t)n);
+    debug_puts(p->ncq ? " NCQ" : " DMA");
+    debug_puts(" sectors=0x");
+    debug_puthex64(sectors);
+    debug_putc('\n');
+    return 0;
+}
+
+int ahci_attach(uintptr_t abar)
+{
+    ahci_mmio_base = abar;
+    ahci_writel(AHCI_GHC, ahci_readl(AHCI_GHC) | AHCI_GHC_AE);
+    uint32_t cap = ahci_readl(AHCI_CAP);
+    hba_slots = AHCI_CAP_NCS(cap);
+    hba_ncq = (cap & AHCI_CAP_SNCQ) != 0;
+    uint32_t pi = ahci_readl(AHCI_PI);
+
+    int found = 0;
+    for (int n = 0; n < AHCI_MAX_PORTS; n++) {
+        if ((pi & (1u << n)) && port_init(n) == 0)
+            found++;
+    }
+    ahci_writel(AHCI_IS, 0xFFFFFFFF);
+    /* no vector reaches ahci_irq() yet, so keep GHC.IE clear: an unrouted
+     * level interrupt would only fire into nothing */
+    ahci_writel(AHCI_GHC, ahci_readl(AHCI_GHC) & ~AHCI_GHC_IE);
+    return found;
+}
+
+void ahci_irq(void)
+{
+    uint32_t is = ahci_readl(AHCI_IS);
+    for (int n = 0; n < AHCI_MAX_PORTS; n++) {
+        if ((is & (1u << n)) && ports[n].present)
+            port_service(&ports[n]);
+    }
+    ahci_writel(AHCI_IS, is);
+}
+
+void ahci_poll(void)
+{
+    for (int n = 0; n < AHCI_MAX_PORTS; n++) {
+        if (ports[n].present)
+            port_service(&ports[n]);
+    }
+}
+
+blkdev_t *ahci_get_blkdev(int port)
+{
+    if (port < 0 || port >= AHCI_MAX_PORTS || !ports[port].present)
+        return NULL;
+    return &ports[port].dev;
+}
+
+int ahci_get_stats(int port, ahci_stats_t *out)
+{
+    if (port < 0 || port >= AHCI_MAX_PORTS || !ports[port].present || !out)
+        return -1;
+    *out = ports[port].stats;
+    return 0;
+}
+
+static blkdev_t *first_disk(void)
+{
+    for (int n = 0; n < AHCI_MAX_PORTS; n++) {
+        if (ports[n].present)
+            return &ports[n].dev;
+    }
+    return NULL;
+}
+
+int ahci_read(uint64_t lba, uint32_t count, void *buf)
+{
+    return blkdev_read(first_disk(), lba, count, buf);
+}
+
+int ahci_write(uint64_t lba, uint32_t count, const void *buf)
+{
+    return blkdev_write(first_disk(), lba, count, buf);
+}
+
+/* --- PnP glue --- */
+
+static const pci_match_t ahci_ids[] = {
+    { .flags = PCI_MATCH_CLASS | PCI_MATCH_SUBCLASS,
+      .class_code = 0x01, .subclass = 0x06 }, // SATA
+    { 0 }
+};
+
+static void ahci_pnp_init(const pci_device_t *dev)
+{
+    uint32_t bar5 = pci_config_read32(dev->bus, dev->slot, dev->func, 0x24);
+    uint64_t abar = (uint64_t)(bar5 & ~0xFULL);
+    uint32_t cmd = pci_config_read32(dev->bus, dev->slot, dev->func, 0x04);
+    /* memory space + bus master so the HBA can DMA command lists */
+    pci_config_write32(dev->bus, dev->slot, dev->func, 0x04, cmd | 0x6);
+    map_identity_range(abar, 0x2000);
+    debug_puts("AHCI: ABAR at 0x");
+    debug_puthex64(abar);
+    debug_putc('\n');
+    ahci_attach((uintptr_t)abar);
+}
+
+driver_t ahci_pnp_driver = {
+    .name = "AHCI SATA",
+    .ids = ahci_ids,
+    .init = ahci_pnp_init,
+    .provides = DRIVER_DEP_STORAGE,
+};
@@ -0,0 +1,40 @@
+#ifndef PHILLOS_AHCI_H
+#define PHILLOS_AHCI_H
+
+#include <stdint.h>
+#include "blkdev.h"
+#include "../driver_manager.h"
+
+#define AHCI_MAX_PORTS 32
+#define AHCI_MAX_SLOTS 32
+
+typedef struct {
+    uint64_t commands;     /* commands issued to the device */
+    uint64_t completions;  /* commands completed successfully */
+    uint64_t errors;       /* commands failed by task file or host errors */
+    uint32_t inflight;     /* commands currently owned by the device */
+    uint32_t max_inflight; /* high water mark of inflight */
+    uint32_t slots;        /* command slots in use by the driver */
+    uint32_t ncq;          /* 1 when Native Command Queuing is used */
+} ahci_stats_t;
+
+/* Bring up every implemented port with an ATA disk behind the HBA whose
+ * registers live at `abar` and register each one as a block device.
+ * Returns the number of disks found. */
+int ahci_attach(uintptr_t abar);
+
+/* Interrupt entry: reaps completions on every port flagged in IS. The HBA
+ * is left with interrupts masked; callers may still use this as a poll. */
+void ahci_irq(void);
+/* Batched polling: reaps completions on every attached port. */
+void ahci_poll(void);
+
+int ahci_read(uint64_t lba, uint32_t count, void *buf);
+int ahci_write(uint64_t lba, uint32_t count, const void *buf);
+
+blkdev_t *ahci_get_blkdev(int port);
+int ahci_get_stats(int port, ahci_stats_t *out);
+
+extern driver_t ahci_pnp_driver;
+
+#endif // PHILLOS_AHCI_H
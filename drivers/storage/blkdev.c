@@ -0,0 +1,129 @@
+#include "blkdev.h"
+#include "iosched.h"
+#include <string.h>
+
+static blkdev_t *blkdev_list = NULL;
+static blkdev_t *boot_dev = NULL;
+
+void blkdev_register(blkdev_t *dev)
+{
+    if (!dev)
+        return;
+    dev->next = blkdev_list;
+    blkdev_list = dev;
+    if (!boot_dev)
+        boot_dev = dev;
+}
+
+void blkdev_unregister(blkdev_t *dev)
+{
+    iosched_detach(dev);
+    blkdev_t **p = &blkdev_list;
+    while (*p) {
+        if (*p == dev) {
+            *p = dev->next;
+            dev->next = NULL;
+            break;
+        }
+        p = &(*p)->next;
+    }
+    if (boot_dev == dev)
+        boot_dev = blkdev_list;
+}
+
+blkdev_t *blkdev_find(const char *name)
+{
+    if (!name)
+        return NULL;
+    for (blkdev_t *d = blkdev_list; d; d = d->next) {
+        if (d->name && strcmp(d->name, name) == 0)
+            return d;
+    }
+    return NULL;
+}
+
+blkdev_t *blkdev_get_boot(void)
+{
+    return boot_dev;
+}
+
+void blkdev_set_boot(blkdev_t *dev)
+{
+    boot_dev = dev;
+}
+
+void blk_request_init(blk_request_t *req, blk_op_t op,
+                      uint64_t lba, uint32_t count)
+{
+    memset(req, 0, sizeof(*req));
+    req->op = op;
+    req->lba = lba;
+    req->count = count;
+}
+
+int blk_request_add_sg(blk_request_t *req, void *buf, uint32_t len)
+{
+    if (!req || !buf || !len || req->sg_count >= BLKDEV_MAX_SG)
+        return -1;
+    req->sg[req->sg_count].buf = buf;
+    req->sg[req->sg_count].len = len;
+    req->sg_count++;
+    return 0;
+}
+
+int blkdev_submit(blkdev_t *dev, blk_request_t *req)
+{
+    if (!dev || !dev->ops || !dev->ops->submit || !req || !req->count)
+        return -1;
+    if (req->lba + req->count > dev->block_count)
+        return -1;
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < req->sg_count; i++)
+        bytes += req->sg[i].len;
+    if (bytes != (uint64_t)req->count * dev->block_size)
+        return -1;
+    req->status = 1; /* in flight */
+    if (dev->sched)
+        return iosched_submit(dev->sched, req);
+    return dev->ops->submit(dev, req);
+}
+
+void blkdev_poll(blkdev_t *dev)
+{
+    if (dev && dev->ops && dev->ops->poll)
+        dev->ops->poll(dev);
+    if (dev && dev->sched)
+        iosched_dispatch(dev->sched);
+}
+
+static void sync_done(blk_request_t *req, int status)
+{
+    req->status = status;
+}
+
+static int blkdev_sync(blkdev_t *dev, blk_op_t op, uint64_t lba,
+                       uint32_t count, void *buf)
+{
+    if (!dev)
+        return -1;
+    blk_request_t req;
+    blk_request_init(&req, op, lba, count);
+    req.done = sync_done;
+    if (blk_request_add_sg(&req, buf, count * dev->block_size))
+        return -1;
+    if (blkdev_submit(dev, &req))
+        return -1;
+    while (req.status > 0)
+        blkdev_poll(dev);
+    return req.status;
+}
+
+int blkdev_read(blkdev_t *dev, uint64_t lba, uint32_t count, void *buf)
+{
+    return blkdev_sync(dev, BLK_OP_READ, lba, count, buf);
+}
+
+int blkdev_write(blkdev_t *dev, uint64_t lba, uint32_t count, const void *buf)
+{
+    return blkdev_sync(dev, BLK_OP_WRITE, lba, count, (void *)buf);
+}
@@ -0,0 +1,77 @@
+#ifndef PHILLOS_BLKDEV_H
+#define PHILLOS_BLKDEV_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Generic block device layer. Filesystems build requests carrying a
+ * scatter-gather list and a completion callback; drivers queue them in
+ * submit() and complete them from their interrupt handler or poll(). */
+
+#define BLKDEV_MAX_SG 16
+
+typedef enum {
+    BLK_OP_READ = 0,
+    BLK_OP_WRITE = 1,
+} blk_op_t;
+
+typedef struct blk_sg {
+    void *buf;
+    uint32_t len;           /* bytes, multiple of the device block size */
+} blk_sg_t;
+
+struct blk_request;
+typedef void (*blk_done_fn)(struct blk_request *req, int status);
+
+typedef struct blk_request {
+    blk_op_t op;
+    uint64_t lba;
+    uint32_t count;         /* blocks */
+    blk_sg_t sg[BLKDEV_MAX_SG];
+    uint32_t sg_count;
+    blk_done_fn done;
+    void *priv;             /* owner data for the completion callback */
+    int status;
+    struct blk_request *next; /* driver queue linkage */
+    uint64_t start;         /* scheduler: submission tick */
+    uint64_t seq;           /* scheduler: arrival order */
+} blk_request_t;
+
+struct iosched;
+
+struct blkdev;
+
+typedef struct blkdev_ops {
+    int  (*submit)(struct blkdev *dev, blk_request_t *req);
+    void (*poll)(struct blkdev *dev);
+} blkdev_ops_t;
+
+typedef struct blkdev {
+    const char *name;
+    uint32_t block_size;
+    uint64_t block_count;
+    const blkdev_ops_t *ops;
+    void *priv;
+    struct iosched *sched;  /* NULL submits straight to the driver */
+    struct blkdev *next;
+} blkdev_t;
+
+void blkdev_register(blkdev_t *dev);
+void blkdev_unregister(blkdev_t *dev);
+blkdev_t *blkdev_find(const char *name);
+blkdev_t *blkdev_get_boot(void);
+void blkdev_set_boot(blkdev_t *dev);
+
+void blk_request_init(blk_request_t *req, blk_op_t op,
+                      uint64_t lba, uint32_t count);
+int blk_request_add_sg(blk_request_t *req, void *buf, uint32_t len);
+
+int blkdev_submit(blkdev_t *dev, blk_request_t *req);
+void blkdev_poll(blkdev_t *dev);
+
+/* Synchronous helpers: submit a single-segment request and poll until it
+ * completes. */
+int blkdev_read(blkdev_t *dev, uint64_t lba, uint32_t count, void *buf);
+int blkdev_write(blkdev_t *dev, uint64_t lba, uint32_t count, const void *buf);
+
+#endif // PHILLOS_BLKDEV_H
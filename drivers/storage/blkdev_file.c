@@ -0,0 +1,96 @@
+#include "blkdev_file.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define BLKDEV_FILE_BLOCK 512
+
+static int file_submit(blkdev_t *dev, blk_request_t *req)
+{
+    blkdev_file_t *bf = dev->priv;
+    req->next = NULL;
+    if (bf->pending_tail)
+        bf->pending_tail->next = req;
+    else
+        bf->pending = req;
+    bf->pending_tail = req;
+    return 0;
+}
+
+static int file_service(blkdev_file_t *bf, blk_request_t *req)
+{
+    struct iovec iov[BLKDEV_MAX_SG];
+    size_t total = 0;
+    for (uint32_t i = 0; i < req->sg_count; i++) {
+        iov[i].iov_base = req->sg[i].buf;
+        iov[i].iov_len = req->sg[i].len;
+        total += req->sg[i].len;
+    }
+    off_t off = (off_t)(req->lba * bf->dev.block_size);
+    ssize_t n;
+    if (req->op == BLK_OP_WRITE)
+        n = pwritev(bf->fd, iov, (int)req->sg_count, off);
+    else
+        n = preadv(bf->fd, iov, (int)req->sg_count, off);
+    if (n < 0 || (size_t)n != total)
+        return -1;
+    bf->requests++;
+    bf->bytes += total;
+    return 0;
+}
+
+static void file_poll(blkdev_t *dev)
+{
+    blkdev_file_t *bf = dev->priv;
+    blk_request_t *req = bf->pending;
+    bf->pending = bf->pending_tail = NULL;
+    while (req) {
+        blk_request_t *next = req->next;
+        int status = file_service(bf, req);
+        if (req->done)
+            req->done(req, status);
+        else
+            req->status = status;
+        req = next;
+    }
+}
+
+static const blkdev_ops_t file_ops = {
+    .submit = file_submit,
+    .poll = file_poll,
+};
+
+int blkdev_file_open(blkdev_file_t *bf, const char *path, const char *name,
+                     int writable)
+{
+    if (!bf || !path)
+        return -1;
+    memset(bf, 0, sizeof(*bf));
+    bf->fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (bf->fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(bf->fd, &st) != 0) {
+        close(bf->fd);
+        return -1;
+    }
+    bf->dev.name = name ? name : "file";
+    bf->dev.block_size = BLKDEV_FILE_BLOCK;
+    bf->dev.block_count = (uint64_t)st.st_size / BLKDEV_FILE_BLOCK;
+    bf->dev.ops = &file_ops;
+    bf->dev.priv = bf;
+    blkdev_register(&bf->dev);
+    return 0;
+}
+
+void blkdev_file_close(blkdev_file_t *bf)
+{
+    if (!bf || bf->fd < 0)
+        return;
+    file_poll(&bf->dev);
+    blkdev_unregister(&bf->dev);
+    close(bf->fd);
+    bf->fd = -1;
+}
@@ -0,0 +1,23 @@
+#ifndef PHILLOS_BLKDEV_FILE_H
+#define PHILLOS_BLKDEV_FILE_H
+
+#include "blkdev.h"
+
+/* Host-side block device backed by a regular file or disk image. Used to
+ * exercise the filesystem on Linux against real FAT images. Requests are
+ * queued on submit and serviced with preadv/pwritev on poll. */
+
+typedef struct {
+    blkdev_t dev;
+    int fd;
+    blk_request_t *pending;
+    blk_request_t *pending_tail;
+    uint64_t requests;
+    uint64_t bytes;
+} blkdev_file_t;
+
+int blkdev_file_open(blkdev_file_t *bf, const char *path, const char *name,
+                     int writable);
+void blkdev_file_close(blkdev_file_t *bf);
+
+#endif // PHILLOS_BLKDEV_FILE_H
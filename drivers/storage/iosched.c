@@ -0,0 +1,269 @@
+#include "iosched.h"
+#include "../../kernel/tsc.h"
+#include <string.h>
+
+/* Requests wait on an LBA sorted list linked through req->next. Dispatch
+ * picks the next request at or after the sweep head (wrapping to the
+ * lowest LBA), unless the oldest request has passed its deadline, then
+ * absorbs following requests that continue it into one merged command.
+ * A request never overtakes an older overlapping request when either of
+ * them writes, so reordering cannot expose stale data. */
+
+typedef struct iosched_cmd {
+    blk_request_t req;           /* merged command handed to the driver */
+    blk_request_t *children;     /* original requests in LBA order */
+    struct iosched *sched;
+    int used;
+} iosched_cmd_t;
+
+typedef struct iosched {
+    blkdev_t *dev;
+    blk_request_t *queue;
+    uint64_t head;               /* LBA after the last dispatch */
+    uint64_t seq;
+    uint64_t deadline[2];        /* indexed by blk_op_t */
+    int plugged;
+    iosched_cmd_t cmds[IOSCHED_DEPTH];
+    iosched_stats_t stats;
+} iosched_t;
+
+static iosched_t scheds[IOSCHED_MAX_DEVICES];
+
+int iosched_attach(blkdev_t *dev)
+{
+    if (!dev)
+        return -1;
+    if (dev->sched)
+        return 0;
+    for (int i = 0; i < IOSCHED_MAX_DEVICES; i++) {
+        iosched_t *s = &scheds[i];
+        if (s->dev)
+            continue;
+        memset(s, 0, sizeof(*s));
+        s->dev = dev;
+        s->deadline[BLK_OP_READ] = tsc_ms(IOSCHED_READ_DEADLINE_MS);
+        s->deadline[BLK_OP_WRITE] = tsc_ms(IOSCHED_WRITE_DEADLINE_MS);
+        for (int c = 0; c < IOSCHED_DEPTH; c++)
+            s->cmds[c].sched = s;
+        dev->sched = s;
+        return 0;
+    }
+    return -1;
+}
+
+void iosched_detach(blkdev_t *dev)
+{
+    if (!dev || !dev->sched)
+        return;
+    iosched_t *s = dev->sched;
+    /* let queued and in-flight work drain through the driver first */
+    s->plugged = 0;
+    while (s->queue || s->stats.inflight)
+        blkdev_poll(dev);
+    dev->sched = NULL;
+    s->dev = NULL;
+}
+
+void iosched_set_deadlines(blkdev_t *dev, uint32_t read_ms,
+                           uint32_t write_ms)
+{
+    if (!dev || !dev->sched)
+        return;
+    dev->sched->deadline[BLK_OP_READ] = tsc_ms(read_ms);
+    dev->sched->deadline[BLK_OP_WRITE] = tsc_ms(write_ms);
+}
+
+void iosched_plug(blkdev_t *dev)
+{
+    if (dev && dev->sched)
+        dev->sched->plugged++;
+}
+
+void iosched_unplug(blkdev_t *dev)
+{
+    if (!dev || !dev->sched || !dev->sched->plugged)
+        return;
+    if (--dev->sched->plugged == 0)
+        iosched_dispatch(dev->sched);
+}
+
+static int overlaps(uint64_t lba_a, uint32_t cnt_a, uint64_t lba_b, uint32_t cnt_b)
+{
+    return lba_a < lba_b + cnt_b && lba_b < lba_a + cnt_a;
+}
+
+/* True when `r` must wait for an older overlapping request. */
+static int blocked(iosched_t *s, const blk_request_t *r)
+{
+    for (blk_request_t *q = s->queue; q; q = q->next) {
+        if (q->seq < r->seq &&
+            (q->op == BLK_OP_WRITE || r->op == BLK_OP_WRITE) &&
+            overlaps(q->lba, q->count, r->lba, r->count))
+            return 1;
+    }
+    for (int c = 0; c < IOSCHED_DEPTH; c++) {
+        iosched_cmd_t *cmd = &s->cmds[c];
+        if (cmd->used &&
+            (cmd->req.op == BLK_OP_WRITE || r->op == BLK_OP_WRITE) &&
+            overlaps(cmd->req.lba, cmd->req.count, r->lba, r->count))
+            return 1;
+    }
+    return 0;
+}
+
+int iosched_submit(iosched_t *s, blk_request_t *req)
+{
+    req->start = tsc_read();
+    req->seq = s->seq++;
+
+    blk_request_t **p = &s->queue;
+    while (*p && (*p)->lba <= req->lba)
+        p = &(*p)->next;
+    req->next = *p;
+    *p = req;
+
+    s->stats.submitted++;
+    s->stats.queued++;
+    if (s->stats.queued > s->stats.max_queued)
+        s->stats.max_queued = s->stats.queued;
+    if (!s->plugged)
+        iosched_dispatch(s);
+    return 0;
+}
+
+static void cmd_done(blk_request_t *req, int status)
+{
+    iosched_cmd_t *cmd = req->priv;
+    iosched_t *s = cmd->sched;
+    uint64_t now = tsc_read();
+    blk_request_t *child = cmd->children;
+    cmd->children = NULL;
+    cmd->used = 0;
+    s->stats.inflight--;
+    while (child) {
+        blk_request_t *next = child->next;
+        uint64_t lat = (now - child->start) >> IOSCHED_LAT_SHIFT;
+        unsigned b = 0;
+        while (lat > 1 && b < IOSCHED_LAT_BUCKETS - 1) {
+            lat >>= 1;
+            b++;
+        }
+        s->stats.lat_hist[b]++;
+        child->next = NULL;
+        if (child->done)
+            child->done(child, status);
+        else
+            child->status = status;
+        child = next;
+    }
+}
+
+static iosched_cmd_t *free_cmd(iosched_t *s)
+{
+    for (int c = 0; c < IOSCHED_DEPTH; c++) {
+        if (!s->cmds[c].used)
+            return &s->cmds[c];
+    }
+    return NULL;
+}
+
+/* Choose the request to dispatch next; *link_out receives the link that
+ * points at it. */
+static blk_request_t *pick(iosched_t *s, blk_request_t ***link_out)
+{
+    blk_request_t **oldest = &s->queue;
+    for (blk_request_t **p = &s->queue; *p; p = &(*p)->next) {
+        if ((*p)->seq < (*oldest)->seq)
+            oldest = p;
+    }
+    /* the oldest request can only wait on commands already in flight */
+    if (tsc_read() - (*oldest)->start > s->deadline[(*oldest)->op] &&
+        !blocked(s, *oldest)) {
+        s->stats.expired++;
+        *link_out = oldest;
+        return *oldest;
+    }
+
+    blk_request_t **first = NULL;
+    for (blk_request_t **p = &s->queue; *p; p = &(*p)->next) {
+        if ((*p)->lba >= s->head && !blocked(s, *p)) {
+            *link_out = p;
+            return *p;
+        }
+        if (!first && (*p)->lba < s->head && !blocked(s, *p))
+            first = p;
+    }
+    if (!first)
+        return NULL;
+    *link_out = first;
+    return *first;
+}
+
+void iosched_dispatch(iosched_t *s)
+{
+    while (s->queue) {
+        iosched_cmd_t *cmd = free_cmd(s);
+        if (!cmd)
+            return;
+        blk_request_t **link;
+        blk_request_t *r = pick(s, &link);
+        if (!r)
+            return;
+
+        *link = r->next;
+        r->next = NULL;
+        s->stats.queued--;
+
+        blk_request_init(&cmd->req, r->op, r->lba, r->count);
+        cmd->req.done = cmd_done;
+        cmd->req.priv = cmd;
+        memcpy(cmd->req.sg, r->sg, r->sg_count * sizeof(blk_sg_t));
+        cmd->req.sg_count = r->sg_count;
+        cmd->children = r;
+        blk_request_t *tail = r;
+
+        /* absorb requests that continue this one */
+        while (*link) {
+            blk_request_t *n = *link;
+            if (n->op != cmd->req.op ||
+                n->lba != cmd->req.lba + cmd->req.count ||
+                cmd->req.count + n->count > IOSCHED_MAX_BLOCKS ||
+                cmd->req.sg_count + n->sg_count > BLKDEV_MAX_SG ||
+                blocked(s, n))
+                break;
+            *link = n->next;
+            n->next = NULL;
+            memcpy(&cmd->req.sg[cmd->req.sg_count], n->sg,
+                   n->sg_count * sizeof(blk_sg_t));
+            cmd->req.sg_count += n->sg_count;
+            cmd->req.count += n->count;
+            tail->next = n;
+            tail = n;
+            s->stats.queued--;
+            s->stats.merged++;
+        }
+
+        cmd->used = 1;
+        cmd->req.status = 1;
+        s->head = cmd->req.lba + cmd->req.count;
+        s->stats.inflight++;
+        s->stats.dispatched++;
+        if (s->dev->ops->submit(s->dev, &cmd->req))
+            cmd_done(&cmd->req, -1);
+    }
+}
+
+int iosched_get_stats(blkdev_t *dev, iosched_stats_t *out)
+{
+    if (!dev || !dev->sched || !out)
+        return -1;
+    *out = dev->sched->stats;
+    return 0;
+}
+
+blkdev_t *iosched_device(uint32_t index)
+{
+    if (index >= IOSCHED_MAX_DEVICES)
+        return NULL;
+    return scheds[index].dev;
+}
@@ -0,0 +1,54 @@
+#ifndef PHILLOS_IOSCHED_H
+#define PHILLOS_IOSCHED_H
+
+#include <stdint.h>
+#include "blkdev.h"
+
+/* Elevator I/O scheduler sitting between blkdev_submit() and a driver.
+ * Queued requests are kept sorted by LBA and dispatched in one-way sweeps;
+ * requests that continue each other are merged into a single command and
+ * requests older than their deadline jump the sweep. */
+
+#define IOSCHED_MAX_DEVICES  8
+#define IOSCHED_DEPTH        32   /* merged commands in flight per device */
+#define IOSCHED_MAX_BLOCKS   256  /* largest merged command */
+#define IOSCHED_LAT_BUCKETS  16
+#define IOSCHED_LAT_SHIFT    10   /* bucket 0 covers < 2^11 ticks */
+
+/* default deadlines, converted to TSC ticks at attach */
+#define IOSCHED_READ_DEADLINE_MS   50
+#define IOSCHED_WRITE_DEADLINE_MS  250
+
+typedef struct {
+    uint64_t submitted;    /* requests accepted */
+    uint64_t dispatched;   /* commands sent to the driver */
+    uint64_t merged;       /* requests folded into another command */
+    uint64_t expired;      /* dispatched out of order by their deadline */
+    uint32_t queued;       /* requests waiting in the scheduler */
+    uint32_t inflight;     /* commands owned by the driver */
+    uint32_t max_queued;
+    uint32_t lat_hist[IOSCHED_LAT_BUCKETS]; /* log2 completion latency */
+} iosched_stats_t;
+
+struct iosched;
+
+/* Route every request submitted to `dev` through a scheduler. */
+int iosched_attach(blkdev_t *dev);
+void iosched_detach(blkdev_t *dev);
+void iosched_set_deadlines(blkdev_t *dev, uint32_t read_ms,
+                           uint32_t write_ms);
+
+/* Plugging holds dispatch back so a burst of submissions can be sorted and
+ * merged before the driver sees any of it. Plugs nest. */
+void iosched_plug(blkdev_t *dev);
+void iosched_unplug(blkdev_t *dev);
+
+/* Called by the block layer. */
+int iosched_submit(struct iosched *s, blk_request_t *req);
+void iosched_dispatch(struct iosched *s);
+
+int iosched_get_stats(blkdev_t *dev, iosched_stats_t *out);
+/* Device attached to scheduler slot `index`, or NULL. */
+blkdev_t *iosched_device(uint32_t index);
+
+#endif // PHILLOS_IOSCHED_H
@@ -7,12 +7,24 @@
 extern "C" {
 #endif
 
+/* Callbacks run from deferred work, never inside a bus scan, one call
+ * per device. */
 typedef struct IHotSwapListener {
     void (*device_added)(const IDevice *dev);
     void (*device_removed)(const IDevice *dev);
     struct IHotSwapListener *next;
 } IHotSwapListener;
 
+/* Registered separately, so listeners built against the struct above
+ * keep their layout. Changes that land together are delivered together:
+ * each run of consecutive additions or removals comes as one array, in
+ * the order they happened. */
+typedef struct IHotSwapBatchListener {
+    void (*devices_added)(const IDevice *devs, uint32_t count);
+    void (*devices_removed)(const IDevice *devs, uint32_t count);
+    struct IHotSwapBatchListener *next;
+} IHotSwapBatchListener;
+
 #ifdef __cplusplus
 }
 #endif
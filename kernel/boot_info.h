@@ -47,6 +47,9 @@ typedef struct {
     uint32_t display_height; // 0 = use GOP mode
     uint32_t display_refresh; // Hz, 0 = default
     char cmdline[128];
+    uint64_t acpi_rsdp; // physical address of the ACPI RSDP, 0 if none
+    uint64_t pcisnap_base; // last boot's PCI snapshot file, 0 if none
+    uint64_t pcisnap_size;
 } boot_info_t;
 
 #endif // PHILLOS_BOOT_INFO_H
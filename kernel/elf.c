@@ -1,6 +1,10 @@
 #include "elf.h"
 #include "memory/heap.h"
+#include "memory/alloc.h"
+#include "memory/paging.h"
+#include "memory/vm.h"
 #include "debug.h"
+#include "ksyms.h"
 #include <string.h>
 
 /* ELF structures */
@@ -57,6 +61,10 @@ typedef struct {
 
 #define PT_LOAD    1
 #define PT_DYNAMIC 2
+#define PT_GNU_RELRO 0x6474e552
+
+#define PF_X       0x1
+#define PF_W       0x2
 
 #define DT_NULL    0
 #define DT_HASH    4
@@ -67,10 +75,318 @@ typedef struct {
 #define DT_RELAENT 9
 #define DT_STRSZ   10
 #define DT_SYMENT  11
+#define DT_PLTRELSZ 2
+#define DT_PLTGOT  3
+#define DT_PLTREL  20
+#define DT_TEXTREL 22
+#define DT_JMPREL  23
+#define DT_BIND_NOW 24
+#define DT_FLAGS   30
+#define DT_FLAGS_1 0x6ffffffb
+#define DT_GNU_HASH 0x6ffffef5
+
+#define DF_TEXTREL  0x4
+#define DF_BIND_NOW 0x8
+#define DF_1_NOW    0x1
+
+#define SHN_UNDEF  0
+#define STB_WEAK   2
 
-#define R_X86_64_RELATIVE 8
+#define R_X86_64_NONE      0
+#define R_X86_64_64        1
+#define R_X86_64_GLOB_DAT  6
+#define R_X86_64_JUMP_SLOT 7
+#define R_X86_64_RELATIVE  8
 
 #define ELF64_R_TYPE(i) ((uint32_t)(i))
+#define ELF64_R_SYM(i)  ((uint32_t)((i) >> 32))
+#define ELF64_ST_BIND(i) ((i) >> 4)
+
+/* Lazy PLT binding. PLT0 pushes GOT[1] (the image) and jumps to GOT[2]
+ * with the relocation index pushed by the PLT entry above it. The
+ * trampoline preserves the argument registers, binds the slot and tail
+ * jumps to the target as if it had been called directly. */
+uint64_t elf_lazy_resolve(elf_image_t *img, uint64_t index);
+void elf_plt_trampoline(void);
+
+__asm__(
+    ".text\n"
+    ".globl elf_plt_trampoline\n"
+    ".hidden elf_plt_trampoline\n"
+    ".type elf_plt_trampoline, @function\n"
+    "elf_plt_trampoline:\n"
+    "    push %rax\n"
+    "    push %rcx\n"
+    "    push %rdx\n"
+    "    push %rsi\n"
+    "    push %rdi\n"
+    "    push %r8\n"
+    "    push %r9\n"
+    "    sub $128, %rsp\n"
+    "    movdqu %xmm0, 0(%rsp)\n"
+    "    movdqu %xmm1, 16(%rsp)\n"
+    "    movdqu %xmm2, 32(%rsp)\n"
+    "    movdqu %xmm3, 48(%rsp)\n"
+    "    movdqu %xmm4, 64(%rsp)\n"
+    "    movdqu %xmm5, 80(%rsp)\n"
+    "    movdqu %xmm6, 96(%rsp)\n"
+    "    movdqu %xmm7, 112(%rsp)\n"
+    "    mov 184(%rsp), %rdi\n"      /* GOT[1] */
+    "    mov 192(%rsp), %rsi\n"      /* relocation index */
+    "    call elf_lazy_resolve@PLT\n"
+    "    mov %rax, %r11\n"
+    "    movdqu 0(%rsp), %xmm0\n"
+    "    movdqu 16(%rsp), %xmm1\n"
+    "    movdqu 32(%rsp), %xmm2\n"
+    "    movdqu 48(%rsp), %xmm3\n"
+    "    movdqu 64(%rsp), %xmm4\n"
+    "    movdqu 80(%rsp), %xmm5\n"
+    "    movdqu 96(%rsp), %xmm6\n"
+    "    movdqu 112(%rsp), %xmm7\n"
+    "    add $128, %rsp\n"
+    "    pop %r9\n"
+    "    pop %r8\n"
+    "    pop %rdi\n"
+    "    pop %rsi\n"
+    "    pop %rdx\n"
+    "    pop %rcx\n"
+    "    pop %rax\n"
+    "    add $16, %rsp\n"
+    "    jmp *%r11\n"
+    ".size elf_plt_trampoline, .-elf_plt_trampoline\n"
+);
+
+/* DT_GNU_HASH layout: nbuckets, symoffset, bloom_size, bloom_shift,
+ * bloom[bloom_size] (64-bit words), buckets[nbuckets], chain[]. A chain
+ * entry holds the symbol hash with bit 0 marking the end of a bucket. */
+static const uint64_t *gnu_bloom(const uint32_t *gh)
+{
+    return (const uint64_t *)(gh + 4);
+}
+
+static const uint32_t *gnu_buckets(const uint32_t *gh)
+{
+    return (const uint32_t *)(gnu_bloom(gh) + gh[2]);
+}
+
+static const uint32_t *gnu_chain(const uint32_t *gh)
+{
+    return gnu_buckets(gh) + gh[0];
+}
+
+/* GNU hash tables do not record the symbol count; it is one past the
+ * last chain entry of the highest bucket. */
+static uint32_t gnu_hash_sym_count(const uint32_t *gh)
+{
+    const uint32_t *buckets = gnu_buckets(gh);
+    const uint32_t *chain = gnu_chain(gh);
+    uint32_t symoffset = gh[1];
+    uint32_t last = 0;
+    for (uint32_t i = 0; i < gh[0]; i++) {
+        if (buckets[i] > last)
+            last = buckets[i];
+    }
+    if (last < symoffset)
+        return symoffset;
+    while (!(chain[last - symoffset] & 1))
+        last++;
+    return last + 1;
+}
+
+static uint32_t gnu_hash_name(const char *name)
+{
+    uint32_t h = 5381;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++)
+        h = h * 33 + *p;
+    return h;
+}
+
+static uint32_t sysv_hash_name(const char *name)
+{
+    uint32_t h = 0;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        h = (h << 4) + *p;
+        uint32_t g = h & 0xf0000000;
+        if (g)
+            h ^= g >> 24;
+        h &= ~g;
+    }
+    return h;
+}
+
+static int apply_rela(elf_image_t *img, const Elf64_Rela *rela, size_t count,
+                      int lazy);
+
+/* --- segment mapping --- */
+
+/* An image lives in its own vm area whose priv holds one elf_page_t per
+ * page: either borrowed from the file mapping or a private page. */
+
+typedef struct {
+    vm_page_ref_t ref;
+    uint64_t flags;      /* final page table flags */
+    void *pristine;      /* writable page contents right after relocation */
+} elf_page_t;
+
+static void image_release(vm_area_t *area, uint64_t offset, uint64_t phys)
+{
+    vm_page_ref_t *ref = &((elf_page_t *)area->priv)[offset / PAGE_SIZE].ref;
+    (void)phys;
+    if (!ref->phys)
+        return;
+    if (ref->put)
+        ref->put(ref->key);
+    else
+        free_page((void *)(uintptr_t)ref->phys);
+    ref->phys = 0;
+}
+
+static uint64_t image_fault(vm_area_t *area, uint64_t offset)
+{
+    return ((elf_page_t *)area->priv)[offset / PAGE_SIZE].ref.phys;
+}
+
+static void image_close(vm_area_t *area)
+{
+    elf_page_t *pages = area->priv;
+    /* pages that were never mapped are still owned here */
+    for (uint64_t off = 0; off < area->size; off += PAGE_SIZE) {
+        image_release(area, off, 0);
+        if (pages[off / PAGE_SIZE].pristine)
+            free_page(pages[off / PAGE_SIZE].pristine);
+    }
+    kfree(pages);
+}
+
+static const vm_ops_t image_vm_ops = {
+    .fault = image_fault,
+    .release = image_release,
+    .close = image_close,
+};
+
+static int touches(const Elf64_Phdr *ph, uint64_t pg)
+{
+    return ph->p_type == PT_LOAD && ph->p_vaddr < pg + PAGE_SIZE &&
+           pg < ph->p_vaddr + ph->p_memsz;
+}
+
+/* Text relocations would write into pages borrowed from the file. */
+static int has_textrel(const unsigned char *data, size_t size,
+                       const Elf64_Phdr *ph, uint16_t phnum)
+{
+    for (uint16_t i = 0; i < phnum; i++) {
+        if (ph[i].p_type != PT_DYNAMIC || ph[i].p_offset + ph[i].p_filesz > size)
+            continue;
+        const Elf64_Dyn *dyn = (const Elf64_Dyn *)(data + ph[i].p_offset);
+        for (size_t d = 0; d < ph[i].p_filesz / sizeof(Elf64_Dyn); d++) {
+            if (dyn[d].d_tag == DT_TEXTREL ||
+                (dyn[d].d_tag == DT_FLAGS && (dyn[d].d_un.d_val & DF_TEXTREL)))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/* Copy the file bytes of every segment on page `pg` and zero only the
+ * gaps between them and the .bss tail. Segments are sorted by p_vaddr. */
+static void fill_page(unsigned char *page, uint64_t pg, const unsigned char *data,
+                      const Elf64_Phdr *ph, uint16_t phnum)
+{
+    uint64_t cur = pg;
+    for (uint16_t i = 0; i < phnum; i++) {
+        if (!touches(&ph[i], pg))
+            continue;
+        uint64_t s = ph[i].p_vaddr > pg ? ph[i].p_vaddr : pg;
+        uint64_t e = ph[i].p_vaddr + ph[i].p_filesz;
+        if (e > pg + PAGE_SIZE)
+            e = pg + PAGE_SIZE;
+        if (s > cur) {
+            memset(page + (cur - pg), 0, s - cur);
+            cur = s;
+        }
+        if (e > s) {
+            memcpy(page + (s - pg), data + ph[i].p_offset + (s - ph[i].p_vaddr),
+                   e - s);
+            cur = e;
+        }
+    }
+    if (cur < pg + PAGE_SIZE)
+        memset(page + (cur - pg), 0, pg + PAGE_SIZE - cur);
+}
+
+/* Back each page of the image starting at vaddr `first`. A read-only page
+ * covered by file data of a single segment is borrowed from the file
+ * mapping when the buffer can share pages; everything else is copied. */
+static int back_pages(elf_page_t *pages, uint64_t npages, uint64_t first,
+                      const unsigned char *data, const Elf64_Phdr *ph,
+                      uint16_t phnum, int textrel)
+{
+    for (uint64_t i = 0; i < npages; i++) {
+        uint64_t pg = first + i * PAGE_SIZE;
+        const Elf64_Phdr *only = NULL;
+        int count = 0;
+        for (uint16_t j = 0; j < phnum; j++) {
+            if (touches(&ph[j], pg)) {
+                only = &ph[j];
+                count++;
+            }
+        }
+        if (count == 1 && !textrel && !(only->p_flags & PF_W)) {
+            uint64_t end = only->p_vaddr + only->p_memsz;
+            if (end > pg + PAGE_SIZE)
+                end = pg + PAGE_SIZE;
+            uint64_t src = (uint64_t)(uintptr_t)data + only->p_offset -
+                           only->p_vaddr + pg;
+            if (end <= only->p_vaddr + only->p_filesz &&
+                !(src & (PAGE_SIZE - 1)) && vm_hold_page(src, &pages[i].ref) == 0)
+                continue;
+        }
+        unsigned char *page = alloc_page();
+        if (!page)
+            return -1;
+        pages[i].ref.phys = (uint64_t)(uintptr_t)page;
+        pages[i].ref.put = NULL;
+        fill_page(page, pg, data, ph, phnum);
+    }
+    return 0;
+}
+
+/* Apply p_flags to every page. Until `final` private pages stay writable
+ * so relocations can be applied; after it RELRO pages lose write access. */
+static void protect_pages(vm_area_t *area, uint64_t first, const Elf64_Phdr *ph,
+                          uint16_t phnum, int final)
+{
+    elf_page_t *pages = area->priv;
+    uint64_t relro_lo = 0, relro_hi = 0;
+    for (uint16_t i = 0; i < phnum; i++) {
+        if (ph[i].p_type == PT_GNU_RELRO) {
+            relro_lo = ph[i].p_vaddr & ~(PAGE_SIZE - 1);
+            relro_hi = (ph[i].p_vaddr + ph[i].p_memsz) & ~(PAGE_SIZE - 1);
+        }
+    }
+    for (uint64_t off = 0; off < area->size; off += PAGE_SIZE) {
+        uint64_t pg = first + off;
+        uint32_t pf = 0;
+        for (uint16_t i = 0; i < phnum; i++) {
+            if (touches(&ph[i], pg))
+                pf |= ph[i].p_flags;
+        }
+        uint64_t flags = PAGE_PRESENT;
+        if ((pf & PF_W) || (!final && !pages[off / PAGE_SIZE].ref.put))
+            flags |= PAGE_WRITE;
+        if (!(pf & PF_X))
+            flags |= PAGE_NX;
+        if (final && pg >= relro_lo && pg < relro_hi)
+            flags &= ~PAGE_WRITE;
+        if (final && (flags & PAGE_WRITE) && !(flags & PAGE_NX)) {
+            debug_puts("elf: writable and executable page at 0x");
+            debug_puthex64(area->start + off);
+            debug_putc('\n');
+        }
+        pages[off / PAGE_SIZE].flags = flags;
+        map_page(area->start + off, pages[off / PAGE_SIZE].ref.phys, flags);
+    }
+}
 
 int elf_load_image(const void *data, size_t size, elf_image_t *out)
 {
@@ -91,6 +407,10 @@ int elf_load_image(const void *data, size_t size, elf_image_t *out)
     for (uint16_t i = 0; i < eh->e_phnum; i++) {
         if (ph[i].p_type != PT_LOAD)
             continue;
+        if (ph[i].p_offset + ph[i].p_filesz > size ||
+            ph[i].p_filesz > ph[i].p_memsz ||
+            (ph[i].p_offset - ph[i].p_vaddr) & (PAGE_SIZE - 1))
+            return -1;
         if (ph[i].p_vaddr < min_vaddr)
             min_vaddr = ph[i].p_vaddr;
         uint64_t end = ph[i].p_vaddr + ph[i].p_memsz;
@@ -100,27 +420,33 @@ int elf_load_image(const void *data, size_t size, elf_image_t *out)
     if (max_vaddr <= min_vaddr)
         return -1;
 
-    size_t mem_size = (size_t)(max_vaddr - min_vaddr);
-    unsigned char *mem = kmalloc(mem_size);
-    if (!mem)
+    uint64_t first = min_vaddr & ~(PAGE_SIZE - 1);
+    uint64_t npages = (max_vaddr - first + PAGE_SIZE - 1) / PAGE_SIZE;
+    elf_page_t *pages = kmalloc(npages * sizeof(elf_page_t));
+    if (!pages)
+        return -1;
+    memset(pages, 0, npages * sizeof(elf_page_t));
+    vm_area_t *area = vm_map(npages * PAGE_SIZE, VM_READ | VM_WRITE | VM_EXEC,
+                             &image_vm_ops, pages);
+    if (!area) {
+        kfree(pages);
+        return -1;
+    }
+    if (back_pages(pages, npages, first, data, ph, eh->e_phnum,
+                   has_textrel(data, size, ph, eh->e_phnum)) ||
+        vm_populate(area, 0, area->size)) {
+        vm_unmap(area);
         return -1;
-    memset(mem, 0, mem_size);
-
-    for (uint16_t i = 0; i < eh->e_phnum; i++) {
-        if (ph[i].p_type != PT_LOAD)
-            continue;
-        memcpy(mem + (ph[i].p_vaddr - min_vaddr),
-               (const unsigned char *)data + ph[i].p_offset,
-               ph[i].p_filesz);
     }
+    protect_pages(area, first, ph, eh->e_phnum, 0);
 
-    uint64_t bias = (uint64_t)mem - min_vaddr;
+    uint64_t bias = area->start - first;
 
     const Elf64_Dyn *dyn = NULL;
     size_t dyn_count = 0;
     for (uint16_t i = 0; i < eh->e_phnum; i++) {
         if (ph[i].p_type == PT_DYNAMIC) {
-            dyn = (const Elf64_Dyn *)(mem + (ph[i].p_vaddr - min_vaddr));
+            dyn = (const Elf64_Dyn *)(bias + ph[i].p_vaddr);
             dyn_count = ph[i].p_memsz / sizeof(Elf64_Dyn);
             break;
         }
@@ -131,6 +457,11 @@ int elf_load_image(const void *data, size_t size, elf_image_t *out)
     Elf64_Sym *symtab = NULL;
     const char *strtab = NULL;
     uint32_t *hash = NULL;
+    uint32_t *gnu_hash = NULL;
+    Elf64_Rela *jmprel = NULL;
+    size_t jmprel_cnt = 0;
+    uint64_t *got = NULL;
+    int bind_now = 0;
 
     if (dyn) {
         for (size_t i = 0; i < dyn_count; i++) {
@@ -150,40 +481,309 @@ int elf_load_image(const void *data, size_t size, elf_image_t *out)
             case DT_HASH:
                 hash = (uint32_t *)(bias + dyn[i].d_un.d_ptr);
                 break;
+            case DT_GNU_HASH:
+                gnu_hash = (uint32_t *)(bias + dyn[i].d_un.d_ptr);
+                break;
+            case DT_JMPREL:
+                jmprel = (Elf64_Rela *)(bias + dyn[i].d_un.d_ptr);
+                break;
+            case DT_PLTRELSZ:
+                jmprel_cnt = dyn[i].d_un.d_val / sizeof(Elf64_Rela);
+                break;
+            case DT_PLTREL:
+                if (dyn[i].d_un.d_val != DT_RELA) {
+                    vm_unmap(area);
+                    return -1;
+                }
+                break;
+            case DT_PLTGOT:
+                got = (uint64_t *)(bias + dyn[i].d_un.d_ptr);
+                break;
+            case DT_BIND_NOW:
+                bind_now = 1;
+                break;
+            case DT_FLAGS:
+                if (dyn[i].d_un.d_val & DF_BIND_NOW)
+                    bind_now = 1;
+                break;
+            case DT_FLAGS_1:
+                if (dyn[i].d_un.d_val & DF_1_NOW)
+                    bind_now = 1;
+                break;
             }
         }
     }
 
-    for (size_t i = 0; i < rela_cnt; i++) {
-        if (ELF64_R_TYPE(rela[i].r_info) == R_X86_64_RELATIVE) {
-            uint64_t *loc = (uint64_t *)(bias + rela[i].r_offset);
-            *loc = bias + rela[i].r_addend;
-        }
-    }
-
     uint32_t sym_cnt = 0;
     if (hash)
         sym_cnt = hash[1];
+    else if (gnu_hash)
+        sym_cnt = gnu_hash_sym_count(gnu_hash);
 
-    out->base = mem;
+    memset(out, 0, sizeof(*out));
+    out->base = (void *)(uintptr_t)area->start;
     out->bias = bias;
-    out->size = mem_size;
+    out->size = area->size;
+    out->area = area;
     out->symtab = symtab;
     out->strtab = strtab;
     out->sym_count = sym_cnt;
+    out->hash = hash;
+    out->gnu_hash = gnu_hash;
+    out->jmprel = jmprel;
+    out->plt_count = (uint32_t)jmprel_cnt;
+
+    int lazy = !bind_now && got && jmprel_cnt;
+    if (lazy) {
+        /* the resolver needs an image that outlives the caller's copy */
+        out->self = kmalloc(sizeof(elf_image_t));
+        if (!out->self)
+            lazy = 0;
+    }
+    if (apply_rela(out, rela, rela_cnt, 0) ||
+        apply_rela(out, jmprel, jmprel_cnt, lazy)) {
+        kfree(out->self);
+        vm_unmap(area);
+        return -1;
+    }
+    if (lazy) {
+        got[1] = (uint64_t)out->self;
+        got[2] = (uint64_t)elf_plt_trampoline;
+        *out->self = *out;
+    }
+    protect_pages(area, first, ph, eh->e_phnum, 1);
     return 0;
 }
 
-void *elf_lookup_symbol(const elf_image_t *img, const char *name)
+void elf_unload_image(elf_image_t *img)
+{
+    if (!img)
+        return;
+    kfree(img->self);
+    vm_unmap(img->area);
+    img->self = NULL;
+    img->area = NULL;
+    img->base = NULL;
+}
+
+int elf_image_snapshot(elf_image_t *img)
+{
+    if (!img || !img->area)
+        return -1;
+    vm_area_t *area = img->area;
+    elf_page_t *pages = area->priv;
+    for (uint64_t off = 0; off < area->size; off += PAGE_SIZE) {
+        elf_page_t *pg = &pages[off / PAGE_SIZE];
+        if (!(pg->flags & PAGE_WRITE) || pg->pristine)
+            continue;
+        pg->pristine = alloc_page();
+        if (!pg->pristine)
+            return -1;
+        memcpy(pg->pristine, (void *)(uintptr_t)(area->start + off), PAGE_SIZE);
+    }
+    img->snapshot = 1;
+    return 0;
+}
+
+int elf_image_reset(elf_image_t *img)
+{
+    if (!img || !img->area || !img->snapshot)
+        return -1;
+    vm_area_t *area = img->area;
+    elf_page_t *pages = area->priv;
+    for (uint64_t off = 0; off < area->size; off += PAGE_SIZE) {
+        if (pages[off / PAGE_SIZE].pristine)
+            memcpy((void *)(uintptr_t)(area->start + off),
+                   pages[off / PAGE_SIZE].pristine, PAGE_SIZE);
+    }
+    /* the GOT went back to its unbound state with the data pages */
+    if (img->self)
+        img->self->plt_bound = img->plt_bound;
+    return 0;
+}
+
+uint32_t elf_plt_bound(const elf_image_t *img)
+{
+    if (!img)
+        return 0;
+    return img->self ? img->self->plt_bound : img->plt_bound;
+}
+
+static int resolve_sym(const elf_image_t *img, uint32_t index, uint64_t *value)
+{
+    const Elf64_Sym *sym = (const Elf64_Sym *)img->symtab + index;
+    if (!index) {
+        *value = 0;
+        return 0;
+    }
+    if (sym->st_shndx != SHN_UNDEF) {
+        *value = img->bias + sym->st_value;
+        return 0;
+    }
+    const char *name = img->strtab + sym->st_name;
+    void *addr = ksym_lookup(name);
+    if (addr) {
+        *value = (uint64_t)addr;
+        return 0;
+    }
+    if (ELF64_ST_BIND(sym->st_info) == STB_WEAK) {
+        *value = 0;
+        return 0;
+    }
+    debug_puts("elf: unresolved symbol ");
+    debug_puts(name);
+    debug_putc('\n');
+    return -1;
+}
+
+static int apply_rela(elf_image_t *img, const Elf64_Rela *rela, size_t count,
+                      int lazy)
+{
+    for (size_t i = 0; i < count; i++) {
+        uint64_t *loc = (uint64_t *)(img->bias + rela[i].r_offset);
+        uint32_t type = ELF64_R_TYPE(rela[i].r_info);
+        uint64_t value;
+        switch (type) {
+        case R_X86_64_NONE:
+            break;
+        case R_X86_64_RELATIVE:
+            *loc = img->bias + rela[i].r_addend;
+            break;
+        case R_X86_64_64:
+            if (resolve_sym(img, ELF64_R_SYM(rela[i].r_info), &value))
+                return -1;
+            *loc = value + rela[i].r_addend;
+            break;
+        case R_X86_64_GLOB_DAT:
+            if (resolve_sym(img, ELF64_R_SYM(rela[i].r_info), &value))
+                return -1;
+            *loc = value;
+            break;
+        case R_X86_64_JUMP_SLOT:
+            if (lazy) {
+                /* the slot points back into its PLT entry until first use */
+                *loc += img->bias;
+                break;
+            }
+            if (resolve_sym(img, ELF64_R_SYM(rela[i].r_info), &value))
+                return -1;
+            *loc = value;
+            img->plt_bound++;
+            break;
+        default:
+            debug_puts("elf: unsupported relocation type 0x");
+            debug_puthex(type);
+            debug_putc('\n');
+            return -1;
+        }
+    }
+    return 0;
+}
+
+uint64_t elf_lazy_resolve(elf_image_t *img, uint64_t index)
+{
+    const Elf64_Rela *r = (const Elf64_Rela *)img->jmprel + index;
+    uint64_t value = 0;
+    if (resolve_sym(img, ELF64_R_SYM(r->r_info), &value) || !value) {
+        debug_puts("elf: lazy binding failed\n");
+        for (;;)
+            __asm__ volatile("cli; hlt");
+    }
+    *(uint64_t *)(img->bias + r->r_offset) = value;
+    img->plt_bound++;
+    return value;
+}
+
+/* A defined symbol called `name`, or NULL. */
+static const Elf64_Sym *symbol_is(const elf_image_t *img, const Elf64_Sym *sym,
+                                  const char *name)
+{
+    if (sym->st_shndx == SHN_UNDEF)
+        return NULL;
+    if (strcmp(img->strtab + sym->st_name, name) != 0)
+        return NULL;
+    return sym;
+}
+
+static const Elf64_Sym *gnu_lookup(const elf_image_t *img, const char *name)
+{
+    const uint32_t *gh = img->gnu_hash;
+    const Elf64_Sym *symtab = (const Elf64_Sym *)img->symtab;
+    uint32_t nbuckets = gh[0], symoffset = gh[1];
+    uint32_t bloom_size = gh[2], bloom_shift = gh[3];
+    if (!nbuckets || !bloom_size)
+        return NULL;
+
+    uint32_t h = gnu_hash_name(name);
+    uint64_t word = gnu_bloom(gh)[(h / 64) % bloom_size];
+    uint64_t mask = (1ULL << (h % 64)) | (1ULL << ((h >> bloom_shift) % 64));
+    if ((word & mask) != mask)
+        return NULL;
+
+    uint32_t i = gnu_buckets(gh)[h % nbuckets];
+    if (i < symoffset)
+        return NULL;
+    const uint32_t *chain = gnu_chain(gh);
+    for (;; i++) {
+        uint32_t h2 = chain[i - symoffset];
+        if ((h | 1) == (h2 | 1)) {
+            const Elf64_Sym *sym = symbol_is(img, &symtab[i], name);
+            if (sym)
+                return sym;
+        }
+        if (h2 & 1)
+            return NULL;
+    }
+}
+
+static const Elf64_Sym *sysv_lookup(const elf_image_t *img, const char *name)
+{
+    const uint32_t *hash = img->hash;
+    const Elf64_Sym *symtab = (const Elf64_Sym *)img->symtab;
+    uint32_t nbucket = hash[0], nchain = hash[1];
+    if (!nbucket)
+        return NULL;
+    const uint32_t *bucket = hash + 2;
+    const uint32_t *chain = bucket + nbucket;
+    for (uint32_t i = bucket[sysv_hash_name(name) % nbucket];
+         i && i < nchain; i = chain[i]) {
+        const Elf64_Sym *sym = symbol_is(img, &symtab[i], name);
+        if (sym)
+            return sym;
+    }
+    return NULL;
+}
+
+static const Elf64_Sym *find_symbol(const elf_image_t *img, const char *name)
 {
     if (!img || !name || !img->symtab || !img->strtab)
         return NULL;
+    /* both tables index the same dynamic symbols, so a GNU miss is final */
+    if (img->gnu_hash)
+        return gnu_lookup(img, name);
+    if (img->hash)
+        return sysv_lookup(img, name);
 
     const Elf64_Sym *symtab = (const Elf64_Sym *)img->symtab;
     for (uint32_t i = 0; i < img->sym_count; i++) {
-        const char *sname = img->strtab + symtab[i].st_name;
-        if (strcmp(sname, name) == 0)
-            return (void *)(img->bias + symtab[i].st_value);
+        const Elf64_Sym *sym = symbol_is(img, &symtab[i], name);
+        if (sym)
+            return sym;
     }
     return NULL;
 }
+
+void *elf_lookup_symbol(const elf_image_t *img, const char *name)
+{
+    return elf_lookup_object(img, name, NULL);
+}
+
+void *elf_lookup_object(const elf_image_t *img, const char *name, size_t *size)
+{
+    const Elf64_Sym *sym = find_symbol(img, name);
+    if (!sym)
+        return NULL;
+    if (size)
+        *size = sym->st_size;
+    return (void *)(img->bias + sym->st_value);
+}
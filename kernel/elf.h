@@ -6,16 +6,46 @@
 
 /* Basic ELF64 structures and loader for shared objects */
 
-typedef struct {
+struct vm_area;
+
+typedef struct elf_image {
     void *base;        /* loaded base address */
     uint64_t bias;     /* base - original min vaddr */
-    size_t size;       /* size of allocated memory */
+    size_t size;       /* size of the mapping */
     void *symtab;      /* pointer to symbol table */
     const char *strtab;/* pointer to string table */
     uint32_t sym_count;/* number of symbols */
+    const uint32_t *hash;     /* DT_HASH table or NULL */
+    const uint32_t *gnu_hash; /* DT_GNU_HASH table or NULL */
+    const void *jmprel;       /* DT_JMPREL relocations */
+    uint32_t plt_count;       /* JUMP_SLOT relocations */
+    uint32_t plt_bound;       /* slots bound so far */
+    struct elf_image *self;   /* stable copy used by lazy PLT binding */
+    struct vm_area *area;     /* pages backing the image */
+    int snapshot;             /* writable pages saved by elf_image_snapshot */
 } elf_image_t;
 
+/* Load a shared object and apply its relocations. Segments are mapped on
+ * page boundaries with protections from p_flags; read-only pages are
+ * shared with the file mapping when `data` comes from fat32_mmap().
+ * Imports resolve against the image itself and then the kernel export
+ * table (ksyms.h). PLT slots are bound on first call unless the object
+ * asks for BIND_NOW. */
 int elf_load_image(const void *data, size_t size, elf_image_t *out);
+void elf_unload_image(elf_image_t *img);
+/* Save the writable pages of a freshly relocated image so it can later be
+ * reused at the same address: elf_image_reset() puts .data, .bss and the
+ * GOT back to their state at load without redoing any relocation. */
+int elf_image_snapshot(elf_image_t *img);
+int elf_image_reset(elf_image_t *img);
+/* Number of PLT slots bound so far. */
+uint32_t elf_plt_bound(const elf_image_t *img);
+/* Resolve a defined symbol through DT_GNU_HASH, or DT_HASH when the
+ * object has no GNU table; a GNU miss is final. Objects carrying neither
+ * table fall back to a linear scan. */
 void *elf_lookup_symbol(const elf_image_t *img, const char *name);
+/* Same lookup, also giving the symbol's st_size: the size of the object
+ * as the module was compiled. */
+void *elf_lookup_object(const elf_image_t *img, const char *name, size_t *size);
 
 #endif /* PHILLOS_ELF_H */
@@ -0,0 +1,195 @@
+#include "bcache.h"
+#include <stddef.h>
+#include <string.h>
+
+/* Fixed size block cache. Entries are found through a small chained hash
+ * table and replaced with a clock sweep, so lookups and evictions never
+ * walk the whole cache. */
+
+#define BCACHE_HASH_SIZE 256
+#define BCACHE_NONE      (-1)
+#define RA_STAGE_BLOCKS  256
+
+typedef struct {
+    uint64_t lba;
+    int16_t next;        /* hash chain */
+    uint8_t valid;
+    uint8_t referenced;  /* clock bit */
+    uint8_t prefetched;  /* filled by readahead and not consumed yet */
+} bcache_entry_t;
+
+static bcache_entry_t entries[BCACHE_ENTRIES];
+static uint8_t block_data[BCACHE_ENTRIES][BCACHE_BLOCK_SIZE];
+static int16_t buckets[BCACHE_HASH_SIZE];
+static unsigned clock_hand = 0;
+static bcache_read_fn backend_read = NULL;
+static bcache_stats_t stats;
+
+/* staging area for multi-block readahead commands */
+static uint8_t ra_stage[RA_STAGE_BLOCKS * BCACHE_BLOCK_SIZE];
+
+static unsigned hash_lba(uint64_t lba)
+{
+    return (unsigned)((lba ^ (lba >> 8)) & (BCACHE_HASH_SIZE - 1));
+}
+
+void bcache_invalidate(void)
+{
+    for (unsigned i = 0; i < BCACHE_HASH_SIZE; i++)
+        buckets[i] = BCACHE_NONE;
+    for (unsigned i = 0; i < BCACHE_ENTRIES; i++) {
+        entries[i].valid = 0;
+        entries[i].next = BCACHE_NONE;
+    }
+    clock_hand = 0;
+}
+
+void bcache_init(bcache_read_fn backend)
+{
+    backend_read = backend;
+    memset(&stats, 0, sizeof(stats));
+    bcache_invalidate();
+}
+
+static int lookup(uint64_t lba)
+{
+    for (int i = buckets[hash_lba(lba)]; i != BCACHE_NONE; i = entries[i].next) {
+        if (entries[i].lba == lba)
+            return i;
+    }
+    return BCACHE_NONE;
+}
+
+static void unlink_entry(int idx)
+{
+    int16_t *p = &buckets[hash_lba(entries[idx].lba)];
+    while (*p != BCACHE_NONE) {
+        if (*p == idx) {
+            *p = entries[idx].next;
+            break;
+        }
+        p = &entries[*p].next;
+    }
+    entries[idx].valid = 0;
+    entries[idx].next = BCACHE_NONE;
+}
+
+static int evict_one(void)
+{
+    for (;;) {
+        bcache_entry_t *e = &entries[clock_hand];
+        int idx = (int)clock_hand;
+        clock_hand = (clock_hand + 1) % BCACHE_ENTRIES;
+        if (!e->valid)
+            return idx;
+        if (e->referenced) {
+            e->referenced = 0;
+            continue;
+        }
+        if (e->prefetched)
+            stats.ra_wasted++;
+        unlink_entry(idx);
+        return idx;
+    }
+}
+
+static void insert(uint64_t lba, const void *data, int prefetched)
+{
+    int idx = evict_one();
+    bcache_entry_t *e = &entries[idx];
+    memcpy(block_data[idx], data, BCACHE_BLOCK_SIZE);
+    e->lba = lba;
+    e->valid = 1;
+    e->referenced = 1;
+    e->prefetched = (uint8_t)prefetched;
+    unsigned h = hash_lba(lba);
+    e->next = buckets[h];
+    buckets[h] = (int16_t)idx;
+}
+
+static int copy_out(int idx, void *buf)
+{
+    bcache_entry_t *e = &entries[idx];
+    memcpy(buf, block_data[idx], BCACHE_BLOCK_SIZE);
+    e->referenced = 1;
+    stats.hits++;
+    if (e->prefetched) {
+        /* file data is not cached on demand either, so once a prefetched
+         * block is delivered its slot is released for the next window */
+        e->prefetched = 0;
+        stats.ra_hits++;
+        unlink_entry(idx);
+    }
+    return 0;
+}
+
+int bcache_read(uint64_t lba, void *buf)
+{
+    int idx = lookup(lba);
+    if (idx != BCACHE_NONE)
+        return copy_out(idx, buf);
+    if (!backend_read || backend_read(lba, 1, buf))
+        return -1;
+    stats.misses++;
+    insert(lba, buf, 0);
+    return 0;
+}
+
+int bcache_read_range(uint64_t lba, uint32_t count, void *buf)
+{
+    uint8_t *out = buf;
+    uint32_t i = 0;
+    while (i < count) {
+        int idx = lookup(lba + i);
+        if (idx != BCACHE_NONE) {
+            copy_out(idx, out + (size_t)i * BCACHE_BLOCK_SIZE);
+            i++;
+            continue;
+        }
+        uint32_t run = 1;
+        while (i + run < count && lookup(lba + i + run) == BCACHE_NONE)
+            run++;
+        if (!backend_read ||
+            backend_read(lba + i, run, out + (size_t)i * BCACHE_BLOCK_SIZE))
+            return -1;
+        stats.misses += run;
+        i += run;
+    }
+    return 0;
+}
+
+void bcache_update(uint64_t lba, const void *buf)
+{
+    int idx = lookup(lba);
+    if (idx != BCACHE_NONE)
+        memcpy(block_data[idx], buf, BCACHE_BLOCK_SIZE);
+}
+
+int bcache_prefetch(uint64_t lba, uint32_t count)
+{
+    uint32_t i = 0;
+    while (i < count) {
+        if (lookup(lba + i) != BCACHE_NONE) {
+            i++;
+            continue;
+        }
+        uint32_t run = 1;
+        while (i + run < count && run < RA_STAGE_BLOCKS &&
+               lookup(lba + i + run) == BCACHE_NONE)
+            run++;
+        if (!backend_read || backend_read(lba + i, run, ra_stage))
+            return -1;
+        for (uint32_t j = 0; j < run; j++)
+            insert(lba + i + j, ra_stage + (size_t)j * BCACHE_BLOCK_SIZE, 1);
+        stats.ra_issued += run;
+        stats.ra_requests++;
+        i += run;
+    }
+    return 0;
+}
+
+void bcache_get_stats(bcache_stats_t *out)
+{
+    if (out)
+        *out = stats;
+}
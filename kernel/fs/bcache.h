@@ -0,0 +1,43 @@
+#ifndef PHILLOS_FS_BCACHE_H
+#define PHILLOS_FS_BCACHE_H
+
+#include <stdint.h>
+
+/* Small sector cache sitting between the filesystem and the storage driver.
+ * Metadata (FAT and directory sectors) is cached on demand while file data
+ * only enters the cache through readahead. */
+
+#define BCACHE_BLOCK_SIZE 512
+#define BCACHE_ENTRIES    512
+
+typedef int (*bcache_read_fn)(uint64_t lba, uint32_t count, void *buf);
+
+typedef struct {
+    uint64_t hits;       /* demand reads served from the cache */
+    uint64_t misses;     /* demand reads that went to the device */
+    uint64_t ra_issued;  /* blocks fetched by readahead */
+    uint64_t ra_hits;    /* prefetched blocks later consumed */
+    uint64_t ra_wasted;  /* prefetched blocks evicted without use */
+    uint64_t ra_requests;/* device commands issued by readahead */
+} bcache_stats_t;
+
+void bcache_init(bcache_read_fn backend);
+void bcache_invalidate(void);
+
+/* Read a single block through the cache, inserting it on a miss. */
+int bcache_read(uint64_t lba, void *buf);
+
+/* Read a run of blocks. Cached blocks are copied out, the rest are read from
+ * the device in as few commands as possible without polluting the cache. */
+int bcache_read_range(uint64_t lba, uint32_t count, void *buf);
+
+/* A block was written to the device: refresh the cached copy, if any. */
+void bcache_update(uint64_t lba, const void *buf);
+
+/* Fetch blocks into the cache ahead of use. Already cached blocks are
+ * skipped and contiguous misses are merged into one device command. */
+int bcache_prefetch(uint64_t lba, uint32_t count);
+
+void bcache_get_stats(bcache_stats_t *out);
+
+#endif // PHILLOS_FS_BCACHE_H
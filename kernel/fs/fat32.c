@@ -1,14 +1,19 @@
 #include "fat32.h"
+#include "bcache.h"
+#include "pagecache.h"
 #include "../debug.h"
 #include "../memory/heap.h"
-#include "../../drivers/storage/ahci.h"
+#include "../memory/vm.h"
+#include "../memory/paging.h"
+#include "../../drivers/storage/blkdev.h"
+#include "../../drivers/storage/iosched.h"
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
-/* Simple read-only FAT32 implementation sufficient to load files from the
- * boot partition. Only short file names and basic long file names are
- * supported. */
+/* Simple FAT32 implementation sufficient to load files from the boot
+ * partition and to overwrite existing files in place. Only short file
+ * names and basic long file names are supported. */
 
 typedef struct {
     uint32_t fat_start;      // LBA of first FAT
@@ -17,13 +22,24 @@ typedef struct {
     uint32_t sectors_per_cluster;
     uint32_t bytes_per_sector;
     uint32_t root_cluster;
+    blkdev_t *dev;
 } fat32_fs_t;
 
 static fat32_fs_t fs;
 
+/* Readahead: sequential access is detected per file and the prefetch
+ * window, counted in clusters, doubles every time reads reach the window
+ * issued previously. A non-sequential access drops back to the minimum
+ * window. The window never covers more than half the block cache, or
+ * with large clusters prefetched blocks would evict each other before
+ * they are read. */
+#define RA_MIN_CLUSTERS 2
+#define RA_MAX_CLUSTERS 32
+#define RA_MAX_SECTORS  (BCACHE_ENTRIES / 2)
+
 static int read_sectors(uint64_t lba, uint32_t count, void *buf)
 {
-    return ahci_read(lba, count, buf);
+    return blkdev_read(fs.dev, lba, count, buf);
 }
 
 static uint32_t cluster_to_lba(uint32_t cluster)
@@ -36,16 +52,155 @@ static uint32_t fat_get_next(uint32_t cluster)
     uint32_t offset = cluster * 4;
     uint32_t sector = fs.fat_start + offset / fs.bytes_per_sector;
     uint32_t off = offset % fs.bytes_per_sector;
-    uint8_t buf[4];
-    if (read_sectors(sector, 1, buf))
+    uint8_t buf[BCACHE_BLOCK_SIZE];
+    if (bcache_read(sector, buf))
         return 0x0FFFFFFF;
     uint32_t val = *(uint32_t *)(buf + off);
     return val & 0x0FFFFFFF;
 }
 
-int fat32_init(void)
+static int is_eoc(uint32_t cluster)
+{
+    return cluster < 2 || cluster >= 0x0FFFFFF8;
+}
+
+static void ra_open(fat32_file_t *f, uint32_t cluster, uint32_t size)
+{
+    uint32_t cluster_bytes = fs.sectors_per_cluster * fs.bytes_per_sector;
+    f->first_cluster = cluster;
+    f->size = size;
+    f->pos_index = 0;
+    f->pos_cluster = cluster;
+    f->cluster_count = (size + cluster_bytes - 1) / cluster_bytes;
+    f->last_index = 0xFFFFFFFF;
+    f->ra_size = 0;
+    f->ra_mark = 0;
+    f->ra_next_index = 1;
+    f->ra_next_cluster = 0;
+}
+
+/* Prefetch `count` clusters starting at the readahead cursor, merging
+ * physically contiguous clusters into a single device read. */
+static void ra_issue(fat32_file_t *f, uint32_t count)
+{
+    uint32_t cur = f->ra_next_cluster;
+    uint32_t end = f->ra_next_index + count;
+    if (end > f->cluster_count)
+        end = f->cluster_count;
+    while (f->ra_next_index < end && !is_eoc(cur)) {
+        uint32_t run_start = cur;
+        uint32_t run_len = 0;
+        uint32_t next = cur;
+        while (f->ra_next_index < end && !is_eoc(cur) &&
+               cur == run_start + run_len) {
+            next = fat_get_next(cur);
+            run_len++;
+            f->ra_next_index++;
+            cur = next;
+        }
+        if (bcache_prefetch(cluster_to_lba(run_start),
+                            run_len * fs.sectors_per_cluster))
+            break;
+    }
+    f->ra_next_cluster = cur;
+}
+
+static void ra_access(fat32_file_t *f, uint32_t index, uint32_t cluster)
+{
+    if (index != f->last_index + 1) {
+        f->ra_size = 0;
+        f->ra_mark = index;
+        f->ra_next_index = index + 1;
+        f->ra_next_cluster = fat_get_next(cluster);
+    } else if (index == 0) {
+        f->ra_next_cluster = fat_get_next(cluster);
+    }
+    f->last_index = index;
+    if (index < f->ra_mark || f->ra_next_index >= f->cluster_count)
+        return;
+
+    uint32_t max = RA_MAX_SECTORS / fs.sectors_per_cluster;
+    if (max > RA_MAX_CLUSTERS)
+        max = RA_MAX_CLUSTERS;
+    if (!max)
+        max = 1;
+    uint32_t window = f->ra_size ? f->ra_size * 2 : RA_MIN_CLUSTERS;
+    if (window > max)
+        window = max;
+    f->ra_size = window;
+    f->ra_mark = f->ra_next_index;
+    ra_issue(f, window);
+}
+
+/* Write `len` bytes starting `skip` bytes into `cluster`. Partial sectors
+ * are read, patched and written back whole. */
+static int write_cluster_data(uint32_t cluster, uint32_t skip,
+                              const uint8_t *src, uint32_t len)
+{
+    uint64_t lba = cluster_to_lba(cluster) + skip / fs.bytes_per_sector;
+    uint32_t off = skip % fs.bytes_per_sector;
+    uint8_t buf[BCACHE_BLOCK_SIZE];
+    while (len) {
+        uint32_t n = fs.bytes_per_sector - off;
+        if (n > len)
+            n = len;
+        if (n < fs.bytes_per_sector) {
+            if (bcache_read_range(lba, 1, buf))
+                return -1;
+            memcpy(buf + off, src, n);
+        } else {
+            memcpy(buf, src, n);
+        }
+        if (blkdev_write(fs.dev, lba, 1, buf))
+            return -1;
+        bcache_update(lba, buf);
+        src += n;
+        len -= n;
+        off = 0;
+        lba++;
+    }
+    return 0;
+}
+
+/* Copy `len` bytes starting `skip` bytes into `cluster`. */
+static int read_cluster_data(uint32_t cluster, uint32_t skip, uint8_t *dst,
+                             uint32_t len)
+{
+    uint64_t lba = cluster_to_lba(cluster) + skip / fs.bytes_per_sector;
+    uint32_t head = skip % fs.bytes_per_sector;
+    uint8_t buf[BCACHE_BLOCK_SIZE];
+    if (head) {
+        uint32_t n = fs.bytes_per_sector - head;
+        if (n > len)
+            n = len;
+        if (bcache_read_range(lba, 1, buf))
+            return -1;
+        memcpy(dst, buf + head, n);
+        dst += n;
+        len -= n;
+        lba++;
+    }
+    uint32_t full = len / fs.bytes_per_sector;
+    uint32_t tail = len % fs.bytes_per_sector;
+    if (full && bcache_read_range(lba, full, dst))
+        return -1;
+    if (tail) {
+        if (bcache_read_range(lba + full, 1, buf))
+            return -1;
+        memcpy(dst + (size_t)full * fs.bytes_per_sector, buf, tail);
+    }
+    return 0;
+}
+
+int fat32_mount(blkdev_t *dev)
 {
     uint8_t bs[512];
+    if (!dev || dev->block_size != BCACHE_BLOCK_SIZE)
+        return -1;
+    fs.dev = dev;
+    bcache_init(read_sectors);
+    /* faults on pages fat32_prefetch() is still reading wait on this */
+    pagecache_set_poll(fat32_poll);
     if (read_sectors(0, 1, bs))
         return -1;
     fs.bytes_per_sector = bs[11] | (bs[12] << 8);
@@ -56,11 +211,16 @@ int fat32_init(void)
     fs.root_cluster = bs[44] | (bs[45] << 8) | (bs[46] << 16) | (bs[47] << 24);
     fs.fat_start = reserved;
     fs.data_start = reserved + fats * fs.sectors_per_fat;
-    if (!fs.bytes_per_sector || !fs.sectors_per_cluster)
+    if (fs.bytes_per_sector != BCACHE_BLOCK_SIZE || !fs.sectors_per_cluster)
         return -1;
     return 0;
 }
 
+int fat32_init(void)
+{
+    return fat32_mount(blkdev_get_boot());
+}
+
 /* simple util functions */
 static size_t c_strlen(const char *s)
 {
@@ -133,8 +293,8 @@ static int read_directory(uint32_t cluster, const char *name,
     size_t lfn_len = 0;
     while (cur >= 2 && cur < 0x0FFFFFF8) {
         for (uint32_t sec = 0; sec < fs.sectors_per_cluster; sec++) {
-            uint8_t buf[512];
-            if (read_sectors(cluster_to_lba(cur) + sec, 1, buf))
+            uint8_t buf[BCACHE_BLOCK_SIZE];
+            if (bcache_read(cluster_to_lba(cur) + sec, buf))
                 return -1;
             for (uint32_t off = 0; off < fs.bytes_per_sector; off += 32) {
                 fat_dir_entry_t *ent = (fat_dir_entry_t *)(buf + off);
@@ -184,11 +344,15 @@ static int read_directory(uint32_t cluster, const char *name,
     return -1;
 }
 
-void *fat32_load_file(const char *path, uint32_t *size)
+int fat32_open(const char *path, fat32_file_t *file)
 {
-    if (!path || path[0] != '/')
-        return NULL;
+    if (!path || path[0] != '/' || !file)
+        return -1;
+    /* the boot disk only appears once the AHCI driver has been probed */
+    if (!fs.dev && fat32_init())
+        return -1;
     uint32_t cluster = fs.root_cluster;
+    uint32_t fsize = 0;
     const char *p = path + 1;
     char name[256];
     while (*p) {
@@ -198,42 +362,380 @@ void *fat32_load_file(const char *path, uint32_t *size)
             i++;
         }
         name[i] = '\0';
-        uint32_t next_cluster = 0, fsize = 0;
+        uint32_t next_cluster = 0;
         uint8_t attr = 0;
         if (read_directory(cluster, name, &next_cluster, &fsize, &attr))
-            return NULL;
+            return -1;
         if (p[i] == '/') {
             if (!(attr & 0x10))
-                return NULL; // not a directory
+                return -1; // not a directory
             cluster = next_cluster;
             p += i + 1;
         } else {
             if (attr & 0x10)
-                return NULL; // is a directory
+                return -1; // is a directory
             cluster = next_cluster;
-            if (size) *size = fsize;
             break;
         }
     }
     if (!cluster)
+        return -1;
+    ra_open(file, cluster, fsize);
+    return 0;
+}
+
+static uint32_t seek_cluster(fat32_file_t *f, uint32_t index)
+{
+    if (index < f->pos_index || is_eoc(f->pos_cluster)) {
+        f->pos_index = 0;
+        f->pos_cluster = f->first_cluster;
+    }
+    while (f->pos_index < index && !is_eoc(f->pos_cluster)) {
+        f->pos_cluster = fat_get_next(f->pos_cluster);
+        f->pos_index++;
+    }
+    return f->pos_cluster;
+}
+
+int fat32_read_at(fat32_file_t *f, uint32_t offset, void *buf, uint32_t len)
+{
+    if (!f || !buf || offset > f->size || len > f->size - offset)
+        return -1;
+    uint32_t cluster_bytes = fs.sectors_per_cluster * fs.bytes_per_sector;
+    uint8_t *dst = buf;
+    while (len) {
+        uint32_t index = offset / cluster_bytes;
+        uint32_t skip = offset % cluster_bytes;
+        uint32_t cur = seek_cluster(f, index);
+        if (is_eoc(cur))
+            return -1;
+        if (index != f->last_index)
+            ra_access(f, index, cur);
+        uint32_t chunk = cluster_bytes - skip;
+        if (chunk > len)
+            chunk = len;
+        if (read_cluster_data(cur, skip, dst, chunk))
+            return -1;
+        dst += chunk;
+        offset += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+int fat32_write_at(fat32_file_t *f, uint32_t offset, const void *buf,
+                   uint32_t len)
+{
+    if (!f || !buf || offset > f->size || len > f->size - offset)
+        return -1;
+    uint32_t cluster_bytes = fs.sectors_per_cluster * fs.bytes_per_sector;
+    const uint8_t *src = buf;
+    while (len) {
+        uint32_t index = offset / cluster_bytes;
+        uint32_t skip = offset % cluster_bytes;
+        uint32_t cur = seek_cluster(f, index);
+        if (is_eoc(cur))
+            return -1;
+        uint32_t chunk = cluster_bytes - skip;
+        if (chunk > len)
+            chunk = len;
+        if (write_cluster_data(cur, skip, src, chunk))
+            return -1;
+        src += chunk;
+        offset += chunk;
+        len -= chunk;
+    }
+    /* mappings read the file through the page cache */
+    pagecache_drop(f->first_cluster);
+    return 0;
+}
+
+void *fat32_load_file(const char *path, uint32_t *size)
+{
+    fat32_file_t file;
+    if (fat32_open(path, &file))
         return NULL;
-    uint32_t remaining = size ? *size : fsize;
-    uint8_t *buffer = kmalloc(remaining);
+    if (size) *size = file.size;
+    uint8_t *buffer = kmalloc(file.size);
     if (!buffer) return NULL;
-    uint8_t *ptr = buffer;
-    uint32_t cur = cluster;
-    while (remaining && cur >= 2 && cur < 0x0FFFFFF8) {
-        for (uint32_t sec = 0; sec < fs.sectors_per_cluster; sec++) {
-            uint64_t lba = cluster_to_lba(cur) + sec;
-            uint32_t to_read = fs.bytes_per_sector;
-            if (read_sectors(lba, 1, ptr)) { kfree(buffer); return NULL; }
-            ptr += to_read;
-            if (remaining <= to_read) { remaining = 0; break; }
-            remaining -= to_read;
-        }
-        if (remaining)
-            cur = fat_get_next(cur);
+    if (fat32_read_at(&file, 0, buffer, file.size)) {
+        kfree(buffer);
+        return NULL;
     }
-    if (remaining) { kfree(buffer); return NULL; }
     return buffer;
 }
+
+/* --- memory mapped files --- */
+
+static int map_fill(void *ctx, uint32_t index, void *page)
+{
+    fat32_file_t *f = ctx;
+    uint32_t off = index * (uint32_t)PAGE_SIZE;
+    memset(page, 0, PAGE_SIZE);
+    if (off >= f->size)
+        return 0;
+    uint32_t len = f->size - off;
+    if (len > PAGE_SIZE)
+        len = PAGE_SIZE;
+    return fat32_read_at(f, off, page, len);
+}
+
+static uint64_t map_fault(vm_area_t *area, uint64_t offset)
+{
+    fat32_file_t *f = area->priv;
+    void *page = pagecache_get(f->first_cluster, (uint32_t)(offset / PAGE_SIZE),
+                               map_fill, f);
+    return (uint64_t)(uintptr_t)page; /* page cache pages are identity mapped */
+}
+
+static void map_release(vm_area_t *area, uint64_t offset, uint64_t phys)
+{
+    fat32_file_t *f = area->priv;
+    (void)phys;
+    pagecache_put(f->first_cluster, (uint32_t)(offset / PAGE_SIZE));
+}
+
+static void map_close(vm_area_t *area)
+{
+    kfree(area->priv);
+}
+
+static void map_put(uint64_t key)
+{
+    pagecache_put((uint32_t)(key >> 32), (uint32_t)key);
+}
+
+/* Lend a page cache page to another mapping, e.g. module text. */
+static int map_hold(vm_area_t *area, uint64_t offset, vm_page_ref_t *ref)
+{
+    fat32_file_t *f = area->priv;
+    uint32_t index = (uint32_t)(offset / PAGE_SIZE);
+    void *page = pagecache_get(f->first_cluster, index, map_fill, f);
+    if (!page)
+        return -1;
+    ref->phys = (uint64_t)(uintptr_t)page;
+    ref->put = map_put;
+    ref->key = ((uint64_t)f->first_cluster << 32) | index;
+    return 0;
+}
+
+static const vm_ops_t fat32_vm_ops = {
+    .fault = map_fault,
+    .release = map_release,
+    .close = map_close,
+    .hold = map_hold,
+};
+
+void *fat32_mmap(const char *path, uint32_t *size)
+{
+    fat32_file_t *f = kmalloc(sizeof(fat32_file_t));
+    if (!f)
+        return NULL;
+    if (fat32_open(path, f) || !f->size) {
+        kfree(f);
+        return NULL;
+    }
+    vm_area_t *area = vm_map(f->size, VM_READ, &fat32_vm_ops, f);
+    if (!area) {
+        kfree(f);
+        return NULL;
+    }
+    if (size) *size = f->size;
+    return (void *)(uintptr_t)area->start;
+}
+
+void fat32_munmap(void *addr)
+{
+    vm_area_t *area = vm_find((uint64_t)(uintptr_t)addr);
+    if (area && area->ops == &fat32_vm_ops)
+        vm_unmap(area);
+}
+
+/* --- asynchronous prefetch --- */
+
+static uint32_t page_bytes(const fat32_file_t *f, uint32_t index)
+{
+    uint32_t off = index * (uint32_t)PAGE_SIZE;
+    return f->size - off < PAGE_SIZE ? f->size - off : PAGE_SIZE;
+}
+
+static void prefetch_free(fat32_prefetch_t *op)
+{
+    kfree(op->reqs);
+    kfree(op->pages);
+    kfree(op->cached);
+    kfree(op->req_page);
+    kfree(op->page_reqs);
+    op->reqs = NULL;
+    op->pages = NULL;
+    op->cached = NULL;
+    op->req_page = NULL;
+    op->page_reqs = NULL;
+}
+
+static void prefetch_finish(fat32_prefetch_t *op)
+{
+    fat32_file_t *f = &op->file;
+    for (uint32_t i = 0; i < op->npages; i++) {
+        if (op->pages[i])
+            pagecache_complete(f->first_cluster, i, op->status);
+        else if (op->cached && op->cached[i])
+            pagecache_put(f->first_cluster, i);
+    }
+    prefetch_free(op);
+    if (op->done)
+        op->done(op, op->status);
+}
+
+/* Every read of page `index` finished. */
+static void prefetch_page_ready(fat32_prefetch_t *op, uint32_t index)
+{
+    uint32_t n = page_bytes(&op->file, index);
+    /* sectors past the end of the file hold whatever was on disk */
+    if (n < PAGE_SIZE)
+        memset((uint8_t *)op->pages[index] + n, 0, PAGE_SIZE - n);
+    if (op->page)
+        op->page(op, index, op->pages[index], n);
+}
+
+static void prefetch_done(blk_request_t *req, int status)
+{
+    fat32_prefetch_t *op = req->priv;
+    if (status)
+        op->status = status;
+    uint32_t index = op->req_page[req - op->reqs];
+    if (--op->page_reqs[index] == 0)
+        prefetch_page_ready(op, index);
+    if (--op->pending == 0)
+        prefetch_finish(op);
+}
+
+/* Queue the reads for page `index`, extending the previous request when
+ * the next chunk continues it on disk and in the page. */
+static int prefetch_page(fat32_prefetch_t *op, uint32_t index, uint8_t *page,
+                         uint32_t *cluster, uint32_t *cluster_index)
+{
+    fat32_file_t *f = &op->file;
+    uint32_t cluster_bytes = fs.sectors_per_cluster * fs.bytes_per_sector;
+    uint32_t off = index * (uint32_t)PAGE_SIZE;
+    uint32_t end = f->size - off < PAGE_SIZE ? f->size : off + (uint32_t)PAGE_SIZE;
+    blk_request_t *prev = NULL;
+    while (off < end) {
+        uint32_t ci = off / cluster_bytes;
+        while (*cluster_index < ci && !is_eoc(*cluster)) {
+            *cluster = fat_get_next(*cluster);
+            (*cluster_index)++;
+        }
+        if (is_eoc(*cluster))
+            return -1;
+        uint32_t within = off % cluster_bytes;
+        uint32_t len = cluster_bytes - within;
+        if (len > end - off)
+            len = end - off;
+        uint32_t sectors = (len + fs.bytes_per_sector - 1) / fs.bytes_per_sector;
+        uint64_t lba = cluster_to_lba(*cluster) + within / fs.bytes_per_sector;
+        uint8_t *dst = page + (off - index * (uint32_t)PAGE_SIZE);
+        if (prev && prev->lba + prev->count == lba) {
+            prev->count += sectors;
+            prev->sg[0].len += sectors * fs.bytes_per_sector;
+        } else {
+            op->req_page[op->nreqs] = index;
+            op->page_reqs[index]++;
+            prev = &op->reqs[op->nreqs++];
+            blk_request_init(prev, BLK_OP_READ, lba, sectors);
+            blk_request_add_sg(prev, dst, sectors * fs.bytes_per_sector);
+            prev->done = prefetch_done;
+            prev->priv = op;
+        }
+        off += len;
+    }
+    return 0;
+}
+
+int fat32_prefetch(const char *path, fat32_prefetch_t *op,
+                   void (*done)(fat32_prefetch_t *op, int status), void *ctx)
+{
+    return fat32_stream(path, op, 0, NULL, done, ctx);
+}
+
+int fat32_stream(const char *path, fat32_prefetch_t *op, uint32_t tail,
+                 fat32_page_fn page,
+                 void (*done)(fat32_prefetch_t *op, int status), void *ctx)
+{
+    if (!op)
+        return -1;
+    memset(op, 0, sizeof(*op));
+    if (fat32_open(path, &op->file))
+        return -1;
+    fat32_file_t *f = &op->file;
+    uint32_t cluster_bytes = fs.sectors_per_cluster * fs.bytes_per_sector;
+    uint32_t per_page = cluster_bytes < PAGE_SIZE ? PAGE_SIZE / cluster_bytes : 1;
+    op->npages = (f->size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t max_reqs = op->npages * per_page;
+    op->pages = kmalloc(op->npages * sizeof(void *) + 1);
+    op->reqs = kmalloc(max_reqs * sizeof(blk_request_t) + 1);
+    op->req_page = kmalloc(max_reqs * sizeof(uint32_t) + 1);
+    op->page_reqs = kmalloc(op->npages * sizeof(uint16_t) + 1);
+    if (page)
+        op->cached = kmalloc(op->npages * sizeof(void *) + 1);
+    if (!op->pages || !op->reqs || !op->req_page || !op->page_reqs ||
+        (page && !op->cached)) {
+        prefetch_free(op);
+        return -1;
+    }
+    memset(op->page_reqs, 0, op->npages * sizeof(uint16_t));
+    if (op->cached)
+        memset(op->cached, 0, op->npages * sizeof(void *));
+    op->page = page;
+    op->done = done;
+    op->ctx = ctx;
+
+    uint32_t cluster = f->first_cluster, cluster_index = 0;
+    for (uint32_t i = 0; i < op->npages; i++) {
+        op->pages[i] = pagecache_reserve(f->first_cluster, i);
+        if (op->pages[i] &&
+            prefetch_page(op, i, op->pages[i], &cluster, &cluster_index))
+            op->status = -1;
+    }
+
+    /* the extra pending count keeps completions from finishing early */
+    op->pending = op->nreqs + 1;
+    /* the tail goes straight to the disk; the rest is submitted under a
+     * plug so the scheduler sees the whole file at once */
+    uint32_t tail_page = op->npages;
+    if (tail)
+        tail_page = f->size > tail ? (f->size - tail) / PAGE_SIZE : 0;
+    uint32_t first = 0;
+    while (first < op->nreqs && op->req_page[first] < tail_page)
+        first++;
+    for (uint32_t i = first; i < op->nreqs; i++) {
+        if (blkdev_submit(fs.dev, &op->reqs[i]))
+            prefetch_done(&op->reqs[i], -1);
+    }
+    iosched_plug(fs.dev);
+    for (uint32_t i = 0; i < first; i++) {
+        if (blkdev_submit(fs.dev, &op->reqs[i]))
+            prefetch_done(&op->reqs[i], -1);
+    }
+    iosched_unplug(fs.dev);
+
+    /* cached pages are handed over while the reads are in flight */
+    for (uint32_t i = 0; page && i < op->npages; i++) {
+        if (op->pages[i])
+            continue;
+        op->cached[i] = pagecache_get(f->first_cluster, i, map_fill, f);
+        if (op->cached[i])
+            page(op, i, op->cached[i], page_bytes(f, i));
+        else
+            op->status = -1;
+    }
+    if (--op->pending == 0)
+        prefetch_finish(op);
+    return 0;
+}
+
+void fat32_poll(void)
+{
+    if (fs.dev)
+        blkdev_poll(fs.dev);
+}
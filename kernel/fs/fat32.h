@@ -1,6 +1,75 @@
 #ifndef PHILLOS_FS_FAT32_H
 #define PHILLOS_FS_FAT32_H
 #include <stdint.h>
+struct blkdev;
+
+typedef struct fat32_file {
+    uint32_t first_cluster;
+    uint32_t size;
+    uint32_t pos_index;       /* cluster cursor for fat32_read_at */
+    uint32_t pos_cluster;
+    /* readahead state */
+    uint32_t cluster_count;   /* clusters covered by the file size */
+    uint32_t last_index;      /* last file-relative cluster read */
+    uint32_t ra_size;         /* current window, 0 before the first trigger */
+    uint32_t ra_mark;         /* index that triggers the next window */
+    uint32_t ra_next_index;   /* first index not yet prefetched */
+    uint32_t ra_next_cluster; /* cluster number at ra_next_index */
+} fat32_file_t;
+
 int fat32_init(void);
+int fat32_mount(struct blkdev *dev);
+int fat32_open(const char *path, fat32_file_t *file);
+int fat32_read_at(fat32_file_t *file, uint32_t offset, void *buf, uint32_t len);
 void *fat32_load_file(const char *path, uint32_t *size);
+/* Overwrite part of an existing file in place. Files never grow and no
+ * clusters are allocated, so state that must persist lives in a file
+ * created at its full size when the boot partition is built. */
+int fat32_write_at(fat32_file_t *file, uint32_t offset, const void *buf,
+                   uint32_t len);
+
+/* Map a file read-only into kernel address space. Pages come from the
+ * shared page cache and are read in on first access. */
+void *fat32_mmap(const char *path, uint32_t *size);
+void fat32_munmap(void *addr);
+
+/* Asynchronous prefetch of a whole file into the page cache. Every page
+ * not already cached is read with its own block requests, which are all
+ * submitted before fat32_prefetch() returns; done() runs from the block
+ * device's completion path once the last one finishes, or right away when
+ * the whole file was cached already. A later fat32_mmap() of the file
+ * then hits the page cache. */
+struct fat32_prefetch;
+typedef void (*fat32_page_fn)(struct fat32_prefetch *op, uint32_t index,
+                              const void *data, uint32_t len);
+
+typedef struct fat32_prefetch {
+    fat32_file_t file;
+    struct blk_request *reqs;
+    uint32_t nreqs;
+    uint32_t pending;
+    void **pages;             /* reserved pages, NULL where already cached */
+    void **cached;            /* streaming: held cached pages */
+    uint32_t *req_page;       /* page each request reads into */
+    uint16_t *page_reqs;      /* reads outstanding per page */
+    uint32_t npages;
+    int status;
+    fat32_page_fn page;
+    void (*done)(struct fat32_prefetch *op, int status);
+    void *ctx;
+} fat32_prefetch_t;
+
+int fat32_prefetch(const char *path, fat32_prefetch_t *op,
+                   void (*done)(fat32_prefetch_t *op, int status), void *ctx);
+/* Prefetch that also hands every page to page() as soon as it is in
+ * memory: cached pages right after the reads are issued, the others as
+ * their reads complete, so not in file order. `len` is the file data in
+ * the page and `data` stays valid until done() is called. The reads for
+ * the last `tail` bytes go out ahead of the rest so that a trailer such
+ * as a signature arrives first. */
+int fat32_stream(const char *path, fat32_prefetch_t *op, uint32_t tail,
+                 fat32_page_fn page,
+                 void (*done)(fat32_prefetch_t *op, int status), void *ctx);
+/* Drive outstanding prefetch I/O on the boot disk. */
+void fat32_poll(void);
 #endif // PHILLOS_FS_FAT32_H
@@ -0,0 +1,229 @@
+#include "pagecache.h"
+#include "../memory/alloc.h"
+#include <stddef.h>
+
+#define PC_HASH_SIZE 1024
+#define PC_NONE      (-1)
+
+typedef struct {
+    uint32_t file;
+    uint32_t index;
+    void *page;          /* NULL when the slot is free */
+    uint32_t refs;
+    int16_t next;        /* hash chain */
+    uint8_t referenced;  /* clock bit */
+    uint8_t pending;     /* reserved, contents not read yet */
+    uint8_t inflight;    /* ... and an asynchronous read is filling it */
+} pc_entry_t;
+
+static pc_entry_t entries[PAGECACHE_PAGES];
+static int16_t buckets[PC_HASH_SIZE];
+static int initialized = 0;
+static unsigned clock_hand = 0;
+static pagecache_stats_t stats;
+static void (*poll_fn)(void) = NULL;
+
+static unsigned hash_key(uint32_t file, uint32_t index)
+{
+    uint32_t h = file * 0x9E3779B1u ^ index;
+    return (h ^ (h >> 16)) & (PC_HASH_SIZE - 1);
+}
+
+static void init_once(void)
+{
+    if (initialized)
+        return;
+    for (unsigned i = 0; i < PC_HASH_SIZE; i++)
+        buckets[i] = PC_NONE;
+    for (unsigned i = 0; i < PAGECACHE_PAGES; i++)
+        entries[i].next = PC_NONE;
+    initialized = 1;
+}
+
+static int lookup(uint32_t file, uint32_t index)
+{
+    for (int i = buckets[hash_key(file, index)]; i != PC_NONE; i = entries[i].next) {
+        if (entries[i].file == file && entries[i].index == index)
+            return i;
+    }
+    return PC_NONE;
+}
+
+static void unlink_entry(int idx)
+{
+    int16_t *p = &buckets[hash_key(entries[idx].file, entries[idx].index)];
+    while (*p != PC_NONE) {
+        if (*p == idx) {
+            *p = entries[idx].next;
+            break;
+        }
+        p = &entries[*p].next;
+    }
+    entries[idx].next = PC_NONE;
+}
+
+/* Find a slot for a new page: a free slot, or an unreferenced page that
+ * has not been used since the last sweep. */
+static int claim_slot(void)
+{
+    for (unsigned n = 0; n < 2 * PAGECACHE_PAGES; n++) {
+        pc_entry_t *e = &entries[clock_hand];
+        int idx = (int)clock_hand;
+        clock_hand = (clock_hand + 1) % PAGECACHE_PAGES;
+        if (!e->page)
+            return idx;
+        if (e->refs)
+            continue;
+        if (e->referenced) {
+            e->referenced = 0;
+            continue;
+        }
+        unlink_entry(idx);
+        stats.evictions++;
+        stats.resident--;
+        return idx;
+    }
+    return PC_NONE;
+}
+
+void *pagecache_get(uint32_t file, uint32_t index,
+                    pagecache_fill_fn fill, void *ctx)
+{
+    init_once();
+    int idx = lookup(file, index);
+    if (idx != PC_NONE && entries[idx].pending) {
+        /* a second read into a page the device is still filling would
+         * race it; let that read land, holding a reference so nothing
+         * completing meanwhile evicts the page */
+        pc_entry_t *e = &entries[idx];
+        e->refs++;
+        e->referenced = 1;
+        while (e->inflight && poll_fn)
+            poll_fn();
+        if (e->inflight) {
+            e->refs--;
+            return NULL;
+        }
+        if (!e->pending) {
+            stats.hits++;
+            return e->page;
+        }
+        /* the asynchronous read failed; try again here */
+        if (!fill || fill(ctx, index, e->page)) {
+            e->refs--;
+            return NULL;
+        }
+        e->pending = 0;
+        stats.misses++;
+        return e->page;
+    }
+    if (idx != PC_NONE) {
+        entries[idx].refs++;
+        entries[idx].referenced = 1;
+        stats.hits++;
+        return entries[idx].page;
+    }
+
+    idx = claim_slot();
+    if (idx == PC_NONE)
+        return NULL;
+    pc_entry_t *e = &entries[idx];
+    if (!e->page) {
+        e->page = alloc_page();
+        if (!e->page)
+            return NULL;
+    }
+    if (!fill || fill(ctx, index, e->page)) {
+        free_page(e->page);
+        e->page = NULL;
+        return NULL;
+    }
+    e->file = file;
+    e->index = index;
+    e->refs = 1;
+    e->referenced = 1;
+    e->pending = 0;
+    e->inflight = 0;
+    unsigned h = hash_key(file, index);
+    e->next = buckets[h];
+    buckets[h] = (int16_t)idx;
+    stats.misses++;
+    stats.resident++;
+    return e->page;
+}
+
+void *pagecache_reserve(uint32_t file, uint32_t index)
+{
+    init_once();
+    if (lookup(file, index) != PC_NONE)
+        return NULL;
+    int idx = claim_slot();
+    if (idx == PC_NONE)
+        return NULL;
+    pc_entry_t *e = &entries[idx];
+    if (!e->page) {
+        e->page = alloc_page();
+        if (!e->page)
+            return NULL;
+    }
+    e->file = file;
+    e->index = index;
+    e->refs = 1;
+    e->referenced = 1;
+    e->pending = 1;
+    e->inflight = 1;
+    unsigned h = hash_key(file, index);
+    e->next = buckets[h];
+    buckets[h] = (int16_t)idx;
+    stats.resident++;
+    return e->page;
+}
+
+void pagecache_complete(uint32_t file, uint32_t index, int status)
+{
+    init_once();
+    int idx = lookup(file, index);
+    if (idx == PC_NONE)
+        return;
+    /* a failed read stays pending and is retried by the next get */
+    entries[idx].inflight = 0;
+    if (!status && entries[idx].pending) {
+        entries[idx].pending = 0;
+        stats.misses++;
+    }
+    if (entries[idx].refs)
+        entries[idx].refs--;
+}
+
+void pagecache_set_poll(void (*poll)(void))
+{
+    poll_fn = poll;
+}
+
+void pagecache_put(uint32_t file, uint32_t index)
+{
+    init_once();
+    int idx = lookup(file, index);
+    if (idx != PC_NONE && entries[idx].refs)
+        entries[idx].refs--;
+}
+
+void pagecache_drop(uint32_t file)
+{
+    init_once();
+    for (int i = 0; i < PAGECACHE_PAGES; i++) {
+        pc_entry_t *e = &entries[i];
+        if (!e->page || e->refs || e->file != file)
+            continue;
+        unlink_entry(i);
+        free_page(e->page);
+        e->page = NULL;
+        stats.resident--;
+    }
+}
+
+void pagecache_get_stats(pagecache_stats_t *out)
+{
+    if (out)
+        *out = stats;
+}
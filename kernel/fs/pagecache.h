@@ -0,0 +1,41 @@
+#ifndef PHILLOS_PAGECACHE_H
+#define PHILLOS_PAGECACHE_H
+
+#include <stdint.h>
+
+/* Page cache for file data. Pages are identified by a file id and a page
+ * index and shared by every mapping of that file. Unreferenced pages stay
+ * cached until the clock sweep needs their slot. */
+
+#define PAGECACHE_PAGES 2048
+
+/* Fill `page` (4 KiB) with file data for page `index`. */
+typedef int (*pagecache_fill_fn)(void *ctx, uint32_t index, void *page);
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint32_t resident;
+} pagecache_stats_t;
+
+/* Return the page for (file, index) with its reference count raised,
+ * reading it through `fill` on a miss. NULL when no page is available. */
+void *pagecache_get(uint32_t file, uint32_t index,
+                    pagecache_fill_fn fill, void *ctx);
+void pagecache_put(uint32_t file, uint32_t index);
+
+/* Asynchronous fill: reserve an empty, referenced page for (file, index)
+ * that the caller reads itself, then report the result with
+ * pagecache_complete(), which also drops the reference. Returns NULL when
+ * the page is already cached. A get() that finds the read still in flight
+ * drives `poll` until it completes, and reads the page itself only if
+ * that read failed. */
+void *pagecache_reserve(uint32_t file, uint32_t index);
+void pagecache_complete(uint32_t file, uint32_t index, int status);
+void pagecache_set_poll(void (*poll)(void));
+/* Drop every unreferenced page of `file`. */
+void pagecache_drop(uint32_t file);
+void pagecache_get_stats(pagecache_stats_t *out);
+
+#endif // PHILLOS_PAGECACHE_H
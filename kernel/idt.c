@@ -0,0 +1,80 @@
+#include "idt.h"
+#include "memory/vm.h"
+#include "debug.h"
+#include <stdint.h>
+
+/* Interrupt handlers must not touch SSE registers; the page fault handler
+ * saves the FPU/SSE state itself before calling into code that may. */
+#pragma GCC target("general-regs-only")
+
+typedef struct __attribute__((packed)) {
+    uint16_t offset_low;
+    uint16_t selector;
+    uint8_t ist;
+    uint8_t type_attr;
+    uint16_t offset_mid;
+    uint32_t offset_high;
+    uint32_t zero;
+} idt_entry_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t limit;
+    uint64_t base;
+} idt_ptr_t;
+
+#define IDT_ENTRIES     256
+#define VEC_PAGE_FAULT  14
+#define IDT_INTERRUPT   0x8E    /* present, DPL0, 64-bit interrupt gate */
+
+#define PF_PRESENT      0x1
+#define PF_WRITE        0x2
+
+static idt_entry_t idt[IDT_ENTRIES];
+
+struct interrupt_frame;
+
+__attribute__((interrupt))
+static void page_fault_handler(struct interrupt_frame *frame, uint64_t error)
+{
+    (void)frame;
+    uint8_t fpu[512] __attribute__((aligned(16)));
+    uint64_t addr;
+    __asm__ volatile("mov %%cr2, %0" : "=r"(addr));
+    __asm__ volatile("fxsave %0" : "=m"(fpu));
+    int handled = !(error & PF_PRESENT) &&
+                  vm_handle_fault(addr, (error & PF_WRITE) != 0) == 0;
+    if (!handled) {
+        debug_puts("page fault at 0x");
+        debug_puthex64(addr);
+        debug_puts(" error 0x");
+        debug_puthex((uint32_t)error);
+        debug_putc('\n');
+        for (;;)
+            __asm__ volatile("cli; hlt");
+    }
+    __asm__ volatile("fxrstor %0" :: "m"(fpu));
+}
+
+static void set_gate(int vec, void *handler, uint16_t selector)
+{
+    uint64_t addr = (uint64_t)handler;
+    idt[vec].offset_low = (uint16_t)addr;
+    idt[vec].selector = selector;
+    idt[vec].ist = 0;
+    idt[vec].type_attr = IDT_INTERRUPT;
+    idt[vec].offset_mid = (uint16_t)(addr >> 16);
+    idt[vec].offset_high = (uint32_t)(addr >> 32);
+    idt[vec].zero = 0;
+}
+
+void idt_init(void)
+{
+    uint16_t cs;
+    __asm__ volatile("mov %%cs, %0" : "=r"(cs));
+    set_gate(VEC_PAGE_FAULT, (void *)page_fault_handler, cs);
+    idt_ptr_t ptr = {
+        .limit = sizeof(idt) - 1,
+        .base = (uint64_t)idt,
+    };
+    __asm__ volatile("lidt %0" :: "m"(ptr));
+}
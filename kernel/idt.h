@@ -0,0 +1,8 @@
+#ifndef PHILLOS_IDT_H
+#define PHILLOS_IDT_H
+
+/* Install the kernel IDT. Only the page fault vector is handled so far;
+ * it services demand paging for vm areas (see memory/vm.h). */
+void idt_init(void);
+
+#endif // PHILLOS_IDT_H
@@ -3,11 +3,14 @@
 #include "memory/paging.h"
 #include "memory/alloc.h"
 #include "memory/heap.h"
-#include "../drivers/storage/ahci.h"
+#include "idt.h"
+#include "tsc.h"
 #include "fs/fat32.h"
 #include "../drivers/graphics/framebuffer.h"
 #include "../drivers/graphics/gpu.h"
 #include "../drivers/driver_manager.h"
+#include "../drivers/pci.h"
+#include "../drivers/pci_snapshot.h"
 #include "../drivers/register.h"
 #include "offline.h"
 #include "theme.h"
@@ -50,8 +53,13 @@ void kernel_main(boot_info_t *boot_info) {
     init_physical_memory(boot_info);
     init_paging();
     init_heap();
+    idt_init();
+    tsc_calibrate();
     if (boot_info->ai_size)
         init_ai_heap((void *)boot_info->ai_base, boot_info->ai_size);
+    pci_init(boot_info->acpi_rsdp);
+    pci_snapshot_set_boot_copy((const void *)boot_info->pcisnap_base,
+                               boot_info->pcisnap_size);
     drivers_register_all();
     fat32_init();
     offline_reload_cfg();
@@ -59,8 +67,12 @@ void kernel_main(boot_info_t *boot_info) {
     cursor_reload_cfg();
     gpu_reload_cfg();
     display_reload_cfg();
+    /* GPU drivers reprogram the framebuffer set up below; their init
+     * jobs wait until it is */
+    driver_manager_hold(DRIVER_DEP_FRAMEBUFFER);
     driver_manager_init();
     init_framebuffer(&boot_info->fb);
+    driver_manager_release(DRIVER_DEP_FRAMEBUFFER);
     fb_clear(theme_is_dark() ? 0x00000000 : 0x00FFFFFF);
     fb_fill_rect(20, 20, 100, 60, 0x0000FF00); // simple boot banner
     if (offline_is_enabled())
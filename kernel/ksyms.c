@@ -0,0 +1,95 @@
+#include "ksyms.h"
+#include "debug.h"
+#include "memory/heap.h"
+#include "memory/alloc.h"
+#include "memory/paging.h"
+#include "fs/fat32.h"
+#include "../drivers/driver_manager.h"
+#include "../drivers/storage/blkdev.h"
+#include <string.h>
+
+/* Export table. Lookups go through an open addressing index built on first
+ * use, so resolving an import costs one hash and usually one strcmp. */
+
+#define KSYM(sym) { #sym, (void *)&sym }
+
+static const ksym_t ksyms[] = {
+    KSYM(memset),
+    KSYM(memcpy),
+    KSYM(memmove),
+    KSYM(strlen),
+    KSYM(strcmp),
+    KSYM(strncmp),
+    KSYM(debug_putc),
+    KSYM(debug_puts),
+    KSYM(debug_puthex),
+    KSYM(debug_puthex64),
+    KSYM(kmalloc),
+    KSYM(kfree),
+    KSYM(alloc_page),
+    KSYM(free_page),
+    KSYM(map_identity_range),
+    KSYM(map_page),
+    KSYM(unmap_page),
+    KSYM(pci_config_read32),
+    KSYM(pci_config_write32),
+    KSYM(pci_find_capability),
+    KSYM(pci_find_ext_capability),
+    KSYM(driver_manager_register),
+    KSYM(driver_manager_unregister),
+    KSYM(driver_manager_add_listener),
+    KSYM(driver_manager_remove_listener),
+    KSYM(blkdev_register),
+    KSYM(blkdev_unregister),
+    KSYM(blkdev_find),
+    KSYM(blkdev_submit),
+    KSYM(blkdev_poll),
+    KSYM(blkdev_read),
+    KSYM(blkdev_write),
+    KSYM(blk_request_init),
+    KSYM(blk_request_add_sg),
+    KSYM(fat32_load_file),
+};
+
+#define KSYM_COUNT (sizeof(ksyms) / sizeof(ksyms[0]))
+#define KSYM_SLOTS 128  /* power of two, at least twice KSYM_COUNT */
+
+static int16_t slots[KSYM_SLOTS];
+static int indexed = 0;
+
+static uint32_t ksym_hash(const char *name)
+{
+    uint32_t h = 5381;
+    while (*name)
+        h = h * 33 + (unsigned char)*name++;
+    return h;
+}
+
+static void build_index(void)
+{
+    for (int i = 0; i < KSYM_SLOTS; i++)
+        slots[i] = -1;
+    for (unsigned i = 0; i < KSYM_COUNT; i++) {
+        uint32_t s = ksym_hash(ksyms[i].name) & (KSYM_SLOTS - 1);
+        while (slots[s] >= 0)
+            s = (s + 1) & (KSYM_SLOTS - 1);
+        slots[s] = (int16_t)i;
+    }
+    indexed = 1;
+}
+
+void *ksym_lookup(const char *name)
+{
+    if (!name)
+        return NULL;
+    if (!indexed)
+        build_index();
+    uint32_t s = ksym_hash(name) & (KSYM_SLOTS - 1);
+    while (slots[s] >= 0) {
+        const ksym_t *k = &ksyms[slots[s]];
+        if (strcmp(k->name, name) == 0)
+            return k->addr;
+        s = (s + 1) & (KSYM_SLOTS - 1);
+    }
+    return NULL;
+}
@@ -0,0 +1,14 @@
+#ifndef PHILLOS_KSYMS_H
+#define PHILLOS_KSYMS_H
+
+/* Kernel symbols that loadable modules may import. */
+
+typedef struct {
+    const char *name;
+    void *addr;
+} ksym_t;
+
+/* Address of the exported kernel symbol `name`, or NULL. */
+void *ksym_lookup(const char *name);
+
+#endif // PHILLOS_KSYMS_H
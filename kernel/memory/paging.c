@@ -17,6 +17,25 @@ static inline void zero_page(void *page) {
 }
 
 #define IDENTITY_MAP_SIZE (16 * 1024 * 1024ULL) /* map first 16 MiB */
+#define MSR_EFER  0xC0000080
+#define EFER_NXE  (1ULL << 11)
+
+static int nx_enabled = 0;
+
+static void enable_nx(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    __asm__ volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                     : "a"(0x80000001));
+    if (!(edx & (1u << 20)))
+        return;
+    uint32_t lo, hi;
+    __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(MSR_EFER));
+    uint64_t efer = ((uint64_t)hi << 32) | lo | EFER_NXE;
+    __asm__ volatile("wrmsr" :: "a"((uint32_t)efer), "d"((uint32_t)(efer >> 32)),
+                     "c"(MSR_EFER));
+    nx_enabled = 1;
+}
 
 void init_paging(void) {
     /* Allocate a fresh PML4 table */
@@ -26,6 +45,8 @@ void init_paging(void) {
 
     zero_page(pml4);
     kernel_pml4 = pml4;
+    /* PAGE_NX is reserved until EFER.NXE is set */
+    enable_nx();
 
     /* Identity map the low physical memory region used by the kernel */
     map_identity_range(0, IDENTITY_MAP_SIZE);
@@ -73,3 +94,65 @@ void map_identity_range(uint64_t phys_addr, uint64_t size)
         pt[pt_i] = addr | PAGE_FLAGS;
     }
 }
+
+static uint64_t *walk(uint64_t virt, int alloc)
+{
+    size_t pml4_i = (virt >> 39) & 0x1FF;
+    size_t pdpt_i = (virt >> 30) & 0x1FF;
+    size_t pd_i   = (virt >> 21) & 0x1FF;
+    size_t pt_i   = (virt >> 12) & 0x1FF;
+
+    if (!kernel_pml4)
+        return NULL;
+    if (!alloc) {
+        uint64_t *t = kernel_pml4;
+        size_t idx[3] = { pml4_i, pdpt_i, pd_i };
+        for (int l = 0; l < 3; l++) {
+            if (!(t[idx[l]] & PAGE_PRESENT))
+                return NULL;
+            t = (uint64_t *)(t[idx[l]] & ~0xFFFULL);
+        }
+        return &t[pt_i];
+    }
+    uint64_t *pdpt = get_or_alloc_table(kernel_pml4, pml4_i);
+    if (!pdpt) return NULL;
+    uint64_t *pd = get_or_alloc_table(pdpt, pdpt_i);
+    if (!pd) return NULL;
+    uint64_t *pt = get_or_alloc_table(pd, pd_i);
+    if (!pt) return NULL;
+    return &pt[pt_i];
+}
+
+static inline void invlpg(uint64_t virt)
+{
+    __asm__ volatile("invlpg (%0)" :: "r"(virt) : "memory");
+}
+
+int map_page(uint64_t virt, uint64_t phys, uint64_t flags)
+{
+    uint64_t *pte = walk(virt & ~0xFFFULL, 1);
+    if (!pte)
+        return -1;
+    if (!nx_enabled)
+        flags &= ~PAGE_NX;
+    *pte = (phys & ~0xFFFULL) | flags | PAGE_PRESENT;
+    invlpg(virt);
+    return 0;
+}
+
+void unmap_page(uint64_t virt)
+{
+    uint64_t *pte = walk(virt & ~0xFFFULL, 0);
+    if (!pte)
+        return;
+    *pte = 0;
+    invlpg(virt);
+}
+
+uint64_t paging_lookup(uint64_t virt)
+{
+    uint64_t *pte = walk(virt & ~0xFFFULL, 0);
+    if (!pte || !(*pte & PAGE_PRESENT))
+        return 0;
+    return (*pte & 0x000FFFFFFFFFF000ULL) | (virt & 0xFFF);
+}
@@ -5,9 +5,17 @@
 
 #define PAGE_PRESENT 0x1ULL
 #define PAGE_WRITE   0x2ULL
+#define PAGE_NX      (1ULL << 63)
+#define PAGE_SIZE    4096ULL
 
 void init_paging(void);
 void map_identity_range(uint64_t phys_addr, uint64_t size);
 int paging_is_initialized(void);
 
+/* Map a single 4 KiB page. Intermediate tables are allocated on demand. */
+int map_page(uint64_t virt, uint64_t phys, uint64_t flags);
+void unmap_page(uint64_t virt);
+/* Physical address backing `virt`, or 0 when it is not mapped. */
+uint64_t paging_lookup(uint64_t virt);
+
 #endif // PHILLOS_PAGING_H
@@ -0,0 +1,119 @@
+#include "vm.h"
+#include "paging.h"
+#include "heap.h"
+
+/* Areas are kept sorted by address. Address space is handed out first-fit
+ * from the gaps between areas, so unmapped ranges are reused. */
+
+static vm_area_t *areas = NULL;
+
+vm_area_t *vm_map(uint64_t size, uint32_t prot, const vm_ops_t *ops, void *priv)
+{
+    if (!size || !ops || !ops->fault)
+        return NULL;
+    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    /* leave an unmapped guard page after every area */
+    uint64_t start = VM_BASE;
+    vm_area_t **link = &areas;
+    while (*link) {
+        if (start + size + PAGE_SIZE <= (*link)->start)
+            break;
+        start = (*link)->start + (*link)->size + PAGE_SIZE;
+        link = &(*link)->next;
+    }
+    if (start + size > VM_LIMIT)
+        return NULL;
+
+    vm_area_t *area = kmalloc(sizeof(vm_area_t));
+    if (!area)
+        return NULL;
+    area->start = start;
+    area->size = size;
+    area->prot = prot;
+    area->ops = ops;
+    area->priv = priv;
+    area->next = *link;
+    *link = area;
+    return area;
+}
+
+void vm_unmap(vm_area_t *area)
+{
+    if (!area)
+        return;
+    for (uint64_t off = 0; off < area->size; off += PAGE_SIZE) {
+        uint64_t phys = paging_lookup(area->start + off);
+        if (!phys)
+            continue;
+        unmap_page(area->start + off);
+        if (area->ops->release)
+            area->ops->release(area, off, phys & ~(PAGE_SIZE - 1));
+    }
+    vm_area_t **link = &areas;
+    while (*link && *link != area)
+        link = &(*link)->next;
+    if (*link)
+        *link = area->next;
+    if (area->ops->close)
+        area->ops->close(area);
+    kfree(area);
+}
+
+vm_area_t *vm_find(uint64_t addr)
+{
+    for (vm_area_t *a = areas; a && a->start <= addr; a = a->next) {
+        if (addr < a->start + a->size)
+            return a;
+    }
+    return NULL;
+}
+
+static int fault_in(vm_area_t *area, uint64_t offset)
+{
+    uint64_t virt = area->start + offset;
+    if (paging_lookup(virt))
+        return 0;
+    uint64_t phys = area->ops->fault(area, offset);
+    if (!phys)
+        return -1;
+    uint64_t flags = PAGE_PRESENT;
+    if (area->prot & VM_WRITE)
+        flags |= PAGE_WRITE;
+    if (map_page(virt, phys, flags)) {
+        if (area->ops->release)
+            area->ops->release(area, offset, phys);
+        return -1;
+    }
+    return 0;
+}
+
+int vm_handle_fault(uint64_t addr, int write)
+{
+    vm_area_t *area = vm_find(addr);
+    if (!area)
+        return -1;
+    if (write && !(area->prot & VM_WRITE))
+        return -1;
+    return fault_in(area, (addr - area->start) & ~(PAGE_SIZE - 1));
+}
+
+int vm_populate(vm_area_t *area, uint64_t offset, uint64_t len)
+{
+    if (!area || offset + len > area->size)
+        return -1;
+    uint64_t end = offset + len;
+    for (uint64_t off = offset & ~(PAGE_SIZE - 1); off < end; off += PAGE_SIZE) {
+        if (fault_in(area, off))
+            return -1;
+    }
+    return 0;
+}
+
+int vm_hold_page(uint64_t addr, vm_page_ref_t *ref)
+{
+    vm_area_t *area = vm_find(addr);
+    if (!area || !ref || !area->ops->hold)
+        return -1;
+    return area->ops->hold(area, (addr - area->start) & ~(PAGE_SIZE - 1), ref);
+}
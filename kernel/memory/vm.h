@@ -0,0 +1,63 @@
+#ifndef PHILLOS_VM_H
+#define PHILLOS_VM_H
+
+#include <stdint.h>
+
+/* Kernel virtual memory areas outside the identity map. Pages of an area
+ * are populated on demand: the page fault handler asks the area's fault()
+ * callback for the physical page backing an offset and maps it. */
+
+#define VM_READ   0x1
+#define VM_WRITE  0x2
+#define VM_EXEC   0x4
+
+#define VM_BASE   0xFFFFC00000000000ULL
+#define VM_LIMIT  0xFFFFE00000000000ULL
+
+struct vm_area;
+
+/* A page borrowed from another area. It stays valid after that area is
+ * unmapped until put(key) is called; put is NULL for pages the holder
+ * allocated itself. */
+typedef struct vm_page_ref {
+    uint64_t phys;
+    void (*put)(uint64_t key);
+    uint64_t key;
+} vm_page_ref_t;
+
+typedef struct vm_ops {
+    /* Physical page for the page at `offset` within the area, 0 on error. */
+    uint64_t (*fault)(struct vm_area *area, uint64_t offset);
+    /* The page at `offset` was unmapped. */
+    void (*release)(struct vm_area *area, uint64_t offset, uint64_t phys);
+    /* The area is going away; drop `priv`. */
+    void (*close)(struct vm_area *area);
+    /* Optional: take a reference on the page at `offset` for another
+     * mapping. Returns 0 on success. */
+    int (*hold)(struct vm_area *area, uint64_t offset, vm_page_ref_t *ref);
+} vm_ops_t;
+
+typedef struct vm_area {
+    uint64_t start;
+    uint64_t size;
+    uint32_t prot;
+    const vm_ops_t *ops;
+    void *priv;
+    struct vm_area *next;
+} vm_area_t;
+
+/* Reserve `size` bytes of address space. Nothing is mapped until touched. */
+vm_area_t *vm_map(uint64_t size, uint32_t prot, const vm_ops_t *ops, void *priv);
+void vm_unmap(vm_area_t *area);
+vm_area_t *vm_find(uint64_t addr);
+
+/* Fault in the page holding `addr`. Returns 0 when the access may be
+ * retried, -1 when it is a genuine fault. */
+int vm_handle_fault(uint64_t addr, int write);
+/* Fault in every page of [offset, offset + len) up front. */
+int vm_populate(vm_area_t *area, uint64_t offset, uint64_t len);
+/* Borrow the page holding `addr` so it can be mapped a second time
+ * without copying. Fails for areas that cannot share their pages. */
+int vm_hold_page(uint64_t addr, vm_page_ref_t *ref);
+
+#endif // PHILLOS_VM_H
@@ -1,18 +1,249 @@
 #include "modules.h"
 #include "../fs/fat32.h"
 #include "../memory/heap.h"
+#include "../memory/paging.h"
 #include "../debug.h"
 #include "../security/signature.h"
+#include "../security/verify_cache.h"
+#include "../workqueue.h"
 #include <string.h>
 
-static module_t *module_list = NULL;
+/* Registry of loaded modules, hashed by path and by driver pointer. */
+static module_t *by_path[MODULE_HASH_SIZE];
+static module_t *by_driver[MODULE_HASH_SIZE];
 
-module_t *module_load(const char *path)
+static uint32_t path_hash(const char *path)
+{
+    uint32_t h = 5381;
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++)
+        h = h * 33 + *p;
+    return h & (MODULE_HASH_SIZE - 1);
+}
+
+static uint32_t driver_hash(const driver_t *drv)
+{
+    uint64_t v = (uint64_t)(uintptr_t)drv;
+    v ^= v >> 17;
+    v *= 0x9E3779B97F4A7C15ULL;
+    return (uint32_t)(v >> 58) & (MODULE_HASH_SIZE - 1);
+}
+
+static void registry_add(module_t *mod)
+{
+    uint32_t p = path_hash(mod->path);
+    uint32_t d = driver_hash(mod->driver);
+    mod->path_next = by_path[p];
+    by_path[p] = mod;
+    mod->driver_next = by_driver[d];
+    by_driver[d] = mod;
+}
+
+static void registry_remove(module_t *mod)
+{
+    for (module_t **p = &by_path[path_hash(mod->path)]; *p; p = &(*p)->path_next) {
+        if (*p == mod) {
+            *p = mod->path_next;
+            break;
+        }
+    }
+    for (module_t **p = &by_driver[driver_hash(mod->driver)]; *p;
+         p = &(*p)->driver_next) {
+        if (*p == mod) {
+            *p = mod->driver_next;
+            break;
+        }
+    }
+}
+
+module_t *module_find(const char *path)
 {
     if (!path)
         return NULL;
+    for (module_t *m = by_path[path_hash(path)]; m; m = m->path_next) {
+        if (strcmp(m->path, path) == 0)
+            return m;
+    }
+    return NULL;
+}
+
+module_t *module_find_by_driver(driver_t *drv)
+{
+    for (module_t *m = by_driver[driver_hash(drv)]; m; m = m->driver_next) {
+        if (m->driver == drv)
+            return m;
+    }
+    return NULL;
+}
+
+void module_hold(module_t *mod)
+{
+    if (mod)
+        mod->refs++;
+}
+
+/* Prelink cache. When a module is unloaded its relocated image stays
+ * mapped, keyed by the SHA-256 digest of the code it was built from.
+ * Loading a file whose code hashes to the same digest resets the image's
+ * writable pages and skips ELF parsing and relocation; the digest is
+ * still checked against the file's signature on every hit, which the
+ * verification cache answers without an RSA operation. A changed file
+ * hashes differently and never reaches a stale image.
+ *
+ * The cache lives in memory only. A relocated image holds the address
+ * its vm area got this boot, heap pointers for lazy binding and kernel
+ * symbol addresses, and nothing signs those pages, so writing them to
+ * the boot partition would hand unverified code pointers to the next
+ * boot. Across boots the signed manifest is what saves the RSA work. */
+
+typedef struct prelink {
+    struct prelink *next;
+    char path[64];
+    uint8_t digest[SHA256_DIGEST_LEN];
+    uint8_t sig[MODULE_SIG_LEN];   /* only a hint for background loads */
+    elf_image_t image;
+    driver_t driver;
+} prelink_t;
+
+static prelink_t *prelink_list = NULL;
+static uint32_t prelink_count = 0;
+static module_prelink_stats_t prelink_stats;
+
+static void prelink_free(prelink_t *e)
+{
+    elf_unload_image(&e->image);
+    kfree(e);
+}
+
+/* Take the image built from `digest`. Images of older versions of the
+ * same path can never hit again and are dropped on the way. */
+static prelink_t *prelink_take(const char *path, const uint8_t *digest)
+{
+    prelink_t *found = NULL;
+    for (prelink_t **p = &prelink_list; *p; ) {
+        prelink_t *e = *p;
+        if (!found && memcmp(e->digest, digest, SHA256_DIGEST_LEN) == 0) {
+            *p = e->next;
+            prelink_count--;
+            found = e;
+        } else if (strcmp(e->path, path) == 0) {
+            *p = e->next;
+            prelink_count--;
+            prelink_free(e);
+        } else {
+            p = &e->next;
+        }
+    }
+    return found;
+}
+
+/* Whether a background load of `path` is likely to hit: the signature
+ * block matches a cached image. The digest decides once it is known. */
+static int prelink_has(const char *path, const uint8_t *sig)
+{
+    for (prelink_t *e = prelink_list; e; e = e->next) {
+        if (strcmp(e->path, path) == 0 &&
+            memcmp(e->sig, sig, MODULE_SIG_LEN) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/* Keep an unloaded module's image for the next load, evicting the oldest
+ * entry when the cache is full. Returns -1 when the image was not kept. */
+static int prelink_store(module_t *mod)
+{
+    if (!mod->image.snapshot)
+        return -1;
+    prelink_t *e = kmalloc(sizeof(prelink_t));
+    if (!e)
+        return -1;
+    memset(e, 0, sizeof(prelink_t));
+    strncpy(e->path, mod->path, sizeof(e->path) - 1);
+    memcpy(e->digest, mod->digest, SHA256_DIGEST_LEN);
+    memcpy(e->sig, (const uint8_t *)mod->file_data + mod->file_size,
+           MODULE_SIG_LEN);
+    e->image = mod->image;
+    e->driver = mod->entry;
+    e->next = prelink_list;
+    prelink_list = e;
+    if (++prelink_count > MODULE_PRELINK_MAX) {
+        prelink_t **p = &prelink_list;
+        while ((*p)->next)
+            p = &(*p)->next;
+        prelink_free(*p);
+        *p = NULL;
+        prelink_count--;
+    }
+    return 0;
+}
+
+/* Verification done while a background load read the file: the leading
+ * `hashed` bytes of code folded into `hash`, and the signature opened in
+ * the meantime. */
+typedef struct {
+    uint32_t code_size;
+    uint32_t hashed;
+    sha256_ctx_t hash;
+    signature_opened_t opened;
+} module_check_t;
+
+static int check_module(const uint8_t *digest, const uint8_t *sig,
+                        const module_check_t *check)
+{
+    if (check && check->opened.valid)
+        return module_verify_opened(digest, &check->opened);
+    /* files verified earlier this boot are answered from the cache */
+    return module_verify_digest(digest, sig);
+}
+
+/* Relocate and snapshot a module that missed the prelink cache, and copy
+ * its driver_entry into `entry`. */
+static int link_module(const char *path, const void *data, uint32_t code_size,
+                       elf_image_t *img, driver_t *entry)
+{
+    if (elf_load_image(data, code_size, img)) {
+        debug_puts("module_load: bad ELF ");
+        debug_puts(path);
+        debug_putc('\n');
+        return -1;
+    }
+
+    size_t entry_size = 0;
+    const driver_t *drv = elf_lookup_object(img, "driver_entry", &entry_size);
+    if (!drv) {
+        debug_puts("module_load: no driver_entry in ");
+        debug_puts(path);
+        debug_putc('\n');
+        elf_unload_image(img);
+        return -1;
+    }
+    if (entry_size < DRIVER_MIN_SIZE) {
+        debug_puts("module_load: driver_t layout too old in ");
+        debug_puts(path);
+        debug_putc('\n');
+        elf_unload_image(img);
+        return -1;
+    }
+    /* fields added after the module was built stay 0 */
+    memset(entry, 0, sizeof(*entry));
+    memcpy(entry, drv, entry_size < sizeof(*entry) ? entry_size : sizeof(*entry));
+    /* without a snapshot the module still loads, it just is not cached */
+    elf_image_snapshot(img);
+    return 0;
+}
+
+static module_t *load_module(const char *path, const module_check_t *check)
+{
+    module_t *loaded = module_find(path);
+    if (loaded) {
+        loaded->refs++;
+        return loaded;
+    }
+
     uint32_t size = 0;
-    void *data = fat32_load_file(path, &size);
+    /* the file is mapped from the page cache, so repeated loads share the
+     * file pages instead of reading a private copy each time */
+    void *data = fat32_mmap(path, &size);
     if (!data) {
         debug_puts("module_load: failed ");
         debug_puts(path);
@@ -24,86 +255,311 @@ module_t *module_load(const char *path)
         debug_puts("module_load: no signature in ");
         debug_puts(path);
         debug_putc('\n');
-        kfree(data);
+        fat32_munmap(data);
         return NULL;
     }
     uint32_t code_size = size - MODULE_SIG_LEN;
     const uint8_t *sig = (const uint8_t *)data + code_size;
-    if (!verify_module_signature(data, code_size, sig)) {
-        debug_puts("module_load: bad signature in ");
-        debug_puts(path);
-        debug_putc('\n');
-        kfree(data);
-        return NULL;
+    uint8_t digest[SHA256_DIGEST_LEN];
+    if (check && check->code_size == code_size) {
+        /* a background load hashed what arrived while it was reading */
+        sha256_ctx_t ctx = check->hash;
+        sha256_update(&ctx, (const uint8_t *)data + check->hashed,
+                      code_size - check->hashed);
+        sha256_final(&ctx, digest);
+    } else {
+        sha256(data, code_size, digest);
     }
 
-    elf_image_t img;
-    if (elf_load_image(data, code_size, &img)) {
-        debug_puts("module_load: bad ELF ");
+    prelink_t *pre = prelink_take(path, digest);
+    if (!check_module(digest, sig, check)) {
+        debug_puts("module_load: bad signature in ");
         debug_puts(path);
         debug_putc('\n');
-        kfree(data);
+        if (pre)
+            prelink_free(pre);
+        fat32_munmap(data);
         return NULL;
     }
 
-    driver_t *drv = (driver_t *)elf_lookup_symbol(&img, "driver_entry");
-    if (!drv) {
-        debug_puts("module_load: no driver_entry in ");
-        debug_puts(path);
-        debug_putc('\n');
-        kfree(img.base);
-        kfree(data);
-        return NULL;
+    elf_image_t img;
+    driver_t entry;
+    if (pre) {
+        img = pre->image;
+        entry = pre->driver;
+        kfree(pre);
+        elf_image_reset(&img);
+        prelink_stats.hits++;
+    } else {
+        prelink_stats.misses++;
+        if (link_module(path, data, code_size, &img, &entry)) {
+            fat32_munmap(data);
+            return NULL;
+        }
     }
 
     module_t *mod = kmalloc(sizeof(module_t));
     if (!mod) {
-        kfree(img.base);
-        kfree(data);
+        elf_unload_image(&img);
+        fat32_munmap(data);
         return NULL;
     }
     memset(mod, 0, sizeof(module_t));
     strncpy(mod->path, path, sizeof(mod->path)-1);
     mod->file_data = data;
     mod->file_size = code_size;
+    memcpy(mod->digest, digest, SHA256_DIGEST_LEN);
     mod->image = img;
-    mod->driver = drv;
-
-    mod->next = module_list;
-    module_list = mod;
+    mod->entry = entry;
+    mod->driver = &mod->entry;
+    mod->refs = 1;
+    registry_add(mod);
 
-    driver_manager_register(drv);
+    driver_manager_register(mod->driver);
     return mod;
 }
 
-static void remove_from_list(module_t *mod)
+module_t *module_load(const char *path)
 {
-    module_t **p = &module_list;
-    while (*p) {
-        if (*p == mod) {
-            *p = mod->next;
-            return;
-        }
-        p = &(*p)->next;
-    }
+    if (!path)
+        return NULL;
+    return load_module(path, NULL);
 }
 
 void module_unload(module_t *mod)
 {
-    if (!mod)
+    if (!mod || !mod->refs || --mod->refs)
         return;
     driver_manager_unregister(mod->driver);
-    remove_from_list(mod);
-    kfree(mod->image.base);
-    kfree(mod->file_data);
+    registry_remove(mod);
+    if (prelink_store(mod))
+        elf_unload_image(&mod->image);
+    fat32_munmap(mod->file_data);
     kfree(mod);
 }
 
-module_t *module_find_by_driver(driver_t *drv)
+void module_get_prelink_stats(module_prelink_stats_t *out)
 {
-    for (module_t *m = module_list; m; m = m->next) {
-        if (m->driver == drv)
-            return m;
+    if (!out)
+        return;
+    *out = prelink_stats;
+    out->cached = prelink_count;
+}
+
+int module_load_manifest(const char *path)
+{
+    uint32_t size = 0;
+    void *data = fat32_load_file(path, &size);
+    if (!data)
+        return -1;
+    int ret = module_manifest_load(data, size);
+    kfree(data);
+    return ret;
+}
+
+/* --- background loading --- */
+
+typedef struct module_waiter {
+    module_done_fn done;
+    void *ctx;
+    struct module_waiter *next;
+} module_waiter_t;
+
+/* A background load verifies the file while it is being read: pages are
+ * hashed in file order as soon as the ones before them have arrived, and
+ * the signature pages are read first so the RSA step runs on the
+ * workqueue while the rest of the file is still on its way.
+ *
+ * Pages arrive in block completion context, which a page fault can reach
+ * through a synchronous read. The fault handler only saves FXSAVE state,
+ * so nothing there may touch the AVX registers the hash uses: arrival
+ * just records the page, and hash_work does the hashing. Pages still
+ * unhashed when the read finishes are hashed from the mapping when the
+ * module is linked. */
+typedef struct module_job {
+    struct module_job *next;
+    char path[64];
+    fat32_prefetch_t fetch;
+    work_t work;
+    work_t open_work;
+    work_t hash_work;
+    module_waiter_t *waiters;
+    const uint8_t **pages;      /* delivered, NULL once the read is done */
+    uint32_t next_page;         /* first page not folded into the hash */
+    uint32_t sig_have;          /* signature bytes copied so far */
+    int streaming;
+    uint8_t sig[MODULE_SIG_LEN];
+    module_check_t check;
+} module_job_t;
+
+static module_job_t *job_list = NULL;
+
+static void job_link(work_t *work)
+{
+    module_job_t *job = (module_job_t *)((char *)work - offsetof(module_job_t, work));
+    for (module_job_t **p = &job_list; *p; p = &(*p)->next) {
+        if (*p == job) {
+            *p = job->next;
+            break;
+        }
     }
-    return NULL;
+
+    /* the file is in the page cache now, so this links and hashes what
+     * is left; a failed stream falls back to hashing the mapping */
+    module_t *mod = load_module(job->path, job->streaming ? &job->check : NULL);
+    module_waiter_t *w = job->waiters;
+    for (int first = 1; w; first = 0) {
+        module_waiter_t *next = w->next;
+        if (mod && !first)
+            module_hold(mod);
+        w->done(mod, w->ctx);
+        kfree(w);
+        w = next;
+    }
+    kfree(job);
+}
+
+static void job_open(work_t *work)
+{
+    module_job_t *job = (module_job_t *)((char *)work - offsetof(module_job_t, open_work));
+    signature_open(job->sig, &job->check.opened);
+}
+
+/* Fold the pages that have arrived in order into the digest. */
+static void job_hash(work_t *work)
+{
+    module_job_t *job = (module_job_t *)((char *)work - offsetof(module_job_t, hash_work));
+    module_check_t *check = &job->check;
+    /* the pages are only valid until the read completes */
+    if (!job->pages)
+        return;
+    while (job->next_page < job->fetch.npages && job->pages[job->next_page]) {
+        uint32_t start = job->next_page * (uint32_t)PAGE_SIZE;
+        if (start < check->code_size) {
+            uint32_t n = check->code_size - start;
+            if (n > PAGE_SIZE)
+                n = PAGE_SIZE;
+            sha256_update(&check->hash, job->pages[job->next_page], n);
+            check->hashed += n;
+        }
+        job->next_page++;
+    }
+}
+
+static void job_page(fat32_prefetch_t *op, uint32_t index, const void *data,
+                     uint32_t len)
+{
+    module_job_t *job = op->ctx;
+    uint32_t size = op->file.size;
+    if (!job->streaming) {
+        /* too short to be signed: module_load reports it */
+        if (job->pages || size < MODULE_SIG_LEN)
+            return;
+        job->pages = kmalloc(op->npages * sizeof(uint8_t *));
+        if (!job->pages)
+            return;
+        memset(job->pages, 0, op->npages * sizeof(uint8_t *));
+        job->check.code_size = size - MODULE_SIG_LEN;
+        sha256_init(&job->check.hash);
+        work_init(&job->hash_work, job_hash);
+        job->streaming = 1;
+    }
+
+    uint32_t code_size = job->check.code_size;
+    uint32_t off = index * (uint32_t)PAGE_SIZE;
+    if (off + len > code_size) {
+        uint32_t from = off > code_size ? off : code_size;
+        uint32_t n = off + len - from;
+        memcpy(job->sig + (from - code_size), (const uint8_t *)data + (from - off), n);
+        job->sig_have += n;
+        /* a likely prelink hit is answered by the verification cache */
+        if (job->sig_have == MODULE_SIG_LEN &&
+            !prelink_has(job->path, job->sig)) {
+            work_init(&job->open_work, job_open);
+            workqueue_queue(&job->open_work);
+        }
+    }
+
+    job->pages[index] = data;
+    if (index == job->next_page)
+        workqueue_queue(&job->hash_work);
+}
+
+static void job_fetched(fat32_prefetch_t *op, int status)
+{
+    module_job_t *job = op->ctx;
+    /* page pointers die with the prefetch, so a hash_work still queued
+     * finds none; read errors surface when job_link maps the file */
+    kfree(job->pages);
+    job->pages = NULL;
+    if (status)
+        job->streaming = 0;
+    workqueue_queue(&job->work);
+}
+
+/* First stage: start the reads. Deferred to the workqueue so that a PCI
+ * scan queues every load before the first one touches the disk, which
+ * may itself only appear later in the same scan. */
+static void job_start(work_t *work)
+{
+    module_job_t *job = (module_job_t *)((char *)work - offsetof(module_job_t, work));
+    work_init(&job->work, job_link);
+    /* a missing file fails in job_link like any other load */
+    if (fat32_stream(job->path, &job->fetch, MODULE_SIG_LEN, job_page,
+                     job_fetched, job))
+        workqueue_queue(&job->work);
+}
+
+int module_load_async(const char *path, module_done_fn done, void *ctx)
+{
+    if (!path || !done)
+        return -1;
+    module_t *loaded = module_find(path);
+    if (loaded) {
+        loaded->refs++;
+        done(loaded, ctx);
+        return 0;
+    }
+
+    module_waiter_t *w = kmalloc(sizeof(module_waiter_t));
+    if (!w)
+        return -1;
+    w->done = done;
+    w->ctx = ctx;
+    w->next = NULL;
+
+    for (module_job_t *job = job_list; job; job = job->next) {
+        if (strcmp(job->path, path) == 0) {
+            module_waiter_t **p = &job->waiters;
+            while (*p)
+                p = &(*p)->next;
+            *p = w;
+            return 0;
+        }
+    }
+
+    module_job_t *job = kmalloc(sizeof(module_job_t));
+    if (!job) {
+        kfree(w);
+        return -1;
+    }
+    memset(job, 0, sizeof(module_job_t));
+    strncpy(job->path, path, sizeof(job->path) - 1);
+    job->waiters = w;
+    work_init(&job->work, job_start);
+    job->next = job_list;
+    job_list = job;
+    workqueue_queue(&job->work);
+    return 0;
+}
+
+void module_poll(void)
+{
+    fat32_poll();
+    workqueue_run();
+}
+
+int module_loads_pending(void)
+{
+    return job_list != NULL;
 }
@@ -2,19 +2,54 @@
 #define PHILLOS_MODULES_H
 
 #include "../elf.h"
+#include "../security/sha256.h"
 #include "../../drivers/driver_manager.h"
 
+/* Unloaded modules whose relocated images are kept for reuse. */
+#define MODULE_PRELINK_MAX 8
+
+typedef struct {
+    uint64_t hits;     /* loads served from the prelink cache */
+    uint64_t misses;   /* loads that verified and relocated the file */
+    uint32_t cached;
+} module_prelink_stats_t;
+
+#define MODULE_HASH_SIZE 64
+
 typedef struct module {
-    struct module *next;
+    struct module *path_next;    /* registry chains */
+    struct module *driver_next;
+    uint32_t refs;               /* devices and callers using the module */
     char path[64];
     void *file_data;
     uint32_t file_size;
+    uint8_t digest[SHA256_DIGEST_LEN];   /* of the code, keys the prelink cache */
     elf_image_t image;
-    driver_t *driver;
+    driver_t *driver;            /* &entry */
+    driver_t entry;              /* copy of the module's driver_entry */
 } module_t;
 
+/* Loaded modules are shared: loading a path that is already loaded returns
+ * the same instance with its reference count raised, and module_unload()
+ * only unloads once the last reference is dropped. */
 module_t *module_load(const char *path);
 void module_unload(module_t *mod);
+/* Take another reference on a loaded module. */
+void module_hold(module_t *mod);
+module_t *module_find(const char *path);
 module_t *module_find_by_driver(driver_t *drv);
+void module_get_prelink_stats(module_prelink_stats_t *out);
+/* Read and install a signed manifest of trusted module digests. */
+int module_load_manifest(const char *path);
+
+/* Background loading. The file is prefetched with asynchronous reads and
+ * verified and linked from the workqueue once it is in the page cache, so
+ * many loads keep the disk busy at once. done() receives a referenced
+ * module or NULL; requests for a path already in flight share one load. */
+typedef void (*module_done_fn)(module_t *mod, void *ctx);
+int module_load_async(const char *path, module_done_fn done, void *ctx);
+/* Drive outstanding loads: poll storage and run finished stages. */
+void module_poll(void);
+int module_loads_pending(void);
 
 #endif // PHILLOS_MODULES_H
@@ -2,6 +2,7 @@
 #include "memory/heap.h"
 #include "init.h"
 #include "../drivers/driver_manager.h"
+#include "../drivers/storage/iosched.h"
 
 static const uint32_t TOKEN_SECRET = 0x5a17c3e4;
 
@@ -13,11 +14,16 @@ static uint32_t sign_token(uint32_t nonce, uint32_t query)
     return hash;
 }
 
-int kernel_query(const kernel_query_request_t *req, kernel_query_response_t *res)
+int kernel_query_verify(const kernel_query_request_t *req)
 {
-    if (!req || !res)
+    if (!req || req->signature != sign_token(req->nonce, req->query))
         return -1;
-    if (req->signature != sign_token(req->nonce, req->query))
+    return 0;
+}
+
+int kernel_query(const kernel_query_request_t *req, kernel_query_response_t *res)
+{
+    if (!res || kernel_query_verify(req) != 0)
         return -1;
     switch (req->query) {
     case KERNEL_QUERY_HEAP_USAGE:
@@ -36,6 +42,15 @@ int kernel_query(const kernel_query_request_t *req, kernel_query_response_t *res
     case KERNEL_QUERY_NEXT_DEVICE_EVENT:
         res->result = kernel_pop_device_event(NULL) == 0 ? 1 : 0;
         return 0;
+    case KERNEL_QUERY_IO_STATS: {
+        uint32_t count = 0;
+        for (uint32_t i = 0; i < IOSCHED_MAX_DEVICES; i++) {
+            if (iosched_device(i))
+                count++;
+        }
+        res->result = count;
+        return 0;
+    }
     default:
         return -1;
     }
@@ -52,3 +67,28 @@ int kernel_pop_device_event(kernel_device_event_t *ev)
     }
     return 0;
 }
+
+int kernel_get_io_stats(uint32_t index, kernel_io_stats_t *out)
+{
+    blkdev_t *dev = iosched_device(index);
+    iosched_stats_t st;
+    if (!out || iosched_get_stats(dev, &st) != 0)
+        return -1;
+    out->index = index;
+    uint32_t n = 0;
+    while (dev->name && dev->name[n] && n < sizeof(out->name) - 1) {
+        out->name[n] = dev->name[n];
+        n++;
+    }
+    out->name[n] = '\0';
+    out->queue_depth = st.queued;
+    out->inflight = st.inflight;
+    out->max_queue_depth = st.max_queued;
+    out->merge_permille = st.submitted ?
+        (uint32_t)(st.merged * 1000 / st.submitted) : 0;
+    out->requests = st.submitted;
+    out->commands = st.dispatched;
+    for (int i = 0; i < KERNEL_IO_LAT_BUCKETS && i < IOSCHED_LAT_BUCKETS; i++)
+        out->latency_hist[i] = st.lat_hist[i];
+    return 0;
+}
@@ -8,6 +8,7 @@ typedef enum {
     KERNEL_QUERY_SCHED_STATS = 2,
     KERNEL_QUERY_AI_HEAP_USAGE = 3,
     KERNEL_QUERY_NEXT_DEVICE_EVENT = 4,
+    KERNEL_QUERY_IO_STATS = 5,
 } kernel_query_t;
 
 typedef struct {
@@ -29,6 +30,26 @@ typedef struct {
 
 int kernel_pop_device_event(kernel_device_event_t *ev);
 
+#define KERNEL_IO_LAT_BUCKETS 16
+
+typedef struct {
+    uint32_t index;            /* in: block device slot */
+    char name[16];
+    uint32_t queue_depth;      /* requests waiting in the I/O scheduler */
+    uint32_t inflight;         /* commands owned by the driver */
+    uint32_t max_queue_depth;
+    uint32_t merge_permille;   /* merged requests per 1000 submitted */
+    uint64_t requests;
+    uint64_t commands;
+    uint32_t latency_hist[KERNEL_IO_LAT_BUCKETS]; /* log2 TSC ticks from 2^11 */
+} kernel_io_stats_t;
+
+int kernel_get_io_stats(uint32_t index, kernel_io_stats_t *out);
+
+/* 0 if the request carries a valid signature for its nonce and query.
+ * kernel_query() checks this itself; callers that serve a query's extra
+ * payload without it must check first. */
+int kernel_query_verify(const kernel_query_request_t *req);
 int kernel_query(const kernel_query_request_t *req, kernel_query_response_t *res);
 
 #endif // PHILLOS_QUERY_H
@@ -14,6 +14,7 @@ typedef struct {
     kernel_query_request_t req;
     kernel_query_response_t res;
     kernel_device_event_t event;
+    kernel_io_stats_t io;
 } query_ioc_t;
 
 #define QUERY_IOCTL _IOWR('p', 1, query_ioc_t)
@@ -28,8 +29,8 @@ static uint32_t sign_token(uint32_t nonce, uint32_t query)
 
 int main(int argc, char **argv)
 {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <type>\n", argv[0]);
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "Usage: %s <type> [index]\n", argv[0]);
         return 1;
     }
 
@@ -42,6 +43,8 @@ int main(int argc, char **argv)
         req.query = KERNEL_QUERY_AI_HEAP_USAGE;
     } else if (strcmp(argv[1], "event") == 0) {
         req.query = KERNEL_QUERY_NEXT_DEVICE_EVENT;
+    } else if (strcmp(argv[1], "io") == 0) {
+        req.query = KERNEL_QUERY_IO_STATS;
     } else {
         fprintf(stderr, "Unknown query type\n");
         return 1;
@@ -57,7 +60,10 @@ int main(int argc, char **argv)
     }
 
     query_ioc_t ioc;
+    memset(&ioc, 0, sizeof(ioc));
     ioc.req = req;
+    if (argc == 3)
+        ioc.io.index = (uint32_t)strtoul(argv[2], NULL, 0);
 
     if (ioctl(fd, QUERY_IOCTL, &ioc) < 0) {
         perror("ioctl");
@@ -81,6 +87,21 @@ int main(int argc, char **argv)
         } else {
             printf("no event\n");
         }
+    } else if (req.query == KERNEL_QUERY_IO_STATS) {
+        if (ioc.res.result) {
+            printf("%s queued:%u inflight:%u max_queued:%u merged:%u.%u%% "
+                   "requests:%llu commands:%llu\nlatency:",
+                   ioc.io.name, ioc.io.queue_depth, ioc.io.inflight,
+                   ioc.io.max_queue_depth, ioc.io.merge_permille / 10,
+                   ioc.io.merge_permille % 10,
+                   (unsigned long long)ioc.io.requests,
+                   (unsigned long long)ioc.io.commands);
+            for (int i = 0; i < KERNEL_IO_LAT_BUCKETS; i++)
+                printf(" %u", ioc.io.latency_hist[i]);
+            printf("\n");
+        } else {
+            printf("no device\n");
+        }
     } else {
         printf("%llu\n", (unsigned long long)ioc.res.result);
     }
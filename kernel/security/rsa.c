@@ -0,0 +1,187 @@
+#include "rsa.h"
+#include <string.h>
+
+/* Multiplication uses the coarsely integrated operand scanning (CIOS)
+ * Montgomery method: each row of a * b[i] is followed immediately by one
+ * reduction step, so the accumulator never grows past RSA_LIMBS + 2 limbs.
+ * Squaring computes the cross products once, doubles them and reduces the
+ * full 4096-bit square afterwards. Only public key operations run here, so
+ * nothing tries to be constant time. */
+
+typedef unsigned __int128 u128;
+
+static int cmp_n(const uint64_t *a, const uint64_t *n)
+{
+    for (int i = RSA_LIMBS - 1; i >= 0; i--) {
+        if (a[i] != n[i])
+            return a[i] > n[i] ? 1 : -1;
+    }
+    return 0;
+}
+
+static uint64_t sub_n(uint64_t *r, const uint64_t *a, const uint64_t *n)
+{
+    uint64_t borrow = 0;
+    for (int i = 0; i < RSA_LIMBS; i++) {
+        u128 d = (u128)a[i] - n[i] - borrow;
+        r[i] = (uint64_t)d;
+        borrow = (uint64_t)(d >> 64) & 1;
+    }
+    return borrow;
+}
+
+int rsa_key_init(rsa_key_t *key, const uint64_t n[RSA_LIMBS])
+{
+    if (!key || !n || !(n[0] & 1) || !n[RSA_LIMBS - 1])
+        return -1;
+    memcpy(key->n, n, sizeof(key->n));
+
+    /* Newton iteration doubles the correct low bits each step; any odd
+     * n is its own inverse mod 8 */
+    uint64_t inv = n[0];
+    for (int i = 0; i < 5; i++)
+        inv *= 2 - n[0] * inv;
+    key->n0inv = -inv;
+
+    /* R^2 mod n = 2^4096 mod n by modular doubling of 1 */
+    uint64_t *x = key->rr;
+    memset(x, 0, sizeof(key->rr));
+    x[0] = 1;
+    for (int bit = 0; bit < 2 * RSA_BITS; bit++) {
+        uint64_t top = x[RSA_LIMBS - 1] >> 63;
+        for (int i = RSA_LIMBS - 1; i > 0; i--)
+            x[i] = x[i] << 1 | x[i - 1] >> 63;
+        x[0] <<= 1;
+        if (top || cmp_n(x, n) >= 0)
+            sub_n(x, x, n);
+    }
+    return 0;
+}
+
+void rsa_mont_mul(const rsa_key_t *key, uint64_t r[RSA_LIMBS],
+                  const uint64_t a[RSA_LIMBS], const uint64_t b[RSA_LIMBS])
+{
+    const uint64_t *n = key->n;
+    uint64_t t[RSA_LIMBS + 2];
+    memset(t, 0, sizeof(t));
+
+    for (int i = 0; i < RSA_LIMBS; i++) {
+        uint64_t carry = 0;
+        for (int j = 0; j < RSA_LIMBS; j++) {
+            u128 u = (u128)a[j] * b[i] + t[j] + carry;
+            t[j] = (uint64_t)u;
+            carry = (uint64_t)(u >> 64);
+        }
+        u128 u = (u128)t[RSA_LIMBS] + carry;
+        t[RSA_LIMBS] = (uint64_t)u;
+        t[RSA_LIMBS + 1] = (uint64_t)(u >> 64);
+
+        /* add m * n so the low limb becomes zero and shift it out */
+        uint64_t m = t[0] * key->n0inv;
+        u = (u128)m * n[0] + t[0];
+        carry = (uint64_t)(u >> 64);
+        for (int j = 1; j < RSA_LIMBS; j++) {
+            u = (u128)m * n[j] + t[j] + carry;
+            t[j - 1] = (uint64_t)u;
+            carry = (uint64_t)(u >> 64);
+        }
+        u = (u128)t[RSA_LIMBS] + carry;
+        t[RSA_LIMBS - 1] = (uint64_t)u;
+        t[RSA_LIMBS] = t[RSA_LIMBS + 1] + (uint64_t)(u >> 64);
+    }
+
+    if (t[RSA_LIMBS] || cmp_n(t, n) >= 0)
+        sub_n(t, t, n);
+    memcpy(r, t, RSA_LIMBS * sizeof(uint64_t));
+}
+
+void rsa_mont_sqr(const rsa_key_t *key, uint64_t r[RSA_LIMBS],
+                  const uint64_t a[RSA_LIMBS])
+{
+    const uint64_t *n = key->n;
+    uint64_t t[2 * RSA_LIMBS];
+    memset(t, 0, sizeof(t));
+
+    /* cross products a[i] * a[j] for i < j */
+    for (int i = 0; i < RSA_LIMBS - 1; i++) {
+        uint64_t carry = 0;
+        for (int j = i + 1; j < RSA_LIMBS; j++) {
+            u128 u = (u128)a[i] * a[j] + t[i + j] + carry;
+            t[i + j] = (uint64_t)u;
+            carry = (uint64_t)(u >> 64);
+        }
+        t[i + RSA_LIMBS] = carry;
+    }
+    /* double them; the sum is below 2^4095 so nothing shifts out */
+    for (int k = 2 * RSA_LIMBS - 1; k > 0; k--)
+        t[k] = t[k] << 1 | t[k - 1] >> 63;
+    t[0] <<= 1;
+    /* and add the squares on the diagonal */
+    uint64_t carry = 0;
+    for (int i = 0; i < RSA_LIMBS; i++) {
+        u128 u = (u128)a[i] * a[i] + t[2 * i] + carry;
+        t[2 * i] = (uint64_t)u;
+        u = (u128)t[2 * i + 1] + (uint64_t)(u >> 64);
+        t[2 * i + 1] = (uint64_t)u;
+        carry = (uint64_t)(u >> 64);
+    }
+
+    /* reduce one limb per row; `over` carries into the next row's top */
+    uint64_t over = 0;
+    for (int i = 0; i < RSA_LIMBS; i++) {
+        uint64_t m = t[i] * key->n0inv;
+        carry = 0;
+        for (int j = 0; j < RSA_LIMBS; j++) {
+            u128 u = (u128)m * n[j] + t[i + j] + carry;
+            t[i + j] = (uint64_t)u;
+            carry = (uint64_t)(u >> 64);
+        }
+        u128 u = (u128)t[i + RSA_LIMBS] + carry + over;
+        t[i + RSA_LIMBS] = (uint64_t)u;
+        over = (uint64_t)(u >> 64);
+    }
+
+    uint64_t *hi = t + RSA_LIMBS;
+    if (over || cmp_n(hi, n) >= 0)
+        sub_n(hi, hi, n);
+    memcpy(r, hi, RSA_LIMBS * sizeof(uint64_t));
+}
+
+int rsa_pow_f4(const rsa_key_t *key, uint64_t r[RSA_LIMBS],
+               const uint64_t a[RSA_LIMBS])
+{
+    if (cmp_n(a, key->n) >= 0)
+        return -1;
+
+    uint64_t am[RSA_LIMBS], x[RSA_LIMBS];
+    rsa_mont_mul(key, am, a, key->rr);
+    memcpy(x, am, sizeof(x));
+    for (int i = 0; i < 16; i++)
+        rsa_mont_sqr(key, x, x);
+    rsa_mont_mul(key, x, x, am);
+
+    /* multiplying by plain 1 strips the last factor of R */
+    uint64_t one[RSA_LIMBS] = { 1 };
+    rsa_mont_mul(key, r, x, one);
+    return 0;
+}
+
+void rsa_from_bytes(uint64_t r[RSA_LIMBS], const uint8_t *bytes)
+{
+    for (int i = 0; i < RSA_LIMBS; i++) {
+        const uint8_t *p = bytes + RSA_BYTES - 8 * (i + 1);
+        uint64_t v = 0;
+        for (int k = 0; k < 8; k++)
+            v = v << 8 | p[k];
+        r[i] = v;
+    }
+}
+
+void rsa_to_bytes(uint8_t *bytes, const uint64_t a[RSA_LIMBS])
+{
+    for (int i = 0; i < RSA_LIMBS; i++) {
+        uint8_t *p = bytes + RSA_BYTES - 8 * (i + 1);
+        for (int k = 0; k < 8; k++)
+            p[k] = (uint8_t)(a[i] >> (56 - 8 * k));
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef PHILLOS_RSA_H
+#define PHILLOS_RSA_H
+
+#include <stdint.h>
+
+/* Fixed size RSA-2048 public key operations. Numbers are 32 little-endian
+ * 64-bit limbs and all arithmetic happens in Montgomery form with
+ * R = 2^2048, so a reduction costs one extra pass of multiply-adds instead
+ * of a long division. */
+
+#define RSA_BITS   2048
+#define RSA_BYTES  (RSA_BITS / 8)
+#define RSA_LIMBS  (RSA_BITS / 64)
+
+typedef struct {
+    uint64_t n[RSA_LIMBS];
+    uint64_t rr[RSA_LIMBS];  /* R^2 mod n, converts into Montgomery form */
+    uint64_t n0inv;          /* -n^-1 mod 2^64 */
+} rsa_key_t;
+
+/* Precompute the Montgomery constants for an odd modulus. */
+int rsa_key_init(rsa_key_t *key, const uint64_t n[RSA_LIMBS]);
+
+/* r = a * b * R^-1 mod n. Inputs must be below n; r may alias either. */
+void rsa_mont_mul(const rsa_key_t *key, uint64_t r[RSA_LIMBS],
+                  const uint64_t a[RSA_LIMBS], const uint64_t b[RSA_LIMBS]);
+/* r = a * a * R^-1 mod n, sharing the cross products. */
+void rsa_mont_sqr(const rsa_key_t *key, uint64_t r[RSA_LIMBS],
+                  const uint64_t a[RSA_LIMBS]);
+
+/* r = a^65537 mod n as 16 squarings and one multiply. Fails if a >= n. */
+int rsa_pow_f4(const rsa_key_t *key, uint64_t r[RSA_LIMBS],
+               const uint64_t a[RSA_LIMBS]);
+
+/* Big-endian byte string of RSA_BYTES to limbs and back. */
+void rsa_from_bytes(uint64_t r[RSA_LIMBS], const uint8_t *bytes);
+void rsa_to_bytes(uint8_t *bytes, const uint64_t a[RSA_LIMBS]);
+
+#endif // PHILLOS_RSA_H
@@ -0,0 +1,438 @@
+#include "sha256.h"
+#include <string.h>
+#include <immintrin.h>
+
+/* Every implementation exposes the same block function over whole 64-byte
+ * blocks; sha256_update only copies the partial block at either end of a
+ * call. The SIMD paths are compiled with target attributes so the rest of
+ * the kernel keeps its baseline ISA; they run only after CPUID (and XCR0
+ * for AVX state) says they can. */
+
+typedef void (*blocks_fn)(uint32_t state[8], const uint8_t *data,
+                          size_t blocks);
+
+static const uint32_t K[64] = {
+    0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
+    0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+    0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
+    0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+    0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
+    0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+    0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
+    0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
+};
+
+static const uint32_t H0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+#define ROTRIGHT(a,b) (((a) >> (b)) | ((a) << (32-(b))))
+#define CH(x,y,z) (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x,y,z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define EP0(x) (ROTRIGHT(x,2) ^ ROTRIGHT(x,13) ^ ROTRIGHT(x,22))
+#define EP1(x) (ROTRIGHT(x,6) ^ ROTRIGHT(x,11) ^ ROTRIGHT(x,25))
+#define SIG0(x) (ROTRIGHT(x,7) ^ ROTRIGHT(x,18) ^ ((x) >> 3))
+#define SIG1(x) (ROTRIGHT(x,17) ^ ROTRIGHT(x,19) ^ ((x) >> 10))
+
+static uint32_t load_be32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+           (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+/* 64 rounds over a precomputed W[t] + K[t], read every `stride` words. */
+static void compress(uint32_t state[8], const uint32_t *wk, size_t stride)
+{
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + EP1(e) + CH(e,f,g) + wk[i * stride];
+        uint32_t t2 = EP0(a) + MAJ(a,b,c);
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+static void blocks_scalar(uint32_t state[8], const uint8_t *data,
+                          size_t blocks)
+{
+    uint32_t w[64];
+    for (; blocks; blocks--, data += SHA256_BLOCK_LEN) {
+        for (int i = 0; i < 16; i++)
+            w[i] = load_be32(data + i * 4);
+        for (int i = 16; i < 64; i++)
+            w[i] = SIG1(w[i-2]) + w[i-7] + SIG0(w[i-15]) + w[i-16];
+        for (int i = 0; i < 64; i++)
+            w[i] += K[i];
+        compress(state, w, 1);
+    }
+}
+
+/* ---- AVX2: eight message schedules per pass, one block per lane ---- */
+
+#define AVX2 __attribute__((target("avx2")))
+#define VROR(x,n) _mm256_or_si256(_mm256_srli_epi32(x, n), \
+                                  _mm256_slli_epi32(x, 32 - (n)))
+
+/* wk[t][lane] = W[t] + K[t] for the block at p[lane] */
+AVX2 static void schedule8(const uint8_t *const p[8], uint32_t wk[64][8])
+{
+    __m256i w[16];
+    for (int t = 0; t < 16; t++) {
+        w[t] = _mm256_setr_epi32(load_be32(p[0] + 4*t), load_be32(p[1] + 4*t),
+                                 load_be32(p[2] + 4*t), load_be32(p[3] + 4*t),
+                                 load_be32(p[4] + 4*t), load_be32(p[5] + 4*t),
+                                 load_be32(p[6] + 4*t), load_be32(p[7] + 4*t));
+        _mm256_store_si256((__m256i *)wk[t],
+                           _mm256_add_epi32(w[t], _mm256_set1_epi32(K[t])));
+    }
+    for (int t = 16; t < 64; t++) {
+        __m256i w2 = w[(t - 2) & 15], w15 = w[(t - 15) & 15];
+        __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(VROR(w2, 17), VROR(w2, 19)),
+                                      _mm256_srli_epi32(w2, 10));
+        __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(VROR(w15, 7), VROR(w15, 18)),
+                                      _mm256_srli_epi32(w15, 3));
+        __m256i v = _mm256_add_epi32(_mm256_add_epi32(s1, w[(t - 7) & 15]),
+                                     _mm256_add_epi32(s0, w[t & 15]));
+        w[t & 15] = v;
+        _mm256_store_si256((__m256i *)wk[t],
+                           _mm256_add_epi32(v, _mm256_set1_epi32(K[t])));
+    }
+}
+
+/* Single stream: schedule eight consecutive blocks at once, then run the
+ * dependent rounds in scalar code. */
+AVX2 static void blocks_avx2(uint32_t state[8], const uint8_t *data,
+                             size_t blocks)
+{
+    uint32_t wk[64][8] __attribute__((aligned(32)));
+    for (; blocks >= 8; blocks -= 8, data += 8 * SHA256_BLOCK_LEN) {
+        const uint8_t *p[8];
+        for (int j = 0; j < 8; j++)
+            p[j] = data + j * SHA256_BLOCK_LEN;
+        schedule8(p, wk);
+        for (int j = 0; j < 8; j++)
+            compress(state, &wk[0][j], 8);
+    }
+    blocks_scalar(state, data, blocks);
+}
+
+/* Multi-buffer: st[i][lane] is state word i of each lane's message. */
+AVX2 static void compress8(uint32_t st[8][8], const uint32_t wk[64][8])
+{
+    __m256i s[8];
+    for (int i = 0; i < 8; i++)
+        s[i] = _mm256_load_si256((const __m256i *)st[i]);
+    __m256i a = s[0], b = s[1], c = s[2], d = s[3];
+    __m256i e = s[4], f = s[5], g = s[6], h = s[7];
+
+    for (int t = 0; t < 64; t++) {
+        __m256i ep1 = _mm256_xor_si256(_mm256_xor_si256(VROR(e, 6), VROR(e, 11)),
+                                       VROR(e, 25));
+        __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f),
+                                      _mm256_andnot_si256(e, g));
+        __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, ep1),
+                                      _mm256_add_epi32(ch,
+                                          _mm256_load_si256((const __m256i *)wk[t])));
+        __m256i ep0 = _mm256_xor_si256(_mm256_xor_si256(VROR(a, 2), VROR(a, 13)),
+                                       VROR(a, 22));
+        __m256i maj = _mm256_xor_si256(_mm256_and_si256(a, b),
+                                       _mm256_and_si256(c, _mm256_xor_si256(a, b)));
+        __m256i t2 = _mm256_add_epi32(ep0, maj);
+        h = g;
+        g = f;
+        f = e;
+        e = _mm256_add_epi32(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm256_add_epi32(t1, t2);
+    }
+
+    s[0] = _mm256_add_epi32(s[0], a);
+    s[1] = _mm256_add_epi32(s[1], b);
+    s[2] = _mm256_add_epi32(s[2], c);
+    s[3] = _mm256_add_epi32(s[3], d);
+    s[4] = _mm256_add_epi32(s[4], e);
+    s[5] = _mm256_add_epi32(s[5], f);
+    s[6] = _mm256_add_epi32(s[6], g);
+    s[7] = _mm256_add_epi32(s[7], h);
+    for (int i = 0; i < 8; i++)
+        _mm256_store_si256((__m256i *)st[i], s[i]);
+}
+
+/* ---- SHA-NI: four rounds per pair of sha256rnds2 ---- */
+
+__attribute__((target("sha,sse4.1")))
+static void blocks_shani(uint32_t state[8], const uint8_t *data,
+                         size_t blocks)
+{
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                         0x0405060700010203ULL);
+    /* the instructions want the state as ABEF / CDGH */
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+    __m128i st1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+    __m128i st0 = _mm_alignr_epi8(tmp, st1, 8);
+    st1 = _mm_blend_epi16(st1, tmp, 0xF0);
+
+    for (; blocks; blocks--, data += SHA256_BLOCK_LEN) {
+        __m128i abef = st0, cdgh = st1;
+        __m128i m[4];
+#pragma GCC unroll 16
+        for (int g = 0; g < 16; g++) {
+            __m128i *cur = &m[g & 3];
+            if (g < 4)
+                *cur = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * g)),
+                                        bswap);
+            __m128i msg = _mm_add_epi32(*cur, _mm_loadu_si128((const __m128i *)&K[4 * g]));
+            st1 = _mm_sha256rnds2_epu32(st1, st0, msg);
+            if (g >= 3 && g <= 14) {
+                __m128i *next = &m[(g + 1) & 3];
+                *next = _mm_add_epi32(*next, _mm_alignr_epi8(*cur, m[(g + 3) & 3], 4));
+                *next = _mm_sha256msg2_epu32(*next, *cur);
+            }
+            st0 = _mm_sha256rnds2_epu32(st0, st1, _mm_shuffle_epi32(msg, 0x0E));
+            if (g >= 1 && g <= 12)
+                m[(g + 3) & 3] = _mm_sha256msg1_epu32(m[(g + 3) & 3], *cur);
+        }
+        st0 = _mm_add_epi32(st0, abef);
+        st1 = _mm_add_epi32(st1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(st0, 0x1B);
+    st1 = _mm_shuffle_epi32(st1, 0xB1);
+    _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, st1, 0xF0));
+    _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(st1, tmp, 8));
+}
+
+/* ---- implementation selection ---- */
+
+static blocks_fn blocks;
+static sha256_impl_t impl;
+
+static void cpuid(uint32_t leaf, uint32_t sub, uint32_t r[4])
+{
+    __asm__ volatile("cpuid" : "=a"(r[0]), "=b"(r[1]), "=c"(r[2]), "=d"(r[3])
+                     : "a"(leaf), "c"(sub));
+}
+
+static int has_impl(sha256_impl_t which)
+{
+    uint32_t r[4], leaf1[4];
+    cpuid(0, 0, r);
+    if (which == SHA256_IMPL_SCALAR)
+        return 1;
+    if (r[0] < 7)
+        return 0;
+    cpuid(1, 0, leaf1);
+    cpuid(7, 0, r);
+    if (which == SHA256_IMPL_SHANI)
+        return (r[1] & (1u << 29)) && (leaf1[2] & (1u << 19)) &&
+               (leaf1[2] & (1u << 9));
+    /* AVX2 also needs the OS to have enabled YMM state in XCR0 */
+    if (!(r[1] & (1u << 5)) || !(leaf1[2] & (1u << 27)) ||
+        !(leaf1[2] & (1u << 28)))
+        return 0;
+    uint32_t lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (lo & 6) == 6;
+}
+
+sha256_impl_t sha256_probe(void)
+{
+    if (has_impl(SHA256_IMPL_SHANI))
+        return SHA256_IMPL_SHANI;
+    if (has_impl(SHA256_IMPL_AVX2))
+        return SHA256_IMPL_AVX2;
+    return SHA256_IMPL_SCALAR;
+}
+
+int sha256_use(sha256_impl_t which)
+{
+    static const blocks_fn fns[] = {
+        [SHA256_IMPL_SCALAR] = blocks_scalar,
+        [SHA256_IMPL_AVX2] = blocks_avx2,
+        [SHA256_IMPL_SHANI] = blocks_shani,
+    };
+    if ((unsigned)which > SHA256_IMPL_SHANI || !has_impl(which))
+        return -1;
+    impl = which;
+    blocks = fns[which];
+    return 0;
+}
+
+sha256_impl_t sha256_current(void)
+{
+    if (!blocks)
+        sha256_use(sha256_probe());
+    return impl;
+}
+
+/* ---- streaming interface ---- */
+
+void sha256_init(sha256_ctx_t *ctx)
+{
+    if (!blocks)
+        sha256_use(sha256_probe());
+    memcpy(ctx->state, H0, sizeof(H0));
+    ctx->length = 0;
+    ctx->buflen = 0;
+}
+
+void sha256_update(sha256_ctx_t *ctx, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    ctx->length += len;
+    if (ctx->buflen) {
+        size_t n = SHA256_BLOCK_LEN - ctx->buflen;
+        if (n > len)
+            n = len;
+        memcpy(ctx->buf + ctx->buflen, p, n);
+        ctx->buflen += n;
+        p += n;
+        len -= n;
+        if (ctx->buflen < SHA256_BLOCK_LEN)
+            return;
+        blocks(ctx->state, ctx->buf, 1);
+        ctx->buflen = 0;
+    }
+    if (len >= SHA256_BLOCK_LEN) {
+        size_t n = len / SHA256_BLOCK_LEN;
+        blocks(ctx->state, p, n);
+        p += n * SHA256_BLOCK_LEN;
+        len -= n * SHA256_BLOCK_LEN;
+    }
+    memcpy(ctx->buf, p, len);
+    ctx->buflen = len;
+}
+
+void sha256_final(sha256_ctx_t *ctx, uint8_t out[SHA256_DIGEST_LEN])
+{
+    uint64_t bits = ctx->length * 8;
+    size_t n = ctx->buflen;
+    ctx->buf[n++] = 0x80;
+    if (n > 56) {
+        memset(ctx->buf + n, 0, SHA256_BLOCK_LEN - n);
+        blocks(ctx->state, ctx->buf, 1);
+        n = 0;
+    }
+    memset(ctx->buf + n, 0, 56 - n);
+    for (int i = 0; i < 8; i++)
+        ctx->buf[56 + i] = (uint8_t)(bits >> (56 - 8 * i));
+    blocks(ctx->state, ctx->buf, 1);
+
+    for (int i = 0; i < 8; i++) {
+        out[i*4]     = (ctx->state[i] >> 24) & 0xff;
+        out[i*4 + 1] = (ctx->state[i] >> 16) & 0xff;
+        out[i*4 + 2] = (ctx->state[i] >> 8) & 0xff;
+        out[i*4 + 3] = ctx->state[i] & 0xff;
+    }
+}
+
+void sha256(const void *data, size_t len, uint8_t out[SHA256_DIGEST_LEN])
+{
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, len);
+    sha256_final(&ctx, out);
+}
+
+/* Advance up to eight messages in lock step while at least two of them
+ * still have whole blocks left. Idle lanes rehash a live lane's block and
+ * their result is dropped. The tails finish through the streaming code. */
+AVX2 static void mb_group(const void *const data[], const size_t len[],
+                          int count, uint8_t out[][SHA256_DIGEST_LEN])
+{
+    uint32_t st[8][8] __attribute__((aligned(32)));
+    uint32_t keep[8][8] __attribute__((aligned(32)));
+    uint32_t wk[64][8] __attribute__((aligned(32)));
+    size_t left[8], done[8];
+    for (int j = 0; j < 8; j++) {
+        left[j] = j < count ? len[j] / SHA256_BLOCK_LEN : 0;
+        done[j] = 0;
+        for (int i = 0; i < 8; i++)
+            st[i][j] = H0[i];
+    }
+
+    for (;;) {
+        int live = 0, any = -1;
+        size_t step = SIZE_MAX;
+        for (int j = 0; j < count; j++) {
+            if (!left[j])
+                continue;
+            live++;
+            any = j;
+            if (left[j] < step)
+                step = left[j];
+        }
+        if (live < 2)
+            break;
+        for (; step; step--) {
+            const uint8_t *p[8];
+            for (int j = 0; j < 8; j++) {
+                int src = left[j] ? j : any;
+                p[j] = (const uint8_t *)data[src] + done[src] * SHA256_BLOCK_LEN;
+            }
+            memcpy(keep, st, sizeof(st));
+            schedule8(p, wk);
+            compress8(st, wk);
+            for (int j = 0; j < 8; j++) {
+                if (!left[j]) {
+                    for (int i = 0; i < 8; i++)
+                        st[i][j] = keep[i][j];
+                }
+            }
+            for (int j = 0; j < 8; j++) {
+                if (left[j]) {
+                    left[j]--;
+                    done[j]++;
+                }
+            }
+        }
+    }
+
+    for (int j = 0; j < count; j++) {
+        sha256_ctx_t ctx;
+        sha256_init(&ctx);
+        for (int i = 0; i < 8; i++)
+            ctx.state[i] = st[i][j];
+        size_t off = done[j] * SHA256_BLOCK_LEN;
+        ctx.length = off;
+        sha256_update(&ctx, (const uint8_t *)data[j] + off, len[j] - off);
+        sha256_final(&ctx, out[j]);
+    }
+}
+
+void sha256_mb(const void *const data[], const size_t len[], int count,
+               uint8_t out[][SHA256_DIGEST_LEN])
+{
+    /* SHA-NI on one stream outruns eight AVX2 lanes, so it stays serial */
+    if (sha256_current() != SHA256_IMPL_AVX2) {
+        for (int i = 0; i < count; i++)
+            sha256(data[i], len[i], out[i]);
+        return;
+    }
+    for (int base = 0; base < count; base += SHA256_MB_LANES) {
+        int n = count - base;
+        if (n > SHA256_MB_LANES)
+            n = SHA256_MB_LANES;
+        mb_group(&data[base], &len[base], n, &out[base]);
+    }
+}
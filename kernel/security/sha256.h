@@ -0,0 +1,44 @@
+#ifndef PHILLOS_SHA256_H
+#define PHILLOS_SHA256_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* SHA-256 hashing whole 64-byte blocks straight from the caller's buffer.
+ * The block function is picked once from CPUID: SHA-NI when present, else
+ * a scalar compression fed by an AVX2 message schedule, else plain C. */
+
+#define SHA256_DIGEST_LEN  32
+#define SHA256_BLOCK_LEN   64
+#define SHA256_MB_LANES    8    /* messages hashed together by sha256_mb */
+
+typedef enum {
+    SHA256_IMPL_SCALAR,
+    SHA256_IMPL_AVX2,
+    SHA256_IMPL_SHANI,
+} sha256_impl_t;
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;                 /* bytes hashed so far */
+    uint8_t buf[SHA256_BLOCK_LEN];   /* partial block only */
+    size_t buflen;
+} sha256_ctx_t;
+
+void sha256_init(sha256_ctx_t *ctx);
+void sha256_update(sha256_ctx_t *ctx, const void *data, size_t len);
+void sha256_final(sha256_ctx_t *ctx, uint8_t out[SHA256_DIGEST_LEN]);
+void sha256(const void *data, size_t len, uint8_t out[SHA256_DIGEST_LEN]);
+
+/* Hash `count` independent messages. With AVX2 up to SHA256_MB_LANES of
+ * them advance together, one message per vector lane. */
+void sha256_mb(const void *const data[], const size_t len[], int count,
+               uint8_t out[][SHA256_DIGEST_LEN]);
+
+/* Fastest implementation this CPU supports. */
+sha256_impl_t sha256_probe(void);
+/* Force an implementation; fails if the CPU lacks it. */
+int sha256_use(sha256_impl_t impl);
+sha256_impl_t sha256_current(void);
+
+#endif // PHILLOS_SHA256_H
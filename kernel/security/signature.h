@@ -3,9 +3,26 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "rsa.h"
 
 #define MODULE_SIG_LEN 256
 
 int verify_module_signature(const void *data, size_t size, const uint8_t *sig);
+/* Same check against an explicit public key. */
+int verify_signature_with(const rsa_key_t *key, const void *data, size_t size,
+                          const uint8_t *sig);
+/* Check a signature against a SHA-256 digest the caller already has. */
+int verify_digest_signature(const uint8_t *digest, const uint8_t *sig);
+
+/* verify_digest_signature() in two steps. Opening the signature is the
+ * RSA work and needs only the signature bytes, so it can run while the
+ * data it covers is still being read and hashed. */
+typedef struct {
+    uint64_t value[RSA_LIMBS];   /* sig^e mod n */
+    int valid;
+} signature_opened_t;
+
+int signature_open(const uint8_t *sig, signature_opened_t *out);
+int signature_matches(const signature_opened_t *opened, const uint8_t *digest);
 
 #endif // PHILLOS_SIGNATURE_H
@@ -0,0 +1,165 @@
+#include "verify_cache.h"
+#include "signature.h"
+#include "../memory/heap.h"
+#include "../debug.h"
+#include <string.h>
+
+/* The remembered digests form a small ring; once it is full the oldest
+ * entry makes room. A digest only enters it after the RSA check passed,
+ * and it names the exact bytes that were checked, so a hit trusts nothing
+ * new. Manifest digests stay in one sorted array for binary search. */
+
+static uint8_t cache[VERIFY_CACHE_SIZE][SHA256_DIGEST_LEN];
+static uint32_t cache_count = 0;
+static uint32_t cache_next = 0;
+
+static uint8_t (*manifest)[SHA256_DIGEST_LEN] = NULL;
+static uint32_t manifest_count = 0;
+
+static verify_cache_stats_t stats;
+
+static int cache_has(const uint8_t *digest)
+{
+    for (uint32_t i = 0; i < cache_count; i++) {
+        if (memcmp(cache[i], digest, SHA256_DIGEST_LEN) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+static void cache_add(const uint8_t *digest)
+{
+    memcpy(cache[cache_next], digest, SHA256_DIGEST_LEN);
+    cache_next = (cache_next + 1) % VERIFY_CACHE_SIZE;
+    if (cache_count < VERIFY_CACHE_SIZE)
+        cache_count++;
+}
+
+static int manifest_has(const uint8_t *digest)
+{
+    uint32_t lo = 0, hi = manifest_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int c = memcmp(manifest[mid], digest, SHA256_DIGEST_LEN);
+        if (c == 0)
+            return 1;
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return 0;
+}
+
+/* Accept a digest the cache or manifest already knows. */
+static int known(const uint8_t *digest)
+{
+    if (cache_has(digest)) {
+        stats.cache_hits++;
+        return 1;
+    }
+    if (manifest_has(digest)) {
+        stats.manifest_hits++;
+        return 1;
+    }
+    return 0;
+}
+
+static int checked(const uint8_t *digest, int ok)
+{
+    if (!ok) {
+        stats.rejected++;
+        return 0;
+    }
+    cache_add(digest);
+    return 1;
+}
+
+int module_verify(const void *data, size_t size, const uint8_t *sig)
+{
+    if (!data || !sig || size == 0)
+        return 0;
+
+    uint8_t digest[SHA256_DIGEST_LEN];
+    sha256(data, size, digest);
+    return module_verify_digest(digest, sig);
+}
+
+int module_verify_digest(const uint8_t *digest, const uint8_t *sig)
+{
+    if (!digest || !sig)
+        return 0;
+    if (known(digest))
+        return 1;
+    stats.rsa_verifies++;
+    return checked(digest, verify_digest_signature(digest, sig));
+}
+
+int module_verify_opened(const uint8_t *digest,
+                         const signature_opened_t *opened)
+{
+    if (!digest || !opened)
+        return 0;
+    if (known(digest))
+        return 1;
+    stats.rsa_verifies++;
+    return checked(digest, signature_matches(opened, digest));
+}
+
+int module_manifest_load(const void *data, size_t size)
+{
+    const module_manifest_hdr_t *hdr = data;
+    if (!data || size < sizeof(*hdr) + MODULE_SIG_LEN)
+        return -1;
+    size_t body = size - MODULE_SIG_LEN;
+    if (hdr->magic != MODULE_MANIFEST_MAGIC ||
+        hdr->count > MODULE_MANIFEST_MAX ||
+        body != sizeof(*hdr) + (size_t)hdr->count * SHA256_DIGEST_LEN)
+        return -1;
+
+    stats.rsa_verifies++;
+    if (!verify_module_signature(data, body, (const uint8_t *)data + body)) {
+        stats.rejected++;
+        debug_puts("manifest: bad signature\n");
+        return -1;
+    }
+
+    const uint8_t (*digests)[SHA256_DIGEST_LEN] =
+        (const void *)((const uint8_t *)data + sizeof(*hdr));
+    for (uint32_t i = 1; i < hdr->count; i++) {
+        if (memcmp(digests[i - 1], digests[i], SHA256_DIGEST_LEN) >= 0) {
+            debug_puts("manifest: digests not sorted\n");
+            return -1;
+        }
+    }
+
+    void *copy = NULL;
+    if (hdr->count) {
+        copy = kmalloc((size_t)hdr->count * SHA256_DIGEST_LEN);
+        if (!copy)
+            return -1;
+        memcpy(copy, digests, (size_t)hdr->count * SHA256_DIGEST_LEN);
+    }
+    kfree(manifest);
+    manifest = copy;
+    manifest_count = hdr->count;
+    return 0;
+}
+
+void verify_cache_get_stats(verify_cache_stats_t *out)
+{
+    if (!out)
+        return;
+    *out = stats;
+    out->cached = cache_count;
+    out->manifest_entries = manifest_count;
+}
+
+void verify_cache_flush(void)
+{
+    cache_count = 0;
+    cache_next = 0;
+    kfree(manifest);
+    manifest = NULL;
+    manifest_count = 0;
+}
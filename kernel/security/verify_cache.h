@@ -0,0 +1,53 @@
+#ifndef PHILLOS_VERIFY_CACHE_H
+#define PHILLOS_VERIFY_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sha256.h"
+#include "signature.h"
+
+/* Module verification with memory. Digests of files that passed the RSA
+ * check during this boot are remembered, so loading the same bytes again
+ * (a reload after hot-unplug and replug) costs one SHA-256 pass. A signed
+ * manifest can vouch for many digests at once for the price of a single
+ * RSA operation. */
+
+#define VERIFY_CACHE_SIZE      32
+#define MODULE_MANIFEST_PATH   "/modules/manifest"
+#define MODULE_MANIFEST_MAGIC  0x464D4D50   /* "PMMF" */
+#define MODULE_MANIFEST_MAX    4096
+
+/* Manifest file: this header, `count` digests in strictly ascending byte
+ * order, then a MODULE_SIG_LEN signature over everything before it. */
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+} module_manifest_hdr_t;
+
+typedef struct {
+    uint64_t cache_hits;     /* accepted by digest alone */
+    uint64_t manifest_hits;  /* accepted through the manifest */
+    uint64_t rsa_verifies;   /* full signature checks */
+    uint64_t rejected;
+    uint32_t cached;
+    uint32_t manifest_entries;
+} verify_cache_stats_t;
+
+/* Same contract as verify_module_signature(): 1 if trusted, 0 if not. */
+int module_verify(const void *data, size_t size, const uint8_t *sig);
+/* Same, for a caller that already hashed the file. */
+int module_verify_digest(const uint8_t *digest, const uint8_t *sig);
+
+/* Streaming form for a digest computed while the file was read and a
+ * signature opened in the meantime with signature_open(). */
+int module_verify_opened(const uint8_t *digest,
+                         const signature_opened_t *opened);
+
+/* Check and install a manifest, replacing any earlier one. */
+int module_manifest_load(const void *data, size_t size);
+
+void verify_cache_get_stats(verify_cache_stats_t *out);
+/* Forget every remembered digest and the manifest. */
+void verify_cache_flush(void);
+
+#endif // PHILLOS_VERIFY_CACHE_H
@@ -20,6 +20,15 @@ void *memmove(void *dest, const void *src, size_t n) {
     }
     return dest;
 }
+int memcmp(const void *a, const void *b, size_t n) {
+    const unsigned char *x = a;
+    const unsigned char *y = b;
+    for (size_t i = 0; i < n; i++) {
+        if (x[i] != y[i])
+            return x[i] - y[i];
+    }
+    return 0;
+}
 
 size_t strlen(const char *s) {
     size_t l = 0;
@@ -0,0 +1,103 @@
+#include "tsc.h"
+#include "debug.h"
+
+/* The invariant TSC runs at a fixed rate that CPUID reports directly on
+ * newer parts: leaf 0x15 gives the ratio to the core crystal (and, when
+ * filled in, the crystal frequency), leaf 0x16 the base frequency in MHz.
+ * Where neither is available the TSC is timed against PIT channel 2,
+ * whose input clock is fixed at 1.193182 MHz on every PC. Channel 2 is
+ * used because its gate and output are visible in port 0x61 and no
+ * interrupt has to be set up for it. */
+
+#define PIT_HZ          1193182u
+#define PIT_CH2         0x42
+#define PIT_CMD         0x43
+#define PIT_GATE        0x61
+#define PIT_GATE_CH2    0x01
+#define PIT_SPEAKER     0x02
+#define PIT_OUT_CH2     0x20
+#define PIT_CALIBRATE_MS 10
+#define TSC_MIN_HZ      100000000ULL   /* anything slower is a misread */
+
+static uint64_t hz = TSC_DEFAULT_HZ;
+
+static inline void outb(uint16_t port, uint8_t val)
+{
+    __asm__ volatile("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline uint8_t inb(uint16_t port)
+{
+    uint8_t val;
+    __asm__ volatile("inb %1, %0" : "=a"(val) : "Nd"(port));
+    return val;
+}
+
+static void cpuid(uint32_t leaf, uint32_t r[4])
+{
+    __asm__ volatile("cpuid" : "=a"(r[0]), "=b"(r[1]), "=c"(r[2]), "=d"(r[3])
+                     : "a"(leaf), "c"(0));
+}
+
+static uint64_t cpuid_hz(void)
+{
+    uint32_t r[4];
+    cpuid(0, r);
+    uint32_t max = r[0];
+    if (max >= 0x15) {
+        cpuid(0x15, r);
+        /* eax: denominator, ebx: numerator, ecx: crystal Hz or 0 */
+        if (r[0] && r[1] && r[2])
+            return (uint64_t)r[2] * r[1] / r[0];
+    }
+    if (max >= 0x16) {
+        cpuid(0x16, r);
+        if (r[0] & 0xFFFF)
+            return (uint64_t)(r[0] & 0xFFFF) * 1000000;
+    }
+    return 0;
+}
+
+/* Count TSC ticks across a one-shot countdown of PIT channel 2. */
+static uint64_t pit_hz(void)
+{
+    uint32_t count = PIT_HZ / 1000 * PIT_CALIBRATE_MS;
+    uint8_t gate = inb(PIT_GATE);
+    /* gate low while programming, speaker off */
+    outb(PIT_GATE, gate & ~(PIT_GATE_CH2 | PIT_SPEAKER));
+    outb(PIT_CMD, 0xB0);                 /* ch 2, lo/hi byte, mode 0 */
+    outb(PIT_CH2, count & 0xFF);
+    outb(PIT_CH2, count >> 8);
+    outb(PIT_GATE, (gate & ~PIT_SPEAKER) | PIT_GATE_CH2);
+
+    /* output goes high at terminal count. Without a PIT the port reads
+     * stuck high or low, which shows up as an implausible rate below */
+    uint64_t limit = 100 * (TSC_DEFAULT_HZ / 1000) * PIT_CALIBRATE_MS;
+    uint64_t start = tsc_read();
+    uint64_t ticks;
+    int done;
+    do {
+        done = inb(PIT_GATE) & PIT_OUT_CH2;
+        ticks = tsc_read() - start;
+    } while (!done && ticks < limit);
+    outb(PIT_GATE, gate);
+    uint64_t rate = ticks * 1000 / PIT_CALIBRATE_MS;
+    return done && rate >= TSC_MIN_HZ ? rate : 0;
+}
+
+void tsc_calibrate(void)
+{
+    uint64_t measured = cpuid_hz();
+    if (!measured)
+        measured = pit_hz();
+    if (measured)
+        hz = measured;
+    debug_puts("TSC: 0x");
+    debug_puthex64(hz);
+    debug_puts(" Hz\n");
+}
+
+uint64_t tsc_hz(void)
+{
+    return hz;
+}
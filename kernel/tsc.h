@@ -0,0 +1,30 @@
+#ifndef PHILLOS_TSC_H
+#define PHILLOS_TSC_H
+
+#include <stdint.h>
+
+/* Raw time stamp counter. The rate is measured once at boot by
+ * tsc_calibrate(); timeouts and intervals are given in milliseconds and
+ * converted with tsc_ms() so they hold on any clock speed. */
+static inline uint64_t tsc_read(void)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* Assumed until tsc_calibrate() has run, or if every method fails. */
+#define TSC_DEFAULT_HZ 2000000000ULL
+
+/* Measure the TSC rate: CPUID leaf 0x15, then leaf 0x16, then 10 ms of
+ * PIT channel 2. */
+void tsc_calibrate(void);
+/* TSC ticks per second. */
+uint64_t tsc_hz(void);
+
+static inline uint64_t tsc_ms(uint64_t ms)
+{
+    return tsc_hz() / 1000 * ms;
+}
+
+#endif // PHILLOS_TSC_H
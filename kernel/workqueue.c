@@ -0,0 +1,48 @@
+#include "workqueue.h"
+#include <stddef.h>
+
+static work_t *head = NULL;
+static work_t *tail = NULL;
+
+void work_init(work_t *work, work_fn fn)
+{
+    work->fn = fn;
+    work->next = NULL;
+    work->queued = 0;
+}
+
+int workqueue_queue(work_t *work)
+{
+    if (!work || !work->fn || work->queued)
+        return -1;
+    work->queued = 1;
+    work->next = NULL;
+    if (tail)
+        tail->next = work;
+    else
+        head = work;
+    tail = work;
+    return 0;
+}
+
+int workqueue_run(void)
+{
+    int ran = 0;
+    while (head) {
+        work_t *w = head;
+        head = w->next;
+        if (!head)
+            tail = NULL;
+        w->next = NULL;
+        w->queued = 0;
+        /* the item may free or requeue itself */
+        w->fn(w);
+        ran++;
+    }
+    return ran;
+}
+
+int workqueue_pending(void)
+{
+    return head != NULL;
+}
@@ -0,0 +1,27 @@
+#ifndef PHILLOS_WORKQUEUE_H
+#define PHILLOS_WORKQUEUE_H
+
+/* Deferred work. Items run to completion in FIFO order whenever the
+ * kernel calls workqueue_run(), currently from the main loop and from
+ * places that wait for background work. The kernel runs on one CPU
+ * without preemption, so an item never races another item; long jobs
+ * are split into stages that requeue themselves when their I/O lands. */
+
+struct work;
+typedef void (*work_fn)(struct work *work);
+
+typedef struct work {
+    work_fn fn;
+    struct work *next;
+    int queued;
+} work_t;
+
+void work_init(work_t *work, work_fn fn);
+/* Returns -1 when the item is already queued. */
+int workqueue_queue(work_t *work);
+/* Run every queued item, including ones queued while running. Returns
+ * the number of items run. */
+int workqueue_run(void);
+int workqueue_pending(void);
+
+#endif // PHILLOS_WORKQUEUE_H
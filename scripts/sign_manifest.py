@@ -0,0 +1,28 @@
+#!/usr/bin/env python3
+import sys, os, struct, hashlib, subprocess
+
+if len(sys.argv) < 4:
+    print("Usage: sign_manifest.py <private-key.pem> <manifest> <module.ko>...")
+    sys.exit(1)
+
+key, manifest, modules = sys.argv[1], sys.argv[2], sys.argv[3:]
+MAGIC = 0x464D4D50  # "PMMF"
+SIG_LEN = 256
+
+# digests cover the module contents without their own signature
+digests = set()
+for path in modules:
+    with open(path, 'rb') as f:
+        data = f.read()
+    if len(data) < SIG_LEN:
+        print(f"{path}: not signed")
+        sys.exit(1)
+    digests.add(hashlib.sha256(data[:-SIG_LEN]).digest())
+
+with open(manifest, 'wb') as f:
+    f.write(struct.pack('<II', MAGIC, len(digests)))
+    for d in sorted(digests):
+        f.write(d)
+
+sign = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'sign_module.py')
+subprocess.check_call([sys.executable, sign, key, manifest])
@@ -22,6 +22,7 @@ const KERNEL_QUERY_HEAP_USAGE: u32 = 1;
 const KERNEL_QUERY_SCHED_STATS: u32 = 2;
 const KERNEL_QUERY_AI_HEAP_USAGE: u32 = 3;
 const KERNEL_QUERY_NEXT_DEVICE_EVENT: u32 = 4;
+const KERNEL_QUERY_IO_STATS: u32 = 5;
 
 #[repr(C)]
 #[derive(Default, Clone)]
@@ -70,12 +71,27 @@ struct KernelDeviceEvent {
     dev: IDevice,
 }
 
+#[repr(C)]
+#[derive(Default, Clone)]
+struct KernelIoStats {
+    index: u32,
+    name: [u8; 16],
+    queue_depth: u32,
+    inflight: u32,
+    max_queue_depth: u32,
+    merge_permille: u32,
+    requests: u64,
+    commands: u64,
+    latency_hist: [u32; 16],
+}
+
 #[repr(C)]
 #[derive(Default, Clone)]
 struct QueryIoc {
     req: KernelQueryRequest,
     res: KernelQueryResponse,
     event: KernelDeviceEvent,
+    io: KernelIoStats,
 }
 
 static OFFLINE: Lazy<AtomicBool> = Lazy::new(|| AtomicBool::new(false));
@@ -429,6 +445,54 @@ fn next_device_event() -> Result<Option<DeviceEvent>, String> {
     }))
 }
 
+#[derive(Serialize)]
+#[serde(rename_all = "camelCase")]
+struct IoStats {
+    name: String,
+    queue_depth: u32,
+    inflight: u32,
+    max_queue_depth: u32,
+    merge_rate: f32,
+    requests: u64,
+    commands: u64,
+    latency_hist: Vec<u32>,
+}
+
+#[command]
+fn query_io_stats(index: u32) -> Result<Option<IoStats>, String> {
+    let mut ioc = QueryIoc::default();
+    ioc.req.query = KERNEL_QUERY_IO_STATS;
+    ioc.req.nonce = std::time::SystemTime::now()
+        .duration_since(std::time::UNIX_EPOCH)
+        .unwrap()
+        .as_secs() as u32;
+    ioc.req.signature = sign_token(ioc.req.nonce, ioc.req.query);
+    ioc.io.index = index;
+    let file = OpenOptions::new()
+        .read(true)
+        .write(true)
+        .open("/dev/phillos-query")
+        .map_err(|e| e.to_string())?;
+    let ret = unsafe { libc::ioctl(file.as_raw_fd(), QUERY_IOCTL, &mut ioc) };
+    if ret < 0 {
+        return Err("ioctl failed".into());
+    }
+    if ioc.res.result == 0 {
+        return Ok(None);
+    }
+    let len = ioc.io.name.iter().position(|&c| c == 0).unwrap_or(16);
+    Ok(Some(IoStats {
+        name: String::from_utf8_lossy(&ioc.io.name[..len]).into(),
+        queue_depth: ioc.io.queue_depth,
+        inflight: ioc.io.inflight,
+        max_queue_depth: ioc.io.max_queue_depth,
+        merge_rate: ioc.io.merge_permille as f32 / 1000.0,
+        requests: ioc.io.requests,
+        commands: ioc.io.commands,
+        latency_hist: ioc.io.latency_hist.to_vec(),
+    }))
+}
+
 #[command]
 fn offline_state() -> bool {
     OFFLINE.load(Ordering::Relaxed)
@@ -451,6 +515,7 @@ fn main() {
             smart_tags,
             query_scheduler,
             next_device_event,
+            query_io_stats,
             offline_state
         ])
         .run(tauri::generate_context!())
@@ -0,0 +1,433 @@
+#include "../../kernel/elf.h"
+#include "../../kernel/memory/paging.h"
+#include "../../kernel/memory/vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+/* Host test for the ELF loader. Loads the same shared object linked with
+ * GNU, SysV and both hash styles and checks every export against an
+ * independent walk of .dynsym from the section headers, then binds an
+ * object importing host symbols both lazily and with BIND_NOW and checks
+ * the page protections and sharing of its segments. */
+
+void *kmalloc(size_t size) { return malloc(size); }
+void kfree(void *ptr) { free(ptr); }
+void *alloc_page(void) { return aligned_alloc(PAGE_SIZE, PAGE_SIZE); }
+void free_page(void *page) { free(page); }
+
+/* Fake vm layer: an area is an RWX host mapping and "physical" pages are
+ * host pointers whose contents are copied in when populated. Page table
+ * entries are only recorded so protections can be checked. */
+#define MAX_PTES 1024
+
+static struct { uint64_t virt, phys, flags; } ptes[MAX_PTES];
+static int held, released;
+
+static int pte_find(uint64_t virt)
+{
+    for (int i = 0; i < MAX_PTES; i++) {
+        if (ptes[i].virt == (virt & ~(PAGE_SIZE - 1)))
+            return i;
+    }
+    return -1;
+}
+
+int map_page(uint64_t virt, uint64_t phys, uint64_t flags)
+{
+    int i = pte_find(virt);
+    if (i < 0)
+        i = pte_find(0);
+    if (i < 0)
+        return -1;
+    ptes[i].virt = virt & ~(PAGE_SIZE - 1);
+    ptes[i].phys = phys;
+    ptes[i].flags = flags | PAGE_PRESENT;
+    return 0;
+}
+
+void unmap_page(uint64_t virt)
+{
+    int i = pte_find(virt);
+    if (i >= 0)
+        memset(&ptes[i], 0, sizeof(ptes[i]));
+}
+
+uint64_t paging_lookup(uint64_t virt)
+{
+    int i = pte_find(virt);
+    return i < 0 ? 0 : ptes[i].phys;
+}
+
+static uint64_t pte_flags(uint64_t virt)
+{
+    int i = pte_find(virt);
+    return i < 0 ? 0 : ptes[i].flags;
+}
+
+vm_area_t *vm_map(uint64_t size, uint32_t prot, const vm_ops_t *ops, void *priv)
+{
+    vm_area_t *area = calloc(1, sizeof(vm_area_t));
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (!area || mem == MAP_FAILED) {
+        free(area);
+        return NULL;
+    }
+    area->start = (uint64_t)(uintptr_t)mem;
+    area->size = size;
+    area->prot = prot;
+    area->ops = ops;
+    area->priv = priv;
+    return area;
+}
+
+int vm_populate(vm_area_t *area, uint64_t offset, uint64_t len)
+{
+    for (uint64_t off = offset; off < offset + len; off += PAGE_SIZE) {
+        uint64_t phys = area->ops->fault(area, off);
+        if (!phys)
+            return -1;
+        memcpy((void *)(uintptr_t)(area->start + off), (void *)(uintptr_t)phys,
+               PAGE_SIZE);
+        map_page(area->start + off, phys, PAGE_WRITE);
+    }
+    return 0;
+}
+
+void vm_unmap(vm_area_t *area)
+{
+    if (!area)
+        return;
+    for (uint64_t off = 0; off < area->size; off += PAGE_SIZE) {
+        uint64_t phys = paging_lookup(area->start + off);
+        if (!phys)
+            continue;
+        unmap_page(area->start + off);
+        if (area->ops->release)
+            area->ops->release(area, off, phys);
+    }
+    if (area->ops->close)
+        area->ops->close(area);
+    munmap((void *)(uintptr_t)area->start, area->size);
+    free(area);
+}
+
+static void put_page(uint64_t key)
+{
+    (void)key;
+    released++;
+}
+
+/* every buffer handed to the loader is page aligned and can be shared */
+int vm_hold_page(uint64_t addr, vm_page_ref_t *ref)
+{
+    ref->phys = addr;
+    ref->put = put_page;
+    ref->key = addr;
+    held++;
+    return 0;
+}
+
+void debug_putc(char c) { (void)c; }
+void debug_puts(const char *s) { (void)s; }
+void debug_puthex(uint32_t v) { (void)v; }
+void debug_puthex64(uint64_t v) { (void)v; }
+
+typedef struct {
+    unsigned char e_ident[16];
+    uint16_t e_type, e_machine;
+    uint32_t e_version;
+    uint64_t e_entry, e_phoff, e_shoff;
+    uint32_t e_flags;
+    uint16_t e_ehsize, e_phentsize, e_phnum, e_shentsize, e_shnum, e_shstrndx;
+} ehdr_t;
+
+typedef struct {
+    uint32_t p_type, p_flags;
+    uint64_t p_offset, p_vaddr, p_paddr, p_filesz, p_memsz, p_align;
+} phdr_t;
+
+typedef struct {
+    uint32_t sh_name, sh_type;
+    uint64_t sh_flags, sh_addr, sh_offset, sh_size;
+    uint32_t sh_link, sh_info;
+    uint64_t sh_addralign, sh_entsize;
+} shdr_t;
+
+typedef struct {
+    uint32_t st_name;
+    unsigned char st_info, st_other;
+    uint16_t st_shndx;
+    uint64_t st_value, st_size;
+} sym_t;
+
+#define SHT_DYNSYM 11
+#define PT_LOAD      1
+#define PT_GNU_RELRO 0x6474e552
+#define PF_X         1
+#define PF_W         2
+
+static uint8_t *read_file(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    *size = (size_t)ftell(f);
+    fseek(f, 0, SEEK_SET);
+    size_t alloc = (*size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uint8_t *buf = aligned_alloc(PAGE_SIZE, alloc);
+    memset(buf, 0, alloc);
+    if (fread(buf, 1, *size, f) != *size) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    return buf;
+}
+
+/* expected address of `name` from the section headers, 0 if absent */
+static uint64_t expected(const uint8_t *file, const char *name, uint32_t *count)
+{
+    const ehdr_t *eh = (const ehdr_t *)file;
+    const shdr_t *sh = (const shdr_t *)(file + eh->e_shoff);
+    for (int i = 0; i < eh->e_shnum; i++) {
+        if (sh[i].sh_type != SHT_DYNSYM)
+            continue;
+        const sym_t *syms = (const sym_t *)(file + sh[i].sh_offset);
+        const char *str = (const char *)(file + sh[sh[i].sh_link].sh_offset);
+        uint32_t n = (uint32_t)(sh[i].sh_size / sizeof(sym_t));
+        if (count)
+            *count = n;
+        for (uint32_t j = 0; j < n; j++) {
+            if (syms[j].st_shndx && strcmp(str + syms[j].st_name, name) == 0)
+                return syms[j].st_value;
+        }
+    }
+    return 0;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double bench(const elf_image_t *img)
+{
+    char name[16];
+    const int rounds = 20;
+    volatile uintptr_t sink = 0;
+    double t0 = now_sec();
+    for (int r = 0; r < rounds; r++) {
+        for (int n = 100; n < 1000; n++) {
+            snprintf(name, sizeof(name), "fn_%d", n);
+            sink += (uintptr_t)elf_lookup_symbol(img, name);
+        }
+    }
+    (void)sink;
+    return rounds * 900 / (now_sec() - t0);
+}
+
+static int check(const char *path, int want_gnu, int want_sysv)
+{
+    size_t size = 0;
+    uint8_t *file = read_file(path, &size);
+    elf_image_t img;
+    if (!file || elf_load_image(file, size, &img)) {
+        fprintf(stderr, "%s: load failed\n", path);
+        return 1;
+    }
+    if (!!img.gnu_hash != want_gnu || !!img.hash != want_sysv) {
+        fprintf(stderr, "%s: unexpected hash tables\n", path);
+        return 1;
+    }
+    uint32_t dynsyms = 0;
+    expected(file, "driver_entry", &dynsyms);
+    if (img.sym_count != dynsyms) {
+        fprintf(stderr, "%s: sym_count %u, .dynsym has %u\n", path,
+                img.sym_count, dynsyms);
+        return 1;
+    }
+
+    char name[16];
+    for (int n = 100; n < 1000; n++) {
+        snprintf(name, sizeof(name), "fn_%d", n);
+        uint64_t value = expected(file, name, NULL);
+        if (!value ||
+            elf_lookup_symbol(&img, name) != (void *)(uintptr_t)(img.bias + value)) {
+            fprintf(stderr, "%s: %s resolved wrong\n", path, name);
+            return 1;
+        }
+    }
+    size_t entry_size = 0;
+    int *entry = elf_lookup_object(&img, "driver_entry", &entry_size);
+    if (!entry || *entry != 42 || entry_size != sizeof(int)) {
+        fprintf(stderr, "%s: driver_entry wrong\n", path);
+        return 1;
+    }
+    const char *missing[] = { "fn_1000", "fn_99", "", "driver_entr", "fn_1" };
+    for (size_t i = 0; i < sizeof(missing) / sizeof(missing[0]); i++) {
+        if (elf_lookup_symbol(&img, missing[i])) {
+            fprintf(stderr, "%s: found missing %s\n", path, missing[i]);
+            return 1;
+        }
+    }
+
+    if (img.gnu_hash && img.hash) {
+        /* a GNU table that rejects everything is not second-guessed by
+         * the SysV one */
+        static const uint32_t empty_gnu[4] = { 1, 1, 0, 6 };
+        elf_image_t gnu = img;
+        gnu.gnu_hash = empty_gnu;
+        if (elf_lookup_symbol(&gnu, "fn_500")) {
+            fprintf(stderr, "%s: SysV retried after a GNU miss\n", path);
+            return 1;
+        }
+    }
+
+    elf_image_t linear = img;
+    linear.hash = NULL;
+    linear.gnu_hash = NULL;
+    double hashed = bench(&img);
+    double scan = bench(&linear);
+    printf("%-18s %4u symbols  hashed %10.0f lookups/s  linear %10.0f lookups/s\n",
+           path, img.sym_count, hashed, scan);
+
+    elf_unload_image(&img);
+    free(file);
+    return 0;
+}
+
+int host_add(int a, int b) { return a + b; }
+int host_mul(int a, int b) { return a * b; }
+double host_scale(double x, double y) { return x * y; }
+int host_counter = 1234;
+
+void *ksym_lookup(const char *name)
+{
+    static const struct { const char *name; void *addr; } syms[] = {
+        { "host_add", (void *)host_add },
+        { "host_mul", (void *)host_mul },
+        { "host_scale", (void *)host_scale },
+        { "host_counter", &host_counter },
+    };
+    for (size_t i = 0; i < sizeof(syms) / sizeof(syms[0]); i++) {
+        if (strcmp(syms[i].name, name) == 0)
+            return syms[i].addr;
+    }
+    return NULL;
+}
+
+#define FAIL(...) do { fprintf(stderr, __VA_ARGS__); return 1; } while (0)
+
+/* W^X from p_flags, RELRO made read-only, read-only pages shared */
+static int check_pages(const char *path, const uint8_t *file,
+                       const elf_image_t *img)
+{
+    const ehdr_t *eh = (const ehdr_t *)file;
+    const phdr_t *ph = (const phdr_t *)(file + eh->e_phoff);
+    uint64_t relro_lo = 0, relro_hi = 0;
+    for (int i = 0; i < eh->e_phnum; i++) {
+        if (ph[i].p_type == PT_GNU_RELRO) {
+            relro_lo = ph[i].p_vaddr & ~(PAGE_SIZE - 1);
+            relro_hi = (ph[i].p_vaddr + ph[i].p_memsz) & ~(PAGE_SIZE - 1);
+        }
+    }
+    int shared = 0;
+    for (int i = 0; i < eh->e_phnum; i++) {
+        if (ph[i].p_type != PT_LOAD)
+            continue;
+        uint64_t pg = ph[i].p_vaddr & ~(PAGE_SIZE - 1);
+        for (; pg < ph[i].p_vaddr + ph[i].p_memsz; pg += PAGE_SIZE) {
+            uint64_t flags = pte_flags(img->bias + pg);
+            int w = (ph[i].p_flags & PF_W) && !(pg >= relro_lo && pg < relro_hi);
+            if (!(flags & PAGE_PRESENT) || !!(flags & PAGE_WRITE) != w ||
+                !!(flags & PAGE_NX) == !!(ph[i].p_flags & PF_X))
+                FAIL("%s: page 0x%lx flags 0x%lx\n", path, (unsigned long)pg,
+                     (unsigned long)flags);
+            uint64_t phys = paging_lookup(img->bias + pg);
+            if (phys == (uint64_t)(uintptr_t)(file + ph[i].p_offset -
+                                              ph[i].p_vaddr + pg))
+                shared++;
+        }
+    }
+    if (!shared || shared != held)
+        FAIL("%s: %d pages shared, %d held\n", path, shared, held);
+    return 0;
+}
+
+static int check_imports(const char *path, int lazy)
+{
+    size_t size = 0;
+    uint8_t *file = read_file(path, &size);
+    elf_image_t img;
+    held = released = 0;
+    if (!file || elf_load_image(file, size, &img))
+        FAIL("%s: load failed\n", path);
+    if (check_pages(path, file, &img) || elf_image_snapshot(&img))
+        FAIL("%s: snapshot failed\n", path);
+    free(file);
+
+    int (*call_add)(int, int) = elf_lookup_symbol(&img, "call_add");
+    int (*call_mul)(int, int) = elf_lookup_symbol(&img, "call_mul");
+    double (*call_scale)(double, double) = elf_lookup_symbol(&img, "call_scale");
+    int (*call_helper)(int) = elf_lookup_symbol(&img, "call_helper");
+    int (*read_counter)(void) = elf_lookup_symbol(&img, "read_counter");
+    int (*has_missing)(void) = elf_lookup_symbol(&img, "has_missing");
+    int **local_ptr = elf_lookup_symbol(&img, "local_ptr");
+    int (**add_ptr)(int, int) = elf_lookup_symbol(&img, "add_ptr");
+    if (!call_add || !call_mul || !call_scale || !call_helper ||
+        !read_counter || !has_missing || !local_ptr || !add_ptr)
+        FAIL("%s: missing export\n", path);
+
+    if (img.plt_count != 4)
+        FAIL("%s: %u PLT relocations\n", path, img.plt_count);
+    uint32_t bound = elf_plt_bound(&img);
+    if (bound != (lazy ? 0 : img.plt_count))
+        FAIL("%s: %u slots bound before first call\n", path, bound);
+
+    /* data relocations are always applied at load time */
+    if (**local_ptr != 7 || *add_ptr != host_add || read_counter() != 1234 ||
+        has_missing())
+        FAIL("%s: data relocation wrong\n", path);
+
+    if (call_add(2, 3) != 5 || call_add(40, 2) != 42)
+        FAIL("%s: call_add wrong\n", path);
+    if (lazy && elf_plt_bound(&img) != 1)
+        FAIL("%s: call_add bound %u slots\n", path, elf_plt_bound(&img));
+    if (call_scale(1.5, 4.0) != 6.0 || call_mul(6, 7) != 42 ||
+        call_helper(41) != 42 || call_helper(1) != 2)
+        FAIL("%s: PLT call wrong\n", path);
+    if (elf_plt_bound(&img) != img.plt_count)
+        FAIL("%s: %u of %u slots bound\n", path, elf_plt_bound(&img),
+             img.plt_count);
+
+    /* reuse without relocating: data and GOT return to their load state */
+    **local_ptr = 99;
+    if (elf_image_reset(&img) || **local_ptr != 7 ||
+        elf_plt_bound(&img) != (lazy ? 0 : img.plt_count) ||
+        call_add(20, 22) != 42 || *add_ptr != host_add)
+        FAIL("%s: reset image wrong\n", path);
+
+    elf_unload_image(&img);
+    if (img.base || img.self || released != held)
+        FAIL("%s: unload left state behind\n", path);
+    return 0;
+}
+
+int main(void)
+{
+    int rc = check("fixture_gnu.so", 1, 0) ||
+             check("fixture_sysv.so", 0, 1) ||
+             check("fixture_both.so", 1, 1) ||
+             check_imports("import_lazy.so", 1) ||
+             check_imports("import_now.so", 0);
+    if (!rc)
+        printf("elf tests passed\n");
+    return rc;
+}
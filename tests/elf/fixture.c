@@ -0,0 +1,10 @@
+/* Shared object with a large export table for the ELF loader test. */
+#define S(a, b, c) int fn_##a##b##c(void) { return a##b##c; }
+#define D(a, b) S(a, b, 0) S(a, b, 1) S(a, b, 2) S(a, b, 3) S(a, b, 4) \
+                S(a, b, 5) S(a, b, 6) S(a, b, 7) S(a, b, 8) S(a, b, 9)
+#define C(a) D(a, 0) D(a, 1) D(a, 2) D(a, 3) D(a, 4) \
+             D(a, 5) D(a, 6) D(a, 7) D(a, 8) D(a, 9)
+
+C(1) C(2) C(3) C(4) C(5) C(6) C(7) C(8) C(9)
+
+int driver_entry = 42;
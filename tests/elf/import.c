@@ -0,0 +1,19 @@
+/* Shared object importing kernel symbols for the relocation test. */
+extern int host_add(int a, int b);
+extern int host_mul(int a, int b);
+extern double host_scale(double x, double y);
+extern int host_counter;
+extern int host_missing(void) __attribute__((weak));
+
+static int local_value = 7;
+int *local_ptr = &local_value;
+int (*add_ptr)(int, int) = host_add;
+
+int helper(int x) { return x + 1; }
+
+int call_add(int a, int b) { return host_add(a, b); }
+int call_mul(int a, int b) { return host_mul(a, b); }
+double call_scale(double x, double y) { return host_scale(x, y); }
+int call_helper(int x) { return helper(x); }
+int read_counter(void) { return host_counter; }
+int has_missing(void) { return host_missing != 0; }
@@ -0,0 +1,587 @@
+#include "../../kernel/fs/fat32.h"
+#include "../../kernel/fs/bcache.h"
+#include "../../kernel/fs/pagecache.h"
+#include "../../kernel/memory/vm.h"
+#include "../../drivers/storage/blkdev_file.h"
+#include "../../drivers/storage/iosched.h"
+#include "../../kernel/tsc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Host test for the FAT32 reader. Builds a small FAT32 image (or uses one
+ * passed on the command line), serves it through the file-backed block
+ * device and checks file contents, readahead behaviour, memory mapped
+ * access, asynchronous prefetch, in-place writes and throughput. */
+
+void *kmalloc(size_t size) { return malloc(size); }
+void kfree(void *ptr) { free(ptr); }
+void debug_putc(char c) { (void)c; }
+void debug_puts(const char *s) { (void)s; }
+void debug_puthex(uint32_t v) { (void)v; }
+void debug_puthex64(uint64_t v) { (void)v; }
+uint64_t tsc_hz(void) { return TSC_DEFAULT_HZ; }
+void *alloc_page(void) { return aligned_alloc(4096, 4096); }
+void free_page(void *p) { free(p); }
+
+/* page table model: host pages stand in for physical memory */
+#define MAX_MAPPED 4096
+static struct { uint64_t virt, phys; } ptes[MAX_MAPPED];
+static int mapped;
+
+int map_page(uint64_t virt, uint64_t phys, uint64_t flags)
+{
+    (void)flags;
+    if (mapped == MAX_MAPPED)
+        return -1;
+    ptes[mapped].virt = virt & ~0xFFFULL;
+    ptes[mapped].phys = phys;
+    mapped++;
+    return 0;
+}
+
+void unmap_page(uint64_t virt)
+{
+    for (int i = 0; i < mapped; i++) {
+        if (ptes[i].virt == (virt & ~0xFFFULL)) {
+            ptes[i] = ptes[--mapped];
+            return;
+        }
+    }
+}
+
+uint64_t paging_lookup(uint64_t virt)
+{
+    for (int i = 0; i < mapped; i++) {
+        if (ptes[i].virt == (virt & ~0xFFFULL))
+            return ptes[i].phys | (virt & 0xFFF);
+    }
+    return 0;
+}
+
+#define SECTOR        512
+#define TOTAL_SECTORS 32768
+#define RESERVED      32
+#define SECTORS_PER_FAT 256
+#define DATA_START    (RESERVED + 2 * SECTORS_PER_FAT)
+#define EOC           0x0FFFFFFF
+
+static uint8_t *img;
+static uint32_t *fat;
+static uint32_t next_free = 3;
+
+static uint8_t *cluster_ptr(uint32_t c)
+{
+    return img + (size_t)(DATA_START + c - 2) * SECTOR;
+}
+
+static uint32_t alloc_chain(uint32_t count, uint32_t stride)
+{
+    uint32_t first = next_free, prev = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t c = next_free;
+        next_free += stride;
+        fat[c] = EOC;
+        if (prev)
+            fat[prev] = c;
+        prev = c;
+    }
+    return first;
+}
+
+static void fill_pattern(uint8_t *buf, size_t len, uint32_t seed)
+{
+    uint32_t x = seed | 1;
+    for (size_t i = 0; i < len; i++) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        buf[i] = (uint8_t)x;
+    }
+}
+
+static void write_chain(uint32_t first, const uint8_t *data, size_t len)
+{
+    for (uint32_t c = first; len; c = fat[c]) {
+        size_t n = len < SECTOR ? len : SECTOR;
+        memcpy(cluster_ptr(c), data, n);
+        data += n;
+        len -= n;
+    }
+}
+
+static uint8_t *dir_slot(uint32_t dir_cluster)
+{
+    uint8_t *p = cluster_ptr(dir_cluster);
+    while (p[0])
+        p += 32;
+    return p;
+}
+
+static void add_entry(uint32_t dir, const char *name83, uint8_t attr,
+                      uint32_t cluster, uint32_t size)
+{
+    uint8_t *e = dir_slot(dir);
+    memcpy(e, name83, 11);
+    e[11] = attr;
+    e[20] = (cluster >> 16) & 0xFF; e[21] = cluster >> 24;
+    e[26] = cluster & 0xFF; e[27] = (cluster >> 8) & 0xFF;
+    memcpy(e + 28, &size, 4);
+}
+
+static void add_lfn(uint32_t dir, const char *name)
+{
+    size_t len = strlen(name);
+    int pieces = (int)((len + 12) / 13);
+    static const int pos[13] = {1,3,5,7,9,14,16,18,20,22,24,28,30};
+    for (int ord = pieces; ord >= 1; ord--) {
+        uint8_t *e = dir_slot(dir);
+        memset(e, 0xFF, 32);
+        e[0] = (uint8_t)(ord | (ord == pieces ? 0x40 : 0));
+        e[11] = 0x0F; e[12] = 0; e[13] = 0; e[26] = 0; e[27] = 0;
+        for (int i = 0; i < 13; i++) {
+            size_t idx = (size_t)(ord - 1) * 13 + i;
+            if (idx < len) { e[pos[i]] = (uint8_t)name[idx]; e[pos[i]+1] = 0; }
+            else if (idx == len) { e[pos[i]] = 0; e[pos[i]+1] = 0; }
+        }
+    }
+}
+
+typedef struct {
+    const char *path;
+    uint8_t *data;
+    uint32_t size;
+} test_file_t;
+
+static test_file_t files[4];
+
+static uint32_t add_file(uint32_t dir, const char *name83, const char *lfn,
+                         uint32_t size, uint32_t stride, uint32_t seed,
+                         test_file_t *tf)
+{
+    tf->size = size;
+    tf->data = malloc(size);
+    fill_pattern(tf->data, size, seed);
+    uint32_t first = alloc_chain((size + SECTOR - 1) / SECTOR, stride);
+    write_chain(first, tf->data, size);
+    if (lfn)
+        add_lfn(dir, lfn);
+    add_entry(dir, name83, 0x20, first, size);
+    return first;
+}
+
+static void build_image(void)
+{
+    img = calloc(TOTAL_SECTORS, SECTOR);
+    uint8_t *bs = img;
+    bs[0] = 0xEB; bs[1] = 0x58; bs[2] = 0x90;
+    bs[11] = SECTOR & 0xFF; bs[12] = SECTOR >> 8;
+    bs[13] = 1;
+    bs[14] = RESERVED; bs[15] = 0;
+    bs[16] = 2;
+    uint32_t spf = SECTORS_PER_FAT, root = 2, total = TOTAL_SECTORS;
+    memcpy(bs + 32, &total, 4);
+    memcpy(bs + 36, &spf, 4);
+    memcpy(bs + 44, &root, 4);
+    bs[510] = 0x55; bs[511] = 0xAA;
+
+    fat = (uint32_t *)(img + RESERVED * SECTOR);
+    fat[0] = 0x0FFFFFF8;
+    fat[1] = EOC;
+    fat[2] = EOC;
+
+    uint32_t mods = alloc_chain(1, 1);
+    add_entry(2, "MODULES    ", 0x10, mods, 0);
+
+    files[0].path = "/hello.txt";
+    add_file(2, "HELLO   TXT", NULL, 100, 1, 1, &files[0]);
+    files[1].path = "/modules/10de_1234.ko";
+    add_file(mods, "10DE_1~1KO ", "10de_1234.ko", 300 * 1024 + 77, 1, 2, &files[1]);
+    files[2].path = "/modules/fragment.bin";
+    add_file(mods, "FRAGMENTBIN", NULL, 64 * 1024, 3, 3, &files[2]);
+    files[3].path = "/readahead_large.bin";
+    add_file(2, "READAH~1BIN", "readahead_large.bin", 4 * 1024 * 1024, 1, 4,
+             &files[3]);
+
+    memcpy(img + (RESERVED + SECTORS_PER_FAT) * SECTOR, fat,
+           SECTORS_PER_FAT * SECTOR);
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_file(blkdev_file_t *bf, const char *path,
+                      const test_file_t *expect)
+{
+    bcache_stats_t before, after;
+    bcache_get_stats(&before);
+    uint64_t req_before = bf->requests;
+    double t0 = now_sec();
+    uint32_t size = 0;
+    uint8_t *data = fat32_load_file(path, &size);
+    double dt = now_sec() - t0;
+    if (!data) {
+        fprintf(stderr, "failed to load %s\n", path);
+        return 1;
+    }
+    bcache_get_stats(&after);
+    if (expect && (size != expect->size || memcmp(data, expect->data, size))) {
+        fprintf(stderr, "content mismatch for %s\n", path);
+        free(data);
+        return 1;
+    }
+    printf("%-24s %8u bytes %7.1f MB/s  dev reqs %4llu  ra blocks %5llu"
+           "  ra hits %5llu  ra waste %llu\n",
+           path, size, dt > 0 ? size / dt / 1e6 : 0.0,
+           (unsigned long long)(bf->requests - req_before),
+           (unsigned long long)(after.ra_issued - before.ra_issued),
+           (unsigned long long)(after.ra_hits - before.ra_hits),
+           (unsigned long long)(after.ra_wasted - before.ra_wasted));
+    free(data);
+    return 0;
+}
+
+static int test_mmap(const test_file_t *tf);
+
+static int test_read_at(const test_file_t *tf)
+{
+    fat32_file_t f;
+    if (fat32_open(tf->path, &f) || f.size != tf->size)
+        return 1;
+    uint8_t buf[5000];
+    uint32_t x = 12345;
+    for (int i = 0; i < 200; i++) {
+        x = x * 1103515245 + 12345;
+        uint32_t len = (x >> 8) % sizeof(buf);
+        uint32_t off = (x >> 3) % (tf->size - len + 1);
+        if (fat32_read_at(&f, off, buf, len) ||
+            memcmp(buf, tf->data + off, len)) {
+            fprintf(stderr, "read_at mismatch %s @%u+%u\n", tf->path, off, len);
+            return 1;
+        }
+    }
+    if (fat32_read_at(&f, tf->size - 10, buf, 11) == 0) {
+        fprintf(stderr, "read past end accepted\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* Overwrite random ranges, including sector and cluster boundaries, and
+ * read them back through every path. */
+static int test_write_at(test_file_t *tf)
+{
+    fat32_file_t f;
+    if (fat32_open(tf->path, &f))
+        return 1;
+    uint8_t buf[3000];
+    uint32_t max = tf->size < sizeof(buf) ? tf->size : sizeof(buf);
+    uint32_t x = 777;
+    for (int i = 0; i < 50; i++) {
+        x = x * 1103515245 + 12345;
+        uint32_t len = 1 + (x >> 8) % max;
+        uint32_t off = (x >> 3) % (tf->size - len + 1);
+        for (uint32_t j = 0; j < len; j++)
+            buf[j] = (uint8_t)(x + j * 7);
+        if (fat32_write_at(&f, off, buf, len)) {
+            fprintf(stderr, "write_at failed %s @%u+%u\n", tf->path, off, len);
+            return 1;
+        }
+        memcpy(tf->data + off, buf, len);
+        if (fat32_read_at(&f, off, buf, len) ||
+            memcmp(buf, tf->data + off, len)) {
+            fprintf(stderr, "write_at readback %s @%u+%u\n", tf->path, off, len);
+            return 1;
+        }
+    }
+    if (fat32_write_at(&f, tf->size - 10, buf, 11) == 0) {
+        fprintf(stderr, "write past end accepted\n");
+        return 1;
+    }
+    /* a fresh open, and the block cache forgotten, see the same bytes */
+    bcache_invalidate();
+    uint32_t size = 0;
+    uint8_t *data = fat32_load_file(tf->path, &size);
+    int bad = !data || size != tf->size || memcmp(data, tf->data, size);
+    free(data);
+    if (bad) {
+        fprintf(stderr, "write_at not persisted %s\n", tf->path);
+        return 1;
+    }
+    return test_mmap(tf);
+}
+
+static int test_mmap(const test_file_t *tf)
+{
+    uint32_t size = 0;
+    uint8_t *a = fat32_mmap(tf->path, &size);
+    if (!a || size != tf->size || mapped) {
+        fprintf(stderr, "mmap %s failed\n", tf->path);
+        return 1;
+    }
+    uint64_t va = (uint64_t)(uintptr_t)a;
+    uint32_t pages = (size + 4095) / 4096;
+    for (uint32_t p = 0; p < pages; p++) {
+        /* touch the page the way the #PF handler would */
+        if (vm_handle_fault(va + p * 4096 + 17, 0))
+            return 1;
+        const uint8_t *page = (const uint8_t *)(uintptr_t)paging_lookup(va + p * 4096);
+        uint32_t n = size - p * 4096 < 4096 ? size - p * 4096 : 4096;
+        if (memcmp(page, tf->data + p * 4096, n))
+            return 1;
+        for (uint32_t i = n; i < 4096; i++)
+            if (page[i])
+                return 1;
+    }
+    if (vm_handle_fault(va, 1) == 0 || vm_handle_fault(va + pages * 4096, 0) == 0) {
+        fprintf(stderr, "bad access accepted\n");
+        return 1;
+    }
+
+    /* a second mapping shares the cached pages */
+    pagecache_stats_t before, after;
+    pagecache_get_stats(&before);
+    uint8_t *b = fat32_mmap(tf->path, NULL);
+    uint64_t vb = (uint64_t)(uintptr_t)b;
+    if (!b || b == a || vm_populate(vm_find(vb), 0, size))
+        return 1;
+    pagecache_get_stats(&after);
+    if (after.hits - before.hits != pages || after.misses != before.misses)
+        return 1;
+    for (uint32_t p = 0; p < pages; p++)
+        if (paging_lookup(va + p * 4096) != paging_lookup(vb + p * 4096))
+            return 1;
+
+    fat32_munmap(a);
+    fat32_munmap(b);
+    if (mapped || vm_find(va) || vm_handle_fault(va, 0) == 0) {
+        fprintf(stderr, "munmap left mappings behind\n");
+        return 1;
+    }
+    return 0;
+}
+
+static void prefetch_done(fat32_prefetch_t *op, int status)
+{
+    *(int *)op->ctx = status ? -1 : 1;
+}
+
+/* Prefetch a file asynchronously, then check that mapping it is served
+ * entirely from the page cache. */
+static int test_prefetch(blkdev_file_t *bf, const test_file_t *tf, int cached)
+{
+    fat32_prefetch_t op;
+    int state = 0;
+    uint64_t req_before = bf->requests;
+    uint32_t pages = (tf->size + 4095) / 4096;
+    if (fat32_prefetch(tf->path, &op, prefetch_done, &state))
+        return 1;
+    if (!cached && state) {
+        fprintf(stderr, "prefetch of %s completed synchronously\n", tf->path);
+        return 1;
+    }
+    while (!state)
+        fat32_poll();
+    if (state < 0)
+        return 1;
+    uint64_t reqs = bf->requests - req_before;
+    if (cached ? reqs != 0 : reqs > (pages + 7) / 8) {
+        fprintf(stderr, "prefetch of %s took %llu requests\n", tf->path,
+                (unsigned long long)reqs);
+        return 1;
+    }
+
+    pagecache_stats_t before, after;
+    pagecache_get_stats(&before);
+    uint8_t *a = fat32_mmap(tf->path, NULL);
+    uint64_t va = (uint64_t)(uintptr_t)a;
+    if (!a || vm_populate(vm_find(va), 0, tf->size))
+        return 1;
+    pagecache_get_stats(&after);
+    if (after.hits - before.hits != pages || after.misses != before.misses ||
+        bf->requests - req_before != reqs) {
+        fprintf(stderr, "mapping %s after prefetch missed the cache\n", tf->path);
+        return 1;
+    }
+    for (uint32_t p = 0; p < pages; p++) {
+        const uint8_t *page = (const uint8_t *)(uintptr_t)paging_lookup(va + p * 4096);
+        uint32_t n = tf->size - p * 4096 < 4096 ? tf->size - p * 4096 : 4096;
+        if (memcmp(page, tf->data + p * 4096, n))
+            return 1;
+        for (uint32_t i = n; i < 4096; i++)
+            if (page[i])
+                return 1;
+    }
+    fat32_munmap(a);
+    printf("%-24s prefetched %u pages in %llu requests\n", tf->path, pages,
+           (unsigned long long)reqs);
+    return 0;
+}
+
+/* Fault a file in while its prefetch is still reading: every page waits
+ * for its read to land instead of being read a second time, so each one
+ * is a page cache hit. */
+static int test_prefetch_wait(const test_file_t *tf)
+{
+    fat32_prefetch_t op;
+    fat32_file_t file;
+    int state = 0;
+    uint32_t pages = (tf->size + 4095) / 4096;
+    if (fat32_open(tf->path, &file))
+        return 1;
+    pagecache_drop(file.first_cluster);
+    pagecache_stats_t before, after;
+    pagecache_get_stats(&before);
+    if (fat32_prefetch(tf->path, &op, prefetch_done, &state) || state)
+        return 1;
+    uint8_t *a = fat32_mmap(tf->path, NULL);
+    uint64_t va = (uint64_t)(uintptr_t)a;
+    if (!a || vm_populate(vm_find(va), 0, tf->size))
+        return 1;
+    while (!state)
+        fat32_poll();
+    pagecache_get_stats(&after);
+    if (state < 0 || after.hits - before.hits != pages ||
+        after.misses - before.misses != pages) {
+        fprintf(stderr, "mapping %s during prefetch read it again\n",
+                tf->path);
+        return 1;
+    }
+    for (uint32_t p = 0; p < pages; p++) {
+        const uint8_t *page = (const uint8_t *)(uintptr_t)paging_lookup(va + p * 4096);
+        uint32_t n = tf->size - p * 4096 < 4096 ? tf->size - p * 4096 : 4096;
+        if (memcmp(page, tf->data + p * 4096, n))
+            return 1;
+    }
+    fat32_munmap(a);
+    return 0;
+}
+
+static struct {
+    const test_file_t *tf;
+    uint32_t order[128];
+    uint32_t seen;
+    int bad;
+} stream;
+
+static void stream_page(fat32_prefetch_t *op, uint32_t index,
+                        const void *data, uint32_t len)
+{
+    (void)op;
+    const test_file_t *tf = stream.tf;
+    const uint8_t *page = data;
+    uint32_t want = tf->size - index * 4096 < 4096 ? tf->size - index * 4096 : 4096;
+    if (len != want || memcmp(page, tf->data + index * 4096, len))
+        stream.bad = 1;
+    for (uint32_t i = len; i < 4096; i++)
+        if (page[i])
+            stream.bad = 1;
+    if (stream.seen < 128)
+        stream.order[stream.seen] = index;
+    stream.seen++;
+}
+
+/* Stream a file with one page already cached: that page is handed over
+ * at once, the tail pages are read before everything else and every page
+ * arrives exactly once with the right contents. */
+static int test_stream(const test_file_t *tf)
+{
+    fat32_file_t file;
+    if (fat32_open(tf->path, &file))
+        return 1;
+    pagecache_drop(file.first_cluster);
+    uint8_t *m = fat32_mmap(tf->path, NULL);
+    if (!m || vm_populate(vm_find((uint64_t)(uintptr_t)m), 3 * 4096, 4096))
+        return 1;
+    fat32_munmap(m);
+
+    uint32_t pages = (tf->size + 4095) / 4096;
+    uint32_t tail_first = (tf->size - 256) / 4096;
+    memset(&stream, 0, sizeof(stream));
+    stream.tf = tf;
+    fat32_prefetch_t op;
+    int state = 0;
+    if (fat32_stream(tf->path, &op, 256, stream_page, prefetch_done, &state))
+        return 1;
+    if (stream.seen != 1 || stream.order[0] != 3)
+        return 1;
+    while (!state)
+        fat32_poll();
+    if (state < 0 || stream.bad || stream.seen != pages)
+        return 1;
+    for (uint32_t i = tail_first; i < pages; i++)
+        if (stream.order[1 + i - tail_first] != i) {
+            fprintf(stderr, "tail of %s was not read first\n", tf->path);
+            return 1;
+        }
+    printf("%-24s streamed %u pages, tail first\n", tf->path, pages);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    blkdev_file_t bf;
+    if (argc == 3) {
+        if (blkdev_file_open(&bf, argv[1], "image", 0) || fat32_init()) {
+            fprintf(stderr, "cannot mount %s\n", argv[1]);
+            return 1;
+        }
+        int rc = bench_file(&bf, argv[2], NULL);
+        blkdev_file_close(&bf);
+        return rc;
+    }
+
+    build_image();
+    char tmpl[] = "/tmp/fat32_testXXXXXX";
+    int fd = mkstemp(tmpl);
+    if (fd < 0 || write(fd, img, (size_t)TOTAL_SECTORS * SECTOR) !=
+                  (ssize_t)TOTAL_SECTORS * SECTOR) {
+        fprintf(stderr, "cannot write test image\n");
+        return 1;
+    }
+    close(fd);
+
+    int rc = 0;
+    if (blkdev_file_open(&bf, tmpl, "image", 1) || fat32_init()) {
+        fprintf(stderr, "mount failed\n");
+        rc = 1;
+    }
+    for (int i = 0; !rc && i < 4; i++)
+        rc = bench_file(&bf, files[i].path, &files[i]);
+    if (!rc && fat32_load_file("/modules/missing.ko", NULL)) {
+        fprintf(stderr, "missing file unexpectedly found\n");
+        rc = 1;
+    }
+
+    bcache_stats_t st;
+    bcache_get_stats(&st);
+    uint32_t large_sectors = files[3].size / SECTOR;
+    if (!rc && (st.ra_hits < large_sectors / 2 ||
+                bf.requests > large_sectors / 8)) {
+        fprintf(stderr, "readahead ineffective: %llu hits, %llu requests\n",
+                (unsigned long long)st.ra_hits,
+                (unsigned long long)bf.requests);
+        rc = 1;
+    }
+    for (int i = 1; !rc && i < 3; i++)
+        rc = test_read_at(&files[i]) || test_mmap(&files[i]);
+    if (!rc && iosched_attach(&bf.dev) == 0) {
+        rc = test_prefetch(&bf, &files[3], 0) || test_prefetch(&bf, &files[0], 0) ||
+             test_prefetch(&bf, &files[2], 1) || test_stream(&files[1]);
+        if (!rc)
+            rc = test_prefetch_wait(&files[1]);
+        iosched_detach(&bf.dev);
+    }
+    if (!rc)
+        rc = test_write_at(&files[2]) || test_write_at(&files[0]);
+
+    blkdev_file_close(&bf);
+    unlink(tmpl);
+    if (!rc)
+        printf("fat32 tests passed\n");
+    return rc;
+}
@@ -0,0 +1,150 @@
+#include "framebuffer.h"
+#include "gfx.h"
+#include "tsc.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Host test for damage tracking in the framebuffer gfx device. The
+ * "screen" is a heap buffer handed over as the GOP framebuffer, wider
+ * than the surfaces so clipping and pitch are exercised; after every
+ * present it must equal the surface wherever the two overlap. */
+
+void *kmalloc(size_t size) { return malloc(size); }
+void kfree(void *ptr) { free(ptr); }
+void debug_putc(char c) { (void)c; }
+void debug_puts(const char *s) { (void)s; }
+void debug_puthex(uint32_t v) { (void)v; }
+void debug_puthex64(uint64_t v) { (void)v; }
+int paging_is_initialized(void) { return 1; }
+void map_identity_range(uint64_t phys, uint64_t size) { (void)phys; (void)size; }
+void gpu_set_active_gfx_device(gfx_device_t *dev) { (void)dev; }
+uint64_t tsc_hz(void) { return TSC_DEFAULT_HZ; }
+
+#define FB_W     1920
+#define FB_H     1080
+#define FB_PITCH 2048
+
+static uint32_t *screen;
+static gfx_device_t *gfx;
+
+static uint64_t present(gfx_surface_t *surf)
+{
+    gfx_present_stats_t st;
+    gfx->present_frame(surf);
+    gfx->get_present_stats(&st);
+    return st.last_bytes;
+}
+
+static void check_screen(const gfx_surface_t *surf)
+{
+    uint32_t w = surf->width < FB_W ? surf->width : FB_W;
+    uint32_t h = surf->height < FB_H ? surf->height : FB_H;
+    for (uint32_t y = 0; y < h; y++)
+        assert(!memcmp(screen + (size_t)y * FB_PITCH,
+                       surf->pixels + (size_t)y * surf->pitch, w * 4));
+}
+
+static void check_disjoint(const gfx_damage_t *d)
+{
+    for (uint32_t i = 0; i < d->count; i++) {
+        for (uint32_t j = i + 1; j < d->count; j++) {
+            const gfx_rect_t *a = &d->rects[i], *b = &d->rects[j];
+            assert(a->x + a->w <= b->x || b->x + b->w <= a->x ||
+                   a->y + a->h <= b->y || b->y + b->h <= a->y);
+        }
+    }
+}
+
+static void test_static_ui(void)
+{
+    gfx_surface_t *surf = gfx->create_surface(FB_W, FB_H);
+    assert(surf);
+    uint64_t full = (uint64_t)FB_W * FB_H * 4;
+    assert(present(surf) == full);
+    assert(present(surf) == 0);
+
+    /* a blinking cursor costs its own pixels, not the screen's */
+    for (int frame = 0; frame < 10; frame++) {
+        gfx->draw_rect(surf, 600, 400, 16, 16, frame & 1 ? 0xFFFFFF : 0);
+        uint64_t bytes = present(surf);
+        assert(bytes == 16 * 16 * 4);
+        assert(full / bytes > 1000);
+    }
+    check_screen(surf);
+
+    /* overlapping and adjacent rectangles are copied once */
+    gfx->draw_rect(surf, 10, 10, 20, 20, 0x112233);
+    gfx->draw_rect(surf, 20, 20, 20, 20, 0x445566);
+    gfx->draw_rect(surf, 40, 20, 10, 20, 0x778899);
+    assert(surf->damage.count == 1);
+    assert(present(surf) == 40 * 30 * 4);
+    check_screen(surf);
+
+    /* clipped at the surface edge */
+    gfx->draw_rect(surf, FB_W - 4, FB_H - 4, 100, 100, 0xABCDEF);
+    assert(present(surf) == 4 * 4 * 4);
+    check_screen(surf);
+
+    gfx_present_stats_t st;
+    gfx->get_present_stats(&st);
+    assert(st.frames == 14 && st.last_rects == 1);
+    free(surf->pixels);
+    free(surf);
+}
+
+/* Random drawing, some of it straight into the pixels, must always leave
+ * the screen equal to the surface while copying far less than it. */
+static void test_random(uint32_t w, uint32_t h)
+{
+    gfx_surface_t *surf = gfx->create_surface(w, h);
+    assert(surf);
+    present(surf);
+    uint64_t total = 0, full = 0;
+    srand(w ^ h);
+    for (int frame = 0; frame < 300; frame++) {
+        int ops = 1 + rand() % 12;
+        for (int k = 0; k < ops; k++) {
+            uint32_t x = rand() % (w + 20), y = rand() % (h + 20);
+            uint32_t rw = 1 + rand() % 40, rh = 1 + rand() % 40;
+            if (rand() % 3) {
+                gfx->draw_rect(surf, x, y, rw, rh, (uint32_t)rand());
+            } else if (x < w && y < h) {
+                surf->pixels[y * surf->pitch + x] = (uint32_t)rand();
+                gfx->damage(surf, x, y, 1, 1);
+            }
+            check_disjoint(&surf->damage);
+            assert(surf->damage.count <= GFX_DAMAGE_RECTS);
+        }
+        total += present(surf);
+        full += (uint64_t)(w < FB_W ? w : FB_W) * (h < FB_H ? h : FB_H) * 4;
+        check_screen(surf);
+        assert(surf->damage.count == 0);
+    }
+    assert(total * 20 < full);
+    free(surf->pixels);
+    free(surf);
+}
+
+int main(void)
+{
+    screen = calloc((size_t)FB_PITCH * FB_H, 4);
+    framebuffer_info_t info = {
+        .base = (uint64_t)(uintptr_t)screen,
+        .size = (uint64_t)FB_PITCH * FB_H * 4,
+        .width = FB_W,
+        .height = FB_H,
+        .pitch = FB_PITCH,
+    };
+    init_framebuffer(&info);
+    gfx = framebuffer_get_gfx_device();
+
+    test_static_ui();
+    test_random(FB_W, FB_H);
+    test_random(2500, 700);    /* wider than the screen */
+    test_random(640, 480);
+    printf("damage tests passed\n");
+    free(screen);
+    return 0;
+}
@@ -0,0 +1,359 @@
+#include "framebuffer.h"
+#include "gfx.h"
+#include "nvidia.h"
+#include "amd.h"
+#include "intel.h"
+#include "tsc.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* Host test for page flipping in the GPU drivers. A register file
+ * modelling each vendor's scanout latch stands in for the MMIO BAR, and a
+ * heap "aperture" holds the buffers. A vblank latches the queued address;
+ * one also fires every few register reads so the drivers' waits end. The
+ * buffer on screen and the one queued for it are kept read-only, so a
+ * present that draws into either crashes the test. */
+
+void *kmalloc(size_t size) { return malloc(size); }
+void kfree(void *ptr) { free(ptr); }
+void debug_putc(char c) { (void)c; }
+void debug_puts(const char *s) { (void)s; }
+void debug_puthex(uint32_t v) { (void)v; }
+void debug_puthex64(uint64_t v) { (void)v; }
+int paging_is_initialized(void) { return 1; }
+void map_identity_range(uint64_t phys, uint64_t size) { (void)phys; (void)size; }
+void gpu_set_active_gfx_device(gfx_device_t *dev) { (void)dev; }
+void gpu_set_active_driver(gpu_driver_t *drv) { (void)drv; }
+uint64_t tsc_hz(void) { return TSC_DEFAULT_HZ; }
+
+#define W      640
+#define H      480
+#define PAGE   4096
+#define FRAME  ((size_t)W * H * 4)     /* a multiple of the page size */
+
+static boot_info_t boot;
+static uint8_t *aperture;
+static uint64_t aperture_size;
+static int aperture_bar;
+
+boot_info_t *boot_info_get(void) { return &boot; }
+
+uint32_t pci_config_read32(uint8_t bus, uint8_t slot, uint8_t func,
+                           uint16_t offset)
+{
+    (void)bus; (void)slot; (void)func; (void)offset;
+    return 0;
+}
+
+int pci_bar_range(uint8_t bus, uint8_t slot, uint8_t func, int bar,
+                  uint64_t *base, uint64_t *size)
+{
+    (void)bus; (void)slot; (void)func;
+    assert(bar == aperture_bar);
+    *base = (uintptr_t)aperture;
+    *size = aperture_size;
+    return 0;
+}
+
+/* --- register model --- */
+
+enum { NV, AMD, INTEL };
+
+#define NV_FB_ADDR        0x00610b10
+#define NV_UNK30          0x00610030
+#define NV_UPDATE         0x00000200
+#define NV_PENDING        0x80000000
+#define AMD_SURFACE       0x6110
+#define AMD_UPDATE        0x6144
+#define AMD_PENDING       0x00000004
+#define INTEL_DSPSURF     0x70184
+#define INTEL_DSPSURFLIVE 0x701ac
+
+#define MAX_REGS 64
+
+static struct { uint32_t reg, val; } regs[MAX_REGS];
+static int nregs;
+static int vendor;
+static uint32_t scanout;        /* address on screen */
+static uint32_t latch;          /* written, waiting for vblank; 0 if none */
+static unsigned reads, vblank_every, vblanks;
+static int guard;
+
+static uint32_t *reg_slot(uint32_t reg)
+{
+    for (int i = 0; i < nregs; i++)
+        if (regs[i].reg == reg)
+            return &regs[i].val;
+    assert(nregs < MAX_REGS);
+    regs[nregs].reg = reg;
+    regs[nregs].val = 0;
+    return &regs[nregs++].val;
+}
+
+static uint8_t *buffer_at(uint32_t addr)
+{
+    for (int b = 0; b < GFX_MAX_BUFFERS; b++)
+        if ((uint32_t)(uintptr_t)(aperture + b * FRAME) == addr)
+            return aperture + b * FRAME;
+    return NULL;
+}
+
+static void protect(void)
+{
+    mprotect(aperture, aperture_size, PROT_READ | PROT_WRITE);
+    if (!guard)
+        return;
+    uint32_t busy[2] = { scanout, latch };
+    for (int i = 0; i < 2; i++) {
+        uint8_t *b = buffer_at(busy[i]);
+        if (b)
+            mprotect(b, FRAME, PROT_READ);
+    }
+}
+
+static void vblank(void)
+{
+    vblanks++;
+    if (!latch)
+        return;
+    scanout = latch;
+    latch = 0;
+    if (vendor == NV)
+        *reg_slot(NV_UNK30) &= ~NV_PENDING;
+    else if (vendor == AMD)
+        *reg_slot(AMD_UPDATE) &= ~AMD_PENDING;
+    else
+        *reg_slot(INTEL_DSPSURFLIVE) = scanout;
+    protect();
+}
+
+uint32_t gpu_emu_readl(uint32_t reg)
+{
+    if (vblank_every && ++reads % vblank_every == 0)
+        vblank();
+    return *reg_slot(reg);
+}
+
+void gpu_emu_writel(uint32_t reg, uint32_t val)
+{
+    *reg_slot(reg) = val;
+    if (vendor == NV && reg == NV_UNK30 && (val & NV_UPDATE)) {
+        *reg_slot(reg) |= NV_PENDING;
+        latch = *reg_slot(NV_FB_ADDR);
+    } else if (vendor == AMD && reg == AMD_SURFACE) {
+        *reg_slot(AMD_UPDATE) |= AMD_PENDING;
+        latch = val;
+    } else if (vendor == INTEL && reg == INTEL_DSPSURF) {
+        latch = val;
+    } else {
+        return;
+    }
+    protect();
+}
+
+/* --- tests --- */
+
+static gfx_device_t *gfx;
+
+static void start(int v, driver_t *drv, int bar, int buffers)
+{
+    guard = 0;
+    protect();
+    memset(aperture, 0x5a, aperture_size);
+    nregs = 0;
+    vendor = v;
+    scanout = latch = 0;
+    reads = vblanks = 0;
+    vblank_every = 5;
+    aperture_bar = bar;
+    aperture_size = (uint64_t)buffers * FRAME;
+
+    pci_device_t dev = { .vendor_id = 0x1234, .class_code = 0x03 };
+    drv->init(&dev);
+    if (vendor == NV) {
+        /* programmed directly, without an update request */
+        scanout = *reg_slot(NV_FB_ADDR);
+    }
+    vblank();
+    assert(buffer_at(scanout) == aperture);
+    gfx = framebuffer_get_gfx_device();
+}
+
+static int screen_matches(const gfx_surface_t *surf)
+{
+    const uint8_t *screen = buffer_at(scanout);
+    assert(screen);
+    return !memcmp(screen, surf->pixels, FRAME);
+}
+
+static gfx_present_stats_t stats(void)
+{
+    gfx_present_stats_t st;
+    gfx->get_present_stats(&st);
+    return st;
+}
+
+static void random_draws(gfx_surface_t *surf)
+{
+    for (int k = rand() % 4; k > 0; k--)
+        gfx->draw_rect(surf, rand() % W, rand() % H, 1 + rand() % 64,
+                       1 + rand() % 64, (uint32_t)rand());
+}
+
+static void test_flipping(int v, driver_t *drv, int bar)
+{
+    start(v, drv, bar, 3);
+    assert(stats().buffers == 3);
+    gfx_surface_t *surf = gfx->create_surface(W, H);
+    assert(surf);
+    guard = 1;
+    protect();
+
+    srand(v + 1);
+    for (uint32_t buffers = 3; buffers >= 2; buffers--) {
+        assert(gfx->set_buffering(buffers) == buffers);
+        gfx_present_stats_t before = stats();
+        for (int frame = 0; frame < 200; frame++) {
+            random_draws(surf);
+            int damaged = surf->damage.count != 0;
+            uint64_t flips = stats().flips;
+            gfx->present_frame(surf);
+            assert(stats().flips == flips + damaged);
+            if (frame % 3 == 0) {
+                /* a flip in flight shows the new frame after a vblank */
+                vblank();
+                assert(screen_matches(surf));
+            }
+        }
+        gfx_present_stats_t after = stats();
+        assert(after.flip_waits > before.flip_waits);
+        assert(after.buffers == buffers);
+    }
+
+    /* a moving cursor costs a few cursor-sized copies per frame, once
+     * every buffer has caught up with the drawing above */
+    uint64_t full = FRAME;
+    for (int frame = 0; frame < 50; frame++) {
+        gfx->draw_rect(surf, 100 + frame * 4, 200, 16, 16, 0xFFFFFF);
+        gfx->present_frame(surf);
+        if (frame >= GFX_MAX_BUFFERS)
+            assert(stats().last_bytes * 100 < full);
+    }
+    vblank();
+    assert(screen_matches(surf));
+
+    /* copy-only: straight into the buffer on screen, no flips */
+    guard = 0;
+    protect();
+    assert(gfx->set_buffering(1) == 1);
+    uint64_t flips = stats().flips;
+    uint32_t shown = scanout;
+    for (int frame = 0; frame < 20; frame++) {
+        random_draws(surf);
+        gfx->present_frame(surf);
+        assert(screen_matches(surf));
+    }
+    assert(stats().flips == flips && scanout == shown);
+
+    /* flipping again picks up the frames the back buffers missed */
+    guard = 1;
+    protect();
+    assert(gfx->set_buffering(3) == 3);
+    for (int frame = 0; frame < 10; frame++) {
+        gfx->draw_rect(surf, rand() % W, rand() % H, 8, 8, (uint32_t)rand());
+        gfx->present_frame(surf);
+        vblank();
+        assert(screen_matches(surf));
+    }
+    guard = 0;
+    protect();
+    free(surf->pixels);
+    free(surf);
+}
+
+/* An aperture with room for the GOP buffer only keeps copying. */
+static void test_no_room(void)
+{
+    start(INTEL, &intel_pnp_driver, 2, 1);
+    assert(stats().buffers == 1);
+    assert(gfx->set_buffering(3) == 1);
+    gfx_surface_t *surf = gfx->create_surface(W, H);
+    random_draws(surf);
+    gfx->present_frame(surf);
+    assert(screen_matches(surf) && stats().flips == 0);
+    free(surf->pixels);
+    free(surf);
+}
+
+/* What the fb_draw_* helpers put on screen survives flips to buffers
+ * that were not showing when it was drawn. */
+static void test_overlay(void)
+{
+    start(INTEL, &intel_pnp_driver, 2, 3);
+    gfx_surface_t *surf = gfx->create_surface(W, H);
+    gfx->present_frame(surf);
+    vblank();
+    fb_fill_rect(20, 20, 100, 60, 0x0000FF00);
+    for (int frame = 0; frame < GFX_MAX_BUFFERS + 1; frame++) {
+        gfx->draw_rect(surf, 300 + frame * 8, 300, 8, 8, 0xFFFFFF);
+        gfx->present_frame(surf);
+        vblank();
+        const uint32_t *px = (const uint32_t *)buffer_at(scanout);
+        assert(px[30 * W + 30] == 0x0000FF00);
+        assert(px[300 * W + 300 + frame * 8] == 0xFFFFFF);
+    }
+    assert(stats().flips == GFX_MAX_BUFFERS + 2);
+    free(surf->pixels);
+    free(surf);
+}
+
+/* A flip that never latches drops the device back to copying, into the
+ * buffer the display still reads from, which stays put even if the flip
+ * does land late. */
+static void test_stuck(int v, driver_t *drv, int bar)
+{
+    start(v, drv, bar, 3);
+    gfx_surface_t *surf = gfx->create_surface(W, H);
+    gfx->present_frame(surf);
+    vblank();
+    vblank_every = 0;
+    gfx->draw_rect(surf, 10, 10, 10, 10, 0xFF);
+    gfx->present_frame(surf);
+    gfx->draw_rect(surf, 30, 30, 10, 10, 0xFF00);
+    gfx->present_frame(surf);
+    gfx_present_stats_t st = stats();
+    assert(st.buffers == 1 && st.flips == 2);
+    assert(screen_matches(surf));
+    vblank();
+    gfx->draw_rect(surf, 50, 50, 10, 10, 0xFF0000);
+    gfx->present_frame(surf);
+    assert(screen_matches(surf));
+    free(surf->pixels);
+    free(surf);
+}
+
+int main(void)
+{
+    aperture = mmap(NULL, GFX_MAX_BUFFERS * FRAME, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(aperture != MAP_FAILED);
+    boot.fb.base = (uintptr_t)aperture;
+    boot.fb.size = FRAME;
+    boot.fb.width = W;
+    boot.fb.height = H;
+    boot.fb.pitch = W;
+
+    test_flipping(NV, &nvidia_pnp_driver, 1);
+    test_flipping(AMD, &amd_pnp_driver, 0);
+    test_flipping(INTEL, &intel_pnp_driver, 2);
+    test_no_room();
+    test_overlay();
+    test_stuck(NV, &nvidia_pnp_driver, 1);
+    test_stuck(AMD, &amd_pnp_driver, 0);
+    test_stuck(INTEL, &intel_pnp_driver, 2);
+    printf("flip tests passed\n");
+    return 0;
+}
@@ -0,0 +1,984 @@
+#include "driver_manager.h"
+#include "pci_snapshot.h"
+#include "workqueue.h"
+#include "tsc.h"
+#include "fs/fat32.h"
+#include "security/verify_cache.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Host test for PCI enumeration and hot-plug in the driver manager. Config
+ * space is a byte model of a few buses behind bridges, reached through the
+ * emulated config ports of pci.c; every read is counted so the cost of a
+ * scan is visible. A catch-all driver claims each device, so no module
+ * loads are started. The event ring is drained by reader threads while
+ * the main thread keeps producing, and the boot snapshot lives in a
+ * memory-backed stand-in for its file. */
+
+void debug_putc(char c) { (void)c; }
+void debug_puts(const char *s) { (void)s; }
+void debug_puthex(uint32_t v) { (void)v; }
+void debug_puthex64(uint64_t v) { (void)v; }
+void map_identity_range(uint64_t phys, uint64_t size) { (void)phys; (void)size; }
+uint64_t tsc_hz(void) { return TSC_DEFAULT_HZ; }
+
+/* init() calls made by the dependency tests, in order */
+static uint8_t init_order[16];
+static unsigned init_count;
+
+/* the manifest is a storage job; note how many inits had run before it */
+static unsigned manifest_loads, manifest_after;
+
+typedef struct module module_t;
+int module_load_manifest(const char *path)
+{
+    assert(!strcmp(path, MODULE_MANIFEST_PATH));
+    manifest_loads++;
+    manifest_after = init_count;
+    return -1;
+}
+int module_loads_pending(void) { return 0; }
+/* set to leave the workqueue to the test, as a poll that comes back
+ * before it drains would */
+static int poll_skips_workqueue;
+void module_poll(void)
+{
+    if (!poll_skips_workqueue)
+        workqueue_run();
+}
+void module_unload(module_t *mod) { (void)mod; }
+void module_hold(module_t *mod) { (void)mod; }
+module_t *module_find_by_driver(driver_t *drv) { (void)drv; return NULL; }
+int module_load_async(const char *path, void (*done)(module_t *, void *),
+                      void *ctx)
+{
+    (void)path; (void)done; (void)ctx;
+    assert(!"no module loads expected");
+    return -1;
+}
+
+/* the snapshot file, and the copy the loader hands over at boot; the
+ * file itself is only reachable once the disk driver's init has run */
+static uint8_t snap_file[PCI_SNAPSHOT_FILE_SIZE];
+static uint8_t snap_boot_copy[PCI_SNAPSHOT_FILE_SIZE];
+static int snap_exists;
+static unsigned snap_writes;
+static int disk_up;
+
+int fat32_open(const char *path, fat32_file_t *file)
+{
+    assert(!strcmp(path, PCI_SNAPSHOT_PATH));
+    if (!snap_exists)
+        return -1;
+    assert(disk_up);
+    memset(file, 0, sizeof(*file));
+    file->size = sizeof(snap_file);
+    return 0;
+}
+
+int fat32_write_at(fat32_file_t *file, uint32_t offset, const void *buf,
+                   uint32_t len)
+{
+    assert(offset + len <= file->size);
+    memcpy(snap_file + offset, buf, len);
+    snap_writes++;
+    return 0;
+}
+
+#define BUSES 8
+#define HP_CAP 0x40          /* PCI Express capability of every bridge */
+static uint8_t cfg[BUSES][32][8][256];
+static uint32_t port_addr;
+static unsigned cfg_reads;
+
+static uint8_t *port_target(void)
+{
+    uint8_t bus = port_addr >> 16, slot = (port_addr >> 11) & 31;
+    uint8_t func = (port_addr >> 8) & 7;
+    return bus < BUSES ? cfg[bus][slot][func] : NULL;
+}
+
+uint32_t pci_emu_inl(uint16_t port)
+{
+    assert(port == 0xcfc);
+    cfg_reads++;
+    uint8_t *c = port_target();
+    uint32_t v = 0xFFFFFFFF;
+    if (c)
+        memcpy(&v, c + (port_addr & 0xfc), 4);
+    return v;
+}
+
+void pci_emu_outl(uint16_t port, uint32_t val)
+{
+    if (port == 0xcf8) {
+        port_addr = val;
+        return;
+    }
+    uint8_t *c = port_target();
+    uint8_t off = port_addr & 0xfc;
+    if (!c || c[0] == 0xFF)
+        return;
+    if (off == HP_CAP + PCI_EXP_SLTCTL) {
+        /* Slot Status is write-1-to-clear */
+        uint16_t status;
+        memcpy(&status, c + off + 2, 2);
+        status &= ~(val >> 16);
+        memcpy(c + off, &val, 2);
+        memcpy(c + off + 2, &status, 2);
+        return;
+    }
+    memcpy(c + off, &val, 4);
+}
+
+static void add_fn(uint8_t bus, uint8_t slot, uint8_t func, uint16_t vendor,
+                   uint8_t class_code, uint8_t subclass, uint8_t header)
+{
+    uint8_t *c = cfg[bus][slot][func];
+    memset(c, 0, 256);
+    c[0] = vendor & 0xFF;
+    c[1] = vendor >> 8;
+    c[2] = slot;                        /* device id: slot and func */
+    c[3] = func;
+    c[0x0A] = subclass;
+    c[0x0B] = class_code;
+    c[PCI_HEADER_TYPE] = header;
+}
+
+static void put16(uint8_t *c, uint16_t off, uint16_t v)
+{
+    memcpy(c + off, &v, 2);
+}
+
+static uint16_t get16(const uint8_t *c, uint16_t off)
+{
+    uint16_t v;
+    memcpy(&v, c + off, 2);
+    return v;
+}
+
+static void add_bridge(uint8_t bus, uint8_t slot, uint8_t secondary,
+                       uint8_t subordinate, int hotplug)
+{
+    add_fn(bus, slot, 0, 0x8086, 0x06, 0x04, PCI_HEADER_TYPE_BRIDGE);
+    uint8_t *c = cfg[bus][slot][0];
+    c[PCI_PRIMARY_BUS] = bus;
+    c[PCI_SECONDARY_BUS] = secondary;
+    c[PCI_SUBORDINATE_BUS] = subordinate;
+    c[PCI_STATUS] = PCI_STATUS_CAP_LIST;
+    c[PCI_CAP_PTR] = HP_CAP;
+    c[HP_CAP] = PCI_CAP_ID_PCIE;
+    if (hotplug) {
+        put16(c, HP_CAP + PCI_EXP_FLAGS, PCI_EXP_FLAGS_SLOT | 2);
+        put16(c, HP_CAP + PCI_EXP_SLTCAP, PCI_EXP_SLTCAP_HPC);
+    }
+}
+
+static void del_fn(uint8_t bus, uint8_t slot, uint8_t func)
+{
+    memset(cfg[bus][slot][func], 0xFF, 256);
+}
+
+/* What a downstream port reports when its slot changes. */
+static void slot_event(uint8_t bus, uint8_t slot, uint16_t bits)
+{
+    uint8_t *c = cfg[bus][slot][0];
+    put16(c, HP_CAP + PCI_EXP_SLTSTA, get16(c, HP_CAP + PCI_EXP_SLTSTA) | bits);
+}
+
+/* --- what the listener has seen --- */
+
+static uint8_t present[BUSES][32][8];
+static unsigned added, removed;
+
+static unsigned claimed_inits;
+static int claim(const pci_device_t *dev) { (void)dev; return 1; }
+static void claimed(const pci_device_t *dev) { (void)dev; claimed_inits++; }
+static driver_t catch_all = { .name = "all", .match = claim, .init = claimed };
+
+static void on_added(const IDevice *dev)
+{
+    assert(!present[dev->bus][dev->slot][dev->func]);
+    assert(dev->device_id == (dev->func << 8 | dev->slot));
+    present[dev->bus][dev->slot][dev->func] = 1;
+    added++;
+}
+
+static void on_removed(const IDevice *dev)
+{
+    assert(present[dev->bus][dev->slot][dev->func]);
+    present[dev->bus][dev->slot][dev->func] = 0;
+    removed++;
+    /* removing a device unregisters its driver; keep claiming the rest */
+    driver_manager_unregister(&catch_all);
+    driver_manager_register(&catch_all);
+}
+
+static IHotSwapListener listener = { .device_added = on_added,
+                                     .device_removed = on_removed };
+
+/* a second listener that takes batches */
+static unsigned batch_calls;
+static uint32_t batch_last;
+static int batch_last_added;
+
+static void on_batch(const IDevice *devs, uint32_t count, int was_added)
+{
+    for (uint32_t i = 0; i < count; i++)
+        assert(present[devs[i].bus][devs[i].slot][devs[i].func] == was_added);
+    batch_calls++;
+    batch_last = count;
+    batch_last_added = was_added;
+}
+
+static void on_batch_added(const IDevice *devs, uint32_t count)
+{
+    on_batch(devs, count, 1);
+}
+
+static void on_batch_removed(const IDevice *devs, uint32_t count)
+{
+    on_batch(devs, count, 0);
+}
+
+static IHotSwapBatchListener batch_listener = {
+    .devices_added = on_batch_added,
+    .devices_removed = on_batch_removed,
+};
+
+static void build_tree(void)
+{
+    memset(cfg, 0xFF, sizeof(cfg));
+    add_fn(0, 0, 0, 0x8086, 0x06, 0x00, 0);              /* host bridge */
+    add_bridge(0, 1, 1, 2, 0);
+    add_fn(0, 2, 0, 0x1af4, 0x02, 0x00, PCI_HEADER_MULTIFUNCTION);
+    add_fn(0, 2, 1, 0x1af4, 0x02, 0x00, 0);
+    add_fn(0, 2, 3, 0x1af4, 0x02, 0x00, 0);
+    /* single-function device that decodes every function number */
+    add_fn(0, 3, 0, 0x10ec, 0x02, 0x00, 0);
+    add_fn(0, 3, 5, 0x10ec, 0x02, 0x00, 0);
+    add_bridge(0, 4, 3, 3, 1);                           /* hot-plug slot */
+    add_bridge(1, 0, 2, 2, 0);
+    add_fn(2, 0, 0, 0x144d, 0x01, 0x08, 0);
+    add_bridge(2, 1, 1, 1, 0);                           /* loops back */
+    /* bus 5 has a device but no bridge leads there */
+    add_fn(5, 0, 0, 0x1234, 0x03, 0x00, 0);
+}
+
+static unsigned count_present(void)
+{
+    unsigned n = 0;
+    for (unsigned b = 0; b < BUSES; b++)
+        for (unsigned s = 0; s < 32; s++)
+            for (unsigned f = 0; f < 8; f++)
+                n += present[b][s][f];
+    return n;
+}
+
+static void test_walk(void)
+{
+    build_tree();
+    pci_init(0);
+    driver_manager_set_rescan_interval(~0ULL);
+    driver_manager_register(&catch_all);
+    driver_manager_add_batch_listener(&batch_listener);
+    driver_manager_add_listener(&listener);
+
+    cfg_reads = 0;
+    driver_manager_init();
+    unsigned init_reads = cfg_reads;
+    assert(count_present() == 10);
+    assert(present[0][2][1] && present[0][2][3] && !present[0][2][2]);
+    assert(present[0][3][0] && !present[0][3][5]);
+    assert(present[1][0][0] && present[2][0][0] && present[2][1][0]);
+    assert(!present[5][0][0]);
+    /* buses 0-3: 32 probes each plus a handful per device */
+    assert(init_reads < 4 * 32 + 10 * 6);
+    /* the hot-plug port latches slot events, but does not interrupt */
+    uint16_t sltctl = get16(cfg[0][4][0], HP_CAP + PCI_EXP_SLTCTL);
+    assert((sltctl & PCI_EXP_SLTCTL_PDCE) && (sltctl & PCI_EXP_SLTCTL_DLLSCE));
+    assert(!(sltctl & PCI_EXP_SLTCTL_HPIE));
+
+    cfg_reads = 0;
+    added = removed = 0;
+    driver_manager_rescan();
+    assert(added == 0 && removed == 0);
+    assert(cfg_reads <= init_reads);
+}
+
+static void test_changes(void)
+{
+    added = removed = 0;
+    del_fn(0, 2, 1);
+    add_fn(2, 7, 0, 0x8086, 0x0c, 0x03, 0);
+    driver_manager_rescan();
+    assert(added == 1 && removed == 1);
+    assert(!present[0][2][1] && present[2][7][0]);
+
+    /* unplugging a bridge takes everything behind it away, and batch
+     * listeners hear about it in one call */
+    batch_calls = 0;
+    del_fn(0, 1, 0);
+    driver_manager_rescan();
+    assert(!present[1][0][0] && !present[2][0][0] && !present[2][7][0]);
+    assert(count_present() == 5);
+    assert(batch_calls == 1 && batch_last == 5 && !batch_last_added);
+    add_bridge(0, 1, 1, 2, 0);
+    driver_manager_rescan();
+    assert(count_present() == 10);
+    assert(batch_calls == 2 && batch_last == 5 && batch_last_added);
+
+    /* listeners run from the workqueue, not from inside the unload */
+    driver_manager_unload(2, 0, 0);
+    assert(present[2][0][0]);
+    workqueue_run();
+    assert(!present[2][0][0]);
+    driver_manager_unload(2, 0, 0);
+    workqueue_run();
+    assert(removed == 1 + 5 + 1);
+}
+
+static void test_hotplug(void)
+{
+    /* a quiet poll reads the one hot-plug port's status and nothing else */
+    cfg_reads = 0;
+    added = removed = 0;
+    driver_manager_poll();
+    assert(cfg_reads == 1 && added == 0);
+
+    add_fn(3, 9, 0, 0x10de, 0x03, 0x00, 0);
+    slot_event(0, 4, PCI_EXP_SLTSTA_PDC | PCI_EXP_SLTSTA_DLLSC);
+    cfg_reads = 0;
+    driver_manager_poll();
+    assert(added == 1 && present[3][9][0]);
+    assert(get16(cfg[0][4][0], HP_CAP + PCI_EXP_SLTSTA) == 0);
+    /* only bus 3 was walked */
+    assert(cfg_reads < 40);
+
+    /* the interrupt entry only acks the event; the next poll rescans */
+    hot_swap_event_t ev[16];
+    while (driver_manager_pop_events(ev, 16) > 0)
+        ;
+    del_fn(3, 9, 0);
+    slot_event(0, 4, PCI_EXP_SLTSTA_PDC);
+    cfg_reads = 0;
+    driver_manager_hotplug_irq();
+    assert(cfg_reads == 1 && present[3][9][0]);
+    assert(get16(cfg[0][4][0], HP_CAP + PCI_EXP_SLTSTA) == 0);
+    /* and pushes no event: the ring has a single producer */
+    assert(!workqueue_pending() && !driver_manager_pop_events(ev, 16));
+    driver_manager_poll();
+    assert(removed == 1 && !present[3][9][0]);
+    assert(driver_manager_pop_events(ev, 16) == 1 && !ev[0].added);
+
+    /* changes outside hot-plug slots wait for the fallback scan */
+    add_fn(1, 6, 0, 0x8086, 0x02, 0x00, 0);
+    driver_manager_poll();
+    assert(!present[1][6][0]);
+    driver_manager_set_rescan_interval(0);
+    driver_manager_poll();
+    assert(present[1][6][0]);
+    del_fn(1, 6, 0);
+    driver_manager_poll();
+    assert(!present[1][6][0]);
+    driver_manager_set_rescan_interval(~0ULL);
+
+    /* once the port itself is gone it is no longer polled */
+    del_fn(0, 4, 0);
+    driver_manager_rescan();
+    cfg_reads = 0;
+    driver_manager_poll();
+    assert(cfg_reads == 0);
+    add_bridge(0, 4, 3, 3, 1);
+    driver_manager_rescan();
+    cfg_reads = 0;
+    driver_manager_poll();
+    assert(cfg_reads == 1);
+
+    /* a port whose rescan drops another port still lets every port be
+     * serviced in the same poll. Arrange the ports as inner, outer,
+     * other: inner sits behind outer, ahead of it in the list. */
+    add_bridge(0, 6, 6, 6, 1);
+    driver_manager_rescan();                     /* outer, other */
+    del_fn(0, 4, 0);
+    driver_manager_rescan();
+    add_bridge(0, 4, 3, 4, 1);
+    add_bridge(3, 0, 4, 4, 1);
+    driver_manager_rescan();                     /* other, outer, inner */
+    del_fn(0, 6, 0);
+    driver_manager_rescan();                     /* inner, outer */
+    add_bridge(0, 6, 6, 6, 1);
+    driver_manager_rescan();                     /* inner, outer, other */
+    del_fn(3, 0, 0);
+    slot_event(0, 4, PCI_EXP_SLTSTA_PDC);
+    add_fn(6, 1, 0, 0x8086, 0x02, 0x00, 0);
+    slot_event(0, 6, PCI_EXP_SLTSTA_PDC);
+    added = removed = 0;
+    driver_manager_poll();
+    assert(removed == 1 && !present[3][0][0]);
+    assert(added == 1 && present[6][1][0]);
+    del_fn(0, 6, 0);
+    cfg[0][4][0][PCI_SUBORDINATE_BUS] = 3;
+    driver_manager_rescan();
+}
+
+/* Swap a full bus behind the hot-plug port for another in polls that
+ * leave the workqueue alone: the removals and the inits all wait for the
+ * workqueue rather than reaching the listeners from inside the scan. A
+ * function that comes and goes before then is never announced at all. */
+#define SWAP_FNS 50
+
+static void swap_set(uint8_t first_slot, int plug)
+{
+    for (unsigned i = 0; i < SWAP_FNS; i++) {
+        uint8_t slot = first_slot + i / 8, func = i % 8;
+        if (plug)
+            add_fn(3, slot, func, 0x1b36, 0x08, 0x80,
+                   func ? 0 : PCI_HEADER_MULTIFUNCTION);
+        else
+            del_fn(3, slot, func);
+    }
+    slot_event(0, 4, PCI_EXP_SLTSTA_PDC);
+    driver_manager_hotplug_irq();
+    poll_skips_workqueue = 1;
+    driver_manager_poll();
+    poll_skips_workqueue = 0;
+}
+
+static void test_notify_queue(void)
+{
+    swap_set(10, 1);
+    workqueue_run();
+    added = removed = 0;
+
+    swap_set(10, 0);
+    /* on_removed() has not run to put the catch-all back yet */
+    driver_manager_register(&catch_all);
+    swap_set(20, 1);
+    assert(added == 0 && removed == 0);
+    uint8_t last_slot = 20 + (SWAP_FNS - 1) / 8, last_func = (SWAP_FNS - 1) % 8;
+    del_fn(3, last_slot, last_func);
+    driver_manager_unload(3, last_slot, last_func);
+    assert(added == 0 && removed == 0);
+    workqueue_run();
+    assert(removed == SWAP_FNS && added == SWAP_FNS - 1);
+    assert(!present[3][10][0] && present[3][20][0]);
+    assert(!present[3][last_slot][last_func]);
+
+    swap_set(20, 0);
+    workqueue_run();
+    assert(removed == 2 * SWAP_FNS - 1);
+
+    /* churn until cancelled jobs fill the table: the functions that find
+     * no free slot wait for one instead of running init() in the scan */
+    added = removed = claimed_inits = 0;
+    swap_set(10, 1);
+    swap_set(10, 0);
+    driver_manager_register(&catch_all);
+    swap_set(20, 1);
+    swap_set(20, 0);
+    driver_manager_register(&catch_all);
+    swap_set(10, 1);
+    assert(claimed_inits == 0 && added == 0);
+    workqueue_run();
+    assert(claimed_inits == SWAP_FNS && added == SWAP_FNS && removed == 0);
+    assert(present[3][10][0] && !present[3][20][0]);
+
+    swap_set(10, 0);
+    workqueue_run();
+    assert(removed == SWAP_FNS);
+}
+
+/* --- match tables --- */
+
+static int bound[32];          /* per slot on bus 1: which driver's init ran */
+static unsigned veto_calls;
+
+static void init_gpu(const pci_device_t *dev) { bound[dev->slot] = 1; }
+static void init_exact(const pci_device_t *dev) { bound[dev->slot] = 2; }
+static void init_net(const pci_device_t *dev) { bound[dev->slot] = 3; }
+static void init_gpu2(const pci_device_t *dev) { bound[dev->slot] = 4; }
+
+static int net_veto(const pci_device_t *dev)
+{
+    veto_calls++;
+    return dev->slot != 13;
+}
+
+static const pci_match_t gpu_ids[] = {
+    { .flags = PCI_MATCH_VENDOR | PCI_MATCH_CLASS,
+      .vendor_id = 0x10de, .class_code = 0x03 },
+    { 0 }
+};
+static const pci_match_t exact_ids[] = {
+    { .flags = PCI_MATCH_VENDOR | PCI_MATCH_DEVICE | PCI_MATCH_CLASS,
+      .vendor_id = 0x10de, .device_id = 11, .class_code = 0x03 },
+    { 0 }
+};
+static const pci_match_t net_ids[] = {
+    { .flags = PCI_MATCH_CLASS | PCI_MATCH_SUBCLASS,
+      .class_code = 0x02, .subclass = 0x00 },
+    { 0 }
+};
+
+static driver_t gpu_drv = { .name = "gpu", .init = init_gpu, .ids = gpu_ids };
+static driver_t exact_drv = { .name = "exact", .init = init_exact,
+                              .ids = exact_ids };
+static driver_t net_drv = { .name = "net", .match = net_veto,
+                            .init = init_net, .ids = net_ids };
+static driver_t gpu2_drv = { .name = "gpu2", .init = init_gpu2,
+                             .ids = gpu_ids };
+
+#define FILLERS 40
+static pci_match_t filler_ids[FILLERS][3];
+static driver_t fillers[FILLERS];
+static unsigned filler_calls;
+
+static int filler_match(const pci_device_t *dev)
+{
+    (void)dev;
+    filler_calls++;
+    return 1;
+}
+
+static void test_match(void)
+{
+    for (int i = 0; i < FILLERS; i++) {
+        filler_ids[i][0] = (pci_match_t){ .flags = PCI_MATCH_VENDOR,
+                                          .vendor_id = 0x2000 + i };
+        filler_ids[i][1] = (pci_match_t){ .flags = PCI_MATCH_VENDOR |
+                                          PCI_MATCH_DEVICE,
+                                          .vendor_id = 0x10de,
+                                          .device_id = 0x4000 + i };
+        fillers[i] = (driver_t){ .name = "filler", .match = filler_match,
+                                 .ids = filler_ids[i] };
+        driver_manager_register(&fillers[i]);
+    }
+    driver_manager_register(&gpu_drv);
+    driver_manager_register(&exact_drv);
+    driver_manager_register(&net_drv);
+
+    add_fn(1, 10, 0, 0x10de, 0x03, 0x00, 0);
+    add_fn(1, 11, 0, 0x10de, 0x03, 0x00, 0);
+    add_fn(1, 12, 0, 0x1af4, 0x02, 0x00, 0);
+    add_fn(1, 13, 0, 0x1af4, 0x02, 0x00, 0);
+    driver_manager_rescan();
+    assert(bound[10] == 1);             /* vendor + class */
+    assert(bound[11] == 2);             /* the more specific entry */
+    assert(bound[12] == 3);
+    assert(bound[13] == 0 && present[1][13][0]);   /* vetoed: catch-all */
+    assert(veto_calls == 2);
+    /* no driver was asked about a device its table does not name */
+    assert(filler_calls == 0);
+
+    /* equal entries: the later registration wins */
+    driver_manager_register(&gpu2_drv);
+    add_fn(1, 14, 0, 0x10de, 0x03, 0x00, 0);
+    driver_manager_rescan();
+    assert(bound[14] == 4);
+
+    /* a driver leaves the index when it is unregistered */
+    driver_manager_unregister(&gpu2_drv);
+    driver_manager_unregister(&gpu_drv);
+    add_fn(1, 15, 0, 0x10de, 0x03, 0x00, 0);
+    driver_manager_rescan();
+    assert(bound[15] == 0 && present[1][15][0]);
+
+    for (int i = 0; i < FILLERS; i++)
+        driver_manager_unregister(&fillers[i]);
+    driver_manager_unregister(&exact_drv);
+    driver_manager_unregister(&net_drv);
+    for (uint8_t slot = 10; slot <= 15; slot++)
+        del_fn(1, slot, 0);
+    driver_manager_rescan();
+    assert(!present[1][10][0] && !present[1][15][0]);
+    assert(filler_calls == 0);
+}
+
+/* Random churn on bus 3 checks the BDF index against the listener's view
+ * while records move around in devices[]. */
+static unsigned bus3_functions(void)
+{
+    unsigned n = 0;
+    for (unsigned s = 0; s < 32; s++)
+        for (unsigned f = 0; f < 8; f++)
+            n += cfg[3][s][f][0] != 0xFF;
+    return n;
+}
+
+static void test_churn(void)
+{
+    srand(42);
+    for (int round = 0; round < 500; round++) {
+        for (int k = 0; k < 6; k++) {
+            uint8_t slot = rand() % 32, func = rand() % 8;
+            if (cfg[3][slot][func][0] == 0xFF && bus3_functions() < 40) {
+                add_fn(3, slot, func, 0x1b36, 0x08, 0x80,
+                       PCI_HEADER_MULTIFUNCTION);
+                if (func)
+                    add_fn(3, slot, 0, 0x1b36, 0x08, 0x80,
+                           PCI_HEADER_MULTIFUNCTION);
+            } else if (cfg[3][slot][func][0] != 0xFF) {
+                del_fn(3, slot, func);
+            }
+        }
+        if (rand() % 4 == 0) {
+            uint8_t slot = rand() % 32, func = rand() % 8;
+            driver_manager_unload(3, slot, func);
+            workqueue_run();
+            assert(!present[3][slot][func]);
+        }
+        driver_manager_rescan();
+        for (unsigned s = 0; s < 32; s++) {
+            int multi = cfg[3][s][0][0] != 0xFF &&
+                        (cfg[3][s][0][PCI_HEADER_TYPE] & PCI_HEADER_MULTIFUNCTION);
+            for (unsigned f = 0; f < 8; f++) {
+                int exists = cfg[3][s][f][0] != 0xFF &&
+                             cfg[3][s][0][0] != 0xFF && (f == 0 || multi);
+                assert(present[3][s][f] == exists);
+            }
+        }
+    }
+}
+
+/* --- init jobs and their dependencies --- */
+
+static void log_init(const pci_device_t *dev)
+{
+    init_order[init_count++] = dev->slot;
+}
+
+/* long enough to show up in the timings */
+static void slow_init(const pci_device_t *dev)
+{
+    uint64_t start = tsc_read();
+    while (tsc_read() - start < 100000)
+        ;
+    log_init(dev);
+}
+
+static const pci_match_t disk_ids[] = {
+    { .flags = PCI_MATCH_VENDOR, .vendor_id = 0xA001 }, { 0 } };
+static const pci_match_t nic_ids[] = {
+    { .flags = PCI_MATCH_VENDOR, .vendor_id = 0xA002 }, { 0 } };
+static const pci_match_t gfx_ids[] = {
+    { .flags = PCI_MATCH_VENDOR, .vendor_id = 0xA003 }, { 0 } };
+static const pci_match_t misc_ids[] = {
+    { .flags = PCI_MATCH_VENDOR, .vendor_id = 0xA004 }, { 0 } };
+
+static void disk_init(const pci_device_t *dev)
+{
+    log_init(dev);
+    disk_up = 1;
+}
+
+static driver_t disk_drv = { .name = "disk", .init = disk_init,
+                             .ids = disk_ids,
+                             .provides = DRIVER_DEP_STORAGE };
+static driver_t nic_drv = { .name = "nic", .init = log_init, .ids = nic_ids,
+                            .provides = DRIVER_DEP_NETWORK,
+                            .requires = DRIVER_DEP_STORAGE };
+static driver_t gfx_drv = { .name = "gfx", .init = log_init, .ids = gfx_ids,
+                            .provides = DRIVER_DEP_DISPLAY,
+                            .requires = DRIVER_DEP_FRAMEBUFFER };
+static driver_t misc_drv = { .name = "misc", .init = slow_init,
+                             .ids = misc_ids };
+
+static int order_of(uint8_t slot)
+{
+    for (unsigned i = 0; i < init_count; i++) {
+        if (init_order[i] == slot)
+            return i;
+    }
+    return -1;
+}
+
+static void test_init_jobs(void)
+{
+    for (unsigned s = 0; s < 32; s++)
+        for (unsigned f = 0; f < 8; f++)
+            del_fn(3, s, f);
+    driver_manager_rescan();
+    driver_manager_register(&disk_drv);
+    driver_manager_register(&nic_drv);
+    driver_manager_register(&gfx_drv);
+    driver_manager_register(&misc_drv);
+
+    /* dependants are found before what they depend on */
+    driver_manager_hold(DRIVER_DEP_FRAMEBUFFER);
+    add_fn(3, 1, 0, 0xA002, 0x02, 0x00, 0);
+    add_fn(3, 2, 0, 0xA003, 0x03, 0x00, 0);
+    add_fn(3, 3, 0, 0xA001, 0x01, 0x06, 0);
+    add_fn(3, 4, 0, 0xA004, 0x08, 0x80, 0);
+    add_fn(3, 5, 0, 0xA001, 0x01, 0x06, 0);
+    added = removed = 0;
+    init_count = 0;
+    driver_manager_rescan();
+    assert(init_count == 4 && added == 4);
+    assert(order_of(3) == 0 && order_of(4) == 1 && order_of(5) == 2);
+    /* the NIC waited for both disks, the GPU for the framebuffer */
+    assert(order_of(1) == 3 && order_of(2) == -1);
+    assert(present[3][1][0] && !present[3][2][0]);
+
+    /* a device that leaves before its init ran was never announced */
+    del_fn(3, 2, 0);
+    driver_manager_rescan();
+    assert(removed == 0);
+    driver_manager_register(&gfx_drv);
+    add_fn(3, 2, 0, 0xA003, 0x03, 0x00, 0);
+    driver_manager_rescan();
+    assert(init_count == 4);
+
+    driver_manager_release(DRIVER_DEP_FRAMEBUFFER);
+    driver_manager_poll();
+    assert(init_count == 5 && order_of(2) == 4 && present[3][2][0]);
+
+    driver_init_stat_t st[MAX_INIT_JOBS];
+    int n = driver_manager_init_stats(st, MAX_INIT_JOBS);
+    int seen_misc = 0, seen_nic = 0;
+    for (int i = 0; i < n; i++) {
+        if (st[i].bus != 3)
+            continue;
+        if (st[i].slot == 4) {
+            assert(!strcmp(st[i].driver, "misc"));
+            assert(st[i].init_ticks >= 100000);
+            seen_misc = 1;
+        } else if (st[i].slot == 1) {
+            /* queued behind the slow device */
+            assert(!strcmp(st[i].driver, "nic"));
+            assert(st[i].wait_ticks >= 100000);
+            seen_nic = 1;
+        }
+    }
+    assert(seen_misc && seen_nic);
+
+    driver_manager_unregister(&disk_drv);
+    driver_manager_unregister(&nic_drv);
+    driver_manager_unregister(&gfx_drv);
+    driver_manager_unregister(&misc_drv);
+}
+
+/* --- hot-swap event ring --- */
+
+#define EV_BUS  3
+#define EV_SLOT 5
+
+static void drain_events(void)
+{
+    hot_swap_event_t ev[16];
+    while (driver_manager_pop_events(ev, 16) > 0)
+        ;
+}
+
+/* One rescan, one event: the test device appears or goes away. */
+static void toggle_device(void)
+{
+    if (cfg[EV_BUS][EV_SLOT][0][0] == 0xFF)
+        add_fn(EV_BUS, EV_SLOT, 0, 0x1b36, 0x08, 0x80, 0);
+    else
+        del_fn(EV_BUS, EV_SLOT, 0);
+    driver_manager_rescan();
+}
+
+static void test_event_burst(void)
+{
+    for (unsigned s = 0; s < 32; s++)
+        for (unsigned f = 0; f < 8; f++)
+            del_fn(EV_BUS, s, f);
+    driver_manager_rescan();
+    drain_events();
+
+    hot_swap_event_stats_t before, after;
+    driver_manager_get_event_stats(&before);
+    assert(before.pending == 0);
+    assert(before.popped + before.overwritten + before.dropped == before.pushed);
+
+    unsigned burst = DRIVER_EVENT_RING_SIZE + 44;
+    for (unsigned i = 0; i < burst; i++)
+        toggle_device();
+    driver_manager_get_event_stats(&after);
+    assert(after.pushed - before.pushed == burst);
+    assert(after.overwritten - before.overwritten == 44);
+    assert(after.dropped == before.dropped);
+    assert(after.pending == DRIVER_EVENT_RING_SIZE);
+
+    /* the newest events survive, in order and without gaps */
+    hot_swap_event_t ev[64];
+    uint64_t next = before.pushed + 44;
+    unsigned got = 0;
+    int n;
+    while ((n = driver_manager_pop_events(ev, 64)) > 0) {
+        for (int i = 0; i < n; i++, next++) {
+            assert(ev[i].seq == next);
+            assert(ev[i].dev.bus == EV_BUS && ev[i].dev.slot == EV_SLOT);
+            assert(ev[i].added == (int)((next - before.pushed) % 2 == 0));
+        }
+        got += n;
+    }
+    assert(got == DRIVER_EVENT_RING_SIZE);
+    hot_swap_event_t one;
+    assert(driver_manager_pop_event(&one) == -1);
+}
+
+#define STRESS_READERS 3
+#define STRESS_EVENTS  20000
+
+static uint8_t seen[STRESS_EVENTS];
+static uint64_t stress_base;
+static int stress_done;
+
+static void *stress_reader(void *arg)
+{
+    (void)arg;
+    hot_swap_event_t ev[8];
+    for (;;) {
+        int done = __atomic_load_n(&stress_done, __ATOMIC_ACQUIRE);
+        int n = driver_manager_pop_events(ev, 1 + rand() % 8);
+        for (int i = 0; i < n; i++) {
+            uint64_t k = ev[i].seq - stress_base;
+            assert(k < STRESS_EVENTS);
+            assert(ev[i].dev.bus == EV_BUS && ev[i].dev.slot == EV_SLOT &&
+                   ev[i].dev.device_id == EV_SLOT);
+            assert(ev[i].added == (int)(k % 2 == 0));
+            __atomic_fetch_add(&seen[k], 1, __ATOMIC_RELAXED);
+        }
+        if (!n && done)
+            return NULL;
+    }
+}
+
+static void test_event_stress(void)
+{
+    hot_swap_event_stats_t before, after;
+    driver_manager_get_event_stats(&before);
+    assert(before.pending == 0);
+    stress_base = before.pushed;
+
+    pthread_t readers[STRESS_READERS];
+    for (int i = 0; i < STRESS_READERS; i++)
+        pthread_create(&readers[i], NULL, stress_reader, NULL);
+    for (unsigned i = 0; i < STRESS_EVENTS; i++)
+        toggle_device();
+    __atomic_store_n(&stress_done, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < STRESS_READERS; i++)
+        pthread_join(readers[i], NULL);
+
+    driver_manager_get_event_stats(&after);
+    uint64_t delivered = 0;
+    for (unsigned k = 0; k < STRESS_EVENTS; k++) {
+        assert(seen[k] <= 1);
+        delivered += seen[k];
+    }
+    assert(after.pushed - before.pushed == STRESS_EVENTS);
+    assert(after.popped - before.popped == delivered);
+    assert(delivered + (after.overwritten - before.overwritten) +
+           (after.dropped - before.dropped) == STRESS_EVENTS);
+    assert(after.pending == 0);
+}
+
+/* --- enumeration snapshot --- */
+
+static void reboot(void)
+{
+    memset(present, 0, sizeof(present));
+    added = removed = 0;
+    cfg_reads = 0;
+    disk_up = 0;
+    memcpy(snap_boot_copy, snap_file, sizeof(snap_file));
+    pci_snapshot_set_boot_copy(snap_exists ? snap_boot_copy : NULL,
+                               sizeof(snap_boot_copy));
+    driver_manager_init();
+}
+
+/* The module manifest comes off the boot disk: it waits for the storage
+ * driver's init, found after another device in the same walk. */
+static void test_manifest(void)
+{
+    driver_manager_register(&disk_drv);
+    driver_manager_register(&misc_drv);
+    add_fn(3, 3, 0, 0xA004, 0x08, 0x80, 0);
+    add_fn(3, 4, 0, 0xA001, 0x01, 0x06, 0);
+    init_count = 0;
+    manifest_loads = 0;
+    reboot();
+    assert(manifest_loads == 1);
+    assert(order_of(4) >= 0 && manifest_after > (unsigned)order_of(4));
+    del_fn(3, 3, 0);
+    del_fn(3, 4, 0);
+    driver_manager_rescan();
+    driver_manager_unregister(&disk_drv);
+    driver_manager_unregister(&misc_drv);
+}
+
+/* The boot disk is a device like any other, found by the walk or bound
+ * from the snapshot; the stubs above fail if the file is touched first. */
+static void test_snapshot(void)
+{
+    driver_manager_register(&disk_drv);
+    add_fn(3, 4, 0, 0xA001, 0x01, 0x06, 0);
+
+    /* an empty file: full scan, then the snapshot is written */
+    snap_exists = 1;
+    reboot();
+    unsigned full_reads = cfg_reads;
+    unsigned devices = count_present();
+    const pci_snapshot_header_t *hdr = (const void *)snap_file;
+    assert(snap_writes == 1);
+    assert(hdr->magic == PCI_SNAPSHOT_MAGIC && hdr->count == devices);
+
+    /* same hardware: one ID read per function and the hot-plug probe,
+     * then the full walk on the first poll finds nothing new */
+    reboot();
+    assert(count_present() == devices && added == devices);
+    assert(cfg_reads < full_reads / 2);
+    assert(workqueue_pending());
+    driver_manager_poll();
+    assert(!workqueue_pending());
+    assert(added == devices && removed == 0 && snap_writes == 1);
+
+    /* a device the snapshot does not know turns up in the background */
+    add_fn(3, 20, 0, 0x1b36, 0x08, 0x80, 0);
+    reboot();
+    assert(!present[3][20][0]);
+    driver_manager_poll();
+    assert(present[3][20][0] && snap_writes == 2);
+    assert(hdr->count == devices + 1);
+
+    /* a remembered function answers with other IDs: full scan at boot */
+    add_fn(3, 20, 0, 0x1b37, 0x08, 0x80, 0);
+    reboot();
+    assert(present[3][20][0] && !workqueue_pending());
+    assert(cfg_reads >= full_reads && snap_writes == 3);
+
+    /* a damaged file is not trusted */
+    snap_file[sizeof(pci_snapshot_header_t) + 4] ^= 1;
+    reboot();
+    assert(cfg_reads >= full_reads && snap_writes == 4);
+    reboot();
+    assert(cfg_reads < full_reads / 2);
+    driver_manager_poll();
+    snap_exists = 0;
+    del_fn(3, 4, 0);
+    driver_manager_rescan();
+    driver_manager_unregister(&disk_drv);
+}
+
+int main(void)
+{
+    test_walk();
+    test_changes();
+    test_hotplug();
+    test_notify_queue();
+    test_match();
+    test_churn();
+    test_init_jobs();
+    test_event_burst();
+    test_event_stress();
+    test_manifest();
+    test_snapshot();
+    printf("driver manager tests passed\n");
+    return 0;
+}
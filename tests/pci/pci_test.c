@@ -0,0 +1,369 @@
+#include "pci.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* Host test for the PCI config access layer. Four buses of config space
+ * live in one buffer that serves both as the ECAM window and as the store
+ * behind a model of the 0xCF8/0xCFC ports; the ACPI tables pointing at it
+ * are built below 4 GiB so the 32-bit RSDT path can be exercised too. */
+
+void debug_putc(char c) { (void)c; }
+void debug_puts(const char *s) { (void)s; }
+void debug_puthex(uint32_t v) { (void)v; }
+void debug_puthex64(uint64_t v) { (void)v; }
+void map_identity_range(uint64_t phys, uint64_t size) { (void)phys; (void)size; }
+
+#define BUSES 4
+#define FN_CFG(b, s, f) (ecam + (((size_t)(b) << 20) | ((s) << 15) | ((f) << 12)))
+
+static uint8_t *ecam;
+static uint32_t port_addr;
+static unsigned port_ops;
+
+/* Writable bits of the GPU's BARs behind the ports: 16 MiB at BAR0, a
+ * 64-bit 256 MiB window at BAR1/2, nothing at BAR3, 256 I/O ports at
+ * BAR4. The low flag bits of each BAR are read-only. */
+static const uint32_t gpu_bar_mask[6] = {
+    0xFF000000, 0xF0000000, 0xFFFFFFFF, 0, 0xFFFFFF00, 0
+};
+
+uint32_t pci_emu_inl(uint16_t port)
+{
+    assert(port == 0xcfc);
+    port_ops++;
+    if (!(port_addr & 0x80000000u))
+        return 0xFFFFFFFF;
+    uint8_t bus = port_addr >> 16, slot = (port_addr >> 11) & 31;
+    uint8_t func = (port_addr >> 8) & 7, off = port_addr & 0xfc;
+    if (bus >= BUSES)
+        return 0xFFFFFFFF;
+    uint32_t v;
+    memcpy(&v, FN_CFG(bus, slot, func) + off, 4);
+    return v;
+}
+
+void pci_emu_outl(uint16_t port, uint32_t val)
+{
+    port_ops++;
+    if (port == 0xcf8) {
+        port_addr = val;
+        return;
+    }
+    assert(port == 0xcfc);
+    uint8_t bus = port_addr >> 16, slot = (port_addr >> 11) & 31;
+    uint8_t func = (port_addr >> 8) & 7, off = port_addr & 0xfc;
+    if (bus >= BUSES)
+        return;
+    uint8_t *cfg = FN_CFG(bus, slot, func);
+    if (cfg == FN_CFG(0, 2, 0) && off >= PCI_BAR0 && off < PCI_BAR0 + 24) {
+        uint32_t mask = gpu_bar_mask[(off - PCI_BAR0) / 4], old;
+        memcpy(&old, cfg + off, 4);
+        /* sizing a BAR that still decodes would move it under live traffic */
+        if (val == 0xFFFFFFFF)
+            assert(!(cfg[PCI_COMMAND] & PCI_COMMAND_MEMORY));
+        val = (val & mask) | (old & ~mask & 0xF);
+    }
+    if (off == PCI_COMMAND)     /* status is write-one-to-clear; keep it */
+        memcpy((uint8_t *)&val + 2, cfg + PCI_STATUS, 2);
+    memcpy(cfg + off, &val, 4);
+}
+
+static void put32(uint8_t *cfg, uint16_t off, uint32_t v)
+{
+    memcpy(cfg + off, &v, 4);
+}
+
+static void add_function(uint8_t bus, uint8_t slot, uint8_t func,
+                         uint32_t id, uint8_t class_code)
+{
+    uint8_t *cfg = FN_CFG(bus, slot, func);
+    memset(cfg, 0, 4096);
+    put32(cfg, 0x00, id);
+    put32(cfg, 0x08, (uint32_t)class_code << 24);
+}
+
+static void add_cap(uint8_t *cfg, uint8_t off, uint8_t id, uint8_t next)
+{
+    cfg[0x06] |= PCI_STATUS_CAP_LIST;
+    if (!cfg[PCI_CAP_PTR])
+        cfg[PCI_CAP_PTR] = off;
+    cfg[off] = id;
+    cfg[off + 1] = next;
+}
+
+static void build_devices(void)
+{
+    memset(ecam, 0xFF, (size_t)BUSES << 20);
+
+    add_function(0, 0, 0, 0x12378086, 0x06);          /* host bridge */
+
+    add_function(0, 2, 0, 0x1eb810de, 0x03);          /* PCIe GPU */
+    uint8_t *gpu = FN_CFG(0, 2, 0);
+    put32(gpu, PCI_COMMAND, 0x0007);
+    put32(gpu, PCI_BAR0, 0xf6000000);
+    put32(gpu, PCI_BAR0 + 4, 0xe0000000 | PCI_BAR_TYPE_64 | 0x8);
+    put32(gpu, PCI_BAR0 + 8, 0x4);
+    put32(gpu, PCI_BAR0 + 16, 0xe000 | PCI_BAR_IO);
+    add_cap(gpu, 0x40, PCI_CAP_ID_PM, 0x50);
+    add_cap(gpu, 0x50, PCI_CAP_ID_PCIE, 0x70);
+    add_cap(gpu, 0x70, PCI_CAP_ID_MSI, 0x00);
+    put32(gpu, 0x100, PCI_EXT_CAP_ID_AER | 1u << 16 | 0x140u << 20);
+    put32(gpu, 0x140, PCI_EXT_CAP_ID_DSN | 1u << 16);
+    put32(gpu, 0x144, 0xdeadbeef);
+
+    add_function(1, 0, 0, 0x80291274, 0x04);          /* conventional PCI */
+    add_cap(FN_CFG(1, 0, 0), 0x40, PCI_CAP_ID_PM, 0x00);
+
+    add_function(2, 3, 0, 0x00011af4, 0x02);          /* looping list */
+    add_cap(FN_CFG(2, 3, 0), 0x40, PCI_CAP_ID_PM, 0x40);
+}
+
+/* --- ACPI tables --- */
+
+typedef struct __attribute__((packed)) {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt;
+    uint32_t length;
+    uint64_t xsdt;
+    uint8_t ext_checksum;
+    uint8_t reserved[3];
+} rsdp_t;
+
+typedef struct __attribute__((packed)) {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem[26];
+} sdt_t;
+
+typedef struct __attribute__((packed)) {
+    uint64_t base;
+    uint16_t segment;
+    uint8_t bus_start;
+    uint8_t bus_end;
+    uint32_t reserved;
+} mcfg_entry_t;
+
+static uint8_t *arena;
+static size_t arena_used;
+
+static void *low_alloc(size_t size)
+{
+    void *p = arena + arena_used;
+    memset(p, 0, size);
+    arena_used += (size + 15) & ~(size_t)15;
+    return p;
+}
+
+static uint8_t sum(const void *p, size_t len)
+{
+    const uint8_t *b = p;
+    uint8_t s = 0;
+    while (len--)
+        s += *b++;
+    return s;
+}
+
+static sdt_t *new_table(const char *sig, size_t len)
+{
+    sdt_t *t = low_alloc(len);
+    memcpy(t->signature, sig, 4);
+    t->length = (uint32_t)len;
+    return t;
+}
+
+static void seal(sdt_t *t)
+{
+    t->checksum = 0;
+    t->checksum = -sum(t, t->length);
+}
+
+static sdt_t *mcfg;
+
+/* MCFG with a segment 0 window over buses 0-3 and one on segment 1. */
+static sdt_t *build_mcfg(void)
+{
+    sdt_t *t = new_table("MCFG", sizeof(sdt_t) + 8 + 2 * sizeof(mcfg_entry_t));
+    mcfg_entry_t *e = (mcfg_entry_t *)((uint8_t *)t + sizeof(sdt_t) + 8);
+    e[0].base = (uintptr_t)ecam;
+    e[0].bus_start = 0;
+    e[0].bus_end = BUSES - 1;
+    e[1].base = 0xe0000000;
+    e[1].segment = 1;
+    e[1].bus_end = 0xff;
+    seal(t);
+    return t;
+}
+
+static uint64_t build_rsdp(int wide)
+{
+    arena_used = 0;
+    sdt_t *apic = new_table("APIC", sizeof(sdt_t) + 8);
+    seal(apic);
+    mcfg = build_mcfg();
+
+    rsdp_t *rsdp = low_alloc(sizeof(*rsdp));
+    memcpy(rsdp->signature, "RSD PTR ", 8);
+    if (wide) {
+        sdt_t *xsdt = new_table("XSDT", sizeof(sdt_t) + 16);
+        uint64_t ents[2] = { (uintptr_t)apic, (uintptr_t)mcfg };
+        memcpy(xsdt + 1, ents, sizeof(ents));
+        seal(xsdt);
+        rsdp->revision = 2;
+        rsdp->length = sizeof(*rsdp);
+        rsdp->xsdt = (uintptr_t)xsdt;
+    } else {
+        sdt_t *rsdt = new_table("RSDT", sizeof(sdt_t) + 8);
+        uint32_t ents[2] = { (uint32_t)(uintptr_t)apic, (uint32_t)(uintptr_t)mcfg };
+        memcpy(rsdt + 1, ents, sizeof(ents));
+        seal(rsdt);
+        rsdp->rsdt = (uint32_t)(uintptr_t)rsdt;
+    }
+    rsdp->checksum = -sum(rsdp, 20);
+    rsdp->ext_checksum = -sum(rsdp, sizeof(*rsdp));
+    return (uintptr_t)rsdp;
+}
+
+/* --- tests --- */
+
+static void check_capabilities(int extended)
+{
+    assert(pci_find_capability(0, 2, 0, PCI_CAP_ID_PM) == 0x40);
+    assert(pci_find_capability(0, 2, 0, PCI_CAP_ID_MSI) == 0x70);
+    assert(pci_find_capability(0, 2, 0, PCI_CAP_ID_MSIX) == 0);
+    assert(pci_find_capability(0, 0, 0, PCI_CAP_ID_PM) == 0);
+    assert(pci_find_capability(0, 5, 0, PCI_CAP_ID_PM) == 0);
+    assert(pci_find_capability(2, 3, 0, PCI_CAP_ID_MSI) == 0);
+    assert(pci_config_size(1, 0, 0) == PCI_CFG_SIZE);
+    assert(pci_find_ext_capability(1, 0, 0, PCI_EXT_CAP_ID_AER) == 0);
+
+    if (extended) {
+        assert(pci_config_size(0, 2, 0) == PCIE_CFG_SIZE);
+        assert(pci_find_ext_capability(0, 2, 0, PCI_EXT_CAP_ID_AER) == 0x100);
+        uint16_t dsn = pci_find_ext_capability(0, 2, 0, PCI_EXT_CAP_ID_DSN);
+        assert(dsn == 0x140);
+        assert(pci_config_read32(0, 2, 0, dsn + 4) == 0xdeadbeef);
+    } else {
+        assert(pci_config_size(0, 2, 0) == PCI_CFG_SIZE);
+        assert(pci_find_ext_capability(0, 2, 0, PCI_EXT_CAP_ID_AER) == 0);
+    }
+}
+
+static unsigned scan_ops(void)
+{
+    unsigned before = port_ops, found = 0;
+    for (unsigned bus = 0; bus < BUSES; bus++)
+        for (uint8_t slot = 0; slot < 32; slot++)
+            for (uint8_t func = 0; func < 8; func++)
+                if ((pci_config_read32(bus, slot, func, 0) & 0xFFFF) != 0xFFFF)
+                    found++;
+    assert(found == 4);
+    return port_ops - before;
+}
+
+static void test_ports(void)
+{
+    build_devices();
+    assert(pci_init(0) == 0);
+    assert(pci_ecam_count() == 0);
+
+    port_ops = 0;
+    assert(pci_config_read32(0, 2, 0, 0) == 0x1eb810de);
+    assert(port_ops == 2);
+    /* extended space is out of reach and costs no port cycles */
+    assert(pci_config_read32(0, 2, 0, 0x100) == 0xFFFFFFFF);
+    assert(pci_config_read32(0, 2, 0, 0x1000) == 0xFFFFFFFF);
+    assert(port_ops == 2);
+
+    pci_config_write32(0, 2, 0, 0x10, 0xf0000000);
+    assert(pci_config_read32(0, 2, 0, 0x12) == 0xf0000000);
+    check_capabilities(0);
+    assert(scan_ops() == 2 * BUSES * 32 * 8);
+}
+
+static void test_ecam(int wide)
+{
+    build_devices();
+    assert(pci_init(build_rsdp(wide)) == 1);
+    const pci_ecam_region_t *r = pci_ecam_region(0);
+    assert(r && r->base == (uintptr_t)ecam);
+    assert(r->segment == 0 && r->bus_start == 0 && r->bus_end == BUSES - 1);
+    assert(!pci_ecam_region(1));
+
+    port_ops = 0;
+    assert(pci_config_read32(0, 2, 0, 0) == 0x1eb810de);
+    pci_config_write32(0, 2, 0, 0x10, 0xf0000000);
+    assert(*(uint32_t *)(FN_CFG(0, 2, 0) + 0x10) == 0xf0000000);
+    pci_config_write32(0, 2, 0, 0x144, 0xdeadbeef);
+    check_capabilities(1);
+    assert(scan_ops() == 0);
+    assert(port_ops == 0);
+
+    /* buses beyond the window still go through the ports */
+    assert(pci_config_read32(9, 0, 0, 0) == 0xFFFFFFFF);
+    assert(port_ops == 2);
+}
+
+static void test_bars(void)
+{
+    build_devices();
+    assert(pci_init(0) == 0);
+    uint64_t base = 0, size = 0;
+    assert(pci_bar_range(0, 2, 0, 0, &base, &size) == 0);
+    assert(base == 0xf6000000 && size == 16 << 20);
+    assert(pci_bar_range(0, 2, 0, 1, &base, &size) == 0);
+    assert(base == 0x4e0000000ULL && size == 256 << 20);
+    assert(pci_bar_range(0, 2, 0, 3, &base, &size) == -1);
+    assert(pci_bar_range(0, 2, 0, 4, &base, &size) == -1);
+    assert(pci_bar_range(0, 2, 0, 6, &base, &size) == -1);
+    assert(pci_bar_range(0, 9, 0, 0, &base, &size) == -1);
+
+    /* the probe leaves the BARs and decoding as it found them */
+    assert(pci_config_read32(0, 2, 0, PCI_BAR0) == 0xf6000000);
+    assert(pci_config_read32(0, 2, 0, PCI_BAR0 + 8) == 0x4);
+    assert(pci_config_read32(0, 2, 0, PCI_COMMAND) ==
+           (PCI_STATUS_CAP_LIST << 16 | 0x0007));
+}
+
+static void test_bad_tables(void)
+{
+    build_devices();
+    uint64_t rsdp = build_rsdp(1);
+    mcfg->checksum ^= 1;
+    assert(pci_init(rsdp) == 0);
+
+    rsdp = build_rsdp(1);
+    ((rsdp_t *)(uintptr_t)rsdp)->signature[0] = 'X';
+    assert(pci_init(rsdp) == 0);
+
+    /* an MCFG too short for its reserved field holds no windows */
+    rsdp = build_rsdp(1);
+    mcfg->length = sizeof(sdt_t) + 4;
+    seal(mcfg);
+    assert(pci_init(rsdp) == 0);
+    assert(pci_config_read32(0, 2, 0, 0) == 0x1eb810de);
+}
+
+int main(void)
+{
+    ecam = aligned_alloc(1 << 20, (size_t)BUSES << 20);
+    /* the RSDT holds 32-bit pointers */
+    arena = mmap(NULL, 1 << 16, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    assert(ecam && arena != MAP_FAILED);
+
+    test_ports();
+    test_ecam(1);
+    test_ecam(0);
+    test_bars();
+    test_bad_tables();
+    printf("pci tests passed\n");
+    return 0;
+}
@@ -0,0 +1,184 @@
+#include "rsa.h"
+#include "signature.h"
+#include "bn.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Host test for the RSA-2048 Montgomery engine. The vectors come from a
+ * throwaway key: test_sig is SHA-256("phillos module") raised to the
+ * private exponent and test_a_e is test_a^65537 mod test_n. The benchmark
+ * times a verify through the old bignum_powmod path against the new one. */
+
+static const uint64_t test_n[RSA_LIMBS] = {
+    0xa6288fdbb4c3d89bULL, 0xf4f8bedb7c3c9872ULL, 0xc95f27829a542da7ULL, 0xed5b2dae90ed6954ULL,
+    0x312287ae6ae098e3ULL, 0xe313b24e130aaee9ULL, 0x301e0a68eb85c2aeULL, 0x7ab1f2d524637ef4ULL,
+    0xf3db1791b00ebf3eULL, 0xbfbfea1bcdc68d70ULL, 0x193c9369e294e546ULL, 0x98a23cf32010ec9aULL,
+    0x9c502929a92b2f18ULL, 0x05636edc0b02b49fULL, 0x7815fa22e546efffULL, 0xe400194da05a8661ULL,
+    0x3498f13ff4d610b9ULL, 0x1b75be0e5ac6a4f8ULL, 0x73e444c3c4761617ULL, 0xc02a03e1fe4157aaULL,
+    0xe3b80dc1f1d81878ULL, 0xa2240eefe2e20629ULL, 0x2a2e49c7106dce69ULL, 0x93ed2121d8bd9e80ULL,
+    0x2649e1e2b8b4f2ecULL, 0xef310591c6c0381dULL, 0x524a1398deae51e8ULL, 0xa9e306a4c31cb224ULL,
+    0x00120ec6da6f1587ULL, 0xc5da56d9eab616bfULL, 0x024dbae7d23e4716ULL, 0xb9f54d9080a36ca8ULL,
+};
+
+static const uint8_t test_sig[RSA_BYTES] = {
+    0x3a, 0x20, 0x68, 0xf8, 0xf2, 0x77, 0xc6, 0xfd, 0xef, 0x25, 0x85, 0x24, 0x74, 0xc0, 0x9b, 0x1e,
+    0x9f, 0xef, 0xc3, 0x6f, 0x17, 0x02, 0x63, 0xe2, 0xbf, 0xcd, 0x1d, 0xec, 0x10, 0x49, 0x4b, 0xd6,
+    0x01, 0xae, 0x39, 0x68, 0xc6, 0x73, 0x92, 0xe6, 0x28, 0xa9, 0xd6, 0x42, 0x2a, 0x4c, 0x11, 0x3a,
+    0x84, 0x86, 0xf6, 0x58, 0xf1, 0xeb, 0x0b, 0x00, 0x75, 0x68, 0x34, 0x88, 0x01, 0xbc, 0xee, 0xf9,
+    0x71, 0x45, 0xf2, 0x72, 0xa1, 0x0a, 0x29, 0x1d, 0x4b, 0x46, 0x34, 0xee, 0xa5, 0xa3, 0x11, 0xe0,
+    0x84, 0xd7, 0xb6, 0xb9, 0x0f, 0xfd, 0x06, 0xd8, 0x57, 0xf1, 0x2d, 0x9b, 0x4f, 0xae, 0x33, 0xbb,
+    0x74, 0x15, 0x8c, 0x99, 0x22, 0x4e, 0xe8, 0x71, 0x22, 0xec, 0x30, 0x23, 0xfe, 0x9f, 0xbc, 0x75,
+    0x3f, 0x5b, 0xc5, 0x98, 0xaa, 0xcb, 0x82, 0x53, 0x98, 0x39, 0xd3, 0x3b, 0x0f, 0x29, 0x1e, 0x1b,
+    0xa4, 0xe6, 0xa0, 0xc1, 0x16, 0x88, 0x3b, 0x14, 0x3c, 0x6b, 0x5a, 0x4a, 0xea, 0x54, 0xa0, 0x30,
+    0x50, 0x3f, 0xc7, 0x42, 0x40, 0x45, 0xa8, 0xe9, 0x90, 0x30, 0x1d, 0x07, 0xe6, 0xa3, 0x51, 0x09,
+    0x95, 0xfd, 0x44, 0x98, 0x16, 0x29, 0xfd, 0xbd, 0x7f, 0x90, 0x51, 0x00, 0xd8, 0xd1, 0x9c, 0xa5,
+    0xae, 0x61, 0xba, 0xa2, 0xee, 0x5e, 0x30, 0x3c, 0xb2, 0xf3, 0x85, 0x17, 0x6a, 0xe4, 0x82, 0x8c,
+    0xc6, 0xfe, 0x2d, 0x01, 0x43, 0x48, 0x3a, 0x0b, 0xf0, 0x50, 0xd3, 0xc2, 0x5a, 0xd4, 0xc4, 0x9c,
+    0x43, 0xac, 0xc5, 0x65, 0x94, 0xbc, 0x17, 0xde, 0x4d, 0x2e, 0x76, 0x7c, 0x44, 0xa2, 0x94, 0x49,
+    0x66, 0x78, 0x08, 0x49, 0x80, 0xbf, 0x7a, 0x33, 0x53, 0xc0, 0x0b, 0x40, 0xf1, 0xea, 0x66, 0x13,
+    0xd4, 0xc7, 0xcb, 0xa7, 0xe0, 0x9f, 0x89, 0xbe, 0x28, 0x5c, 0x5f, 0x96, 0x01, 0xbb, 0x76, 0x42,
+};
+
+static const uint64_t test_a[RSA_LIMBS] = {
+    0xf12398d45e956e1bULL, 0xcca6588e35ec4e00ULL, 0xb6791abd8fda6447ULL, 0xa32c979a29a79296ULL,
+    0xf231d6ff78016016ULL, 0x2400afe693202963ULL, 0x6c81af7f690f12e9ULL, 0xa403d918cb8454b8ULL,
+    0xd0bc76c4587230f2ULL, 0x80f4a4c23d1d184aULL, 0xcfcb6a4fe9adbce7ULL, 0xffec06a290026c78ULL,
+    0x8bed2382e4ea7dbfULL, 0x4f17d8b74b573145ULL, 0xe4539fc241a9f394ULL, 0x8b292786a936681dULL,
+    0xc84653804eb74561ULL, 0xfd6989e499e2dc3fULL, 0xff11946d8d52230cULL, 0x5546e6f207ac6aecULL,
+    0x642eea15ef03f4edULL, 0x2f7aa519d3dff84dULL, 0x616a1c1cbb847c50ULL, 0xf7150fc5a53f67dfULL,
+    0x31fa462fb494e63cULL, 0xb582a9ece3480329ULL, 0x58477b0809d28a51ULL, 0x23e469fbc857cea9ULL,
+    0x4ef22ed77a1b5f87ULL, 0xf706f5f87b06cf7cULL, 0xd8d9f3bd51e01a05ULL, 0x83d024fcc4c9e724ULL,
+};
+
+static const uint64_t test_a_e[RSA_LIMBS] = {
+    0x34e584339150fdd9ULL, 0x6d014aeba75194c6ULL, 0x887f9d294c7653c3ULL, 0x033efda0ce68e2a4ULL,
+    0x9b34a3cf0a585df7ULL, 0x008bdbd6496d9b1cULL, 0x6aad1c9b9d09f731ULL, 0x683313b3ceb91ed0ULL,
+    0xa5e0e0dc6c30b3ceULL, 0x402c11519e5a8546ULL, 0x3c4d6f3515aca815ULL, 0x3926278d43f60c71ULL,
+    0x12b68738deb379caULL, 0xa53dd05eaad6ac1aULL, 0x18fc3da39853a1f0ULL, 0xd4140503f3387649ULL,
+    0x21630b4682329c80ULL, 0x6c7f5203acbc2b92ULL, 0x65c549ea6e80b911ULL, 0xa72de94bb1c2f385ULL,
+    0x34500c1126f3a006ULL, 0x3a6b8f9debf0c339ULL, 0xf89b0032cec2e55eULL, 0x16081ac8cb0df600ULL,
+    0x68d1cbae08492051ULL, 0x5d0221ed943dfff0ULL, 0xde8cfc6ace8ee195ULL, 0xaaecfcfc042789d4ULL,
+    0x3f518933fa70c9f2ULL, 0x704cb0dd56e25660ULL, 0xa1379b5a01223791ULL, 0x859746d95ca4650dULL,
+};
+
+static const char msg[] = "phillos module";
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void random_below(const uint64_t *n, uint64_t *out)
+{
+    for (int i = 0; i < RSA_LIMBS; i++)
+        out[i] = (uint64_t)rand() << 42 ^ (uint64_t)rand() << 21 ^ (uint64_t)rand();
+    out[RSA_LIMBS - 1] %= n[RSA_LIMBS - 1];
+}
+
+static void test_vectors(const rsa_key_t *key)
+{
+    uint64_t r[RSA_LIMBS];
+    assert(rsa_pow_f4(key, r, test_a) == 0);
+    assert(memcmp(r, test_a_e, sizeof(r)) == 0);
+
+    uint8_t bytes[RSA_BYTES];
+    uint64_t back[RSA_LIMBS];
+    rsa_to_bytes(bytes, test_a);
+    rsa_from_bytes(back, bytes);
+    assert(memcmp(back, test_a, sizeof(back)) == 0);
+
+    /* squaring agrees with the general multiply */
+    for (int i = 0; i < 64; i++) {
+        uint64_t a[RSA_LIMBS], s[RSA_LIMBS], m[RSA_LIMBS];
+        random_below(key->n, a);
+        rsa_mont_sqr(key, s, a);
+        rsa_mont_mul(key, m, a, a);
+        assert(memcmp(s, m, sizeof(s)) == 0);
+    }
+}
+
+static void test_verify(const rsa_key_t *key)
+{
+    size_t len = sizeof(msg) - 1;
+    assert(verify_signature_with(key, msg, len, test_sig));
+    assert(!verify_signature_with(key, msg, len - 1, test_sig));
+
+    uint8_t bad[RSA_BYTES];
+    memcpy(bad, test_sig, sizeof(bad));
+    bad[100] ^= 1;
+    assert(!verify_signature_with(key, msg, len, bad));
+    /* values at or above the modulus are not signatures */
+    memset(bad, 0xff, sizeof(bad));
+    assert(!verify_signature_with(key, msg, len, bad));
+    /* the built in key rejects a signature from another key */
+    assert(!verify_module_signature(msg, len, test_sig));
+}
+
+static void to_bn(struct bn *out, const uint64_t *limbs)
+{
+    bignum_init(out);
+    for (int i = 0; i < RSA_LIMBS; i++) {
+        out->array[2 * i] = (uint32_t)limbs[i];
+        out->array[2 * i + 1] = (uint32_t)(limbs[i] >> 32);
+    }
+}
+
+static void bench(const rsa_key_t *key)
+{
+    uint64_t s[RSA_LIMBS];
+    rsa_from_bytes(s, test_sig);
+    struct bn bs, bn_n, bv;
+    to_bn(&bs, s);
+    to_bn(&bn_n, test_n);
+
+    int iters = 0;
+    double t0 = now(), t1;
+    do {
+        bignum_powmod(&bs, 65537, &bn_n, &bv);
+        iters++;
+        t1 = now();
+    } while (t1 - t0 < 0.5);
+    double old_rate = iters / (t1 - t0);
+    uint64_t want[RSA_LIMBS];
+    assert(rsa_pow_f4(key, want, s) == 0);
+    struct bn bw;
+    to_bn(&bw, want);
+    int old_ok = bignum_cmp(&bv, &bw) == EQUAL;
+
+    size_t len = sizeof(msg) - 1;
+    iters = 0;
+    t0 = now();
+    do {
+        assert(verify_signature_with(key, msg, len, test_sig));
+        iters++;
+        t1 = now();
+    } while (t1 - t0 < 0.5);
+    double new_rate = iters / (t1 - t0);
+
+    printf("bignum_powmod: %.1f verifies/s (%s)\n", old_rate,
+           old_ok ? "correct" : "wrong result");
+    printf("montgomery:    %.1f verifies/s (%.0fx)\n", new_rate,
+           new_rate / old_rate);
+}
+
+int main(void)
+{
+    srand(37);
+    rsa_key_t key;
+    uint64_t even[RSA_LIMBS];
+    memcpy(even, test_n, sizeof(even));
+    even[0] &= ~1ULL;
+    assert(rsa_key_init(&key, even) != 0);
+    assert(rsa_key_init(&key, test_n) == 0);
+
+    test_vectors(&key);
+    test_verify(&key);
+    bench(&key);
+    printf("security tests passed\n");
+    return 0;
+}
@@ -0,0 +1,160 @@
+#include "sha256.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Host test for the SHA-256 engine. Every implementation the host CPU
+ * supports is checked against the FIPS 180 examples and against the
+ * scalar code on random split updates, then timed in MB/s. */
+
+static const char *impl_names[] = { "scalar", "avx2", "sha-ni" };
+
+static const struct {
+    const char *msg;
+    const char *hex;
+} vectors[] = {
+    { "", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+    { "abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+};
+
+#define BIG (4u << 20)
+static uint8_t big[BIG];
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void check_hex(const uint8_t *digest, const char *hex)
+{
+    char buf[2 * SHA256_DIGEST_LEN + 1];
+    for (int i = 0; i < SHA256_DIGEST_LEN; i++)
+        sprintf(buf + 2 * i, "%02x", digest[i]);
+    assert(strcmp(buf, hex) == 0);
+}
+
+static void test_vectors(void)
+{
+    uint8_t d[SHA256_DIGEST_LEN];
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        sha256(vectors[i].msg, strlen(vectors[i].msg), d);
+        check_hex(d, vectors[i].hex);
+    }
+
+    /* a million 'a', fed in uneven pieces */
+    static uint8_t a[1000000];
+    memset(a, 'a', sizeof(a));
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    for (size_t off = 0, n = 1; off < sizeof(a); off += n, n = n * 3 + 1) {
+        if (n > sizeof(a) - off)
+            n = sizeof(a) - off;
+        sha256_update(&ctx, a + off, n);
+    }
+    sha256_final(&ctx, d);
+    check_hex(d, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+}
+
+/* digests from the scalar code for random lengths and split points */
+static uint8_t want[64][SHA256_DIGEST_LEN];
+static size_t lens[64], splits[64];
+
+static void make_reference(void)
+{
+    assert(sha256_use(SHA256_IMPL_SCALAR) == 0);
+    for (int i = 0; i < 64; i++) {
+        lens[i] = i < 8 ? (size_t)i * 61 : (size_t)rand() % (1u << 16);
+        splits[i] = lens[i] ? (size_t)rand() % lens[i] : 0;
+        sha256(big + i, lens[i], want[i]);
+    }
+}
+
+static void test_random(void)
+{
+    uint8_t d[SHA256_DIGEST_LEN];
+    for (int i = 0; i < 64; i++) {
+        sha256_ctx_t ctx;
+        sha256_init(&ctx);
+        sha256_update(&ctx, big + i, splits[i]);
+        sha256_update(&ctx, big + i + splits[i], lens[i] - splits[i]);
+        sha256_final(&ctx, d);
+        assert(memcmp(d, want[i], sizeof(d)) == 0);
+    }
+}
+
+static void test_mb(void)
+{
+    const void *data[19];
+    size_t len[19];
+    uint8_t out[19][SHA256_DIGEST_LEN];
+    for (int i = 0; i < 19; i++) {
+        data[i] = big + i;
+        len[i] = lens[i];
+    }
+    sha256_mb(data, len, 19, out);
+    for (int i = 0; i < 19; i++)
+        assert(memcmp(out[i], want[i], SHA256_DIGEST_LEN) == 0);
+}
+
+static void bench(void)
+{
+    uint8_t d[SHA256_DIGEST_LEN];
+    int reps = 0;
+    double t0 = now(), t1;
+    do {
+        sha256(big, BIG, d);
+        reps++;
+        t1 = now();
+    } while (t1 - t0 < 0.3);
+    printf("%-7s %8.1f MB/s", impl_names[sha256_current()],
+           (double)reps * BIG / (1 << 20) / (t1 - t0));
+
+    /* eight 512 KiB modules */
+    const void *data[8];
+    size_t len[8];
+    uint8_t out[8][SHA256_DIGEST_LEN];
+    for (int i = 0; i < 8; i++) {
+        data[i] = big + i * (BIG / 8);
+        len[i] = BIG / 8;
+    }
+    reps = 0;
+    t0 = now();
+    do {
+        sha256_mb(data, len, 8, out);
+        reps++;
+        t1 = now();
+    } while (t1 - t0 < 0.3);
+    printf(", multi-buffer %8.1f MB/s\n",
+           (double)reps * BIG / (1 << 20) / (t1 - t0));
+}
+
+int main(void)
+{
+    srand(38);
+    for (size_t i = 0; i < BIG; i++)
+        big[i] = (uint8_t)rand();
+    make_reference();
+
+    sha256_impl_t best = sha256_probe();
+    for (int i = SHA256_IMPL_SCALAR; i <= SHA256_IMPL_SHANI; i++) {
+        if (sha256_use((sha256_impl_t)i) != 0) {
+            printf("%-7s not supported\n", impl_names[i]);
+            continue;
+        }
+        assert(sha256_current() == (sha256_impl_t)i);
+        test_vectors();
+        test_random();
+        test_mb();
+        bench();
+    }
+    assert(sha256_use((sha256_impl_t)7) != 0);
+    assert(sha256_use(best) == 0);
+    printf("sha256 tests passed\n");
+    return 0;
+}
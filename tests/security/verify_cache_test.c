@@ -0,0 +1,171 @@
+#include "verify_cache.h"
+#include "signature.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Host test for the verified-digest cache. The RSA layer is replaced by a
+ * fake that accepts any signature starting with GOOD and counts how often
+ * it was asked. */
+
+#define GOOD 0x5A
+
+static int rsa_calls;
+
+int verify_digest_signature(const uint8_t *digest, const uint8_t *sig)
+{
+    (void)digest;
+    rsa_calls++;
+    return sig[0] == GOOD;
+}
+
+int verify_module_signature(const void *data, size_t size, const uint8_t *sig)
+{
+    (void)data;
+    (void)size;
+    rsa_calls++;
+    return sig[0] == GOOD;
+}
+
+int signature_matches(const signature_opened_t *opened, const uint8_t *digest)
+{
+    (void)digest;
+    return opened->valid && opened->value[0] == GOOD;
+}
+
+void *kmalloc(size_t size) { return malloc(size); }
+void kfree(void *ptr) { free(ptr); }
+void debug_puts(const char *s) { (void)s; }
+
+static uint8_t good_sig[MODULE_SIG_LEN] = { GOOD };
+static uint8_t bad_sig[MODULE_SIG_LEN] = { 0 };
+
+static void test_cache(void)
+{
+    char mod[64][128];
+    for (int i = 0; i < 64; i++)
+        snprintf(mod[i], sizeof(mod[i]), "module %d", i);
+
+    rsa_calls = 0;
+    assert(module_verify(mod[0], sizeof(mod[0]), good_sig));
+    assert(rsa_calls == 1);
+    /* a replug of the same bytes is hash only */
+    assert(module_verify(mod[0], sizeof(mod[0]), good_sig));
+    assert(rsa_calls == 1);
+    /* a digest hashed by the caller hits the same entry */
+    uint8_t digest[SHA256_DIGEST_LEN];
+    sha256(mod[0], sizeof(mod[0]), digest);
+    assert(module_verify_digest(digest, bad_sig));
+    assert(rsa_calls == 1);
+
+    /* rejected files are never remembered */
+    assert(!module_verify(mod[1], sizeof(mod[1]), bad_sig));
+    assert(!module_verify(mod[1], sizeof(mod[1]), bad_sig));
+    assert(rsa_calls == 3);
+
+    /* changed contents miss even with a good signature */
+    mod[0][0] ^= 1;
+    assert(module_verify(mod[0], sizeof(mod[0]), good_sig));
+    assert(rsa_calls == 4);
+    mod[0][0] ^= 1;
+
+    /* the ring keeps the newest VERIFY_CACHE_SIZE digests */
+    for (int i = 2; i < 2 + VERIFY_CACHE_SIZE; i++)
+        assert(module_verify(mod[i], sizeof(mod[i]), good_sig));
+    rsa_calls = 0;
+    assert(module_verify(mod[2 + VERIFY_CACHE_SIZE - 1],
+                         sizeof(mod[0]), bad_sig));
+    assert(rsa_calls == 0);
+    assert(module_verify(mod[0], sizeof(mod[0]), good_sig));
+    assert(rsa_calls == 1);
+
+    verify_cache_stats_t st;
+    verify_cache_get_stats(&st);
+    assert(st.cached == VERIFY_CACHE_SIZE);
+    assert(st.rejected == 2);
+    assert(st.cache_hits == 3);
+    assert(st.rsa_verifies == 4 + VERIFY_CACHE_SIZE + 1);
+}
+
+/* the streaming form shares the cache with the one-shot form */
+static void test_opened(void)
+{
+    uint8_t digest[SHA256_DIGEST_LEN];
+    const char text[] = "streamed module";
+    sha256(text, sizeof(text), digest);
+    signature_opened_t opened = { .value = { 0 }, .valid = 1 };
+    assert(!module_verify_opened(digest, &opened));
+    opened.value[0] = GOOD;
+    assert(module_verify_opened(digest, &opened));
+
+    rsa_calls = 0;
+    assert(module_verify(text, sizeof(text), bad_sig));
+    assert(rsa_calls == 0);
+    opened.valid = 0;
+    assert(module_verify_opened(digest, &opened));
+}
+
+static int cmp_digest(const void *a, const void *b)
+{
+    return memcmp(a, b, SHA256_DIGEST_LEN);
+}
+
+static void test_manifest(void)
+{
+    verify_cache_flush();
+    char mod[16][32];
+    uint8_t digests[16][SHA256_DIGEST_LEN];
+    for (int i = 0; i < 16; i++) {
+        snprintf(mod[i], sizeof(mod[i]), "driver %d", i);
+        sha256(mod[i], sizeof(mod[i]), digests[i]);
+    }
+    /* the last module is not listed */
+    qsort(digests, 15, SHA256_DIGEST_LEN, cmp_digest);
+
+    size_t body = sizeof(module_manifest_hdr_t) + 15 * SHA256_DIGEST_LEN;
+    uint8_t *file = malloc(body + MODULE_SIG_LEN);
+    module_manifest_hdr_t hdr = { MODULE_MANIFEST_MAGIC, 15 };
+    memcpy(file, &hdr, sizeof(hdr));
+    memcpy(file + sizeof(hdr), digests, 15 * SHA256_DIGEST_LEN);
+    memcpy(file + body, bad_sig, MODULE_SIG_LEN);
+
+    rsa_calls = 0;
+    assert(module_manifest_load(file, body + MODULE_SIG_LEN) != 0);
+    memcpy(file + body, good_sig, MODULE_SIG_LEN);
+    assert(module_manifest_load(file, body) != 0);
+    assert(module_manifest_load(file, body + MODULE_SIG_LEN) == 0);
+    assert(rsa_calls == 2);
+
+    /* listed modules load without any RSA work, even unsigned */
+    for (int i = 0; i < 15; i++)
+        assert(module_verify(mod[i], sizeof(mod[i]), bad_sig));
+    assert(rsa_calls == 2);
+    assert(!module_verify(mod[15], sizeof(mod[15]), bad_sig));
+    assert(rsa_calls == 3);
+
+    verify_cache_stats_t st;
+    verify_cache_get_stats(&st);
+    assert(st.manifest_hits == 15);
+    assert(st.manifest_entries == 15);
+
+    /* unsorted lists are refused and the old manifest stays */
+    memcpy(file + sizeof(hdr), digests[1], SHA256_DIGEST_LEN);
+    assert(module_manifest_load(file, body + MODULE_SIG_LEN) != 0);
+    assert(module_verify(mod[3], sizeof(mod[3]), bad_sig));
+    free(file);
+
+    verify_cache_flush();
+    verify_cache_get_stats(&st);
+    assert(st.cached == 0 && st.manifest_entries == 0);
+    assert(!module_verify(mod[3], sizeof(mod[3]), bad_sig));
+}
+
+int main(void)
+{
+    test_cache();
+    test_opened();
+    test_manifest();
+    printf("verify cache tests passed\n");
+    return 0;
+}
@@ -0,0 +1,385 @@
+#include "../../drivers/storage/ahci.h"
+#include "../../kernel/tsc.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Host test for the AHCI driver. The HBA is a software model of the
+ * register file: CI/SACT are write-1-to-set, IS/SERR write-1-to-clear,
+ * commands are decoded from the real command list and PRD tables, and
+ * completions are delivered in random order whenever the driver looks at
+ * an interrupt status register. */
+
+void debug_putc(char c) { (void)c; }
+void debug_puts(const char *s) { (void)s; }
+void debug_puthex(uint32_t v) { (void)v; }
+void debug_puthex64(uint64_t v) { (void)v; }
+uint64_t tsc_hz(void) { return TSC_DEFAULT_HZ; }
+void *alloc_page(void) { return aligned_alloc(4096, 4096); }
+void free_page(void *p) { free(p); }
+void map_identity_range(uint64_t phys, uint64_t size) { (void)phys; (void)size; }
+uint32_t pci_config_read32(uint8_t bus, uint8_t slot, uint8_t func, uint16_t off)
+{
+    (void)bus; (void)slot; (void)func; (void)off;
+    return 0;
+}
+void pci_config_write32(uint8_t bus, uint8_t slot, uint8_t func, uint16_t off,
+                        uint32_t val)
+{
+    (void)bus; (void)slot; (void)func; (void)off; (void)val;
+}
+
+#define SECTOR       512
+#define DISK_SECTORS 20480    /* 10 MiB: room for reads past one PRD */
+#define NPORTS       3
+
+typedef struct {
+    uint32_t regs[0x80 / 4];
+    uint8_t *disk;
+    int present;
+    int ncq;
+    uint32_t pending;        /* slots executed, completion not posted yet */
+    uint32_t queued_cmds;    /* FPDMA commands seen */
+    uint32_t dma_cmds;       /* DMA EXT commands seen */
+    int64_t bad_lba;         /* commands touching it fail with TFES */
+} emu_port_t;
+
+static uint32_t g_cap, g_ghc, g_is, g_pi;
+static emu_port_t eports[NPORTS];
+
+#define P(reg) (eports[n].regs[(reg) / 4])
+
+static uint64_t rd64(emu_port_t *e, uint32_t lo)
+{
+    return (uint64_t)e->regs[lo / 4] | ((uint64_t)e->regs[lo / 4 + 1] << 32);
+}
+
+static void post_completions(void)
+{
+    for (int n = 0; n < NPORTS; n++) {
+        emu_port_t *e = &eports[n];
+        if (!e->pending)
+            continue;
+        /* complete a random non-empty subset, out of order */
+        uint32_t done = e->pending & (uint32_t)rand();
+        if (!done)
+            done = e->pending & -e->pending;
+        e->pending &= ~done;
+        P(0x38) &= ~done;
+        P(0x34) &= ~done;
+        P(0x10) |= e->ncq ? (1u << 3) : (1u << 0);
+        g_is |= 1u << n;
+    }
+}
+
+static void fail_port(int n)
+{
+    P(0x10) |= 1u << 30;     /* TFES */
+    P(0x20) = 0x51;          /* ERR | DRDY | DSC */
+    g_is |= 1u << n;
+}
+
+static void execute(int n, uint32_t slot)
+{
+    emu_port_t *e = &eports[n];
+    uint8_t *clb = (uint8_t *)(uintptr_t)rd64(e, 0x00);
+    uint8_t *hdr = clb + slot * 32;
+    uint16_t prdtl = (uint16_t)(hdr[2] | (hdr[3] << 8));
+    uint64_t ctba;
+    memcpy(&ctba, hdr + 8, 8);
+    uint8_t *tbl = (uint8_t *)(uintptr_t)ctba;
+    uint8_t *fis = tbl;
+    assert(fis[0] == 0x27 && (fis[1] & 0x80));
+    uint8_t cmd = fis[2];
+    uint64_t lba = (uint64_t)fis[4] | ((uint64_t)fis[5] << 8) |
+                   ((uint64_t)fis[6] << 16) | ((uint64_t)fis[8] << 24) |
+                   ((uint64_t)fis[9] << 32) | ((uint64_t)fis[10] << 40);
+    uint32_t count;
+    int write = 0;
+
+    if (cmd == 0xEC) {
+        uint16_t id[256];
+        memset(id, 0, sizeof(id));
+        id[60] = DISK_SECTORS & 0xFFFF;
+        id[75] = 31;
+        id[76] = e->ncq ? (1u << 8) : 0;
+        id[100] = DISK_SECTORS & 0xFFFF;
+        uint64_t dba;
+        memcpy(&dba, tbl + 0x80, 8);
+        memcpy((void *)(uintptr_t)dba, id, sizeof(id));
+        e->pending |= 1u << slot;
+        return;
+    }
+    if (cmd == 0x60 || cmd == 0x61) {
+        assert(e->ncq);
+        assert((fis[12] >> 3) == slot);
+        assert(P(0x34) & (1u << slot));
+        count = (uint32_t)fis[3] | ((uint32_t)fis[11] << 8);
+        write = cmd == 0x61;
+        e->queued_cmds++;
+    } else if (cmd == 0x25 || cmd == 0x35) {
+        count = (uint32_t)fis[12] | ((uint32_t)fis[13] << 8);
+        write = cmd == 0x35;
+        e->dma_cmds++;
+    } else {
+        fail_port(n);
+        return;
+    }
+    assert(write == ((hdr[0] >> 6) & 1));
+    assert(lba + count <= DISK_SECTORS);
+    if (e->bad_lba >= 0 && (uint64_t)e->bad_lba >= lba &&
+        (uint64_t)e->bad_lba < lba + count) {
+        fail_port(n);
+        return;
+    }
+
+    uint8_t *disk = e->disk + lba * SECTOR;
+    uint32_t total = 0;
+    for (uint16_t i = 0; i < prdtl; i++) {
+        uint8_t *prd = tbl + 0x80 + i * 16;
+        uint64_t dba;
+        uint32_t dbc;
+        memcpy(&dba, prd, 8);
+        memcpy(&dbc, prd + 12, 4);
+        assert(!(dbc & 0x7FC00000));    /* reserved bits above DBC */
+        assert(!(dbc & 0x80000000) || i + 1 == prdtl);
+        uint32_t len = (dbc & 0x3FFFFF) + 1;
+        if (write)
+            memcpy(disk + total, (void *)(uintptr_t)dba, len);
+        else
+            memcpy((void *)(uintptr_t)dba, disk + total, len);
+        total += len;
+    }
+    assert(total == count * SECTOR);
+    e->pending |= 1u << slot;
+}
+
+uint32_t ahci_emu_readl(uint32_t reg)
+{
+    if (reg < 0x100) {
+        switch (reg) {
+        case 0x00: return g_cap;
+        case 0x04: return g_ghc;
+        case 0x08: post_completions(); return g_is;
+        case 0x0C: return g_pi;
+        }
+        return 0;
+    }
+    int n = (int)((reg - 0x100) / 0x80);
+    uint32_t off = (reg - 0x100) % 0x80;
+    assert(n < NPORTS);
+    if (off == 0x10)
+        post_completions();
+    return P(off);
+}
+
+void ahci_emu_writel(uint32_t reg, uint32_t val)
+{
+    if (reg < 0x100) {
+        if (reg == 0x04)
+            g_ghc = val;
+        else if (reg == 0x08)
+            g_is &= ~val;
+        return;
+    }
+    int n = (int)((reg - 0x100) / 0x80);
+    uint32_t off = (reg - 0x100) % 0x80;
+    assert(n < NPORTS);
+    switch (off) {
+    case 0x10:
+    case 0x30:
+        P(off) &= ~val;
+        break;
+    case 0x18:
+        val &= ~((1u << 14) | (1u << 15));
+        if (val & (1u << 4))
+            val |= 1u << 14;
+        if (val & 1u) {
+            val |= 1u << 15;
+        } else {
+            /* clearing ST resets CI and SACT */
+            P(0x38) = 0;
+            P(0x34) = 0;
+            eports[n].pending = 0;
+            P(0x20) = 0x50;
+        }
+        P(off) = val;
+        break;
+    case 0x34:
+        P(off) |= val;
+        break;
+    case 0x38: {
+        assert(P(0x18) & 1u);
+        uint32_t issued = val & ~P(0x38);
+        P(0x38) |= val;
+        while (issued) {
+            uint32_t s = (uint32_t)__builtin_ctz(issued);
+            issued &= issued - 1;
+            execute(n, s);
+        }
+        break;
+    }
+    default:
+        P(off) = val;
+    }
+}
+
+static void emu_reset(void)
+{
+    g_cap = (31u << 8) | (1u << 30) | (NPORTS - 1);
+    g_ghc = 0;
+    g_is = 0;
+    g_pi = (1u << NPORTS) - 1;
+    for (int n = 0; n < NPORTS; n++) {
+        emu_port_t *e = &eports[n];
+        memset(e->regs, 0, sizeof(e->regs));
+        e->present = n != 1;           /* port 1 has no device */
+        e->ncq = n == 0;               /* port 2 disk lacks NCQ */
+        e->bad_lba = -1;
+        e->disk = calloc(DISK_SECTORS, SECTOR);
+        for (uint32_t i = 0; i < DISK_SECTORS * SECTOR / 4; i++)
+            ((uint32_t *)e->disk)[i] = i * 2654435761u + (uint32_t)n;
+        if (e->present) {
+            P(0x28) = 0x113;           /* DET=3, IPM=1 */
+            P(0x24) = 0x00000101;
+        }
+        P(0x20) = 0x50;
+    }
+}
+
+#define NREQ      48
+#define REQ_BLKS  8
+
+static int completed;
+static int failed;
+
+static void on_done(blk_request_t *req, int status)
+{
+    req->status = status;
+    completed++;
+    if (status)
+        failed++;
+}
+
+static void run_batch(blkdev_t *dev, int port, blk_op_t op, uint8_t *buf,
+                      int use_irq)
+{
+    static blk_request_t reqs[NREQ];
+    completed = failed = 0;
+    for (int i = 0; i < NREQ; i++) {
+        /* scattered LBAs, two SG segments per request */
+        uint64_t lba = (uint64_t)((i * 37) % (DISK_SECTORS / REQ_BLKS)) * REQ_BLKS;
+        uint8_t *dst = buf + (size_t)i * REQ_BLKS * SECTOR;
+        blk_request_init(&reqs[i], op, lba, REQ_BLKS);
+        reqs[i].done = on_done;
+        assert(blk_request_add_sg(&reqs[i], dst, 3 * SECTOR) == 0);
+        assert(blk_request_add_sg(&reqs[i], dst + 3 * SECTOR,
+                                  (REQ_BLKS - 3) * SECTOR) == 0);
+        assert(blkdev_submit(dev, &reqs[i]) == 0);
+    }
+    ahci_stats_t st;
+    assert(ahci_get_stats(port, &st) == 0);
+    assert(st.inflight == 32);
+    while (completed < NREQ) {
+        if (use_irq)
+            ahci_irq();
+        else
+            ahci_poll();
+    }
+    assert(failed == 0);
+}
+
+static void check_batch(int port, const uint8_t *buf)
+{
+    for (int i = 0; i < NREQ; i++) {
+        uint64_t lba = (uint64_t)((i * 37) % (DISK_SECTORS / REQ_BLKS)) * REQ_BLKS;
+        assert(memcmp(buf + (size_t)i * REQ_BLKS * SECTOR,
+                      eports[port].disk + lba * SECTOR,
+                      REQ_BLKS * SECTOR) == 0);
+    }
+}
+
+int main(void)
+{
+    srand(1);
+    emu_reset();
+    assert(ahci_attach(0xFEB00000) == 2);
+    assert(ahci_get_blkdev(1) == NULL);
+    blkdev_t *d0 = blkdev_find("ahci0");
+    blkdev_t *d2 = blkdev_find("ahci2");
+    assert(d0 && d0 == ahci_get_blkdev(0) && d2);
+    assert(d0->block_count == DISK_SECTORS && d0->block_size == SECTOR);
+    assert(blkdev_get_boot() == d0);
+
+    ahci_stats_t st;
+    assert(ahci_get_stats(0, &st) == 0);
+    assert(st.ncq == 1 && st.slots == 32);
+    assert(ahci_get_stats(2, &st) == 0);
+    assert(st.ncq == 0);
+
+    uint8_t *buf = malloc((size_t)NREQ * REQ_BLKS * SECTOR);
+
+    /* NCQ reads: 32 in flight, the rest wait on the backlog */
+    run_batch(d0, 0, BLK_OP_READ, buf, 0);
+    check_batch(0, buf);
+    assert(ahci_get_stats(0, &st) == 0);
+    assert(st.max_inflight == 32 && st.inflight == 0);
+    assert(st.completions == NREQ + 1);   /* + IDENTIFY */
+    assert(eports[0].queued_cmds == NREQ && eports[0].dma_cmds == 0);
+
+    /* NCQ writes completed through the interrupt path */
+    for (size_t i = 0; i < (size_t)NREQ * REQ_BLKS * SECTOR; i++)
+        buf[i] = (uint8_t)(i * 7 + 3);
+    run_batch(d0, 0, BLK_OP_WRITE, buf, 1);
+    check_batch(0, buf);
+
+    /* non-NCQ disk still keeps every slot busy */
+    run_batch(d2, 2, BLK_OP_READ, buf, 0);
+    check_batch(2, buf);
+    assert(eports[2].dma_cmds == NREQ && eports[2].queued_cmds == 0);
+
+    /* synchronous helpers used by the filesystem */
+    uint8_t sec[4 * SECTOR];
+    memset(sec, 0xA5, sizeof(sec));
+    assert(ahci_write(100, 4, sec) == 0);
+    memset(sec, 0, sizeof(sec));
+    assert(ahci_read(100, 4, sec) == 0);
+    for (size_t i = 0; i < sizeof(sec); i++)
+        assert(sec[i] == 0xA5);
+    assert(ahci_read(DISK_SECTORS - 1, 2, sec) == -1);
+
+    /* a task file error fails the queue, then the port recovers */
+    eports[0].bad_lba = 5;
+    assert(ahci_read(0, 8, sec) == -1);
+    eports[0].bad_lba = -1;
+    assert(ahci_read(0, 4, sec) == 0);
+    assert(memcmp(sec, eports[0].disk, 4 * SECTOR) == 0);
+    assert(ahci_get_stats(0, &st) == 0);
+    assert(st.errors == 1 && st.inflight == 0);
+
+    /* interrupts stay masked while nothing routes them */
+    assert(!(g_ghc & (1u << 1)) && eports[0].regs[0x14 / 4] == 0);
+
+    /* a segment past 4 MiB is split across PRDs */
+    uint32_t big = 10240;
+    uint8_t *large = malloc((size_t)big * SECTOR);
+    assert(blkdev_read(d0, 2048, big, large) == 0);
+    assert(memcmp(large, eports[0].disk + 2048 * SECTOR,
+                  (size_t)big * SECTOR) == 0);
+
+    /* more PRDs than the table holds, or no blocks, is refused */
+    blk_request_t req;
+    blk_request_init(&req, BLK_OP_READ, 0, 0xFFFF);
+    for (int i = 0; i < BLKDEV_MAX_SG; i++)
+        assert(blk_request_add_sg(&req, large, 8u << 20) == 0);
+    assert(d0->ops->submit(d0, &req) == -1);
+    blk_request_init(&req, BLK_OP_READ, 0, 0);
+    assert(blk_request_add_sg(&req, large, SECTOR) == 0);
+    assert(d0->ops->submit(d0, &req) == -1);
+    free(large);
+
+    free(buf);
+    printf("ahci tests passed\n");
+    return 0;
+}